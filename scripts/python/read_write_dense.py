@@ -37,8 +37,111 @@ import os
 import struct
 
 
+MAT_FILE_MAGIC = b"COLMAPMF"
+MAT_FILE_HEADER_FORMAT = "<8sIIQQQII"
+MAT_FILE_TILE_ENTRY_FORMAT = "<QQ"
+MAT_FILE_MIN_MATCH_LENGTH = 4
+
+
+def read_varint(data, pos):
+    value = 0
+    shift = 0
+    while True:
+        byte = data[pos]
+        pos += 1
+        value |= (byte & 0x7F) << shift
+        if byte & 0x80 == 0:
+            return value, pos
+        shift += 7
+
+
+def decompress_lz(compressed, num_bytes):
+    """
+    see: src/mvs/mat_file.cc
+        bool DecompressLZ(...)
+    """
+    data = bytearray()
+    pos = 0
+    while True:
+        literal_length, pos = read_varint(compressed, pos)
+        data += compressed[pos:pos + literal_length]
+        pos += literal_length
+        if pos == len(compressed):
+            break
+        match_length, pos = read_varint(compressed, pos)
+        match_offset, pos = read_varint(compressed, pos)
+        match_length += MAT_FILE_MIN_MATCH_LENGTH
+        # The match may overlap the output, so copy at most the offset at once.
+        while match_length > 0:
+            start = len(data) - match_offset
+            length = min(match_length, match_offset)
+            data += data[start:start + length]
+            match_length -= length
+    assert len(data) == num_bytes
+    return bytes(data)
+
+
+def decode_tile(encoded_data, tile_width, elem_size):
+    """
+    see: src/mvs/mat_file.cc
+        void DecodeTileInPlace(...)
+    """
+    num_elems = len(encoded_data) // elem_size
+    planes = np.frombuffer(encoded_data, np.uint8).reshape(elem_size, num_elems)
+    elems = planes.T.reshape(-1, tile_width, elem_size)
+    return np.bitwise_xor.accumulate(elems, axis=1).tobytes()
+
+
+def read_mat_file(path):
+    """
+    see: src/mvs/mat_file.h
+        class MatFile
+    """
+    with open(path, "rb") as fid:
+        data = fid.read()
+
+    header_size = struct.calcsize(MAT_FILE_HEADER_FORMAT)
+    magic, version, _, width, height, depth, elem_size, tile_size = \
+        struct.unpack_from(MAT_FILE_HEADER_FORMAT, data)
+    assert magic == MAT_FILE_MAGIC and version == 1 and elem_size == 4
+
+    num_tile_rows = (height + tile_size - 1) // tile_size
+    num_tile_cols = (width + tile_size - 1) // tile_size
+    entry_size = struct.calcsize(MAT_FILE_TILE_ENTRY_FORMAT)
+
+    array = np.zeros((depth, height, width), dtype=np.float32)
+    for tile_row in range(num_tile_rows):
+        for tile_col in range(num_tile_cols):
+            tile_idx = tile_row * num_tile_cols + tile_col
+            offset, num_bytes = struct.unpack_from(
+                MAT_FILE_TILE_ENTRY_FORMAT, data,
+                header_size + tile_idx * entry_size)
+            row = tile_row * tile_size
+            col = tile_col * tile_size
+            tile_height = min(tile_size, height - row)
+            tile_width = min(tile_size, width - col)
+            tile_num_bytes = depth * tile_height * tile_width * elem_size
+            tile_data = data[offset:offset + num_bytes]
+            if num_bytes != tile_num_bytes:
+                tile_data = decode_tile(
+                    decompress_lz(tile_data, tile_num_bytes),
+                    tile_width, elem_size)
+            tile = np.frombuffer(tile_data, "<f4").reshape(
+                (depth, tile_height, tile_width))
+            array[:, row:row + tile_height, col:col + tile_width] = tile
+
+    return np.transpose(array, (1, 2, 0)).squeeze()
+
+
 def read_array(path):
+    """
+    Read a map in the raw format or in the tiled format, which is written
+    with the PatchMatchStereo.map_format option set to tiled or compressed.
+    """
     with open(path, "rb") as fid:
+        if fid.read(len(MAT_FILE_MAGIC)) == MAT_FILE_MAGIC:
+            return read_mat_file(path)
+        fid.seek(0)
         width, height, channels = np.genfromtxt(fid, delimiter="&", max_rows=1,
                                                 usecols=(0, 1, 2), dtype=int)
         fid.seek(0)
@@ -32,6 +32,7 @@
 #ifndef COLMAP_SRC_BASE_CAMERA_MODELS_H_
 #define COLMAP_SRC_BASE_CAMERA_MODELS_H_
 
+#include <algorithm>
 #include <cfloat>
 #include <string>
 #include <vector>
@@ -173,6 +174,13 @@ struct BaseCameraModel {
 
   template <typename T>
   static inline void IterativeUndistortion(const T* params, T* u, T* v);
+
+  // Transform multiple points given as separate arrays of coordinates. The
+  // loop is specialized for the camera model, so it contains no branches
+  // over the model and can be vectorized by the compiler.
+  template <typename T>
+  static inline void WorldToImageBatch(const T* params, const size_t num_points,
+                                       const T* u, const T* v, T* x, T* y);
 };
 
 // Simple Pinhole camera model.
@@ -449,6 +457,22 @@ inline void CameraModelImageToWorld(const int model_id,
                                     const double x, const double y, double* u,
                                     double* v);
 
+// Transform multiple world coordinates in camera coordinate system to image
+// coordinates. This is equivalent to calling `CameraModelWorldToImage` for
+// every point, but only dispatches once on the camera model.
+//
+// @param model_id     Unique model_id of camera model as defined in
+//                     `CAMERA_MODEL_NAME_TO_CODE`.
+// @param params       Array of camera parameters.
+// @param num_points   Number of points.
+// @param u, v         Arrays of coordinates in camera system as (u, v, 1).
+// @param x, y         Output arrays of image coordinates in pixels.
+inline void CameraModelWorldToImageBatch(const int model_id,
+                                         const std::vector<double>& params,
+                                         const size_t num_points,
+                                         const double* u, const double* v,
+                                         double* x, double* y);
+
 // Convert pixel threshold in image plane to world space by dividing
 // the threshold through the mean focal length.
 //
@@ -587,6 +611,21 @@ void BaseCameraModel<CameraModel>::IterativeUndistortion(const T* params, T* u,
   *v = x(1);
 }
 
+template <typename CameraModel>
+template <typename T>
+void BaseCameraModel<CameraModel>::WorldToImageBatch(const T* params,
+                                                     const size_t num_points,
+                                                     const T* u, const T* v,
+                                                     T* x, T* y) {
+  // Copy the parameters, so that the compiler knows that they do not alias
+  // with the output and keeps them in registers.
+  T local_params[CameraModel::kNumParams];
+  std::copy(params, params + CameraModel::kNumParams, local_params);
+  for (size_t i = 0; i < num_points; ++i) {
+    CameraModel::WorldToImage(local_params, u[i], v[i], &x[i], &y[i]);
+  }
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 // SimplePinholeCameraModel
 
@@ -1496,6 +1535,22 @@ void CameraModelWorldToImage(const int model_id,
   }
 }
 
+void CameraModelWorldToImageBatch(const int model_id,
+                                  const std::vector<double>& params,
+                                  const size_t num_points, const double* u,
+                                  const double* v, double* x, double* y) {
+  switch (model_id) {
+#define CAMERA_MODEL_CASE(CameraModel)                                        \
+  case CameraModel::kModelId:                                                 \
+    CameraModel::WorldToImageBatch(params.data(), num_points, u, v, x, y);    \
+    break;
+
+    CAMERA_MODEL_SWITCH_CASES
+
+#undef CAMERA_MODEL_CASE
+  }
+}
+
 void CameraModelImageToWorld(const int model_id,
                              const std::vector<double>& params, const double x,
                              const double y, double* u, double* v) {
@@ -62,6 +62,29 @@ void TestImageToWorldToImage(const std::vector<double> params, const double x0,
   BOOST_CHECK_LT(std::abs(y - y0), 1e-6);
 }
 
+template <typename CameraModel>
+void TestWorldToImageBatch(const std::vector<double> params) {
+  std::vector<double> u;
+  std::vector<double> v;
+  for (double u0 = -0.5; u0 <= 0.5; u0 += 0.1) {
+    for (double v0 = -0.5; v0 <= 0.5; v0 += 0.1) {
+      u.push_back(u0);
+      v.push_back(v0);
+    }
+  }
+
+  std::vector<double> x(u.size());
+  std::vector<double> y(u.size());
+  CameraModelWorldToImageBatch(CameraModel::model_id, params, u.size(),
+                               u.data(), v.data(), x.data(), y.data());
+  for (size_t i = 0; i < u.size(); ++i) {
+    double xx, yy;
+    CameraModel::WorldToImage(params.data(), u[i], v[i], &xx, &yy);
+    BOOST_CHECK_LT(std::abs(x[i] - xx), 1e-6);
+    BOOST_CHECK_LT(std::abs(y[i] - yy), 1e-6);
+  }
+}
+
 template <typename CameraModel>
 void TestModel(const std::vector<double>& params) {
   BOOST_CHECK(CameraModelVerifyParams(CameraModel::model_id, params));
@@ -119,6 +142,8 @@ void TestModel(const std::vector<double>& params) {
     }
   }
 
+  TestWorldToImageBatch<CameraModel>(params);
+
   for (double x = 0; x <= 800; x += 50) {
     for (double y = 0; y <= 800; y += 50) {
       TestImageToWorldToImage<CameraModel>(params, x, y);
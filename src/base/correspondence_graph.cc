@@ -31,19 +31,48 @@
 
 #include "base/correspondence_graph.h"
 
+#include <algorithm>
+#include <limits>
 #include <unordered_set>
 
 #include "base/pose.h"
 #include "util/string.h"
 
 namespace colmap {
+namespace {
+
+// Find the image pair in the sorted table or in the unsorted pairs, for both
+// the const and non-const graph. Returns null if it does not exist.
+template <typename sorted_image_pairs_t, typename image_pairs_t>
+auto FindImagePairIn(sorted_image_pairs_t& sorted_image_pairs,
+                     image_pairs_t& image_pairs, const image_pair_t pair_id)
+    -> decltype(&image_pairs.begin()->second) {
+  const auto sorted_it = std::lower_bound(
+      sorted_image_pairs.begin(), sorted_image_pairs.end(), pair_id,
+      [](const typename sorted_image_pairs_t::value_type& image_pair,
+         const image_pair_t pair_id) { return image_pair.first < pair_id; });
+  if (sorted_it != sorted_image_pairs.end() && sorted_it->first == pair_id) {
+    return &sorted_it->second;
+  }
+  const auto it = image_pairs.find(pair_id);
+  if (it != image_pairs.end()) {
+    return &it->second;
+  }
+  return nullptr;
+}
+
+}  // namespace
 
 CorrespondenceGraph::CorrespondenceGraph() {}
 
 std::unordered_map<image_pair_t, point2D_t>
 CorrespondenceGraph::NumCorrespondencesBetweenImages() const {
   std::unordered_map<image_pair_t, point2D_t> num_corrs_between_images;
-  num_corrs_between_images.reserve(image_pairs_.size());
+  num_corrs_between_images.reserve(NumImagePairs());
+  for (const auto& image_pair : sorted_image_pairs_) {
+    num_corrs_between_images.emplace(image_pair.first,
+                                     image_pair.second.num_correspondences);
+  }
   for (const auto& image_pair : image_pairs_) {
     num_corrs_between_images.emplace(image_pair.first,
                                      image_pair.second.num_correspondences);
@@ -53,19 +82,53 @@ CorrespondenceGraph::NumCorrespondencesBetweenImages() const {
 
 void CorrespondenceGraph::Finalize() {
   for (auto it = images_.begin(); it != images_.end();) {
-    it->second.num_observations = 0;
-    for (auto& corr : it->second.corrs) {
-      corr.shrink_to_fit();
-      if (corr.size() > 0) {
-        it->second.num_observations += 1;
+    struct Image& image = it->second;
+
+    if (!image.IsFinalized()) {
+      size_t num_corrs = 0;
+      for (const auto& corrs : image.corrs) {
+        num_corrs += corrs.size();
+      }
+      CHECK_LE(num_corrs, std::numeric_limits<uint32_t>::max());
+
+      image.corrs_offsets.resize(image.corrs.size() + 1);
+      image.flat_corrs.reserve(num_corrs);
+      image.corrs_offsets[0] = 0;
+      for (size_t i = 0; i < image.corrs.size(); ++i) {
+        image.flat_corrs.insert(image.flat_corrs.end(), image.corrs[i].begin(),
+                                image.corrs[i].end());
+        image.corrs_offsets[i + 1] =
+            static_cast<uint32_t>(image.flat_corrs.size());
+      }
+
+      // Release the per-point vectors.
+      std::vector<std::vector<Correspondence>>().swap(image.corrs);
+    }
+
+    image.num_observations = 0;
+    for (size_t i = 0; i + 1 < image.corrs_offsets.size(); ++i) {
+      if (image.corrs_offsets[i + 1] > image.corrs_offsets[i]) {
+        image.num_observations += 1;
       }
     }
-    if (it->second.num_observations == 0) {
+
+    if (image.num_observations == 0) {
       images_.erase(it++);
     } else {
       ++it;
     }
   }
+
+  if (!image_pairs_.empty()) {
+    sorted_image_pairs_.insert(sorted_image_pairs_.end(), image_pairs_.begin(),
+                               image_pairs_.end());
+    std::sort(sorted_image_pairs_.begin(), sorted_image_pairs_.end(),
+              [](const std::pair<image_pair_t, ImagePair>& image_pair1,
+                 const std::pair<image_pair_t, ImagePair>& image_pair2) {
+                return image_pair1.first < image_pair2.first;
+              });
+    std::unordered_map<image_pair_t, ImagePair>().swap(image_pairs_);
+  }
 }
 
 void CorrespondenceGraph::AddImage(const image_t image_id,
@@ -87,6 +150,12 @@ void CorrespondenceGraph::AddCorrespondences(const image_t image_id1,
   // Corresponding images.
   struct Image& image1 = images_.at(image_id1);
   struct Image& image2 = images_.at(image_id2);
+  if (image1.IsFinalized()) {
+    ExpandImage(&image1);
+  }
+  if (image2.IsFinalized()) {
+    ExpandImage(&image2);
+  }
 
   // Store number of correspondences for each image to find good initial pair.
   image1.num_correspondences += matches.size();
@@ -96,7 +165,9 @@ void CorrespondenceGraph::AddCorrespondences(const image_t image_id1,
   // we will make sure that only unique correspondences are counted.
   const image_pair_t pair_id =
       Database::ImagePairToPairId(image_id1, image_id2);
-  auto& image_pair = image_pairs_[pair_id];
+  ImagePair* found_image_pair = FindImagePair(pair_id);
+  auto& image_pair =
+      found_image_pair != nullptr ? *found_image_pair : image_pairs_[pair_id];
   image_pair.num_correspondences += static_cast<point2D_t>(matches.size());
 
   // Store all matches in correspondence graph data structure. This data-
@@ -165,7 +236,9 @@ CorrespondenceGraph::FindTransitiveCorrespondences(
     const image_t image_id, const point2D_t point2D_idx,
     const size_t transitivity) const {
   if (transitivity == 1) {
-    return FindCorrespondences(image_id, point2D_idx);
+    const CorrespondenceRange corrs =
+        FindCorrespondences(image_id, point2D_idx);
+    return std::vector<Correspondence>(corrs.begin(), corrs.end());
   }
 
   std::vector<Correspondence> found_corrs;
@@ -187,9 +260,8 @@ CorrespondenceGraph::FindTransitiveCorrespondences(
     for (size_t i = corr_queue_begin; i < corr_queue_end; ++i) {
       const Correspondence ref_corr = found_corrs[i];
 
-      const Image& image = images_.at(ref_corr.image_id);
-      const std::vector<Correspondence>& ref_corrs =
-          image.corrs[ref_corr.point2D_idx];
+      const CorrespondenceRange ref_corrs =
+          images_.at(ref_corr.image_id).Correspondences(ref_corr.point2D_idx);
 
       for (const Correspondence& corr : ref_corrs) {
         // Check if correspondence already collected, otherwise collect.
@@ -235,9 +307,9 @@ FeatureMatches CorrespondenceGraph::FindCorrespondencesBetweenImages(
 
   const struct Image& image1 = images_.at(image_id1);
 
-  for (point2D_t point2D_idx1 = 0; point2D_idx1 < image1.corrs.size();
+  for (point2D_t point2D_idx1 = 0; point2D_idx1 < image1.NumPoints2D();
        ++point2D_idx1) {
-    for (const Correspondence& corr1 : image1.corrs[point2D_idx1]) {
+    for (const Correspondence& corr1 : image1.Correspondences(point2D_idx1)) {
       if (corr1.image_id == image_id2) {
         found_corrs.emplace_back(point2D_idx1, corr1.point2D_idx);
       }
@@ -249,15 +321,35 @@ FeatureMatches CorrespondenceGraph::FindCorrespondencesBetweenImages(
 
 bool CorrespondenceGraph::IsTwoViewObservation(
     const image_t image_id, const point2D_t point2D_idx) const {
-  const struct Image& image = images_.at(image_id);
-  const std::vector<Correspondence>& corrs = image.corrs.at(point2D_idx);
+  const CorrespondenceRange corrs = FindCorrespondences(image_id, point2D_idx);
   if (corrs.size() != 1) {
     return false;
   }
-  const struct Image& other_image = images_.at(corrs[0].image_id);
-  const std::vector<Correspondence>& other_corrs =
-      other_image.corrs.at(corrs[0].point2D_idx);
+  const CorrespondenceRange other_corrs =
+      FindCorrespondences(corrs[0].image_id, corrs[0].point2D_idx);
   return other_corrs.size() == 1;
 }
 
+void CorrespondenceGraph::ExpandImage(struct Image* image) {
+  const size_t num_points2D = image->NumPoints2D();
+  image->corrs.resize(num_points2D);
+  for (size_t i = 0; i < num_points2D; ++i) {
+    image->corrs[i].assign(
+        image->flat_corrs.begin() + image->corrs_offsets[i],
+        image->flat_corrs.begin() + image->corrs_offsets[i + 1]);
+  }
+  std::vector<uint32_t>().swap(image->corrs_offsets);
+  std::vector<Correspondence>().swap(image->flat_corrs);
+}
+
+const CorrespondenceGraph::ImagePair* CorrespondenceGraph::FindImagePair(
+    const image_pair_t pair_id) const {
+  return FindImagePairIn(sorted_image_pairs_, image_pairs_, pair_id);
+}
+
+CorrespondenceGraph::ImagePair* CorrespondenceGraph::FindImagePair(
+    const image_pair_t pair_id) {
+  return FindImagePairIn(sorted_image_pairs_, image_pairs_, pair_id);
+}
+
 }  // namespace colmap
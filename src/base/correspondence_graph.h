@@ -36,6 +36,7 @@
 #include <vector>
 
 #include "base/database.h"
+#include "util/logging.h"
 #include "util/types.h"
 
 namespace colmap {
@@ -57,6 +58,31 @@ class CorrespondenceGraph {
     point2D_t point2D_idx;
   };
 
+  // Read-only view of the correspondences of an image point, which remains
+  // valid until the graph is modified.
+  class CorrespondenceRange {
+   public:
+    CorrespondenceRange() : begin_(nullptr), end_(nullptr) {}
+    CorrespondenceRange(const Correspondence* begin, const Correspondence* end)
+        : begin_(begin), end_(end) {}
+
+    inline const Correspondence* begin() const { return begin_; }
+    inline const Correspondence* end() const { return end_; }
+    inline size_t size() const { return end_ - begin_; }
+    inline bool empty() const { return begin_ == end_; }
+    inline const Correspondence& operator[](const size_t idx) const {
+      return begin_[idx];
+    }
+    inline const Correspondence& at(const size_t idx) const {
+      CHECK_LT(idx, size());
+      return begin_[idx];
+    }
+
+   private:
+    const Correspondence* begin_;
+    const Correspondence* end_;
+  };
+
   CorrespondenceGraph();
 
   // Number of added images.
@@ -88,7 +114,13 @@ class CorrespondenceGraph {
   // - Calculates the number of observations per image by counting the number
   //   of image points that have at least one correspondence.
   // - Deletes images without observations, as they are useless for SfM.
-  // - Shrinks the correspondence vectors to their size to save memory.
+  // - Converts the correspondences of each image into a compressed sparse row
+  //   layout of point offsets and one flat correspondence array, and the
+  //   image pairs into a sorted table, to save memory and to speed up the
+  //   traversal of the graph.
+  //
+  // Images and correspondences can still be added after finalizing, in which
+  // case the affected images are expanded again until the next call.
   void Finalize();
 
   // Add new image to the correspondence graph.
@@ -102,7 +134,7 @@ class CorrespondenceGraph {
                           const FeatureMatches& matches);
 
   // Find the correspondence of an image observation to all other images.
-  inline const std::vector<Correspondence>& FindCorrespondences(
+  inline CorrespondenceRange FindCorrespondences(
       const image_t image_id, const point2D_t point2D_idx) const;
 
   // Find correspondences to the given observation.
@@ -140,8 +172,35 @@ class CorrespondenceGraph {
     // to find a good initial pair, that is connected to many images.
     point2D_t num_correspondences = 0;
 
-    // Correspondences to other images per image point.
+    // Correspondences to other images per image point, while correspondences
+    // are added to the image. Empty once the image is finalized.
     std::vector<std::vector<Correspondence>> corrs;
+
+    // Compressed sparse row layout of the finalized image, where the
+    // correspondences of the i-th point are the elements
+    // [corrs_offsets[i], corrs_offsets[i + 1]) of `flat_corrs`.
+    std::vector<uint32_t> corrs_offsets;
+    std::vector<Correspondence> flat_corrs;
+
+    inline bool IsFinalized() const { return !corrs_offsets.empty(); }
+
+    inline size_t NumPoints2D() const {
+      return IsFinalized() ? corrs_offsets.size() - 1 : corrs.size();
+    }
+
+    inline CorrespondenceRange Correspondences(
+        const point2D_t point2D_idx) const {
+      CHECK_LT(point2D_idx, NumPoints2D());
+      if (IsFinalized()) {
+        const Correspondence* data = flat_corrs.data();
+        return CorrespondenceRange(data + corrs_offsets[point2D_idx],
+                                   data + corrs_offsets[point2D_idx + 1]);
+      } else {
+        const std::vector<Correspondence>& point_corrs = corrs[point2D_idx];
+        return CorrespondenceRange(point_corrs.data(),
+                                   point_corrs.data() + point_corrs.size());
+      }
+    }
   };
 
   struct ImagePair {
@@ -149,8 +208,21 @@ class CorrespondenceGraph {
     point2D_t num_correspondences = 0;
   };
 
+  // Convert a finalized image back to per-point correspondence vectors.
+  static void ExpandImage(struct Image* image);
+
+  // Find the image pair in the sorted table or in the pairs that were added
+  // since the last call to `Finalize`. Returns null if it does not exist.
+  const ImagePair* FindImagePair(const image_pair_t pair_id) const;
+  ImagePair* FindImagePair(const image_pair_t pair_id);
+
   EIGEN_STL_UMAP(image_t, Image) images_;
+
+  // Image pairs that were added since the last call to `Finalize`.
   std::unordered_map<image_pair_t, ImagePair> image_pairs_;
+
+  // Image pairs of the finalized graph sorted by their identifier.
+  std::vector<std::pair<image_pair_t, ImagePair>> sorted_image_pairs_;
 };
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -160,7 +232,7 @@ class CorrespondenceGraph {
 size_t CorrespondenceGraph::NumImages() const { return images_.size(); }
 
 size_t CorrespondenceGraph::NumImagePairs() const {
-  return image_pairs_.size();
+  return sorted_image_pairs_.size() + image_pairs_.size();
 }
 
 bool CorrespondenceGraph::ExistsImage(const image_t image_id) const {
@@ -181,23 +253,23 @@ point2D_t CorrespondenceGraph::NumCorrespondencesBetweenImages(
     const image_t image_id1, const image_t image_id2) const {
   const image_pair_t pair_id =
       Database::ImagePairToPairId(image_id1, image_id2);
-  const auto it = image_pairs_.find(pair_id);
-  if (it == image_pairs_.end()) {
+  const ImagePair* image_pair = FindImagePair(pair_id);
+  if (image_pair == nullptr) {
     return 0;
   } else {
-    return static_cast<point2D_t>(it->second.num_correspondences);
+    return static_cast<point2D_t>(image_pair->num_correspondences);
   }
 }
 
-const std::vector<CorrespondenceGraph::Correspondence>&
+CorrespondenceGraph::CorrespondenceRange
 CorrespondenceGraph::FindCorrespondences(const image_t image_id,
                                          const point2D_t point2D_idx) const {
-  return images_.at(image_id).corrs.at(point2D_idx);
+  return images_.at(image_id).Correspondences(point2D_idx);
 }
 
 bool CorrespondenceGraph::HasCorrespondences(
     const image_t image_id, const point2D_t point2D_idx) const {
-  return !images_.at(image_id).corrs.at(point2D_idx).empty();
+  return !images_.at(image_id).Correspondences(point2D_idx).empty();
 }
 
 }  // namespace colmap
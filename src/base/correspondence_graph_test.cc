@@ -371,3 +371,61 @@ BOOST_AUTO_TEST_CASE(TestDuplicate) {
   BOOST_CHECK_EQUAL(
       correspondence_graph.NumCorrespondencesBetweenImages().at(pair_id), 3);
 }
+
+BOOST_AUTO_TEST_CASE(TestAddAfterFinalize) {
+  CorrespondenceGraph correspondence_graph;
+  correspondence_graph.AddImage(0, 10);
+  correspondence_graph.AddImage(1, 10);
+  correspondence_graph.AddImage(2, 10);
+  FeatureMatches matches01(2);
+  matches01[0].point2D_idx1 = 0;
+  matches01[0].point2D_idx2 = 0;
+  matches01[1].point2D_idx1 = 5;
+  matches01[1].point2D_idx2 = 9;
+  correspondence_graph.AddCorrespondences(0, 1, matches01);
+  correspondence_graph.Finalize();
+  BOOST_CHECK_EQUAL(correspondence_graph.NumImages(), 2);
+  BOOST_CHECK_EQUAL(correspondence_graph.NumImagePairs(), 1);
+  BOOST_CHECK_EQUAL(correspondence_graph.NumCorrespondencesBetweenImages(0, 1),
+                    2);
+  BOOST_CHECK_EQUAL(correspondence_graph.NumCorrespondencesBetweenImages(1, 0),
+                    2);
+  BOOST_CHECK_EQUAL(correspondence_graph.FindCorrespondences(0, 5).size(), 1);
+  BOOST_CHECK_EQUAL(correspondence_graph.FindCorrespondences(0, 5)[0].image_id,
+                    1);
+  BOOST_CHECK_EQUAL(
+      correspondence_graph.FindCorrespondences(0, 5)[0].point2D_idx, 9);
+  BOOST_CHECK(correspondence_graph.FindCorrespondences(0, 1).empty());
+  BOOST_CHECK_EQUAL(
+      correspondence_graph.FindCorrespondencesBetweenImages(1, 0).size(), 2);
+
+  correspondence_graph.AddImage(2, 10);
+  FeatureMatches matches02(1);
+  matches02[0].point2D_idx1 = 5;
+  matches02[0].point2D_idx2 = 3;
+  correspondence_graph.AddCorrespondences(0, 2, matches02);
+  FeatureMatches matches01_more(1);
+  matches01_more[0].point2D_idx1 = 1;
+  matches01_more[0].point2D_idx2 = 1;
+  correspondence_graph.AddCorrespondences(0, 1, matches01_more);
+  BOOST_CHECK_EQUAL(correspondence_graph.NumImagePairs(), 2);
+  BOOST_CHECK_EQUAL(correspondence_graph.NumCorrespondencesBetweenImages(0, 1),
+                    3);
+  BOOST_CHECK_EQUAL(correspondence_graph.FindCorrespondences(0, 5).size(), 2);
+  BOOST_CHECK_EQUAL(
+      correspondence_graph.FindTransitiveCorrespondences(1, 9, 2).size(), 2);
+
+  correspondence_graph.Finalize();
+  BOOST_CHECK_EQUAL(correspondence_graph.NumImages(), 3);
+  BOOST_CHECK_EQUAL(correspondence_graph.NumImagePairs(), 2);
+  BOOST_CHECK_EQUAL(correspondence_graph.NumObservationsForImage(0), 3);
+  BOOST_CHECK_EQUAL(correspondence_graph.NumObservationsForImage(2), 1);
+  BOOST_CHECK_EQUAL(correspondence_graph.NumCorrespondencesForImage(0), 4);
+  BOOST_CHECK_EQUAL(correspondence_graph.NumCorrespondencesBetweenImages(0, 2),
+                    1);
+  BOOST_CHECK_EQUAL(
+      correspondence_graph.NumCorrespondencesBetweenImages().size(), 2);
+  BOOST_CHECK_EQUAL(correspondence_graph.FindCorrespondences(0, 5).size(), 2);
+  BOOST_CHECK(correspondence_graph.IsTwoViewObservation(1, 1));
+  BOOST_CHECK(!correspondence_graph.IsTwoViewObservation(1, 9));
+}
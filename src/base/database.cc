@@ -47,6 +47,9 @@ typedef Eigen::Matrix<uint8_t, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor>
 typedef Eigen::Matrix<point2D_t, Eigen::Dynamic, 2, Eigen::RowMajor>
     FeatureMatchesBlob;
 
+// Number of rows written by one multi-row insert statement.
+const size_t kWriteBatchSize = 32;
+
 void SwapFeatureMatchesBlob(FeatureMatchesBlob* matches) {
   matches->col(0).swap(matches->col(1));
 }
@@ -238,6 +241,94 @@ Image ReadImageRow(sqlite3_stmt* sql_stmt) {
   return image;
 }
 
+// Matches in the order of the image pair in the database.
+FeatureMatchesBlob MatchesToDatabaseBlob(const image_t image_id1,
+                                         const image_t image_id2,
+                                         const FeatureMatches& matches) {
+  FeatureMatchesBlob blob = FeatureMatchesToBlob(matches);
+  if (Database::SwapImagePair(image_id1, image_id2)) {
+    SwapFeatureMatchesBlob(&blob);
+  }
+  return blob;
+}
+
+// Row of the two-view geometries table. Its data is bound statically, so the
+// row must live until the statement is executed.
+struct TwoViewGeometryRow {
+  EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+  image_pair_t pair_id = 0;
+  int config = 0;
+  FeatureMatchesBlob inlier_matches;
+  Eigen::Matrix3d Ft;
+  Eigen::Matrix3d Et;
+  Eigen::Matrix3d Ht;
+  Eigen::Vector4d qvec;
+  Eigen::Vector3d tvec;
+};
+
+TwoViewGeometryRow TwoViewGeometryToRow(
+    const image_t image_id1, const image_t image_id2,
+    const TwoViewGeometry& two_view_geometry) {
+  const TwoViewGeometry* two_view_geometry_ptr = &two_view_geometry;
+
+  // Invert the two-view geometry if the image pair has to be swapped.
+  std::unique_ptr<TwoViewGeometry> swapped_two_view_geometry;
+  if (Database::SwapImagePair(image_id1, image_id2)) {
+    swapped_two_view_geometry.reset(new TwoViewGeometry());
+    *swapped_two_view_geometry = two_view_geometry;
+    swapped_two_view_geometry->Invert();
+    two_view_geometry_ptr = swapped_two_view_geometry.get();
+  }
+
+  TwoViewGeometryRow row;
+  row.pair_id = Database::ImagePairToPairId(image_id1, image_id2);
+  row.config = two_view_geometry_ptr->config;
+  row.inlier_matches =
+      FeatureMatchesToBlob(two_view_geometry_ptr->inlier_matches);
+  // Transpose the matrices to obtain row-major data layout.
+  row.Ft = two_view_geometry_ptr->F.transpose();
+  row.Et = two_view_geometry_ptr->E.transpose();
+  row.Ht = two_view_geometry_ptr->H.transpose();
+  row.qvec = two_view_geometry_ptr->qvec;
+  row.tvec = two_view_geometry_ptr->tvec;
+  return row;
+}
+
+// Bind the row to the 10 parameters of the statement starting at `col`.
+void BindTwoViewGeometryRow(sqlite3_stmt* sql_stmt,
+                            const TwoViewGeometryRow& row, const int col) {
+  SQLITE3_CALL(sqlite3_bind_int64(sql_stmt, col, row.pair_id));
+  WriteDynamicMatrixBlob(sql_stmt, row.inlier_matches, col + 1);
+  SQLITE3_CALL(sqlite3_bind_int64(sql_stmt, col + 4, row.config));
+  if (row.inlier_matches.rows() > 0) {
+    WriteStaticMatrixBlob(sql_stmt, row.Ft, col + 5);
+    WriteStaticMatrixBlob(sql_stmt, row.Et, col + 6);
+    WriteStaticMatrixBlob(sql_stmt, row.Ht, col + 7);
+    WriteStaticMatrixBlob(sql_stmt, row.qvec, col + 8);
+    WriteStaticMatrixBlob(sql_stmt, row.tvec, col + 9);
+  } else {
+    for (int i = 5; i < 10; ++i) {
+      WriteStaticMatrixBlob(sql_stmt, Eigen::MatrixXd(0, 0), col + i);
+    }
+  }
+}
+
+// Multi-row insert statement with `num_rows` rows of `num_cols` parameters.
+std::string MultiRowInsertSQL(const std::string& insert,
+                              const size_t num_rows, const size_t num_cols) {
+  std::string row = "(?";
+  for (size_t i = 1; i < num_cols; ++i) {
+    row += ", ?";
+  }
+  row += ")";
+  std::string sql = insert + " VALUES" + row;
+  for (size_t i = 1; i < num_rows; ++i) {
+    sql += ", " + row;
+  }
+  return sql + ";";
+}
+
 }  // namespace
 
 const size_t Database::kMaxNumImages =
@@ -283,6 +374,27 @@ void Database::Open(const std::string& path) {
   PrepareSQLStatements();
 }
 
+void Database::OpenReadOnly(const std::string& path) {
+  Close();
+
+  SQLITE3_CALL(sqlite3_open_v2(path.c_str(), &database_,
+                               SQLITE_OPEN_READONLY | SQLITE_OPEN_NOMUTEX,
+                               nullptr));
+
+  // Store temporary tables and indices in memory
+  SQLITE3_EXEC(database_, "PRAGMA temp_store=MEMORY", nullptr);
+
+  PrepareSQLStatements();
+}
+
+std::string Database::Path() const {
+  if (database_ == nullptr) {
+    return "";
+  }
+  const char* path = sqlite3_db_filename(database_, "main");
+  return path == nullptr ? "" : path;
+}
+
 void Database::Close() {
   if (database_ != nullptr) {
     FinalizeSQLStatements();
@@ -461,6 +573,21 @@ FeatureDescriptors Database::ReadDescriptors(const image_t image_id) const {
   return descriptors;
 }
 
+uint64_t Database::ReadFeaturesStamp(const image_t image_id) const {
+  SQLITE3_CALL(sqlite3_bind_int64(sql_stmt_read_features_stamp_, 1, image_id));
+
+  uint64_t stamp = 0;
+  const int rc = SQLITE3_CALL(sqlite3_step(sql_stmt_read_features_stamp_));
+  if (rc == SQLITE_ROW) {
+    stamp = static_cast<uint64_t>(
+        sqlite3_column_int64(sql_stmt_read_features_stamp_, 0));
+  }
+
+  SQLITE3_CALL(sqlite3_reset(sql_stmt_read_features_stamp_));
+
+  return stamp;
+}
+
 FeatureMatches Database::ReadMatches(image_t image_id1,
                                      image_t image_id2) const {
   const image_pair_t pair_id = ImagePairToPairId(image_id1, image_id2);
@@ -579,6 +706,41 @@ void Database::ReadTwoViewGeometries(
   SQLITE3_CALL(sqlite3_reset(sql_stmt_read_two_view_geometries_));
 }
 
+void Database::ReadTwoViewGeometryInlierMatches(
+    const image_pair_t begin_pair_id, const image_pair_t end_pair_id,
+    std::vector<image_pair_t>* image_pair_ids,
+    std::vector<TwoViewGeometry>* two_view_geometries) const {
+  SQLITE3_CALL(
+      sqlite3_bind_int64(sql_stmt_read_two_view_geometry_inlier_matches_, 1,
+                         static_cast<sqlite3_int64>(begin_pair_id)));
+  SQLITE3_CALL(
+      sqlite3_bind_int64(sql_stmt_read_two_view_geometry_inlier_matches_, 2,
+                         static_cast<sqlite3_int64>(end_pair_id)));
+
+  int rc;
+  while ((rc = SQLITE3_CALL(sqlite3_step(
+              sql_stmt_read_two_view_geometry_inlier_matches_))) ==
+         SQLITE_ROW) {
+    const image_pair_t pair_id =
+        static_cast<image_pair_t>(sqlite3_column_int64(
+            sql_stmt_read_two_view_geometry_inlier_matches_, 0));
+    image_pair_ids->push_back(pair_id);
+
+    TwoViewGeometry two_view_geometry;
+
+    const FeatureMatchesBlob blob = ReadDynamicMatrixBlob<FeatureMatchesBlob>(
+        sql_stmt_read_two_view_geometry_inlier_matches_, rc, 1);
+    two_view_geometry.inlier_matches = FeatureMatchesFromBlob(blob);
+
+    two_view_geometry.config = static_cast<int>(sqlite3_column_int64(
+        sql_stmt_read_two_view_geometry_inlier_matches_, 4));
+
+    two_view_geometries->push_back(std::move(two_view_geometry));
+  }
+
+  SQLITE3_CALL(sqlite3_reset(sql_stmt_read_two_view_geometry_inlier_matches_));
+}
+
 void Database::ReadTwoViewGeometryNumInliers(
     std::vector<std::pair<image_t, image_t>>* image_pairs,
     std::vector<int>* num_inliers) const {
@@ -674,6 +836,8 @@ void Database::WriteKeypoints(const image_t image_id,
 
   SQLITE3_CALL(sqlite3_step(sql_stmt_write_keypoints_));
   SQLITE3_CALL(sqlite3_reset(sql_stmt_write_keypoints_));
+
+  UpdateFeaturesStamp(image_id);
 }
 
 void Database::WriteDescriptors(const image_t image_id,
@@ -683,6 +847,8 @@ void Database::WriteDescriptors(const image_t image_id,
 
   SQLITE3_CALL(sqlite3_step(sql_stmt_write_descriptors_));
   SQLITE3_CALL(sqlite3_reset(sql_stmt_write_descriptors_));
+
+  UpdateFeaturesStamp(image_id);
 }
 
 void Database::WriteMatches(const image_t image_id1, const image_t image_id2,
@@ -691,13 +857,9 @@ void Database::WriteMatches(const image_t image_id1, const image_t image_id2,
   SQLITE3_CALL(sqlite3_bind_int64(sql_stmt_write_matches_, 1, pair_id));
 
   // Important: the swapped data must live until the query is executed.
-  FeatureMatchesBlob blob = FeatureMatchesToBlob(matches);
-  if (SwapImagePair(image_id1, image_id2)) {
-    SwapFeatureMatchesBlob(&blob);
-    WriteDynamicMatrixBlob(sql_stmt_write_matches_, blob, 2);
-  } else {
-    WriteDynamicMatrixBlob(sql_stmt_write_matches_, blob, 2);
-  }
+  const FeatureMatchesBlob blob =
+      MatchesToDatabaseBlob(image_id1, image_id2, matches);
+  WriteDynamicMatrixBlob(sql_stmt_write_matches_, blob, 2);
 
   SQLITE3_CALL(sqlite3_step(sql_stmt_write_matches_));
   SQLITE3_CALL(sqlite3_reset(sql_stmt_write_matches_));
@@ -706,58 +868,66 @@ void Database::WriteMatches(const image_t image_id1, const image_t image_id2,
 void Database::WriteTwoViewGeometry(
     const image_t image_id1, const image_t image_id2,
     const TwoViewGeometry& two_view_geometry) const {
-  const image_pair_t pair_id = ImagePairToPairId(image_id1, image_id2);
-  SQLITE3_CALL(
-      sqlite3_bind_int64(sql_stmt_write_two_view_geometry_, 1, pair_id));
+  // Important: the row must live until the query is executed.
+  const TwoViewGeometryRow row =
+      TwoViewGeometryToRow(image_id1, image_id2, two_view_geometry);
+  BindTwoViewGeometryRow(sql_stmt_write_two_view_geometry_, row, 1);
 
-  const TwoViewGeometry* two_view_geometry_ptr = &two_view_geometry;
+  SQLITE3_CALL(sqlite3_step(sql_stmt_write_two_view_geometry_));
+  SQLITE3_CALL(sqlite3_reset(sql_stmt_write_two_view_geometry_));
+}
 
-  // Invert the two-view geometry if the image pair has to be swapped.
-  std::unique_ptr<TwoViewGeometry> swapped_two_view_geometry;
-  if (SwapImagePair(image_id1, image_id2)) {
-    swapped_two_view_geometry.reset(new TwoViewGeometry());
-    *swapped_two_view_geometry = two_view_geometry;
-    swapped_two_view_geometry->Invert();
-    two_view_geometry_ptr = swapped_two_view_geometry.get();
+void Database::WriteMatches(
+    const std::vector<std::pair<image_t, image_t>>& image_pairs,
+    const std::vector<FeatureMatches>& matches) const {
+  CHECK_EQ(image_pairs.size(), matches.size());
+
+  std::vector<FeatureMatchesBlob> blobs(kWriteBatchSize);
+  size_t i = 0;
+  for (; i + kWriteBatchSize <= image_pairs.size(); i += kWriteBatchSize) {
+    for (size_t j = 0; j < kWriteBatchSize; ++j) {
+      const auto& image_pair = image_pairs[i + j];
+      const int col = static_cast<int>(4 * j + 1);
+      SQLITE3_CALL(sqlite3_bind_int64(
+          sql_stmt_write_matches_batch_, col,
+          ImagePairToPairId(image_pair.first, image_pair.second)));
+      blobs[j] = MatchesToDatabaseBlob(image_pair.first, image_pair.second,
+                                       matches[i + j]);
+      WriteDynamicMatrixBlob(sql_stmt_write_matches_batch_, blobs[j], col + 1);
+    }
+    SQLITE3_CALL(sqlite3_step(sql_stmt_write_matches_batch_));
+    SQLITE3_CALL(sqlite3_reset(sql_stmt_write_matches_batch_));
   }
 
-  const FeatureMatchesBlob inlier_matches =
-      FeatureMatchesToBlob(two_view_geometry_ptr->inlier_matches);
-  WriteDynamicMatrixBlob(sql_stmt_write_two_view_geometry_, inlier_matches, 2);
-
-  SQLITE3_CALL(sqlite3_bind_int64(sql_stmt_write_two_view_geometry_, 5,
-                                  two_view_geometry_ptr->config));
+  for (; i < image_pairs.size(); ++i) {
+    WriteMatches(image_pairs[i].first, image_pairs[i].second, matches[i]);
+  }
+}
 
-  // Transpose the matrices to obtain row-major data layout.
-  // Important: Do not move these objects inside the if-statement, because
-  // the objects must live until `sqlite3_step` is called on the statement.
-  const Eigen::Matrix3d Ft = two_view_geometry_ptr->F.transpose();
-  const Eigen::Matrix3d Et = two_view_geometry_ptr->E.transpose();
-  const Eigen::Matrix3d Ht = two_view_geometry_ptr->H.transpose();
-  const Eigen::Vector4d& qvec = two_view_geometry_ptr->qvec;
-  const Eigen::Vector3d& tvec = two_view_geometry_ptr->tvec;
-
-  if (two_view_geometry_ptr->inlier_matches.size() > 0) {
-    WriteStaticMatrixBlob(sql_stmt_write_two_view_geometry_, Ft, 6);
-    WriteStaticMatrixBlob(sql_stmt_write_two_view_geometry_, Et, 7);
-    WriteStaticMatrixBlob(sql_stmt_write_two_view_geometry_, Ht, 8);
-    WriteStaticMatrixBlob(sql_stmt_write_two_view_geometry_, qvec, 9);
-    WriteStaticMatrixBlob(sql_stmt_write_two_view_geometry_, tvec, 10);
-  } else {
-    WriteStaticMatrixBlob(sql_stmt_write_two_view_geometry_,
-                          Eigen::MatrixXd(0, 0), 6);
-    WriteStaticMatrixBlob(sql_stmt_write_two_view_geometry_,
-                          Eigen::MatrixXd(0, 0), 7);
-    WriteStaticMatrixBlob(sql_stmt_write_two_view_geometry_,
-                          Eigen::MatrixXd(0, 0), 8);
-    WriteStaticMatrixBlob(sql_stmt_write_two_view_geometry_,
-                          Eigen::MatrixXd(0, 0), 9);
-    WriteStaticMatrixBlob(sql_stmt_write_two_view_geometry_,
-                          Eigen::MatrixXd(0, 0), 10);
+void Database::WriteTwoViewGeometries(
+    const std::vector<std::pair<image_t, image_t>>& image_pairs,
+    const std::vector<TwoViewGeometry>& two_view_geometries) const {
+  CHECK_EQ(image_pairs.size(), two_view_geometries.size());
+
+  std::vector<TwoViewGeometryRow, Eigen::aligned_allocator<TwoViewGeometryRow>>
+      rows(kWriteBatchSize);
+  size_t i = 0;
+  for (; i + kWriteBatchSize <= image_pairs.size(); i += kWriteBatchSize) {
+    for (size_t j = 0; j < kWriteBatchSize; ++j) {
+      const auto& image_pair = image_pairs[i + j];
+      rows[j] = TwoViewGeometryToRow(image_pair.first, image_pair.second,
+                                     two_view_geometries[i + j]);
+      BindTwoViewGeometryRow(sql_stmt_write_two_view_geometries_batch_,
+                             rows[j], static_cast<int>(10 * j + 1));
+    }
+    SQLITE3_CALL(sqlite3_step(sql_stmt_write_two_view_geometries_batch_));
+    SQLITE3_CALL(sqlite3_reset(sql_stmt_write_two_view_geometries_batch_));
   }
 
-  SQLITE3_CALL(sqlite3_step(sql_stmt_write_two_view_geometry_));
-  SQLITE3_CALL(sqlite3_reset(sql_stmt_write_two_view_geometry_));
+  for (; i < image_pairs.size(); ++i) {
+    WriteTwoViewGeometry(image_pairs[i].first, image_pairs[i].second,
+                         two_view_geometries[i]);
+  }
 }
 
 void Database::UpdateCamera(const Camera& camera) const {
@@ -1081,6 +1251,15 @@ void Database::PrepareSQLStatements() {
                                   &sql_stmt_update_image_, 0));
   sql_stmts_.push_back(sql_stmt_update_image_);
 
+  // The stamp only has to differ from the previous one, so a random number
+  // avoids looking up the largest stamp on every write.
+  sql =
+      "INSERT OR REPLACE INTO features_stamps(image_id, stamp) "
+      "VALUES(?, random());";
+  SQLITE3_CALL(sqlite3_prepare_v2(database_, sql.c_str(), -1,
+                                  &sql_stmt_update_features_stamp_, 0));
+  sql_stmts_.push_back(sql_stmt_update_features_stamp_);
+
   //////////////////////////////////////////////////////////////////////////////
   // read_*
   //////////////////////////////////////////////////////////////////////////////
@@ -1119,6 +1298,11 @@ void Database::PrepareSQLStatements() {
                                   &sql_stmt_read_descriptors_, 0));
   sql_stmts_.push_back(sql_stmt_read_descriptors_);
 
+  sql = "SELECT stamp FROM features_stamps WHERE image_id = ?;";
+  SQLITE3_CALL(sqlite3_prepare_v2(database_, sql.c_str(), -1,
+                                  &sql_stmt_read_features_stamp_, 0));
+  sql_stmts_.push_back(sql_stmt_read_features_stamp_);
+
   sql = "SELECT rows, cols, data FROM matches WHERE pair_id = ?;";
   SQLITE3_CALL(sqlite3_prepare_v2(database_, sql.c_str(), -1,
                                   &sql_stmt_read_matches_, 0));
@@ -1147,6 +1331,14 @@ void Database::PrepareSQLStatements() {
                                   0));
   sql_stmts_.push_back(sql_stmt_read_two_view_geometry_num_inliers_);
 
+  sql =
+      "SELECT pair_id, rows, cols, data, config FROM two_view_geometries "
+      "WHERE rows > 0 AND pair_id >= ? AND pair_id < ?;";
+  SQLITE3_CALL(
+      sqlite3_prepare_v2(database_, sql.c_str(), -1,
+                         &sql_stmt_read_two_view_geometry_inlier_matches_, 0));
+  sql_stmts_.push_back(sql_stmt_read_two_view_geometry_inlier_matches_);
+
   //////////////////////////////////////////////////////////////////////////////
   // write_*
   //////////////////////////////////////////////////////////////////////////////
@@ -1173,6 +1365,21 @@ void Database::PrepareSQLStatements() {
                                   &sql_stmt_write_two_view_geometry_, 0));
   sql_stmts_.push_back(sql_stmt_write_two_view_geometry_);
 
+  sql = MultiRowInsertSQL("INSERT INTO matches(pair_id, rows, cols, data)",
+                          kWriteBatchSize, 4);
+  SQLITE3_CALL(sqlite3_prepare_v2(database_, sql.c_str(), -1,
+                                  &sql_stmt_write_matches_batch_, 0));
+  sql_stmts_.push_back(sql_stmt_write_matches_batch_);
+
+  sql = MultiRowInsertSQL(
+      "INSERT INTO two_view_geometries(pair_id, rows, cols, data, config, F, "
+      "E, H, qvec, tvec)",
+      kWriteBatchSize, 10);
+  SQLITE3_CALL(sqlite3_prepare_v2(database_, sql.c_str(), -1,
+                                  &sql_stmt_write_two_view_geometries_batch_,
+                                  0));
+  sql_stmts_.push_back(sql_stmt_write_two_view_geometries_batch_);
+
   //////////////////////////////////////////////////////////////////////////////
   // delete_*
   //////////////////////////////////////////////////////////////////////////////
@@ -1233,6 +1440,7 @@ void Database::CreateTables() const {
   CreateDescriptorsTable();
   CreateMatchesTable();
   CreateTwoViewGeometriesTable();
+  CreateFeaturesStampsTable();
 }
 
 void Database::CreateCameraTable() const {
@@ -1326,6 +1534,16 @@ void Database::CreateTwoViewGeometriesTable() const {
   }
 }
 
+void Database::CreateFeaturesStampsTable() const {
+  const std::string sql =
+      "CREATE TABLE IF NOT EXISTS features_stamps"
+      "   (image_id  INTEGER  PRIMARY KEY  NOT NULL,"
+      "    stamp     INTEGER               NOT NULL,"
+      "FOREIGN KEY(image_id) REFERENCES images(image_id) ON DELETE CASCADE);";
+
+  SQLITE3_EXEC(database_, sql.c_str(), nullptr);
+}
+
 void Database::UpdateSchema() const {
   if (!ExistsColumn("two_view_geometries", "F")) {
     SQLITE3_EXEC(database_,
@@ -1361,6 +1579,13 @@ void Database::UpdateSchema() const {
   SQLITE3_EXEC(database_, update_user_version_sql.c_str(), nullptr);
 }
 
+void Database::UpdateFeaturesStamp(const image_t image_id) const {
+  SQLITE3_CALL(
+      sqlite3_bind_int64(sql_stmt_update_features_stamp_, 1, image_id));
+  SQLITE3_CALL(sqlite3_step(sql_stmt_update_features_stamp_));
+  SQLITE3_CALL(sqlite3_reset(sql_stmt_update_features_stamp_));
+}
+
 bool Database::ExistsTable(const std::string& table_name) const {
   const std::string sql =
       "SELECT name FROM sqlite_master WHERE type='table' AND name = ?;";
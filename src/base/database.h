@@ -71,6 +71,14 @@ class Database {
   void Open(const std::string& path);
   void Close();
 
+  // Open an existing database as an additional read-only connection, e.g.,
+  // to read from multiple threads concurrently, each with its own
+  // connection. The schema is neither created nor updated.
+  void OpenReadOnly(const std::string& path);
+
+  // Path of the opened database file, which is empty for in-memory databases.
+  std::string Path() const;
+
   // Check if entry already exists in database. For image pairs, the order of
   // `image_id1` and `image_id2` does not matter.
   bool ExistsCamera(const camera_t camera_id) const;
@@ -149,6 +157,11 @@ class Database {
   FeatureKeypoints ReadKeypoints(const image_t image_id) const;
   FeatureDescriptors ReadDescriptors(const image_t image_id) const;
 
+  // Stamp of the features of an image, which changes every time that its
+  // keypoints or descriptors are written. Returns 0 if the features of the
+  // image were never written through this class, e.g. for older databases.
+  uint64_t ReadFeaturesStamp(const image_t image_id) const;
+
   FeatureMatches ReadMatches(const image_t image_id1,
                              const image_t image_id2) const;
   std::vector<std::pair<image_pair_t, FeatureMatches>> ReadAllMatches() const;
@@ -159,6 +172,15 @@ class Database {
       std::vector<image_pair_t>* image_pair_ids,
       std::vector<TwoViewGeometry>* two_view_geometries) const;
 
+  // Read the inlier matches and configuration of all two-view geometries
+  // with at least one inlier match and a pair identifier in the range
+  // [begin_pair_id, end_pair_id) in ascending order of the pair identifier.
+  // The geometric models are not read.
+  void ReadTwoViewGeometryInlierMatches(
+      const image_pair_t begin_pair_id, const image_pair_t end_pair_id,
+      std::vector<image_pair_t>* image_pair_ids,
+      std::vector<TwoViewGeometry>* two_view_geometries) const;
+
   // Read all image pairs that have an entry in the `NumVerifiedImagePairs`
   // table with at least one inlier match and their number of inlier matches.
   void ReadTwoViewGeometryNumInliers(
@@ -186,6 +208,16 @@ class Database {
   void WriteTwoViewGeometry(const image_t image_id1, const image_t image_id2,
                             const TwoViewGeometry& two_view_geometry) const;
 
+  // Write the matches and two-view geometries of multiple image pairs using
+  // multi-row insert statements, which is considerably faster than writing
+  // the image pairs one by one. Should be wrapped in a transaction.
+  void WriteMatches(
+      const std::vector<std::pair<image_t, image_t>>& image_pairs,
+      const std::vector<FeatureMatches>& matches) const;
+  void WriteTwoViewGeometries(
+      const std::vector<std::pair<image_t, image_t>>& image_pairs,
+      const std::vector<TwoViewGeometry>& two_view_geometries) const;
+
   // Update an existing camera in the database. The user is responsible for
   // making sure that the entry already exists.
   void UpdateCamera(const Camera& camera) const;
@@ -250,9 +282,13 @@ class Database {
   void CreateDescriptorsTable() const;
   void CreateMatchesTable() const;
   void CreateTwoViewGeometriesTable() const;
+  void CreateFeaturesStampsTable() const;
 
   void UpdateSchema() const;
 
+  // Change the features stamp of an image after writing its features.
+  void UpdateFeaturesStamp(const image_t image_id) const;
+
   bool ExistsTable(const std::string& table_name) const;
   bool ExistsColumn(const std::string& table_name,
                     const std::string& column_name) const;
@@ -306,6 +342,7 @@ class Database {
   // update_*
   sqlite3_stmt* sql_stmt_update_camera_ = nullptr;
   sqlite3_stmt* sql_stmt_update_image_ = nullptr;
+  sqlite3_stmt* sql_stmt_update_features_stamp_ = nullptr;
 
   // read_*
   sqlite3_stmt* sql_stmt_read_camera_ = nullptr;
@@ -315,17 +352,21 @@ class Database {
   sqlite3_stmt* sql_stmt_read_images_ = nullptr;
   sqlite3_stmt* sql_stmt_read_keypoints_ = nullptr;
   sqlite3_stmt* sql_stmt_read_descriptors_ = nullptr;
+  sqlite3_stmt* sql_stmt_read_features_stamp_ = nullptr;
   sqlite3_stmt* sql_stmt_read_matches_ = nullptr;
   sqlite3_stmt* sql_stmt_read_matches_all_ = nullptr;
   sqlite3_stmt* sql_stmt_read_two_view_geometry_ = nullptr;
   sqlite3_stmt* sql_stmt_read_two_view_geometries_ = nullptr;
   sqlite3_stmt* sql_stmt_read_two_view_geometry_num_inliers_ = nullptr;
+  sqlite3_stmt* sql_stmt_read_two_view_geometry_inlier_matches_ = nullptr;
 
   // write_*
   sqlite3_stmt* sql_stmt_write_keypoints_ = nullptr;
   sqlite3_stmt* sql_stmt_write_descriptors_ = nullptr;
   sqlite3_stmt* sql_stmt_write_matches_ = nullptr;
   sqlite3_stmt* sql_stmt_write_two_view_geometry_ = nullptr;
+  sqlite3_stmt* sql_stmt_write_matches_batch_ = nullptr;
+  sqlite3_stmt* sql_stmt_write_two_view_geometries_batch_ = nullptr;
 
   // delete_*
   sqlite3_stmt* sql_stmt_delete_matches_ = nullptr;
@@ -31,10 +31,15 @@
 
 #include "base/database_cache.h"
 
+#include <algorithm>
+#include <future>
+#include <limits>
+#include <memory>
 #include <unordered_set>
 
 #include "feature/utils.h"
 #include "util/string.h"
+#include "util/threading.h"
 #include "util/timer.h"
 
 namespace colmap {
@@ -54,7 +59,9 @@ void DatabaseCache::AddImage(const class Image& image) {
 
 void DatabaseCache::Load(const Database& database, const size_t min_num_matches,
                          const bool ignore_watermarks,
-                         const std::unordered_set<std::string>& image_names) {
+                         const std::unordered_set<std::string>& image_names,
+                         const FeatureStore* feature_store,
+                         const int num_threads) {
   //////////////////////////////////////////////////////////////////////////////
   // Load cameras
   //////////////////////////////////////////////////////////////////////////////
@@ -77,19 +84,64 @@ void DatabaseCache::Load(const Database& database, const size_t min_num_matches,
             << std::endl;
 
   //////////////////////////////////////////////////////////////////////////////
-  // Load matches
+  // Setup workers
+  //////////////////////////////////////////////////////////////////////////////
+
+  // Every worker reads over its own read-only connection, which is only
+  // possible for databases on disk.
+  const std::string database_path = database.Path();
+  ThreadBudgetLease thread_budget_lease(
+      database_path.empty() ? 1 : num_threads);
+  const int num_eff_threads = thread_budget_lease.NumThreads();
+
+  std::vector<std::unique_ptr<Database>> connections(num_eff_threads);
+  std::unique_ptr<ThreadPool> thread_pool;
+  if (num_eff_threads > 1) {
+    thread_pool.reset(new ThreadPool(num_eff_threads));
+  }
+
+  auto GetConnection = [&]() -> const Database& {
+    if (!thread_pool) {
+      return database;
+    }
+    auto& connection = connections.at(thread_pool->GetThreadIndex());
+    if (!connection) {
+      connection.reset(new Database());
+      connection->OpenReadOnly(database_path);
+    }
+    return *connection;
+  };
+
+  //////////////////////////////////////////////////////////////////////////////
+  // Load matches and build correspondence graph
   //////////////////////////////////////////////////////////////////////////////
 
   timer.Restart();
   std::cout << "Loading matches..." << std::flush;
 
-  std::vector<image_pair_t> image_pair_ids;
-  std::vector<TwoViewGeometry> two_view_geometries;
-  database.ReadTwoViewGeometries(&image_pair_ids, &two_view_geometries);
+  const std::vector<class Image> images = database.ReadAllImages();
 
-  std::cout << StringPrintf(" %d in %.3fs", image_pair_ids.size(),
-                            timer.ElapsedSeconds())
-            << std::endl;
+  // Determines for which images data should be loaded.
+  std::unordered_set<image_t> image_ids;
+  if (image_names.empty()) {
+    for (const auto& image : images) {
+      image_ids.insert(image.ImageId());
+    }
+  } else {
+    for (const auto& image : images) {
+      if (image_names.count(image.Name()) > 0) {
+        image_ids.insert(image.ImageId());
+      }
+    }
+  }
+
+  // All candidate images are added before reading the matches, so that the
+  // correspondences can be added while the matches are still being read.
+  // Images without correspondences are removed again when finalizing.
+  for (const auto image_id : image_ids) {
+    correspondence_graph_.AddImage(image_id,
+                                   database.NumKeypointsForImage(image_id));
+  }
 
   auto UseInlierMatchesCheck = [min_num_matches, ignore_watermarks](
                                    const TwoViewGeometry& two_view_geometry) {
@@ -99,96 +151,143 @@ void DatabaseCache::Load(const Database& database, const size_t min_num_matches,
             two_view_geometry.config != TwoViewGeometry::WATERMARK);
   };
 
-  //////////////////////////////////////////////////////////////////////////////
-  // Load images
-  //////////////////////////////////////////////////////////////////////////////
-
-  timer.Restart();
-  std::cout << "Loading images..." << std::flush;
-
-  std::unordered_set<image_t> image_ids;
-
-  {
-    const std::vector<class Image> images = database.ReadAllImages();
+  struct ImagePairs {
+    std::vector<std::pair<image_pair_t, FeatureMatches>> matches;
+    size_t num_ignored = 0;
+  };
 
-    // Determines for which images data should be loaded.
-    if (image_names.empty()) {
-      for (const auto& image : images) {
-        image_ids.insert(image.ImageId());
-      }
-    } else {
-      for (const auto& image : images) {
-        if (image_names.count(image.Name()) > 0) {
-          image_ids.insert(image.ImageId());
-        }
-      }
-    }
+  auto ReadImagePairs = [&](const image_pair_t begin_pair_id,
+                            const image_pair_t end_pair_id) {
+    std::vector<image_pair_t> image_pair_ids;
+    std::vector<TwoViewGeometry> two_view_geometries;
+    GetConnection().ReadTwoViewGeometryInlierMatches(
+        begin_pair_id, end_pair_id, &image_pair_ids, &two_view_geometries);
 
-    // Collect all images that are connected in the correspondence graph.
-    std::unordered_set<image_t> connected_image_ids;
-    connected_image_ids.reserve(image_ids.size());
+    ImagePairs image_pairs;
     for (size_t i = 0; i < image_pair_ids.size(); ++i) {
-      if (UseInlierMatchesCheck(two_view_geometries[i])) {
-        image_t image_id1;
-        image_t image_id2;
-        Database::PairIdToImagePair(image_pair_ids[i], &image_id1, &image_id2);
-        if (image_ids.count(image_id1) > 0 && image_ids.count(image_id2) > 0) {
-          connected_image_ids.insert(image_id1);
-          connected_image_ids.insert(image_id2);
-        }
+      image_t image_id1;
+      image_t image_id2;
+      Database::PairIdToImagePair(image_pair_ids[i], &image_id1, &image_id2);
+      if (UseInlierMatchesCheck(two_view_geometries[i]) &&
+          image_ids.count(image_id1) > 0 && image_ids.count(image_id2) > 0) {
+        image_pairs.matches.emplace_back(
+            image_pair_ids[i],
+            std::move(two_view_geometries[i].inlier_matches));
+      } else {
+        image_pairs.num_ignored += 1;
       }
     }
+    return image_pairs;
+  };
 
-    // Load images with correspondences and discard images without
-    // correspondences, as those images are useless for SfM.
-    images_.reserve(connected_image_ids.size());
-    for (const auto& image : images) {
-      if (image_ids.count(image.ImageId()) > 0 &&
-          connected_image_ids.count(image.ImageId()) > 0) {
-        images_.emplace(image.ImageId(), image);
-        const FeatureKeypoints keypoints =
-            database.ReadKeypoints(image.ImageId());
-        const std::vector<Eigen::Vector2d> points =
-            FeatureKeypointsToPointsVector(keypoints);
-        images_[image.ImageId()].SetPoints2D(points);
-      }
+  // Split the pairs into contiguous ranges of the first image of the pair,
+  // which are read by the workers in parallel. The ranges are added to the
+  // graph in order as soon as they are read, so that the graph is identical
+  // to the one of a serial load.
+  const size_t kNumRangesPerThread = 8;
+  const image_pair_t kMaxPairId =
+      static_cast<image_pair_t>(std::numeric_limits<int64_t>::max());
+  std::vector<image_t> sorted_image_ids;
+  sorted_image_ids.reserve(images.size());
+  for (const auto& image : images) {
+    sorted_image_ids.push_back(image.ImageId());
+  }
+  std::sort(sorted_image_ids.begin(), sorted_image_ids.end());
+  const size_t num_ranges =
+      std::max<size_t>(1, std::min(sorted_image_ids.size(),
+                                   kNumRangesPerThread * num_eff_threads));
+  std::vector<image_pair_t> range_begins(num_ranges + 1, 0);
+  for (size_t i = 1; i < num_ranges; ++i) {
+    range_begins[i] =
+        static_cast<image_pair_t>(Database::kMaxNumImages) *
+        sorted_image_ids[i * sorted_image_ids.size() / num_ranges];
+  }
+  range_begins[num_ranges] = kMaxPairId;
+
+  std::vector<std::future<ImagePairs>> futures;
+  if (thread_pool) {
+    futures.reserve(num_ranges);
+    for (size_t i = 0; i < num_ranges; ++i) {
+      futures.push_back(thread_pool->AddTask(ReadImagePairs, range_begins[i],
+                                             range_begins[i + 1]));
     }
+  }
 
-    std::cout << StringPrintf(" %d in %.3fs (connected %d)", images.size(),
-                              timer.ElapsedSeconds(),
-                              connected_image_ids.size())
-              << std::endl;
+  std::unordered_set<image_t> connected_image_ids;
+  connected_image_ids.reserve(image_ids.size());
+  size_t num_image_pairs = 0;
+  size_t num_ignored_image_pairs = 0;
+  for (size_t i = 0; i < num_ranges; ++i) {
+    const ImagePairs image_pairs =
+        thread_pool ? futures[i].get()
+                    : ReadImagePairs(range_begins[i], range_begins[i + 1]);
+    num_image_pairs += image_pairs.matches.size() + image_pairs.num_ignored;
+    num_ignored_image_pairs += image_pairs.num_ignored;
+    for (const auto& matches : image_pairs.matches) {
+      image_t image_id1;
+      image_t image_id2;
+      Database::PairIdToImagePair(matches.first, &image_id1, &image_id2);
+      connected_image_ids.insert(image_id1);
+      connected_image_ids.insert(image_id2);
+      correspondence_graph_.AddCorrespondences(image_id1, image_id2,
+                                               matches.second);
+    }
   }
 
+  correspondence_graph_.Finalize();
+
+  std::cout << StringPrintf(" %d in %.3fs (ignored %d)", num_image_pairs,
+                            timer.ElapsedSeconds(), num_ignored_image_pairs)
+            << std::endl;
+
   //////////////////////////////////////////////////////////////////////////////
-  // Build correspondence graph
+  // Load images
   //////////////////////////////////////////////////////////////////////////////
 
   timer.Restart();
-  std::cout << "Building correspondence graph..." << std::flush;
+  std::cout << "Loading images..." << std::flush;
 
-  for (const auto& image : images_) {
-    correspondence_graph_.AddImage(image.first, image.second.NumPoints2D());
+  // Load images with correspondences and discard images without
+  // correspondences, as those images are useless for SfM.
+  images_.reserve(connected_image_ids.size());
+  for (const auto& image : images) {
+    if (image_ids.count(image.ImageId()) > 0 &&
+        connected_image_ids.count(image.ImageId()) > 0) {
+      images_.emplace(image.ImageId(), image);
+    }
   }
 
-  size_t num_ignored_image_pairs = 0;
-  for (size_t i = 0; i < image_pair_ids.size(); ++i) {
-    if (UseInlierMatchesCheck(two_view_geometries[i])) {
-      image_t image_id1;
-      image_t image_id2;
-      Database::PairIdToImagePair(image_pair_ids[i], &image_id1, &image_id2);
-      if (image_ids.count(image_id1) > 0 && image_ids.count(image_id2) > 0) {
-        correspondence_graph_.AddCorrespondences(
-            image_id1, image_id2, two_view_geometries[i].inlier_matches);
-      } else {
-        num_ignored_image_pairs += 1;
+  auto LoadPoints2D = [&](class Image* image) {
+    const Database& connection = GetConnection();
+    std::vector<Eigen::Vector2d> points;
+    if (feature_store != nullptr &&
+        feature_store->IsUpToDate(connection, image->ImageId())) {
+      const FeatureStore::KeypointsMap keypoints =
+          feature_store->Keypoints(image->ImageId());
+      points.resize(keypoints.num_keypoints);
+      for (size_t i = 0; i < keypoints.num_keypoints; ++i) {
+        points[i] = Eigen::Vector2d(keypoints.x[i], keypoints.y[i]);
       }
     } else {
-      num_ignored_image_pairs += 1;
+      const FeatureKeypoints keypoints =
+          connection.ReadKeypoints(image->ImageId());
+      points = FeatureKeypointsToPointsVector(keypoints);
     }
-  }
+    image->SetPoints2D(points);
+  };
 
-  correspondence_graph_.Finalize();
+  // The images are not inserted or removed anymore, so that each worker can
+  // safely set the points of a different image.
+  for (auto& image : images_) {
+    if (thread_pool) {
+      thread_pool->AddTask(LoadPoints2D, &image.second);
+    } else {
+      LoadPoints2D(&image.second);
+    }
+  }
+  if (thread_pool) {
+    thread_pool->Wait();
+  }
 
   // Set number of observations and correspondences per image.
   for (auto& image : images_) {
@@ -198,8 +297,9 @@ void DatabaseCache::Load(const Database& database, const size_t min_num_matches,
         correspondence_graph_.NumCorrespondencesForImage(image.first));
   }
 
-  std::cout << StringPrintf(" in %.3fs (ignored %d)", timer.ElapsedSeconds(),
-                            num_ignored_image_pairs)
+  std::cout << StringPrintf(" %d in %.3fs (connected %d)", images.size(),
+                            timer.ElapsedSeconds(),
+                            connected_image_ids.size())
             << std::endl;
 }
 
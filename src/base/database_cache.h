@@ -43,6 +43,7 @@
 #include "base/camera_models.h"
 #include "base/correspondence_graph.h"
 #include "base/database.h"
+#include "base/feature_store.h"
 #include "base/image.h"
 #include "util/alignment.h"
 #include "util/types.h"
@@ -88,9 +89,20 @@ class DatabaseCache {
   // @param ignore_watermarks     Whether to ignore watermark image pairs.
   // @param image_names           Whether to use only load the data for a subset
   //                              of the images. All images are used if empty.
+  // @param feature_store         Optional memory-mapped feature store from
+  //                              which keypoints are read instead of the
+  //                              database. Images that are missing or stale
+  //                              in the store are read from the database.
+  // @param num_threads           Number of threads reading the matches and
+  //                              features over separate read-only database
+  //                              connections, while the correspondence graph
+  //                              is built from the matches read so far.
+  //                              In-memory databases are read serially.
   void Load(const Database& database, const size_t min_num_matches,
             const bool ignore_watermarks,
-            const std::unordered_set<std::string>& image_names);
+            const std::unordered_set<std::string>& image_names,
+            const FeatureStore* feature_store = nullptr,
+            const int num_threads = -1);
 
   // Find specific image by name. Note that this uses linear search.
   const class Image* FindImageWithName(const std::string& name) const;
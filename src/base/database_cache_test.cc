@@ -32,6 +32,8 @@
 #define TEST_NAME "base/database_cache"
 #include "util/testing.h"
 
+#include <boost/filesystem.hpp>
+
 #include "base/database_cache.h"
 
 using namespace colmap;
@@ -84,3 +86,84 @@ BOOST_AUTO_TEST_CASE(TestAddImage) {
   BOOST_CHECK_EQUAL(
       cache.CorrespondenceGraph().NumObservationsForImage(image.ImageId()), 0);
 }
+
+BOOST_AUTO_TEST_CASE(TestLoadParallel) {
+  const std::string database_path =
+      (boost::filesystem::temp_directory_path() /
+       boost::filesystem::unique_path("colmap-database-%%%%%%%%.db"))
+          .string();
+
+  const size_t kNumImages = 20;
+  const size_t kNumPoints2D = 50;
+
+  {
+    Database database(database_path);
+    Camera camera;
+    camera.InitializeWithId(SimplePinholeCameraModel::model_id, 1, 1, 1);
+    const camera_t camera_id = database.WriteCamera(camera);
+    std::vector<image_t> image_ids;
+    for (size_t i = 0; i < kNumImages; ++i) {
+      Image image;
+      image.SetName(std::to_string(i));
+      image.SetCameraId(camera_id);
+      image_ids.push_back(database.WriteImage(image));
+      database.WriteKeypoints(image_ids.back(),
+                              FeatureKeypoints(kNumPoints2D));
+    }
+    // The last image has no matches and is not loaded.
+    for (size_t i = 0; i + 1 < kNumImages; ++i) {
+      for (size_t j = i + 1; j + 1 < kNumImages; ++j) {
+        TwoViewGeometry two_view_geometry;
+        two_view_geometry.config = TwoViewGeometry::CALIBRATED;
+        for (size_t k = 0; k < (i + j) % kNumPoints2D; ++k) {
+          two_view_geometry.inlier_matches.emplace_back(k, (k + i) %
+                                                               kNumPoints2D);
+        }
+        database.WriteTwoViewGeometry(image_ids[i], image_ids[j],
+                                      two_view_geometry);
+      }
+    }
+  }
+
+  Database database(database_path);
+  DatabaseCache serial_cache;
+  serial_cache.Load(database, 5, false, {}, nullptr, 1);
+  DatabaseCache parallel_cache;
+  parallel_cache.Load(database, 5, false, {}, nullptr, 4);
+
+  BOOST_CHECK_EQUAL(serial_cache.NumCameras(), 1);
+  BOOST_CHECK_EQUAL(serial_cache.NumImages(), kNumImages - 1);
+  BOOST_CHECK_EQUAL(parallel_cache.NumImages(), serial_cache.NumImages());
+  BOOST_CHECK_EQUAL(parallel_cache.CorrespondenceGraph().NumImagePairs(),
+                    serial_cache.CorrespondenceGraph().NumImagePairs());
+  for (const auto& image : serial_cache.Images()) {
+    const image_t image_id = image.first;
+    BOOST_CHECK(parallel_cache.ExistsImage(image_id));
+    BOOST_CHECK_EQUAL(parallel_cache.Image(image_id).NumPoints2D(),
+                      kNumPoints2D);
+    BOOST_CHECK_EQUAL(parallel_cache.Image(image_id).NumObservations(),
+                      image.second.NumObservations());
+    BOOST_CHECK_EQUAL(parallel_cache.Image(image_id).NumCorrespondences(),
+                      image.second.NumCorrespondences());
+    for (point2D_t point2D_idx = 0; point2D_idx < kNumPoints2D;
+         ++point2D_idx) {
+      const auto& serial_corrs =
+          serial_cache.CorrespondenceGraph().FindCorrespondences(image_id,
+                                                                 point2D_idx);
+      const auto& parallel_corrs =
+          parallel_cache.CorrespondenceGraph().FindCorrespondences(
+              image_id, point2D_idx);
+      BOOST_REQUIRE_EQUAL(serial_corrs.size(), parallel_corrs.size());
+      for (size_t i = 0; i < serial_corrs.size(); ++i) {
+        BOOST_CHECK_EQUAL(serial_corrs[i].image_id, parallel_corrs[i].image_id);
+        BOOST_CHECK_EQUAL(serial_corrs[i].point2D_idx,
+                          parallel_corrs[i].point2D_idx);
+      }
+    }
+  }
+
+  database.Close();
+  boost::filesystem::remove(database_path);
+  boost::filesystem::remove(database_path + "-wal");
+  boost::filesystem::remove(database_path + "-shm");
+}
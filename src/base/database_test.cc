@@ -292,6 +292,29 @@ BOOST_AUTO_TEST_CASE(TestDescriptors) {
   BOOST_CHECK_EQUAL(database.NumDescriptorsForImage(image.ImageId()), 0);
 }
 
+BOOST_AUTO_TEST_CASE(TestFeaturesStamp) {
+  Database database(kMemoryDatabasePath);
+  Camera camera;
+  camera.SetCameraId(database.WriteCamera(camera));
+  Image image;
+  image.SetName("test");
+  image.SetCameraId(camera.CameraId());
+  image.SetImageId(database.WriteImage(image));
+  BOOST_CHECK_EQUAL(database.ReadFeaturesStamp(image.ImageId()), 0);
+  database.WriteKeypoints(image.ImageId(), FeatureKeypoints(10));
+  const uint64_t stamp1 = database.ReadFeaturesStamp(image.ImageId());
+  BOOST_CHECK_NE(stamp1, 0);
+  BOOST_CHECK_EQUAL(database.ReadFeaturesStamp(image.ImageId()), stamp1);
+  database.WriteDescriptors(image.ImageId(), FeatureDescriptors(10, 128));
+  const uint64_t stamp2 = database.ReadFeaturesStamp(image.ImageId());
+  BOOST_CHECK_NE(stamp2, stamp1);
+  database.ClearKeypoints();
+  database.WriteKeypoints(image.ImageId(), FeatureKeypoints(10));
+  BOOST_CHECK_NE(database.ReadFeaturesStamp(image.ImageId()), stamp2);
+  database.ClearImages();
+  BOOST_CHECK_EQUAL(database.ReadFeaturesStamp(image.ImageId()), 0);
+}
+
 BOOST_AUTO_TEST_CASE(TestMatches) {
   Database database(kMemoryDatabasePath);
   const image_t image_id1 = 1;
@@ -408,6 +431,76 @@ BOOST_AUTO_TEST_CASE(TestTwoViewGeometry) {
   BOOST_CHECK_EQUAL(database.NumInlierMatches(), 0);
 }
 
+BOOST_AUTO_TEST_CASE(TestWriteBatch) {
+  Database database(kMemoryDatabasePath);
+  std::vector<std::pair<image_t, image_t>> image_pairs;
+  std::vector<FeatureMatches> matches;
+  std::vector<TwoViewGeometry> two_view_geometries;
+  for (image_t image_id = 1; image_id <= 75; ++image_id) {
+    // Write every other pair in swapped order.
+    if (image_id % 2 == 0) {
+      image_pairs.emplace_back(image_id, 100);
+    } else {
+      image_pairs.emplace_back(100, image_id);
+    }
+    FeatureMatches image_matches(image_id);
+    for (point2D_t i = 0; i < image_id; ++i) {
+      image_matches[i].point2D_idx1 = i;
+      image_matches[i].point2D_idx2 = 2 * i;
+    }
+    matches.push_back(image_matches);
+    TwoViewGeometry two_view_geometry;
+    two_view_geometry.config = TwoViewGeometry::ConfigurationType::CALIBRATED;
+    two_view_geometry.inlier_matches = image_matches;
+    two_view_geometry.F = Eigen::Matrix3d::Random();
+    two_view_geometry.E = Eigen::Matrix3d::Random();
+    // Leave the inlier matches of some pairs empty.
+    if (image_id % 5 == 0) {
+      two_view_geometry.inlier_matches.clear();
+    }
+    two_view_geometries.push_back(two_view_geometry);
+  }
+
+  database.WriteMatches(image_pairs, matches);
+  database.WriteTwoViewGeometries(image_pairs, two_view_geometries);
+  BOOST_CHECK_EQUAL(database.NumMatchedImagePairs(), 75);
+  BOOST_CHECK_EQUAL(database.ReadAllMatches().size(), 75);
+
+  size_t num_inlier_matches = 0;
+  for (size_t i = 0; i < image_pairs.size(); ++i) {
+    const auto& image_pair = image_pairs[i];
+    const FeatureMatches matches_read =
+        database.ReadMatches(image_pair.first, image_pair.second);
+    BOOST_REQUIRE_EQUAL(matches_read.size(), matches[i].size());
+    for (size_t j = 0; j < matches_read.size(); ++j) {
+      BOOST_CHECK_EQUAL(matches_read[j].point2D_idx1,
+                        matches[i][j].point2D_idx1);
+      BOOST_CHECK_EQUAL(matches_read[j].point2D_idx2,
+                        matches[i][j].point2D_idx2);
+    }
+
+    const TwoViewGeometry two_view_geometry_read =
+        database.ReadTwoViewGeometry(image_pair.first, image_pair.second);
+    BOOST_CHECK_EQUAL(two_view_geometry_read.config,
+                      two_view_geometries[i].config);
+    BOOST_REQUIRE_EQUAL(two_view_geometry_read.inlier_matches.size(),
+                        two_view_geometries[i].inlier_matches.size());
+    if (two_view_geometries[i].inlier_matches.empty()) {
+      continue;
+    }
+    num_inlier_matches += two_view_geometry_read.inlier_matches.size();
+    BOOST_CHECK_EQUAL(two_view_geometry_read.F, two_view_geometries[i].F);
+    BOOST_CHECK_EQUAL(two_view_geometry_read.E, two_view_geometries[i].E);
+    for (size_t j = 0; j < matches[i].size(); ++j) {
+      BOOST_CHECK_EQUAL(two_view_geometry_read.inlier_matches[j].point2D_idx1,
+                        matches[i][j].point2D_idx1);
+      BOOST_CHECK_EQUAL(two_view_geometry_read.inlier_matches[j].point2D_idx2,
+                        matches[i][j].point2D_idx2);
+    }
+  }
+  BOOST_CHECK_EQUAL(database.NumInlierMatches(), num_inlier_matches);
+}
+
 BOOST_AUTO_TEST_CASE(TestMerge) {
   Database database1(kMemoryDatabasePath);
   Database database2(kMemoryDatabasePath);
@@ -0,0 +1,276 @@
+// Copyright (c) 2022, ETH Zurich and UNC Chapel Hill.
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//
+//     * Neither the name of ETH Zurich and UNC Chapel Hill nor the names of
+//       its contributors may be used to endorse or promote products derived
+//       from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDERS OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//
+// Author: Johannes L. Schoenberger (jsch-at-demuc-dot-de)
+
+#include "base/feature_store.h"
+
+#include <cstring>
+#include <fstream>
+
+#include "util/endian.h"
+#include "util/logging.h"
+#include "util/misc.h"
+
+namespace colmap {
+namespace {
+
+const char kFeatureStoreMagic[8] = {'C', 'O', 'L', 'M', 'A', 'P', 'F', 'S'};
+const uint32_t kFeatureStoreVersion = 2;
+const size_t kHeaderSize = 8 + 4 + 4 + 8;
+const size_t kIndexEntrySize = 4 * 4 + 3 * 8;
+
+size_t AlignOffset(const size_t offset) {
+  const size_t alignment = FeatureStore::kAlignment;
+  return (offset + alignment - 1) / alignment * alignment;
+}
+
+void WritePadding(std::ofstream* file) {
+  const size_t offset = static_cast<size_t>(file->tellp());
+  const size_t padding = AlignOffset(offset) - offset;
+  const char zeros[FeatureStore::kAlignment] = {};
+  file->write(zeros, padding);
+}
+
+template <typename T>
+T ReadValue(const char* data) {
+  T value;
+  std::memcpy(&value, data, sizeof(T));
+  return LittleEndianToNative(value);
+}
+
+}  // namespace
+
+FeatureKeypoints FeatureStore::KeypointsMap::ToFeatureKeypoints() const {
+  FeatureKeypoints keypoints(num_keypoints);
+  for (size_t i = 0; i < num_keypoints; ++i) {
+    keypoints[i].x = x[i];
+    keypoints[i].y = y[i];
+    keypoints[i].a11 = a11[i];
+    keypoints[i].a12 = a12[i];
+    keypoints[i].a21 = a21[i];
+    keypoints[i].a22 = a22[i];
+  }
+  return keypoints;
+}
+
+FeatureStore::FeatureStore() {}
+
+FeatureStore::~FeatureStore() { Close(); }
+
+std::string FeatureStore::DefaultPath(const std::string& database_path) {
+  return database_path + ".features";
+}
+
+void FeatureStore::Write(const Database& database, const std::string& path) {
+  // The arrays are mapped as-is, so the store is only written in the byte
+  // order in which it is read.
+  CHECK(IsLittleEndian()) << "Feature store requires a little-endian platform";
+
+  std::ofstream file(path, std::ios::binary | std::ios::trunc);
+  CHECK(file.is_open()) << path;
+
+  const std::vector<Image> images = database.ReadAllImages();
+
+  // The index offset is patched once all images are written.
+  file.write(kFeatureStoreMagic, sizeof(kFeatureStoreMagic));
+  WriteBinaryLittleEndian<uint32_t>(&file, kFeatureStoreVersion);
+  WriteBinaryLittleEndian<uint32_t>(&file,
+                                    static_cast<uint32_t>(images.size()));
+  WriteBinaryLittleEndian<uint64_t>(&file, 0);
+
+  std::vector<std::pair<image_t, IndexEntry>> entries;
+  entries.reserve(images.size());
+
+  std::vector<float> values;
+  for (const auto& image : images) {
+    const FeatureKeypoints keypoints = database.ReadKeypoints(image.ImageId());
+    const FeatureDescriptors descriptors =
+        database.ReadDescriptors(image.ImageId());
+
+    IndexEntry entry;
+    entry.num_keypoints = static_cast<uint32_t>(keypoints.size());
+    entry.num_descriptors = static_cast<uint32_t>(descriptors.rows());
+    entry.descriptor_dim = static_cast<uint32_t>(descriptors.cols());
+    entry.features_stamp = database.ReadFeaturesStamp(image.ImageId());
+
+    WritePadding(&file);
+    entry.keypoints_offset = static_cast<uint64_t>(file.tellp());
+    values.resize(keypoints.size());
+    for (const auto member : {&FeatureKeypoint::x, &FeatureKeypoint::y,
+                              &FeatureKeypoint::a11, &FeatureKeypoint::a12,
+                              &FeatureKeypoint::a21, &FeatureKeypoint::a22}) {
+      for (size_t i = 0; i < keypoints.size(); ++i) {
+        values[i] = keypoints[i].*member;
+      }
+      file.write(reinterpret_cast<const char*>(values.data()),
+                 values.size() * sizeof(float));
+      WritePadding(&file);
+    }
+
+    entry.descriptors_offset = static_cast<uint64_t>(file.tellp());
+    file.write(reinterpret_cast<const char*>(descriptors.data()),
+               descriptors.size());
+
+    entries.emplace_back(image.ImageId(), entry);
+  }
+
+  WritePadding(&file);
+  const uint64_t index_offset = static_cast<uint64_t>(file.tellp());
+  for (const auto& entry : entries) {
+    WriteBinaryLittleEndian<uint32_t>(&file, entry.first);
+    WriteBinaryLittleEndian<uint32_t>(&file, entry.second.num_keypoints);
+    WriteBinaryLittleEndian<uint32_t>(&file, entry.second.num_descriptors);
+    WriteBinaryLittleEndian<uint32_t>(&file, entry.second.descriptor_dim);
+    WriteBinaryLittleEndian<uint64_t>(&file, entry.second.features_stamp);
+    WriteBinaryLittleEndian<uint64_t>(&file, entry.second.keypoints_offset);
+    WriteBinaryLittleEndian<uint64_t>(&file, entry.second.descriptors_offset);
+  }
+
+  file.seekp(sizeof(kFeatureStoreMagic) + 2 * sizeof(uint32_t));
+  WriteBinaryLittleEndian<uint64_t>(&file, index_offset);
+}
+
+bool FeatureStore::Open(const std::string& path) {
+  Close();
+
+  if (!IsLittleEndian() || !ExistsFile(path) || !file_.Open(path)) {
+    return false;
+  }
+
+  const char* data = file_.Data();
+  const size_t size = file_.Size();
+
+  if (size < kHeaderSize ||
+      std::memcmp(data, kFeatureStoreMagic, sizeof(kFeatureStoreMagic)) !=
+          0 ||
+      ReadValue<uint32_t>(data + 8) != kFeatureStoreVersion) {
+    Close();
+    return false;
+  }
+
+  const uint32_t num_images = ReadValue<uint32_t>(data + 12);
+  const uint64_t index_offset = ReadValue<uint64_t>(data + 16);
+  if (index_offset > size ||
+      num_images > (size - index_offset) / kIndexEntrySize) {
+    Close();
+    return false;
+  }
+
+  index_.reserve(num_images);
+  for (uint32_t i = 0; i < num_images; ++i) {
+    const char* entry_data = data + index_offset + i * kIndexEntrySize;
+    const image_t image_id = ReadValue<uint32_t>(entry_data);
+    IndexEntry entry;
+    entry.num_keypoints = ReadValue<uint32_t>(entry_data + 4);
+    entry.num_descriptors = ReadValue<uint32_t>(entry_data + 8);
+    entry.descriptor_dim = ReadValue<uint32_t>(entry_data + 12);
+    entry.features_stamp = ReadValue<uint64_t>(entry_data + 16);
+    entry.keypoints_offset = ReadValue<uint64_t>(entry_data + 24);
+    entry.descriptors_offset = ReadValue<uint64_t>(entry_data + 32);
+    const uint64_t keypoints_end =
+        entry.keypoints_offset +
+        6 * AlignOffset(entry.num_keypoints * sizeof(float));
+    const uint64_t descriptors_end =
+        entry.descriptors_offset +
+        static_cast<uint64_t>(entry.num_descriptors) * entry.descriptor_dim;
+    if (keypoints_end > size || descriptors_end > size) {
+      Close();
+      return false;
+    }
+    index_.emplace(image_id, entry);
+  }
+
+  return true;
+}
+
+void FeatureStore::Close() {
+  file_.Close();
+  index_.clear();
+}
+
+bool FeatureStore::IsOpen() const { return file_.IsOpen(); }
+
+size_t FeatureStore::NumImages() const { return index_.size(); }
+
+bool FeatureStore::ExistsImage(const image_t image_id) const {
+  return index_.count(image_id) > 0;
+}
+
+bool FeatureStore::IsUpToDate(const Database& database,
+                              const image_t image_id) const {
+  const auto it = index_.find(image_id);
+  return it != index_.end() &&
+         it->second.features_stamp == database.ReadFeaturesStamp(image_id) &&
+         it->second.num_keypoints == database.NumKeypointsForImage(image_id) &&
+         it->second.num_descriptors ==
+             database.NumDescriptorsForImage(image_id);
+}
+
+size_t FeatureStore::NumKeypoints(const image_t image_id) const {
+  return Entry(image_id).num_keypoints;
+}
+
+size_t FeatureStore::NumDescriptors(const image_t image_id) const {
+  return Entry(image_id).num_descriptors;
+}
+
+FeatureStore::KeypointsMap FeatureStore::Keypoints(
+    const image_t image_id) const {
+  const IndexEntry& entry = Entry(image_id);
+  const size_t stride = AlignOffset(entry.num_keypoints * sizeof(float));
+  const char* base = file_.Data() + entry.keypoints_offset;
+  KeypointsMap keypoints;
+  keypoints.num_keypoints = entry.num_keypoints;
+  keypoints.x = reinterpret_cast<const float*>(base);
+  keypoints.y = reinterpret_cast<const float*>(base + stride);
+  keypoints.a11 = reinterpret_cast<const float*>(base + 2 * stride);
+  keypoints.a12 = reinterpret_cast<const float*>(base + 3 * stride);
+  keypoints.a21 = reinterpret_cast<const float*>(base + 4 * stride);
+  keypoints.a22 = reinterpret_cast<const float*>(base + 5 * stride);
+  return keypoints;
+}
+
+FeatureStore::DescriptorsMap FeatureStore::Descriptors(
+    const image_t image_id) const {
+  const IndexEntry& entry = Entry(image_id);
+  return DescriptorsMap(
+      reinterpret_cast<const uint8_t*>(file_.Data() + entry.descriptors_offset),
+      entry.num_descriptors, entry.descriptor_dim);
+}
+
+const FeatureStore::IndexEntry& FeatureStore::Entry(
+    const image_t image_id) const {
+  CHECK(IsOpen());
+  const auto it = index_.find(image_id);
+  CHECK(it != index_.end()) << "Image " << image_id << " not in feature store";
+  return it->second;
+}
+
+}  // namespace colmap
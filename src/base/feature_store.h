@@ -0,0 +1,140 @@
+// Copyright (c) 2022, ETH Zurich and UNC Chapel Hill.
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//
+//     * Neither the name of ETH Zurich and UNC Chapel Hill nor the names of
+//       its contributors may be used to endorse or promote products derived
+//       from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDERS OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//
+// Author: Johannes L. Schoenberger (jsch-at-demuc-dot-de)
+
+#ifndef COLMAP_SRC_BASE_FEATURE_STORE_H_
+#define COLMAP_SRC_BASE_FEATURE_STORE_H_
+
+#include <string>
+#include <unordered_map>
+
+#include <Eigen/Core>
+
+#include "base/database.h"
+#include "feature/types.h"
+#include "util/mapped_file.h"
+#include "util/types.h"
+
+namespace colmap {
+
+// Read-only store of the keypoints and descriptors of all images in a single
+// packed file, which is memory-mapped so that the features can be accessed
+// without copying them out of the SQLite database. The store is an optional
+// companion of the database and is created with `Write` from its contents.
+// It is a snapshot that is not updated when the features in the database
+// change, so consumers only open it when explicitly requested and check
+// with `IsUpToDate` that the features of an image were not rewritten since.
+//
+// File layout, where all integers are little-endian and every array starts at
+// a multiple of `kAlignment` bytes:
+//
+//    Header:  char[8] magic, uint32 version, uint32 num_images,
+//             uint64 index_offset
+//    Images:  float x[N], y[N], a11[N], a12[N], a21[N], a22[N],
+//             uint8 descriptors[M][D] (row-major)
+//    Index:   num_images times uint32 image_id, uint32 N, uint32 M, uint32 D,
+//             uint64 features_stamp, uint64 keypoints_offset,
+//             uint64 descriptors_offset
+//
+// Keypoints are stored as structure-of-arrays, so that consumers that only
+// need the keypoint locations do not touch the affine shape parameters.
+class FeatureStore {
+ public:
+  static const size_t kAlignment = 64;
+
+  typedef Eigen::Map<const FeatureDescriptors> DescriptorsMap;
+
+  // Keypoints of one image, pointing into the mapped file.
+  struct KeypointsMap {
+    size_t num_keypoints = 0;
+    const float* x = nullptr;
+    const float* y = nullptr;
+    const float* a11 = nullptr;
+    const float* a12 = nullptr;
+    const float* a21 = nullptr;
+    const float* a22 = nullptr;
+
+    FeatureKeypoints ToFeatureKeypoints() const;
+  };
+
+  FeatureStore();
+  ~FeatureStore();
+  FeatureStore(const FeatureStore&) = delete;
+  FeatureStore& operator=(const FeatureStore&) = delete;
+
+  // Default location of the store for the given database file.
+  static std::string DefaultPath(const std::string& database_path);
+
+  // Write the features of all images in the database to a new store.
+  static void Write(const Database& database, const std::string& path);
+
+  // Map an existing store into memory. Returns false if the file does not
+  // exist, is not a valid store, or the platform is big-endian.
+  bool Open(const std::string& path);
+  void Close();
+  bool IsOpen() const;
+
+  size_t NumImages() const;
+  bool ExistsImage(const image_t image_id) const;
+
+  // Whether the features of an image in the store equal those in the
+  // database, i.e. the image exists in both, its features stamp in the
+  // database did not change since the store was written, and the numbers of
+  // keypoints and descriptors agree. The latter also catches features that
+  // were rewritten by external tools, which do not update the stamp.
+  bool IsUpToDate(const Database& database, const image_t image_id) const;
+
+  // Number of keypoints and descriptors of an image.
+  size_t NumKeypoints(const image_t image_id) const;
+  size_t NumDescriptors(const image_t image_id) const;
+
+  // Zero-copy access to the features of an image, valid until `Close`.
+  KeypointsMap Keypoints(const image_t image_id) const;
+  DescriptorsMap Descriptors(const image_t image_id) const;
+
+ private:
+  struct IndexEntry {
+    uint32_t num_keypoints = 0;
+    uint32_t num_descriptors = 0;
+    uint32_t descriptor_dim = 0;
+    uint64_t features_stamp = 0;
+    uint64_t keypoints_offset = 0;
+    uint64_t descriptors_offset = 0;
+  };
+
+  const IndexEntry& Entry(const image_t image_id) const;
+
+  MappedFile file_;
+  std::unordered_map<image_t, IndexEntry> index_;
+};
+
+}  // namespace colmap
+
+#endif  // COLMAP_SRC_BASE_FEATURE_STORE_H_
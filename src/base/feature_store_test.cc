@@ -0,0 +1,139 @@
+// Copyright (c) 2022, ETH Zurich and UNC Chapel Hill.
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//
+//     * Neither the name of ETH Zurich and UNC Chapel Hill nor the names of
+//       its contributors may be used to endorse or promote products derived
+//       from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDERS OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//
+// Author: Johannes L. Schoenberger (jsch-at-demuc-dot-de)
+
+#define TEST_NAME "base/feature_store"
+#include "util/testing.h"
+
+#include <boost/filesystem.hpp>
+
+#include "base/feature_store.h"
+
+using namespace colmap;
+
+namespace {
+
+std::string TempPath() {
+  return (boost::filesystem::temp_directory_path() /
+          boost::filesystem::unique_path("colmap-features-%%%%%%%%"))
+      .string();
+}
+
+}  // namespace
+
+BOOST_AUTO_TEST_CASE(TestEmpty) {
+  FeatureStore store;
+  BOOST_CHECK(!store.IsOpen());
+  BOOST_CHECK_EQUAL(store.NumImages(), 0);
+  BOOST_CHECK(!store.Open(TempPath()));
+  BOOST_CHECK(!store.IsOpen());
+}
+
+BOOST_AUTO_TEST_CASE(TestDefaultPath) {
+  BOOST_CHECK_EQUAL(FeatureStore::DefaultPath("/tmp/database.db"),
+                    "/tmp/database.db.features");
+}
+
+BOOST_AUTO_TEST_CASE(TestWriteOpen) {
+  Database database(":memory:");
+  const camera_t camera_id = database.WriteCamera(Camera());
+
+  Image image1;
+  image1.SetName("image1");
+  image1.SetCameraId(camera_id);
+  const image_t image_id1 = database.WriteImage(image1);
+  Image image2;
+  image2.SetName("image2");
+  image2.SetCameraId(camera_id);
+  const image_t image_id2 = database.WriteImage(image2);
+
+  FeatureKeypoints keypoints(37);
+  for (size_t i = 0; i < keypoints.size(); ++i) {
+    keypoints[i] = FeatureKeypoint(i, 2 * i, 1, 2, 3, 4);
+  }
+  FeatureDescriptors descriptors = FeatureDescriptors::Random(37, 128);
+  database.WriteKeypoints(image_id1, keypoints);
+  database.WriteDescriptors(image_id1, descriptors);
+
+  const std::string path = TempPath();
+  FeatureStore::Write(database, path);
+
+  FeatureStore store;
+  BOOST_CHECK(store.Open(path));
+  BOOST_CHECK(store.IsOpen());
+  BOOST_CHECK_EQUAL(store.NumImages(), 2);
+  BOOST_CHECK(store.ExistsImage(image_id1));
+  BOOST_CHECK(store.ExistsImage(image_id2));
+  BOOST_CHECK(!store.ExistsImage(image_id2 + 1));
+  BOOST_CHECK_EQUAL(store.NumKeypoints(image_id1), 37);
+  BOOST_CHECK_EQUAL(store.NumDescriptors(image_id1), 37);
+  BOOST_CHECK_EQUAL(store.NumKeypoints(image_id2), 0);
+  BOOST_CHECK_EQUAL(store.NumDescriptors(image_id2), 0);
+
+  const FeatureStore::KeypointsMap keypoints_map = store.Keypoints(image_id1);
+  BOOST_CHECK_EQUAL(keypoints_map.num_keypoints, 37);
+  for (const float* array :
+       {keypoints_map.x, keypoints_map.y, keypoints_map.a11, keypoints_map.a12,
+        keypoints_map.a21, keypoints_map.a22}) {
+    BOOST_CHECK_EQUAL(
+        reinterpret_cast<uintptr_t>(array) % FeatureStore::kAlignment, 0);
+  }
+  const FeatureKeypoints read_keypoints = keypoints_map.ToFeatureKeypoints();
+  for (size_t i = 0; i < keypoints.size(); ++i) {
+    BOOST_CHECK_EQUAL(keypoints_map.x[i], keypoints[i].x);
+    BOOST_CHECK_EQUAL(keypoints_map.y[i], keypoints[i].y);
+    BOOST_CHECK_EQUAL(read_keypoints[i].a11, keypoints[i].a11);
+    BOOST_CHECK_EQUAL(read_keypoints[i].a12, keypoints[i].a12);
+    BOOST_CHECK_EQUAL(read_keypoints[i].a21, keypoints[i].a21);
+    BOOST_CHECK_EQUAL(read_keypoints[i].a22, keypoints[i].a22);
+  }
+
+  const FeatureStore::DescriptorsMap descriptors_map =
+      store.Descriptors(image_id1);
+  BOOST_CHECK_EQUAL(descriptors_map.rows(), 37);
+  BOOST_CHECK_EQUAL(descriptors_map.cols(), 128);
+  BOOST_CHECK(descriptors_map == descriptors);
+  BOOST_CHECK_EQUAL(store.Descriptors(image_id2).size(), 0);
+
+  BOOST_CHECK(store.IsUpToDate(database, image_id1));
+  BOOST_CHECK(store.IsUpToDate(database, image_id2));
+  BOOST_CHECK(!store.IsUpToDate(database, image_id2 + 1));
+
+  // Features that are rewritten with the same counts are detected as stale.
+  database.ClearDescriptors();
+  database.WriteDescriptors(image_id1, FeatureDescriptors::Random(37, 128));
+  BOOST_CHECK(!store.IsUpToDate(database, image_id1));
+  BOOST_CHECK(store.IsUpToDate(database, image_id2));
+
+  store.Close();
+  BOOST_CHECK(!store.IsOpen());
+  BOOST_CHECK_EQUAL(store.NumImages(), 0);
+  boost::filesystem::remove(path);
+}
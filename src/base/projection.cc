@@ -31,7 +31,11 @@
 
 #include "base/projection.h"
 
+#include <algorithm>
+
+#include "base/camera_models.h"
 #include "base/pose.h"
+#include "util/logging.h"
 #include "util/matrix.h"
 
 namespace colmap {
@@ -148,6 +152,53 @@ double CalculateSquaredReprojectionError(const Eigen::Vector2d& point2D,
   return (proj_point2D - point2D).squaredNorm();
 }
 
+void CalculateSquaredReprojectionErrors(
+    const std::vector<Eigen::Vector2d>& points2D,
+    const std::vector<Eigen::Vector3d>& points3D,
+    const Eigen::Matrix3x4d& proj_matrix, const Camera& camera,
+    std::vector<double>* squared_reproj_errors) {
+  CHECK_EQ(points2D.size(), points3D.size());
+  squared_reproj_errors->resize(points2D.size());
+
+  // Process the points in fixed size chunks, so that the intermediate
+  // coordinate arrays stay in the L1 cache.
+  const size_t kChunkSize = 256;
+  double u[kChunkSize];
+  double v[kChunkSize];
+  double x[kChunkSize];
+  double y[kChunkSize];
+  bool behind[kChunkSize];
+
+  for (size_t begin = 0; begin < points3D.size(); begin += kChunkSize) {
+    const size_t num_points = std::min(kChunkSize, points3D.size() - begin);
+
+    for (size_t i = 0; i < num_points; ++i) {
+      const Eigen::Vector4d point3D = points3D[begin + i].homogeneous();
+      const double proj_z = proj_matrix.row(2).dot(point3D);
+      // Check that point is infront of camera. Points behind the camera are
+      // still projected to keep the batch dense, but their result is ignored.
+      behind[i] = proj_z < std::numeric_limits<double>::epsilon();
+      const double inv_proj_z = behind[i] ? 0.0 : 1.0 / proj_z;
+      u[i] = inv_proj_z * proj_matrix.row(0).dot(point3D);
+      v[i] = inv_proj_z * proj_matrix.row(1).dot(point3D);
+    }
+
+    CameraModelWorldToImageBatch(camera.ModelId(), camera.Params(), num_points,
+                                 u, v, x, y);
+
+    for (size_t i = 0; i < num_points; ++i) {
+      if (behind[i]) {
+        (*squared_reproj_errors)[begin + i] =
+            std::numeric_limits<double>::max();
+      } else {
+        const double dx = x[i] - points2D[begin + i].x();
+        const double dy = y[i] - points2D[begin + i].y();
+        (*squared_reproj_errors)[begin + i] = dx * dx + dy * dy;
+      }
+    }
+  }
+}
+
 double CalculateAngularError(const Eigen::Vector2d& point2D,
                              const Eigen::Vector3d& point3D,
                              const Eigen::Vector4d& qvec,
@@ -114,6 +114,16 @@ double CalculateSquaredReprojectionError(const Eigen::Vector2d& point2D,
                                          const Eigen::Matrix3x4d& proj_matrix,
                                          const Camera& camera);
 
+// Calculate the squared reprojection errors of multiple observations in the
+// same image. The result is identical to calling the single point version
+// above for each observation, but the points are projected in batches using
+// `CameraModelWorldToImageBatch`, which is considerably faster.
+void CalculateSquaredReprojectionErrors(
+    const std::vector<Eigen::Vector2d>& points2D,
+    const std::vector<Eigen::Vector3d>& points3D,
+    const Eigen::Matrix3x4d& proj_matrix, const Camera& camera,
+    std::vector<double>* squared_reproj_errors);
+
 // Calculate the angular error.
 //
 // The angular error is the angle between the observed viewing ray and the
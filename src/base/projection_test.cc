@@ -123,6 +123,47 @@ BOOST_AUTO_TEST_CASE(TestCalculateSquaredReprojectionError) {
   BOOST_CHECK_CLOSE(error4, 2, 1e-6);
 }
 
+BOOST_AUTO_TEST_CASE(TestCalculateSquaredReprojectionErrors) {
+  const Eigen::Matrix3d R = EulerAnglesToRotationMatrix(0.1, 0.2, 0.3);
+  const Eigen::Vector3d tvec(0.1, 0.2, 3);
+  const auto proj_matrix = ComposeProjectionMatrix(R, tvec);
+
+  Camera camera;
+  camera.InitializeWithId(SimpleRadialCameraModel::model_id, 100, 50, 50);
+  camera.Params(3) = 0.1;
+
+  // More points than fit into a single batch, with some behind the camera.
+  std::vector<Eigen::Vector2d> points2D;
+  std::vector<Eigen::Vector3d> points3D;
+  for (int i = 0; i < 1000; ++i) {
+    points3D.push_back(Eigen::Vector3d::Random());
+    if (i % 10 == 0) {
+      points3D.back().z() = -10;
+    }
+    points2D.push_back(Eigen::Vector2d::Random() * 100);
+  }
+
+  std::vector<double> errors;
+  CalculateSquaredReprojectionErrors(points2D, points3D, proj_matrix, camera,
+                                     &errors);
+  BOOST_CHECK_EQUAL(errors.size(), points3D.size());
+  for (size_t i = 0; i < points3D.size(); ++i) {
+    const double error = CalculateSquaredReprojectionError(
+        points2D[i], points3D[i], proj_matrix, camera);
+    if (i % 10 == 0) {
+      BOOST_CHECK_EQUAL(errors[i], std::numeric_limits<double>::max());
+      BOOST_CHECK_EQUAL(error, std::numeric_limits<double>::max());
+    } else {
+      BOOST_CHECK_CLOSE(errors[i], error, 1e-6);
+    }
+  }
+
+  CalculateSquaredReprojectionErrors(std::vector<Eigen::Vector2d>(),
+                                     std::vector<Eigen::Vector3d>(),
+                                     proj_matrix, camera, &errors);
+  BOOST_CHECK(errors.empty());
+}
+
 BOOST_AUTO_TEST_CASE(TestCalculateAngularError) {
   const Eigen::Vector4d qvec = ComposeIdentityQuaternion();
   const Eigen::Vector3d tvec = Eigen::Vector3d(0, 0, 0);
@@ -41,8 +41,63 @@
 #include "util/bitmap.h"
 #include "util/misc.h"
 #include "util/ply.h"
+#include "util/threading.h"
 
 namespace colmap {
+namespace {
+
+// Minimum number of visited points or observations for which a pass over the
+// reconstruction is parallelized. Smaller passes, e.g., the filtering of the
+// points of a single image in the incremental mapper, do not amortize the
+// cost of starting the threads.
+const size_t kMinNumElementsForParallelPass = 10000;
+
+// Number of consecutive elements processed by a single task in the parallel
+// passes. The chunks do not depend on the number of threads, so that
+// reductions over the chunks are deterministic.
+const size_t kParallelPassChunkSize = 4096;
+
+size_t NumParallelPassChunks(const size_t num_elements) {
+  return (num_elements + kParallelPassChunkSize - 1) / kParallelPassChunkSize;
+}
+
+// Call func(i) for all i in [0, num_tasks) with threads borrowed from the
+// process-wide thread budget, if the pass visits at least
+// kMinNumElementsForParallelPass elements, and serially otherwise.
+template <typename func_t>
+void RunParallelPass(const size_t num_tasks, const size_t num_elements,
+                     func_t&& func) {
+  if (num_tasks > 1 && num_elements >= kMinNumElementsForParallelPass) {
+    ThreadBudgetLease lease(ThreadPool::kMaxNumThreads);
+    if (lease.NumThreads() > 1) {
+      // The calling thread participates in ParallelFor.
+      ThreadPool thread_pool(lease.NumThreads() - 1);
+      thread_pool.ParallelFor(0, num_tasks, 1, func);
+      return;
+    }
+  }
+
+  for (size_t i = 0; i < num_tasks; ++i) {
+    func(i);
+  }
+}
+
+// Call func(element) for all elements in the given chunk of slots of a slot
+// map. Splitting the map by slots allows to process it in parallel without
+// first copying its elements or their identifiers.
+template <typename map_t, typename func_t>
+void ForEachInSlotChunk(map_t& map, const size_t chunk_idx, func_t&& func) {
+  const size_t begin = chunk_idx * kParallelPassChunkSize;
+  const size_t end = std::min(map.NumSlots(), begin + kParallelPassChunkSize);
+  for (size_t slot_idx = begin; slot_idx < end; ++slot_idx) {
+    auto* element = map.Slot(slot_idx);
+    if (element != nullptr) {
+      func(*element);
+    }
+  }
+}
+
+}  // namespace
 
 Reconstruction::Reconstruction()
     : correspondence_graph_(nullptr), num_added_points3D_(0) {}
@@ -400,9 +455,10 @@ Reconstruction::ComputeBoundsAndCentroid(const double p0, const double p1,
 
   // Determine robust bounding box and mean.
 
-  std::sort(coords_x.begin(), coords_x.end());
-  std::sort(coords_y.begin(), coords_y.end());
-  std::sort(coords_z.begin(), coords_z.end());
+  std::vector<float>* coords[3] = {&coords_x, &coords_y, &coords_z};
+  RunParallelPass(3, num_elements, [&](const size_t i) {
+    std::sort(coords[i]->begin(), coords[i]->end());
+  });
 
   const size_t P0 = static_cast<size_t>(
       (coords_x.size() > 3) ? p0 * (coords_x.size() - 1) : 0);
@@ -427,9 +483,14 @@ void Reconstruction::Transform(const SimilarityTransform3& tform) {
   for (auto& image : images_) {
     tform.TransformPose(&image.second.Qvec(), &image.second.Tvec());
   }
-  for (auto& point3D : points3D_) {
-    tform.TransformPoint(&point3D.second.XYZ());
-  }
+  const size_t num_chunks = NumParallelPassChunks(points3D_.NumSlots());
+  RunParallelPass(num_chunks, points3D_.size(), [&](const size_t chunk_idx) {
+    ForEachInSlotChunk(
+        points3D_, chunk_idx,
+        [&](std::pair<const point3D_t, class Point3D>& point3D) {
+          tform.TransformPoint(&point3D.second.XYZ());
+        });
+  });
 }
 
 Reconstruction Reconstruction::Crop(
@@ -577,7 +638,7 @@ void Reconstruction::TranscribeImageIdsToDatabase(const Database& database) {
   std::unordered_map<image_t, image_t> old_to_new_image_ids;
   old_to_new_image_ids.reserve(NumImages());
 
-  EIGEN_STL_UMAP(image_t, class Image) new_images;
+  SlotMap<image_t, class Image> new_images;
   new_images.reserve(NumImages());
 
   for (auto& image : images_) {
@@ -647,19 +708,51 @@ size_t Reconstruction::FilterAllPoints3D(const double max_reproj_error,
 }
 
 size_t Reconstruction::FilterObservationsWithNegativeDepth() {
-  size_t num_filtered = 0;
-  for (const auto image_id : reg_image_ids_) {
-    const class Image& image = Image(image_id);
-    const Eigen::Matrix3x4d proj_matrix = image.ProjectionMatrix();
-    for (point2D_t point2D_idx = 0; point2D_idx < image.NumPoints2D();
-         ++point2D_idx) {
-      const Point2D& point2D = image.Point2D(point2D_idx);
-      if (point2D.HasPoint3D()) {
-        const class Point3D& point3D = Point3D(point2D.Point3DId());
-        if (!HasPointPositiveDepth(proj_matrix, point3D.XYZ())) {
-          DeleteObservation(image_id, point2D_idx);
-          num_filtered += 1;
+  // Find the observations with negative depth of all images in parallel.
+  std::vector<std::vector<point2D_t>> negative_point2D_idxs(
+      reg_image_ids_.size());
+  RunParallelPass(
+      reg_image_ids_.size(), ComputeNumObservations(), [&](const size_t i) {
+        const class Image& image = Image(reg_image_ids_[i]);
+
+        // Gather all observed 3D points of the image, so that their depths
+        // can be computed with a single matrix product.
+        std::vector<point2D_t> point2D_idxs;
+        point2D_idxs.reserve(image.NumPoints3D());
+        for (point2D_t point2D_idx = 0; point2D_idx < image.NumPoints2D();
+             ++point2D_idx) {
+          if (image.Point2D(point2D_idx).HasPoint3D()) {
+            point2D_idxs.push_back(point2D_idx);
+          }
+        }
+
+        Eigen::Matrix4Xd points3D(4, point2D_idxs.size());
+        for (size_t j = 0; j < point2D_idxs.size(); ++j) {
+          const point3D_t point3D_id =
+              image.Point2D(point2D_idxs[j]).Point3DId();
+          points3D.col(j) = Point3D(point3D_id).XYZ().homogeneous();
+        }
+
+        const Eigen::RowVectorXd proj_zs =
+            image.ProjectionMatrix().row(2) * points3D;
+
+        for (size_t j = 0; j < point2D_idxs.size(); ++j) {
+          if (proj_zs(j) < std::numeric_limits<double>::epsilon()) {
+            negative_point2D_idxs[i].push_back(point2D_idxs[j]);
+          }
         }
+      });
+
+  // Delete the observations serially in a deterministic order.
+  size_t num_filtered = 0;
+  for (size_t i = 0; i < reg_image_ids_.size(); ++i) {
+    const image_t image_id = reg_image_ids_[i];
+    for (const point2D_t point2D_idx : negative_point2D_idxs[i]) {
+      // Deleting an observation can delete the entire 3D point, including
+      // another filtered observation, so check again.
+      if (Image(image_id).Point2D(point2D_idx).HasPoint3D()) {
+        DeleteObservation(image_id, point2D_idx);
+        num_filtered += 1;
       }
     }
   }
@@ -716,13 +809,27 @@ double Reconstruction::ComputeMeanObservationsPerRegImage() const {
 }
 
 double Reconstruction::ComputeMeanReprojectionError() const {
+  // Accumulate the errors per chunk of slots in parallel and then sum up the
+  // chunks in a fixed order, so that the result is deterministic.
+  const size_t num_chunks = NumParallelPassChunks(points3D_.NumSlots());
+  std::vector<double> chunk_error_sums(num_chunks, 0.0);
+  std::vector<size_t> chunk_num_valid_errors(num_chunks, 0);
+  RunParallelPass(num_chunks, points3D_.size(), [&](const size_t chunk_idx) {
+    ForEachInSlotChunk(
+        points3D_, chunk_idx,
+        [&](const std::pair<const point3D_t, class Point3D>& point3D) {
+          if (point3D.second.HasError()) {
+            chunk_error_sums[chunk_idx] += point3D.second.Error();
+            chunk_num_valid_errors[chunk_idx] += 1;
+          }
+        });
+  });
+
   double error_sum = 0.0;
   size_t num_valid_errors = 0;
-  for (const auto& point3D : points3D_) {
-    if (point3D.second.HasError()) {
-      error_sum += point3D.second.Error();
-      num_valid_errors += 1;
-    }
+  for (size_t chunk_idx = 0; chunk_idx < num_chunks; ++chunk_idx) {
+    error_sum += chunk_error_sums[chunk_idx];
+    num_valid_errors += chunk_num_valid_errors[chunk_idx];
   }
 
   if (num_valid_errors == 0) {
@@ -1421,50 +1528,73 @@ size_t Reconstruction::FilterPoints3DWithSmallTriangulationAngle(
   // Cache for image projection centers.
   EIGEN_STL_UMAP(image_t, Eigen::Vector3d) proj_centers;
 
+  // Collect the existing points and the projection centers of their images,
+  // so that the points can be checked concurrently without modifying the
+  // cache.
+  std::vector<point3D_t> points3D_to_check;
+  points3D_to_check.reserve(point3D_ids.size());
+  size_t num_observations = 0;
   for (const auto point3D_id : point3D_ids) {
     if (!ExistsPoint3D(point3D_id)) {
       continue;
     }
 
-    const class Point3D& point3D = Point3D(point3D_id);
+    points3D_to_check.push_back(point3D_id);
 
-    // Calculate triangulation angle for all pairwise combinations of image
-    // poses in the track. Only delete point if none of the combinations
-    // has a sufficient triangulation angle.
-    bool keep_point = false;
-    for (size_t i1 = 0; i1 < point3D.Track().Length(); ++i1) {
-      const image_t image_id1 = point3D.Track().Element(i1).image_id;
-
-      Eigen::Vector3d proj_center1;
-      if (proj_centers.count(image_id1) == 0) {
-        const class Image& image1 = Image(image_id1);
-        proj_center1 = image1.ProjectionCenter();
-        proj_centers.emplace(image_id1, proj_center1);
-      } else {
-        proj_center1 = proj_centers.at(image_id1);
+    for (const auto& track_el : Point3D(point3D_id).Track().Elements()) {
+      if (proj_centers.count(track_el.image_id) == 0) {
+        proj_centers.emplace(track_el.image_id,
+                             Image(track_el.image_id).ProjectionCenter());
       }
+      num_observations += 1;
+    }
+  }
+
+  std::vector<char> keep_points(points3D_to_check.size(), false);
+  RunParallelPass(
+      NumParallelPassChunks(points3D_to_check.size()), num_observations,
+      [&](const size_t chunk_idx) {
+        const size_t begin = chunk_idx * kParallelPassChunkSize;
+        const size_t end = std::min(points3D_to_check.size(),
+                                    begin + kParallelPassChunkSize);
+        for (size_t i = begin; i < end; ++i) {
+          const class Point3D& point3D = Point3D(points3D_to_check[i]);
+
+          // Calculate triangulation angle for all pairwise combinations of
+          // image poses in the track. Only delete point if none of the
+          // combinations has a sufficient triangulation angle.
+          bool keep_point = false;
+          for (size_t i1 = 0; i1 < point3D.Track().Length(); ++i1) {
+            const image_t image_id1 = point3D.Track().Element(i1).image_id;
+            const Eigen::Vector3d& proj_center1 = proj_centers.at(image_id1);
+
+            for (size_t i2 = 0; i2 < i1; ++i2) {
+              const image_t image_id2 = point3D.Track().Element(i2).image_id;
+              const Eigen::Vector3d& proj_center2 = proj_centers.at(image_id2);
+
+              const double tri_angle = CalculateTriangulationAngle(
+                  proj_center1, proj_center2, point3D.XYZ());
+
+              if (tri_angle >= min_tri_angle_rad) {
+                keep_point = true;
+                break;
+              }
+            }
+
+            if (keep_point) {
+              break;
+            }
+          }
 
-      for (size_t i2 = 0; i2 < i1; ++i2) {
-        const image_t image_id2 = point3D.Track().Element(i2).image_id;
-        const Eigen::Vector3d proj_center2 = proj_centers.at(image_id2);
-
-        const double tri_angle = CalculateTriangulationAngle(
-            proj_center1, proj_center2, point3D.XYZ());
-
-        if (tri_angle >= min_tri_angle_rad) {
-          keep_point = true;
-          break;
+          keep_points[i] = keep_point;
         }
-      }
-
-      if (keep_point) {
-        break;
-      }
-    }
+      });
 
-    if (!keep_point) {
+  // Delete the points serially in a deterministic order.
+  for (size_t i = 0; i < points3D_to_check.size(); ++i) {
+    if (!keep_points[i]) {
       num_filtered += 1;
-      DeletePoint3D(point3D_id);
+      DeletePoint3D(points3D_to_check[i]);
     }
   }
 
@@ -1479,12 +1609,27 @@ size_t Reconstruction::FilterPoints3DWithLargeReprojectionError(
   // Number of filtered points.
   size_t num_filtered = 0;
 
+  // Observations of the checked points grouped by image, so that the
+  // reprojection errors can be computed in batches for a fixed camera.
+  struct ImageObservations {
+    std::vector<Eigen::Vector2d> points2D;
+    std::vector<Eigen::Vector3d> points3D;
+    // Index of the observation in `squared_reproj_errors` below.
+    std::vector<size_t> error_idxs;
+  };
+
+  std::unordered_map<image_t, size_t> image_idxs;
+  std::vector<std::pair<image_t, ImageObservations>> image_observations;
+  // The checked points and the index of their first track element's error.
+  std::vector<std::pair<point3D_t, size_t>> points3D_to_check;
+  size_t num_errors = 0;
+
   for (const auto point3D_id : point3D_ids) {
     if (!ExistsPoint3D(point3D_id)) {
       continue;
     }
 
-    class Point3D& point3D = Point3D(point3D_id);
+    const class Point3D& point3D = Point3D(point3D_id);
 
     if (point3D.Track().Length() < 2) {
       num_filtered += point3D.Track().Length();
@@ -1492,21 +1637,80 @@ size_t Reconstruction::FilterPoints3DWithLargeReprojectionError(
       continue;
     }
 
-    double reproj_error_sum = 0.0;
+    points3D_to_check.emplace_back(point3D_id, num_errors);
+
+    for (const auto& track_el : point3D.Track().Elements()) {
+      const auto image_idx =
+          image_idxs.emplace(track_el.image_id, image_observations.size());
+      if (image_idx.second) {
+        image_observations.emplace_back(track_el.image_id,
+                                        ImageObservations());
+      }
+      ImageObservations& observations =
+          image_observations[image_idx.first->second].second;
+      observations.points2D.push_back(
+          Image(track_el.image_id).Point2D(track_el.point2D_idx).XY());
+      observations.points3D.push_back(point3D.XYZ());
+      observations.error_idxs.push_back(num_errors);
+      num_errors += 1;
+    }
+  }
+
+  // Compute the reprojection errors of the images in parallel.
+  std::vector<double> squared_reproj_errors(num_errors);
+  RunParallelPass(
+      image_observations.size(), num_errors, [&](const size_t image_idx) {
+        const auto& observations = image_observations[image_idx];
+        const class Image& image = Image(observations.first);
+        std::vector<double> image_squared_reproj_errors;
+        CalculateSquaredReprojectionErrors(
+            observations.second.points2D, observations.second.points3D,
+            image.ProjectionMatrix(), Camera(image.CameraId()),
+            &image_squared_reproj_errors);
+        for (size_t i = 0; i < image_squared_reproj_errors.size(); ++i) {
+          squared_reproj_errors[observations.second.error_idxs[i]] =
+              image_squared_reproj_errors[i];
+        }
+      });
+
+  // Sum up the inlier errors of the points in parallel.
+  std::vector<double> reproj_error_sums(points3D_to_check.size(), 0.0);
+  RunParallelPass(
+      NumParallelPassChunks(points3D_to_check.size()), num_errors,
+      [&](const size_t chunk_idx) {
+        const size_t begin = chunk_idx * kParallelPassChunkSize;
+        const size_t end = std::min(points3D_to_check.size(),
+                                    begin + kParallelPassChunkSize);
+        for (size_t i = begin; i < end; ++i) {
+          const size_t track_length =
+              Point3D(points3D_to_check[i].first).Track().Length();
+          const double* point_squared_reproj_errors =
+              &squared_reproj_errors[points3D_to_check[i].second];
+          for (size_t j = 0; j < track_length; ++j) {
+            if (point_squared_reproj_errors[j] <= max_squared_reproj_error) {
+              reproj_error_sums[i] += std::sqrt(point_squared_reproj_errors[j]);
+            }
+          }
+        }
+      });
+
+  // Apply the mutations serially in a deterministic order. Filtering a point
+  // only modifies its own track, so the errors computed above remain valid
+  // for all remaining points.
+  for (size_t i = 0; i < points3D_to_check.size(); ++i) {
+    const point3D_t point3D_id = points3D_to_check[i].first;
+    class Point3D& point3D = Point3D(point3D_id);
+
+    const double reproj_error_sum = reproj_error_sums[i];
 
     std::vector<TrackElement> track_els_to_delete;
 
+    size_t error_idx = points3D_to_check[i].second;
     for (const auto& track_el : point3D.Track().Elements()) {
-      const class Image& image = Image(track_el.image_id);
-      const class Camera& camera = Camera(image.CameraId());
-      const Point2D& point2D = image.Point2D(track_el.point2D_idx);
-      const double squared_reproj_error = CalculateSquaredReprojectionError(
-          point2D.XY(), point3D.XYZ(), image.Qvec(), image.Tvec(), camera);
-      if (squared_reproj_error > max_squared_reproj_error) {
+      if (squared_reproj_errors[error_idx] > max_squared_reproj_error) {
         track_els_to_delete.push_back(track_el);
-      } else {
-        reproj_error_sum += std::sqrt(squared_reproj_error);
       }
+      error_idx += 1;
     }
 
     if (track_els_to_delete.size() >= point3D.Track().Length() - 1) {
@@ -2114,7 +2318,7 @@ void Reconstruction::SetObservationAsTriangulated(
 
   const class Image& image = Image(image_id);
   const Point2D& point2D = image.Point2D(point2D_idx);
-  const std::vector<CorrespondenceGraph::Correspondence>& corrs =
+  const CorrespondenceGraph::CorrespondenceRange corrs =
       correspondence_graph_->FindCorrespondences(image_id, point2D_idx);
 
   CHECK(image.IsRegistered());
@@ -2148,7 +2352,7 @@ void Reconstruction::ResetTriObservations(const image_t image_id,
 
   const class Image& image = Image(image_id);
   const Point2D& point2D = image.Point2D(point2D_idx);
-  const std::vector<CorrespondenceGraph::Correspondence>& corrs =
+  const CorrespondenceGraph::CorrespondenceRange corrs =
       correspondence_graph_->FindCorrespondences(image_id, point2D_idx);
 
   CHECK(image.IsRegistered());
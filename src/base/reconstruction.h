@@ -49,6 +49,7 @@
 #include "estimators/similarity_transform.h"
 #include "optim/loransac.h"
 #include "util/alignment.h"
+#include "util/slot_map.h"
 #include "util/types.h"
 
 namespace colmap {
@@ -97,9 +98,9 @@ class Reconstruction {
 
   // Get reference to all objects.
   inline const EIGEN_STL_UMAP(camera_t, class Camera) & Cameras() const;
-  inline const EIGEN_STL_UMAP(image_t, class Image) & Images() const;
+  inline const SlotMap<image_t, class Image>& Images() const;
   inline const std::vector<image_t>& RegImageIds() const;
-  inline const EIGEN_STL_UMAP(point3D_t, class Point3D) & Points3D() const;
+  inline const SlotMap<point3D_t, class Point3D>& Points3D() const;
   inline const std::unordered_map<image_pair_t, ImagePairStat>& ImagePairs()
       const;
 
@@ -421,8 +422,8 @@ class Reconstruction {
   const CorrespondenceGraph* correspondence_graph_;
 
   EIGEN_STL_UMAP(camera_t, class Camera) cameras_;
-  EIGEN_STL_UMAP(image_t, class Image) images_;
-  EIGEN_STL_UMAP(point3D_t, class Point3D) points3D_;
+  SlotMap<image_t, class Image> images_;
+  SlotMap<point3D_t, class Point3D> points3D_;
 
   std::unordered_map<image_pair_t, ImagePairStat> image_pair_stats_;
 
@@ -499,7 +500,7 @@ const EIGEN_STL_UMAP(camera_t, Camera) & Reconstruction::Cameras() const {
   return cameras_;
 }
 
-const EIGEN_STL_UMAP(image_t, class Image) & Reconstruction::Images() const {
+const SlotMap<image_t, class Image>& Reconstruction::Images() const {
   return images_;
 }
 
@@ -507,7 +508,7 @@ const std::vector<image_t>& Reconstruction::RegImageIds() const {
   return reg_image_ids_;
 }
 
-const EIGEN_STL_UMAP(point3D_t, Point3D) & Reconstruction::Points3D() const {
+const SlotMap<point3D_t, class Point3D>& Reconstruction::Points3D() const {
   return points3D_;
 }
 
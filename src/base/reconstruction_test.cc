@@ -37,6 +37,7 @@
 #include "base/pose.h"
 #include "base/reconstruction.h"
 #include "base/similarity_transform.h"
+#include "util/threading.h"
 
 using namespace colmap;
 
@@ -611,3 +612,65 @@ BOOST_AUTO_TEST_CASE(TestComputeMeanReprojectionError) {
   reconstruction.Point3D(point3D_id1).SetError(2.0);
   BOOST_CHECK_EQUAL(reconstruction.ComputeMeanReprojectionError(), 2.0);
 }
+
+BOOST_AUTO_TEST_CASE(TestParallelPasses) {
+  // Large enough to run the passes in parallel.
+  const int kPrevThreadBudget = kThreadBudget;
+  kThreadBudget = 4;
+
+  const size_t kNumPoints3D = 20000;
+
+  Reconstruction reconstruction;
+  CorrespondenceGraph correspondence_graph;
+  Camera camera;
+  camera.SetCameraId(1);
+  camera.InitializeWithName("PINHOLE", 1, 1, 1);
+  reconstruction.AddCamera(camera);
+  for (image_t image_id = 1; image_id <= 2; ++image_id) {
+    Image image;
+    image.SetImageId(image_id);
+    image.SetCameraId(1);
+    image.SetName("image" + std::to_string(image_id));
+    image.SetPoints2D(std::vector<Eigen::Vector2d>(
+        kNumPoints3D, Eigen::Vector2d(0.5, 0.5)));
+    reconstruction.AddImage(image);
+    reconstruction.RegisterImage(image_id);
+    correspondence_graph.AddImage(image_id, kNumPoints3D);
+  }
+  reconstruction.SetUp(&correspondence_graph);
+
+  // Every second point lies behind the cameras and every fourth point has
+  // a large reprojection error in the first image.
+  for (point2D_t i = 0; i < kNumPoints3D; ++i) {
+    Track track;
+    track.AddElement(1, i);
+    track.AddElement(2, i);
+    reconstruction.AddPoint3D(Eigen::Vector3d(0, 0, i % 2 == 0 ? 1 : -1),
+                              track);
+    if (i % 4 == 2) {
+      reconstruction.Image(1).Point2D(i).SetXY(Eigen::Vector2d(10, 10));
+    }
+  }
+
+  BOOST_CHECK_EQUAL(reconstruction.FilterObservationsWithNegativeDepth(),
+                    kNumPoints3D / 2);
+  BOOST_CHECK_EQUAL(reconstruction.NumPoints3D(), kNumPoints3D / 2);
+  BOOST_CHECK_EQUAL(reconstruction.ComputeNumObservations(), kNumPoints3D);
+
+  BOOST_CHECK_EQUAL(reconstruction.FilterAllPoints3D(1.0, 0.0),
+                    kNumPoints3D / 2);
+  BOOST_CHECK_EQUAL(reconstruction.NumPoints3D(), kNumPoints3D / 4);
+  for (const auto& point3D : reconstruction.Points3D()) {
+    BOOST_CHECK_EQUAL(point3D.first % 4, 1);
+    BOOST_CHECK_EQUAL(point3D.second.Error(), 0);
+  }
+  BOOST_CHECK_EQUAL(reconstruction.ComputeMeanReprojectionError(), 0);
+
+  reconstruction.Transform(SimilarityTransform3(
+      2, ComposeIdentityQuaternion(), Eigen::Vector3d(1, 2, 3)));
+  for (const auto& point3D : reconstruction.Points3D()) {
+    BOOST_CHECK_EQUAL(point3D.second.XYZ(), Eigen::Vector3d(1, 2, 5));
+  }
+
+  kThreadBudget = kPrevThreadBudget;
+}
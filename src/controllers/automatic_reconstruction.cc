@@ -275,7 +275,6 @@ void AutomaticReconstructionController::RunDenseMapper() {
 
     // Patch match stereo.
 
-#ifdef CUDA_ENABLED
     {
       mvs::PatchMatchController patch_match_controller(
           *option_manager_.patch_match_stereo, dense_path, "COLMAP", "");
@@ -284,13 +283,6 @@ void AutomaticReconstructionController::RunDenseMapper() {
       patch_match_controller.Wait();
       active_thread_ = nullptr;
     }
-#else   // CUDA_ENABLED
-    std::cout
-        << std::endl
-        << "WARNING: Skipping patch match stereo because CUDA is not available."
-        << std::endl;
-    return;
-#endif  // CUDA_ENABLED
 
     if (IsStopped()) {
       return;
@@ -74,7 +74,8 @@ class AutomaticReconstructionController : public Thread {
     // Whether to perform sparse mapping.
     bool sparse = true;
 
-// Whether to perform dense mapping.
+// Whether to perform dense mapping. Without CUDA, patch match stereo runs on
+// the CPU, which is much slower, so that it must be enabled explicitly.
 #ifdef CUDA_ENABLED
     bool dense = true;
 #else
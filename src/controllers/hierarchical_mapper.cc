@@ -152,15 +152,19 @@ void HierarchicalMapperController::Run() {
 
   PrintHeading1("Reconstructing clusters");
 
-  // Determine the number of workers and threads per worker.
+  // Determine the number of workers and threads per worker. The workers are
+  // borrowed from the thread budget, and the components of the workers borrow
+  // their threads from the remaining budget, so the workers do not
+  // oversubscribe the machine, even if their number of threads is given.
   const int kMaxNumThreads = -1;
   const int num_eff_threads = GetEffectiveNumThreads(kMaxNumThreads);
   const int kDefaultNumWorkers = 8;
-  const int num_eff_workers =
+  ThreadBudgetLease thread_budget_lease(
       options_.num_workers < 1
           ? std::min(static_cast<int>(leaf_clusters.size()),
                      std::min(kDefaultNumWorkers, num_eff_threads))
-          : options_.num_workers;
+          : options_.num_workers);
+  const int num_eff_workers = thread_budget_lease.NumThreads();
   const int num_threads_per_worker =
       std::max(1, num_eff_threads / num_eff_workers);
 
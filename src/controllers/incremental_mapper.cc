@@ -32,6 +32,7 @@
 #include "controllers/incremental_mapper.h"
 
 #include "util/misc.h"
+#include "util/socket_replay.h"
 
 namespace colmap {
 namespace {
@@ -46,14 +47,13 @@ size_t TriangulateImage(const IncrementalMapperOptions& options,
   return num_tris;
 }
 
-void AdjustGlobalBundle(const IncrementalMapperOptions& options,
-                        IncrementalMapper* mapper) {
-  BundleAdjustmentOptions custom_ba_options = options.GlobalBundleAdjustment();
+const size_t kMinNumRegImagesForFastBA = 10;
 
-  const size_t num_reg_images = mapper->GetReconstruction().NumRegImages();
+BundleAdjustmentOptions CustomGlobalBundleAdjustment(
+    const IncrementalMapperOptions& options, const size_t num_reg_images) {
+  BundleAdjustmentOptions custom_ba_options = options.GlobalBundleAdjustment();
 
   // Use stricter convergence criteria for first registered images.
-  const size_t kMinNumRegImagesForFastBA = 10;
   if (num_reg_images < kMinNumRegImagesForFastBA) {
     custom_ba_options.solver_options.function_tolerance /= 10;
     custom_ba_options.solver_options.gradient_tolerance /= 10;
@@ -62,6 +62,15 @@ void AdjustGlobalBundle(const IncrementalMapperOptions& options,
     custom_ba_options.solver_options.max_linear_solver_iterations = 200;
   }
 
+  return custom_ba_options;
+}
+
+void AdjustGlobalBundle(const IncrementalMapperOptions& options,
+                        IncrementalMapper* mapper) {
+  const size_t num_reg_images = mapper->GetReconstruction().NumRegImages();
+  const BundleAdjustmentOptions custom_ba_options =
+      CustomGlobalBundleAdjustment(options, num_reg_images);
+
   PrintHeading1("Global bundle adjustment");
   if (options.ba_global_use_pba && !options.fix_existing_images &&
       num_reg_images >= kMinNumRegImagesForFastBA &&
@@ -282,6 +291,7 @@ bool IncrementalMapperOptions::Check() const {
   CHECK_OPTION_GT(max_model_overlap, 0);
   CHECK_OPTION_GE(min_model_size, 0);
   CHECK_OPTION_GT(init_num_trials, 0);
+  CHECK_OPTION_GT(init_num_parallel_trials, 0);
   CHECK_OPTION_GT(min_focal_length_ratio, 0);
   CHECK_OPTION_GT(max_focal_length_ratio, 0);
   CHECK_OPTION_GE(max_extra_param, 0);
@@ -322,10 +332,21 @@ void IncrementalMapperController::Run() {
     return;
   }
 
-  if (options_->tcp_port != -1) {
-    client_ = new mod::TCPClient("127.0.0.1", options_->tcp_port, !options_->tcp_no_nlog, !options_->tcp_no_flog, options_->tcp_mlog);
+  if (options_->tcp_port != -1 || !options_->tcp_endpoint.empty()) {
+    const std::string endpoint =
+        options_->tcp_endpoint.empty()
+            ? StringPrintf("tcp:127.0.0.1:%d", options_->tcp_port)
+            : options_->tcp_endpoint;
+    std::unique_ptr<mod::Transport> transport = mod::ConnectTransport(endpoint);
+    if (!options_->tcp_record_path.empty()) {
+      transport.reset(new mod::RecordingTransport(std::move(transport),
+                                                  options_->tcp_record_path));
+    }
+    client_ = new mod::TCPClient(std::move(transport), !options_->tcp_no_nlog, !options_->tcp_no_flog, options_->tcp_mlog,
+                                 options_->tcp_binary ? mod::Protocol::BINARY : mod::Protocol::TEXT,
+                                 options_->tcp_async);
     if (!client_->Connected()) return;
-    PrintHeading1(StringPrintf("Connected to 127.0.0.1:%d", options_->tcp_port));
+    PrintHeading1("Connected to " + endpoint);
   }
 
 
@@ -382,9 +403,19 @@ bool IncrementalMapperController::LoadDatabase() {
   Database database(database_path_);
   Timer timer;
   timer.Start();
+  // Read the keypoints from the memory-mapped feature store, if requested.
+  FeatureStore feature_store;
+  if (options_->use_feature_store &&
+      !feature_store.Open(FeatureStore::DefaultPath(database_path_))) {
+    std::cout << "WARNING: Could not open feature store, reading features "
+                 "from the database"
+              << std::endl;
+  }
   const size_t min_num_matches = static_cast<size_t>(options_->min_num_matches);
   database_cache_.Load(database, min_num_matches, options_->ignore_watermarks,
-                       image_names);
+                       image_names,
+                       feature_store.IsOpen() ? &feature_store : nullptr,
+                       options_->num_threads);
   std::cout << std::endl;
   timer.PrintMinutes();
 
@@ -450,81 +481,107 @@ void IncrementalMapperController::Reconstruct(
 
       if (client_) client_->FindInitialImagePair(&image_id1, &image_id2);
 
-      // Try to find good initial pair.
-      if (image_id1 == ~0U || image_id2 == ~0U) {
-        PrintHeading1("Finding good initial image pair");
-        
-        const bool find_init_success = mapper.FindInitialImagePair(
-            init_mapper_options, &image_id1, &image_id2);
-        if (!find_init_success) {
+      if (options_->init_num_parallel_trials > 1 &&
+          (image_id1 == kInvalidImageId || image_id2 == kInvalidImageId)) {
+        PrintHeading1("Evaluating initial image pairs");
+        const size_t num_init_pairs = RegisterInitialImagePairs(
+            init_mapper_options, &mapper, &image_id1, &image_id2);
+        if (num_init_pairs == 0) {
           if (client_) client_->EndReconstruction(num_trials, 0, 0);
           std::cout << "  => No good initial image pair found." << std::endl;
           mapper.EndReconstruction(kDiscardReconstruction);
           reconstruction_manager_->Delete(reconstruction_idx);
           break;
         }
-      } else {
-        if (!reconstruction.ExistsImage(image_id1) ||
-            !reconstruction.ExistsImage(image_id2)) {
+
+        // Stop like the sequential initialization, if no pair succeeded.
+        if (image_id1 == kInvalidImageId) {
           if (client_) client_->EndReconstruction(num_trials, 0, 0);
-          std::cout << StringPrintf(
-                           "  => Initial image pair #%d and #%d do not exist.",
-                           image_id1, image_id2)
+          std::cout << "  => Initialization failed for all evaluated pairs."
                     << std::endl;
           mapper.EndReconstruction(kDiscardReconstruction);
           reconstruction_manager_->Delete(reconstruction_idx);
-          return;
+          break;
         }
-      }
 
-      if (client_) client_->InitializeWithImagePair(image_id1, image_id2);
-
-      PrintHeading1(StringPrintf("Initializing with image pair #%d and #%d",
-                                 image_id1, image_id2));
-      const bool reg_init_success = mapper.RegisterInitialImagePair(
-          init_mapper_options, image_id1, image_id2, client_);
-      if (!reg_init_success) {
-        if (client_) {
-          client_->FailInitialization(image_id1, image_id2, init_mapper_options.init_min_tri_angle, init_mapper_options.init_min_num_inliers);
-          client_->EndReconstruction(num_trials, 0, 0);
+        PrintHeading1(StringPrintf("Initializing with image pair #%d and #%d",
+                                   image_id1, image_id2));
+      } else {
+        // Try to find good initial pair.
+        if (image_id1 == ~0U || image_id2 == ~0U) {
+          PrintHeading1("Finding good initial image pair");
+          const bool find_init_success = mapper.FindInitialImagePair(
+              init_mapper_options, &image_id1, &image_id2);
+          if (!find_init_success) {
+            if (client_) client_->EndReconstruction(num_trials, 0, 0);
+            std::cout << "  => No good initial image pair found." << std::endl;
+            mapper.EndReconstruction(kDiscardReconstruction);
+            reconstruction_manager_->Delete(reconstruction_idx);
+            break;
+          }
+        } else {
+          if (!reconstruction.ExistsImage(image_id1) ||
+              !reconstruction.ExistsImage(image_id2)) {
+            if (client_) client_->EndReconstruction(num_trials, 0, 0);
+            std::cout << StringPrintf(
+                             "  => Initial image pair #%d and #%d do not exist.",
+                             image_id1, image_id2)
+                      << std::endl;
+            mapper.EndReconstruction(kDiscardReconstruction);
+            reconstruction_manager_->Delete(reconstruction_idx);
+            return;
+          }
         }
-        std::cout << "  => Initialization failed - possible solutions:"
-                  << std::endl
-                  << "     - try to relax the initialization constraints"
-                  << std::endl
-                  << "     - manually select an initial image pair"
-                  << std::endl;
-        mapper.EndReconstruction(kDiscardReconstruction);
-        reconstruction_manager_->Delete(reconstruction_idx);
-        break;
-      }
 
-      if (options_->ba_global)
-        AdjustGlobalBundle(*options_, &mapper);
-      FilterPoints(*options_, &mapper);
-      FilterImages(*options_, &mapper);
-
-      // Initial image pair failed to register.
-      if (reconstruction.NumRegImages() == 0 ||
-          reconstruction.NumPoints3D() == 0) {
-        if (client_) {
-          client_->FailInitialRegistration(image_id1, image_id2, reconstruction.NumRegImages(), reconstruction.NumPoints3D());
-          client_->FailDueToLittleTriAngle(image_id1, image_id2);
-          client_->EndReconstruction(num_trials, reconstruction.NumRegImages(), reconstruction.NumPoints3D());
-        }
-        mapper.EndReconstruction(kDiscardReconstruction);
-        reconstruction_manager_->Delete(reconstruction_idx);
-        // If both initial images are manually specified, there is no need for
-        // further initialization trials.
-        if (options_->init_image_id1 != -1 && options_->init_image_id2 != -1) {
+        if (client_) client_->InitializeWithImagePair(image_id1, image_id2);
+
+        PrintHeading1(StringPrintf("Initializing with image pair #%d and #%d",
+                                   image_id1, image_id2));
+        const bool reg_init_success = mapper.RegisterInitialImagePair(
+            init_mapper_options, image_id1, image_id2, client_);
+        if (!reg_init_success) {
+          if (client_) {
+            client_->FailInitialization(image_id1, image_id2, init_mapper_options.init_min_tri_angle, init_mapper_options.init_min_num_inliers);
+            client_->EndReconstruction(num_trials, 0, 0);
+          }
+          std::cout << "  => Initialization failed - possible solutions:"
+                    << std::endl
+                    << "     - try to relax the initialization constraints"
+                    << std::endl
+                    << "     - manually select an initial image pair"
+                    << std::endl;
+          mapper.EndReconstruction(kDiscardReconstruction);
+          reconstruction_manager_->Delete(reconstruction_idx);
           break;
-        } else {
-          continue;
         }
-      }
 
-      if (client_)
-        client_->SucceedInitialRegistration(image_id1, image_id2, reconstruction.NumRegImages(), reconstruction.NumPoints3D());
+        if (options_->ba_global)
+          AdjustGlobalBundle(*options_, &mapper);
+        FilterPoints(*options_, &mapper);
+        FilterImages(*options_, &mapper);
+
+        // Initial image pair failed to register.
+        if (reconstruction.NumRegImages() == 0 ||
+            reconstruction.NumPoints3D() == 0) {
+          if (client_) {
+            client_->FailInitialRegistration(image_id1, image_id2, reconstruction.NumRegImages(), reconstruction.NumPoints3D());
+            client_->FailDueToLittleTriAngle(image_id1, image_id2);
+            client_->EndReconstruction(num_trials, reconstruction.NumRegImages(), reconstruction.NumPoints3D());
+          }
+          mapper.EndReconstruction(kDiscardReconstruction);
+          reconstruction_manager_->Delete(reconstruction_idx);
+          // If both initial images are manually specified, there is no need for
+          // further initialization trials.
+          if (options_->init_image_id1 != -1 && options_->init_image_id2 != -1) {
+            break;
+          } else {
+            continue;
+          }
+        }
+
+        if (client_)
+          client_->SucceedInitialRegistration(image_id1, image_id2, reconstruction.NumRegImages(), reconstruction.NumPoints3D());
+      }
 
       if (options_->extract_colors) {
         ExtractColors(image_path_, image_id1, &reconstruction);
@@ -541,6 +598,13 @@ void IncrementalMapperController::Reconstruct(
     size_t ba_prev_num_reg_images = reconstruction.NumRegImages();
     size_t ba_prev_num_points = reconstruction.NumPoints3D();
 
+    // Images to register next, either in the order of the mapper or ranked
+    // by the controller. A ranked list is consumed across iterations until it
+    // is exhausted or global refinement changed the reconstruction.
+    const bool batch_next_images =
+        client_ != nullptr && options_->tcp_batch_next_images;
+    std::vector<mod::NextImageDecision> next_images;
+
     bool reg_next_success = true;
     bool prev_reg_next_success = true;
     while (reg_next_success) {
@@ -551,19 +615,56 @@ void IncrementalMapperController::Reconstruct(
 
       reg_next_success = false;
 
-      const std::vector<image_t> next_images = mapper.FindNextImages(options_->Mapper());
+      const bool reused_next_images =
+          batch_next_images && !next_images.empty();
+      bool ranked_next_images = reused_next_images;
+      if (!ranked_next_images) {
+        const std::vector<image_t> next_image_ids =
+            mapper.FindNextImages(options_->Mapper());
 
-      if (client_) client_->FindNextImages(next_images);
+        if (client_) client_->FindNextImages(next_image_ids);
 
-      if (next_images.empty()) {
-        break;
+        if (next_image_ids.empty()) {
+          break;
+        }
+
+        if (batch_next_images) {
+          client_->RankNextImages(next_image_ids,
+                                  reconstruction.NumRegImages(), &next_images);
+          ranked_next_images = !next_images.empty();
+        }
+
+        if (!ranked_next_images) {
+          next_images.resize(next_image_ids.size());
+          for (size_t i = 0; i < next_image_ids.size(); ++i) {
+            next_images[i].image_id = next_image_ids[i];
+          }
+        }
       }
 
+      size_t num_consumed_next_images = next_images.size();
+      bool gave_up = false;
       for (size_t reg_trial = 0; reg_trial < next_images.size(); ++reg_trial) {
-        image_t next_image_id = next_images[reg_trial];
+        image_t next_image_id = next_images[reg_trial].image_id;
 
-        if (client_)
+        if (ranked_next_images) {
+          if (!reconstruction.ExistsImage(next_image_id) ||
+              reconstruction.IsImageRegistered(next_image_id)) {
+            continue;
+          }
+        } else if (client_) {
           client_->RegisterNextImage(&next_image_id, reconstruction.NumRegImages());
+        }
+
+        IncrementalMapper::Options next_mapper_options = options_->Mapper();
+        if (next_images[reg_trial].min_num_inliers >= 0) {
+          next_mapper_options.abs_pose_min_num_inliers =
+              next_images[reg_trial].min_num_inliers;
+        }
+        if (next_images[reg_trial].max_error > 0) {
+          next_mapper_options.abs_pose_max_error =
+              next_images[reg_trial].max_error;
+        }
 
         const Image& next_image = reconstruction.Image(next_image_id);
 
@@ -576,9 +677,11 @@ void IncrementalMapperController::Reconstruct(
                   << std::endl;
 
         reg_next_success =
-            mapper.RegisterNextImage(options_->Mapper(), next_image_id, client_);
+            mapper.RegisterNextImage(next_mapper_options, next_image_id, client_);
 
         if (reg_next_success) {
+          num_consumed_next_images = reg_trial + 1;
+
           TriangulateImage(*options_, next_image, &mapper);
           IterativeLocalRefinement(*options_, next_image_id, &mapper);
 
@@ -594,6 +697,8 @@ void IncrementalMapperController::Reconstruct(
               IterativeGlobalRefinement(*options_, &mapper);
               ba_prev_num_points = reconstruction.NumPoints3D();
               ba_prev_num_reg_images = reconstruction.NumRegImages();
+              // The ranking is stale after global refinement.
+              num_consumed_next_images = next_images.size();
             }
           }
 
@@ -618,7 +723,10 @@ void IncrementalMapperController::Reconstruct(
         } else {
           if (client_) {
             client_->FailRegistration(next_image_id, reg_trial, reconstruction.NumRegImages());
-            if (client_->GiveUp()) break;
+            if (client_->GiveUp()) {
+              gave_up = true;
+              break;
+            }
           }
           std::cout << "  => Could not register, trying another image."
                     << std::endl;
@@ -634,12 +742,26 @@ void IncrementalMapperController::Reconstruct(
         }
       }
 
+      if (ranked_next_images) {
+        next_images.erase(next_images.begin(),
+                          next_images.begin() + num_consumed_next_images);
+      } else {
+        next_images.clear();
+      }
+
       const size_t max_model_overlap =
           static_cast<size_t>(options_->max_model_overlap);
       if (mapper.NumSharedRegImages() >= max_model_overlap) {
         break;
       }
 
+      // Exhausting the rest of an earlier ranking does not mean that no image
+      // can be registered, so first ask the mapper and controller again.
+      if (!reg_next_success && reused_next_images && !gave_up) {
+        reg_next_success = true;
+        continue;
+      }
+
       if (client_)
         client_->FailAllRegistration(&reg_next_success, &prev_reg_next_success);
 
@@ -701,4 +823,117 @@ void IncrementalMapperController::Reconstruct(
   }
 }
 
+size_t IncrementalMapperController::RegisterInitialImagePairs(
+    const IncrementalMapper::Options& init_mapper_options,
+    IncrementalMapper* mapper, image_t* image_id1, image_t* image_id2) {
+  const std::vector<std::pair<image_t, image_t>> image_pairs =
+      mapper->FindInitialImagePairCandidates(
+          init_mapper_options, *image_id1, *image_id2,
+          static_cast<size_t>(options_->init_num_parallel_trials));
+
+  *image_id1 = kInvalidImageId;
+  *image_id2 = kInvalidImageId;
+
+  if (image_pairs.empty()) {
+    return 0;
+  }
+
+  // Split the threads between the trials, so that the concurrent bundle
+  // adjustments do not oversubscribe the machine. The split only depends on
+  // the options and not on the threads available when a trial starts, such
+  // that the result of every trial is deterministic. All threads are borrowed
+  // from the thread budget up front and the bundle adjustments use exactly
+  // their share without borrowing any further threads.
+  const int num_threads = GetEffectiveNumThreads(options_->num_threads);
+  const int num_trial_threads =
+      std::min(num_threads, static_cast<int>(image_pairs.size()));
+  const int num_ba_threads = std::max(1, num_threads / num_trial_threads);
+  ThreadBudgetLease thread_budget_lease(num_trial_threads * num_ba_threads);
+
+  BundleAdjustmentOptions ba_options =
+      CustomGlobalBundleAdjustment(*options_, 2);
+  ba_options.print_summary = false;
+  ba_options.borrow_solver_threads = false;
+  ba_options.solver_options.minimizer_progress_to_stdout = false;
+  ba_options.solver_options.num_threads = num_ba_threads;
+#if CERES_VERSION_MAJOR < 2
+  ba_options.solver_options.num_linear_solver_threads = num_ba_threads;
+#endif  // CERES_VERSION_MAJOR
+
+  const IncrementalMapper::Options mapper_options = options_->Mapper();
+  const Reconstruction& reconstruction = mapper->GetReconstruction();
+
+  std::vector<std::unique_ptr<Reconstruction>> trial_reconstructions(
+      image_pairs.size());
+  std::vector<mod::InitialImagePairTrial> trials(image_pairs.size());
+
+  auto RegisterTrial = [&](const size_t trial_idx) {
+    const image_t trial_image_id1 = image_pairs[trial_idx].first;
+    const image_t trial_image_id2 = image_pairs[trial_idx].second;
+
+    trial_reconstructions[trial_idx].reset(new Reconstruction(reconstruction));
+    Reconstruction* trial_reconstruction =
+        trial_reconstructions[trial_idx].get();
+
+    // The trial mapper is discarded without ending the reconstruction, since
+    // that would tear down the seeded copy.
+    IncrementalMapper trial_mapper(&database_cache_);
+    trial_mapper.BeginReconstruction(trial_reconstruction);
+    if (trial_mapper.RegisterInitialImagePair(
+            init_mapper_options, trial_image_id1, trial_image_id2, nullptr)) {
+      if (options_->ba_global) {
+        trial_mapper.AdjustGlobalBundle(mapper_options, ba_options);
+      }
+      trial_mapper.FilterPoints(mapper_options);
+      trial_mapper.FilterImages(mapper_options);
+    }
+
+    mod::InitialImagePairTrial& trial = trials[trial_idx];
+    trial.img1 = trial_image_id1;
+    trial.img2 = trial_image_id2;
+    trial.num_reg_images = trial_reconstruction->NumRegImages();
+    trial.num_points_3d = trial_reconstruction->NumPoints3D();
+    trial.success = trial.num_reg_images > 0 && trial.num_points_3d > 0;
+  };
+
+  ThreadPool thread_pool(num_trial_threads);
+  for (size_t trial_idx = 0; trial_idx < image_pairs.size(); ++trial_idx) {
+    thread_pool.AddTask(RegisterTrial, trial_idx);
+  }
+  thread_pool.Wait();
+
+  // Keep the pair with the most 3D points and prefer earlier candidates on
+  // ties, which makes the choice independent of the thread scheduling.
+  int best_trial_idx = -1;
+  for (size_t trial_idx = 0; trial_idx < trials.size(); ++trial_idx) {
+    const mod::InitialImagePairTrial& trial = trials[trial_idx];
+    std::cout << StringPrintf("  => Pair #%d and #%d: %d images, %d points",
+                              trial.img1, trial.img2, trial.num_reg_images,
+                              trial.num_points_3d)
+              << std::endl;
+    if (trial.success &&
+        (best_trial_idx == -1 ||
+         trial.num_points_3d > trials[best_trial_idx].num_points_3d)) {
+      best_trial_idx = static_cast<int>(trial_idx);
+    }
+  }
+
+  for (size_t trial_idx = 0; trial_idx < trials.size(); ++trial_idx) {
+    mapper->AdoptInitialImagePair(
+        image_pairs[trial_idx].first, image_pairs[trial_idx].second,
+        static_cast<int>(trial_idx) == best_trial_idx
+            ? trial_reconstructions[trial_idx].get()
+            : nullptr);
+  }
+
+  if (client_) client_->InitialImagePairTrials(trials, best_trial_idx);
+
+  if (best_trial_idx != -1) {
+    *image_id1 = image_pairs[best_trial_idx].first;
+    *image_id2 = image_pairs[best_trial_idx].second;
+  }
+
+  return image_pairs.size();
+}
+
 }  // namespace colmap
@@ -45,6 +45,11 @@ struct IncrementalMapperOptions {
   // The port used to interact
   int tcp_port = -1;
 
+  // The controller endpoint, which overrides `tcp_port` if not empty. One of
+  // `tcp:<address>:<port>`, `unix:<path>`, or `shm:<name>` for a shared
+  // memory region created by a controller on the same machine.
+  std::string tcp_endpoint = "";
+
   // Whether to disable normal log
   bool tcp_no_nlog = false;
 
@@ -54,6 +59,22 @@ struct IncrementalMapperOptions {
   // Whether to enable major log
   bool tcp_mlog = false;
 
+  // Whether to talk to the controller with the binary wire protocol. Falls
+  // back to the text protocol if the controller does not support it.
+  bool tcp_binary = false;
+
+  // Whether to deliver notifications to the controller asynchronously, so
+  // that only decision points wait for the controller.
+  bool tcp_async = false;
+
+  // Whether the controller ranks all candidates of FindNextImages in one
+  // round-trip instead of confirming every next image individually.
+  bool tcp_batch_next_images = false;
+
+  // Path to a file to record the session with the controller, which can be
+  // replayed offline by `mod::ReplayServer` in place of the controller.
+  std::string tcp_record_path = "";
+
   // The minimum number of matches for inlier matches to be considered.
   int min_num_matches = 15;
 
@@ -84,12 +105,21 @@ struct IncrementalMapperOptions {
   // The number of trials to initialize the reconstruction.
   int init_num_trials = 200;
 
+  // The number of initial image pairs to evaluate concurrently in each
+  // initialization trial, keeping the pair that yields the most 3D points.
+  // A value of 1 tries the initial image pairs one after another.
+  int init_num_parallel_trials = 1;
+
   // Whether to extract colors for reconstructed points.
   bool extract_colors = true;
 
   // The number of threads to use during reconstruction.
   int num_threads = -1;
 
+  // Whether to read the keypoints from the memory-mapped feature store next to
+  // the database (see `SiftMatchingOptions::use_feature_store`).
+  bool use_feature_store = false;
+
   // Thresholds for filtering images with degenerate intrinsics.
   double min_focal_length_ratio = 0.1;
   double max_focal_length_ratio = 10.0;
@@ -192,6 +222,13 @@ class IncrementalMapperController : public Thread {
   void Run();
   bool LoadDatabase();
   void Reconstruct(const IncrementalMapper::Options& init_mapper_options);
+  // Register the candidate initial image pairs concurrently on copies of the
+  // reconstruction and seed the reconstruction with the best pair. Returns
+  // the number of evaluated pairs and sets the image identifiers to the kept
+  // pair, or to kInvalidImageId if no pair could be registered.
+  size_t RegisterInitialImagePairs(
+      const IncrementalMapper::Options& init_mapper_options,
+      IncrementalMapper* mapper, image_t* image_id1, image_t* image_id2);
 
   const IncrementalMapperOptions* options_;
   const std::string image_path_;
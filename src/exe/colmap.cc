@@ -105,6 +105,7 @@ int main(int argc, char** argv) {
   commands.emplace_back("color_extractor", &RunColorExtractor);
   commands.emplace_back("database_cleaner", &RunDatabaseCleaner);
   commands.emplace_back("database_creator", &RunDatabaseCreator);
+  commands.emplace_back("database_feature_store", &RunDatabaseFeatureStore);
   commands.emplace_back("database_merger", &RunDatabaseMerger);
   commands.emplace_back("delaunay_mesher", &RunDelaunayMesher);
   commands.emplace_back("exhaustive_matcher", &RunExhaustiveMatcher);
@@ -32,7 +32,9 @@
 #include "exe/database.h"
 
 #include "base/database.h"
+#include "base/feature_store.h"
 #include "util/misc.h"
+#include "util/timer.h"
 #include "util/option_manager.h"
 
 namespace colmap {
@@ -88,6 +90,41 @@ int RunDatabaseCreator(int argc, char** argv) {
   return EXIT_SUCCESS;
 }
 
+int RunDatabaseFeatureStore(int argc, char** argv) {
+  std::string output_path;
+
+  OptionManager options;
+  options.AddDatabaseOptions();
+  options.AddDefaultOption("output_path", &output_path,
+                           "Defaults to DATABASE_PATH.features");
+  options.Parse(argc, argv);
+
+  if (output_path.empty()) {
+    output_path = FeatureStore::DefaultPath(*options.database_path);
+  }
+
+  PrintHeading1("Writing feature store");
+
+  Timer timer;
+  timer.Start();
+
+  Database database(*options.database_path);
+  FeatureStore::Write(database, output_path);
+
+  FeatureStore feature_store;
+  if (!feature_store.Open(output_path)) {
+    std::cerr << "ERROR: Failed to open written feature store" << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  std::cout << StringPrintf("Wrote features of %d images to %s",
+                            feature_store.NumImages(), output_path.c_str())
+            << std::endl;
+  timer.PrintMinutes();
+
+  return EXIT_SUCCESS;
+}
+
 int RunDatabaseMerger(int argc, char** argv) {
   std::string database_path1;
   std::string database_path2;
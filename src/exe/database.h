@@ -33,6 +33,7 @@ namespace colmap {
 
 int RunDatabaseCleaner(int argc, char** argv);
 int RunDatabaseCreator(int argc, char** argv);
+int RunDatabaseFeatureStore(int argc, char** argv);
 int RunDatabaseMerger(int argc, char** argv);
 
 }  // namespace colmap
@@ -970,7 +970,8 @@ int RunModelSplitter(int argc, char** argv) {
     }
   };
 
-  ThreadPool thread_pool(GetEffectiveNumThreads(num_threads));
+  ThreadBudgetLease thread_budget_lease(num_threads);
+  ThreadPool thread_pool(thread_budget_lease.NumThreads());
   for (size_t idx = 0; idx < num_parts; ++idx) {
     thread_pool.AddTask(SplitReconstruction, idx);
   }
@@ -90,6 +90,10 @@ SiftFeatureExtractor::SiftFeatureExtractor(
       image_reader_(reader_options_, &database_) {
   CHECK(reader_options_.Check());
   CHECK(sift_options_.Check());
+}
+
+void SiftFeatureExtractor::Run() {
+  PrintHeading1("Feature extraction");
 
   std::shared_ptr<Bitmap> camera_mask;
   if (!reader_options_.camera_mask_path.empty()) {
@@ -103,7 +107,11 @@ SiftFeatureExtractor::SiftFeatureExtractor(
     }
   }
 
-  const int num_threads = GetEffectiveNumThreads(sift_options_.num_threads);
+  // The threads are only borrowed while extracting, and the thread count of
+  // the user is kept.
+  ThreadBudgetLease thread_budget_lease(sift_options_.num_threads,
+                                        /*limit_explicit_num_threads=*/false);
+  const int num_threads = thread_budget_lease.NumThreads();
   CHECK_GT(num_threads, 0);
 
   // Make sure that we only have limited number of objects in the queue to avoid
@@ -169,10 +177,6 @@ SiftFeatureExtractor::SiftFeatureExtractor(
 
   writer_.reset(new internal::FeatureWriterThread(
       image_reader_.NumImages(), &database_, writer_queue_.get()));
-}
-
-void SiftFeatureExtractor::Run() {
-  PrintHeading1("Feature extraction");
 
   for (auto& resizer : resizers_) {
     resizer->Start();
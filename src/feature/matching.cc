@@ -44,6 +44,15 @@
 namespace colmap {
 namespace {
 
+std::string FeatureStorePath(const SiftMatchingOptions& match_options,
+                             const std::string& database_path) {
+  if (match_options.use_feature_store) {
+    return FeatureStore::DefaultPath(database_path);
+  } else {
+    return "";
+  }
+}
+
 void PrintElapsedTime(const Timer& timer) {
   std::cout << StringPrintf(" in %.3fs", timer.ElapsedSeconds()) << std::endl;
 }
@@ -68,8 +77,8 @@ void IndexImagesInVisualIndex(const int num_threads, const int num_checks,
     std::cout << StringPrintf("Indexing image [%d/%d]", i + 1, image_ids.size())
               << std::flush;
 
-    auto keypoints = cache->GetKeypoints(image_ids[i]);
-    auto descriptors = cache->GetDescriptors(image_ids[i]);
+    auto keypoints = *cache->GetKeypoints(image_ids[i]);
+    auto descriptors = *cache->GetDescriptors(image_ids[i]);
     if (max_num_features > 0 && descriptors.rows() > max_num_features) {
       ExtractTopScaleFeatures(&keypoints, &descriptors, max_num_features);
     }
@@ -107,8 +116,8 @@ void MatchNearestNeighborsInVisualIndex(
   query_options.num_checks = num_checks;
   query_options.num_images_after_verification = num_images_after_verification;
   auto QueryFunc = [&](const image_t image_id) {
-    auto keypoints = cache->GetKeypoints(image_id);
-    auto descriptors = cache->GetDescriptors(image_id);
+    auto keypoints = *cache->GetKeypoints(image_id);
+    auto descriptors = *cache->GetDescriptors(image_id);
     if (max_num_features > 0 && descriptors.rows() > max_num_features) {
       ExtractTopScaleFeatures(&keypoints, &descriptors, max_num_features);
     }
@@ -212,12 +221,28 @@ bool ImagePairsMatchingOptions::Check() const {
 
 bool FeaturePairsMatchingOptions::Check() const { return true; }
 
-FeatureMatcherCache::FeatureMatcherCache(const size_t cache_size,
-                                         const Database* database)
-    : cache_size_(cache_size), database_(database) {
+FeatureMatcherCache::FeatureMatcherCache(
+    const size_t cache_size, Database* database,
+    const std::string& feature_store_path)
+    : cache_size_(cache_size),
+      database_(database),
+      feature_store_path_(feature_store_path),
+      num_writes_in_progress_(0),
+      stop_writer_(false) {
   CHECK_NOTNULL(database_);
 }
 
+FeatureMatcherCache::~FeatureMatcherCache() {
+  {
+    std::unique_lock<std::mutex> lock(write_mutex_);
+    stop_writer_ = true;
+  }
+  write_condition_.notify_all();
+  if (writer_thread_.joinable()) {
+    writer_thread_.join();
+  }
+}
+
 void FeatureMatcherCache::Setup() {
   const std::vector<Camera> cameras = database_->ReadAllCameras();
   cameras_cache_.reserve(cameras.size());
@@ -231,25 +256,53 @@ void FeatureMatcherCache::Setup() {
     images_cache_.emplace(image.ImageId(), image);
   }
 
-  keypoints_cache_.reset(new LRUCache<image_t, FeatureKeypoints>(
+  // Only use the features of the store for images whose features were not
+  // rewritten in the database since the store was written.
+  stored_image_ids_.clear();
+  if (!feature_store_path_.empty() &&
+      feature_store_.Open(feature_store_path_)) {
+    for (const auto& image : images) {
+      if (feature_store_.IsUpToDate(*database_, image.ImageId())) {
+        stored_image_ids_.insert(image.ImageId());
+      }
+    }
+    std::cout << StringPrintf("Using feature store for %d of %d images",
+                              stored_image_ids_.size(), images.size())
+              << std::endl;
+  }
+
+  keypoints_image_ids_.clear();
+  descriptors_image_ids_.clear();
+  for (const auto& image : images) {
+    if (database_->ExistsKeypoints(image.ImageId())) {
+      keypoints_image_ids_.insert(image.ImageId());
+    }
+    if (database_->ExistsDescriptors(image.ImageId())) {
+      descriptors_image_ids_.insert(image.ImageId());
+    }
+  }
+
+  keypoints_cache_.reset(new ShardedLRUCache<image_t, FeatureKeypoints>(
       cache_size_, [this](const image_t image_id) {
+        if (ExistsStoredFeatures(image_id)) {
+          return feature_store_.Keypoints(image_id).ToFeatureKeypoints();
+        }
+        std::unique_lock<std::mutex> lock(database_mutex_);
         return database_->ReadKeypoints(image_id);
       }));
 
-  descriptors_cache_.reset(new LRUCache<image_t, FeatureDescriptors>(
+  descriptors_cache_.reset(new ShardedLRUCache<image_t, FeatureDescriptors>(
       cache_size_, [this](const image_t image_id) {
+        if (ExistsStoredFeatures(image_id)) {
+          return FeatureDescriptors(feature_store_.Descriptors(image_id));
+        }
+        std::unique_lock<std::mutex> lock(database_mutex_);
         return database_->ReadDescriptors(image_id);
       }));
 
-  keypoints_exists_cache_.reset(new LRUCache<image_t, bool>(
-      images.size(), [this](const image_t image_id) {
-        return database_->ExistsKeypoints(image_id);
-      }));
-
-  descriptors_exists_cache_.reset(new LRUCache<image_t, bool>(
-      images.size(), [this](const image_t image_id) {
-        return database_->ExistsDescriptors(image_id);
-      }));
+  if (!writer_thread_.joinable()) {
+    writer_thread_ = std::thread(&FeatureMatcherCache::WriteLoop, this);
+  }
 }
 
 const Camera& FeatureMatcherCache::GetCamera(const camera_t camera_id) const {
@@ -260,20 +313,40 @@ const Image& FeatureMatcherCache::GetImage(const image_t image_id) const {
   return images_cache_.at(image_id);
 }
 
-const FeatureKeypoints& FeatureMatcherCache::GetKeypoints(
+std::shared_ptr<const FeatureKeypoints> FeatureMatcherCache::GetKeypoints(
     const image_t image_id) {
-  std::unique_lock<std::mutex> lock(database_mutex_);
   return keypoints_cache_->Get(image_id);
 }
 
-const FeatureDescriptors& FeatureMatcherCache::GetDescriptors(
+std::shared_ptr<const FeatureDescriptors> FeatureMatcherCache::GetDescriptors(
     const image_t image_id) {
-  std::unique_lock<std::mutex> lock(database_mutex_);
   return descriptors_cache_->Get(image_id);
 }
 
+void FeatureMatcherCache::Prefetch(const std::vector<image_t>& image_ids) {
+  for (const image_t image_id : image_ids) {
+    if (ExistsKeypoints(image_id)) {
+      keypoints_cache_->Get(image_id);
+    }
+    if (ExistsDescriptors(image_id) && !ExistsStoredFeatures(image_id)) {
+      descriptors_cache_->Get(image_id);
+    }
+  }
+}
+
+bool FeatureMatcherCache::ExistsStoredFeatures(const image_t image_id) const {
+  return stored_image_ids_.count(image_id) > 0;
+}
+
+FeatureStore::DescriptorsMap FeatureMatcherCache::GetStoredDescriptors(
+    const image_t image_id) const {
+  CHECK(ExistsStoredFeatures(image_id));
+  return feature_store_.Descriptors(image_id);
+}
+
 FeatureMatches FeatureMatcherCache::GetMatches(const image_t image_id1,
                                                const image_t image_id2) {
+  FlushImagePairWrites(image_id1, image_id2);
   std::unique_lock<std::mutex> lock(database_mutex_);
   return database_->ReadMatches(image_id1, image_id2);
 }
@@ -287,24 +360,24 @@ std::vector<image_t> FeatureMatcherCache::GetImageIds() const {
   return image_ids;
 }
 
-bool FeatureMatcherCache::ExistsKeypoints(const image_t image_id) {
-  std::unique_lock<std::mutex> lock(database_mutex_);
-  return keypoints_exists_cache_->Get(image_id);
+bool FeatureMatcherCache::ExistsKeypoints(const image_t image_id) const {
+  return keypoints_image_ids_.count(image_id) > 0;
 }
 
-bool FeatureMatcherCache::ExistsDescriptors(const image_t image_id) {
-  std::unique_lock<std::mutex> lock(database_mutex_);
-  return descriptors_exists_cache_->Get(image_id);
+bool FeatureMatcherCache::ExistsDescriptors(const image_t image_id) const {
+  return descriptors_image_ids_.count(image_id) > 0;
 }
 
 bool FeatureMatcherCache::ExistsMatches(const image_t image_id1,
                                         const image_t image_id2) {
+  FlushImagePairWrites(image_id1, image_id2);
   std::unique_lock<std::mutex> lock(database_mutex_);
   return database_->ExistsMatches(image_id1, image_id2);
 }
 
 bool FeatureMatcherCache::ExistsInlierMatches(const image_t image_id1,
                                               const image_t image_id2) {
+  FlushImagePairWrites(image_id1, image_id2);
   std::unique_lock<std::mutex> lock(database_mutex_);
   return database_->ExistsInlierMatches(image_id1, image_id2);
 }
@@ -312,29 +385,134 @@ bool FeatureMatcherCache::ExistsInlierMatches(const image_t image_id1,
 void FeatureMatcherCache::WriteMatches(const image_t image_id1,
                                        const image_t image_id2,
                                        const FeatureMatches& matches) {
-  std::unique_lock<std::mutex> lock(database_mutex_);
-  database_->WriteMatches(image_id1, image_id2, matches);
+  {
+    std::unique_lock<std::mutex> lock(write_mutex_);
+    WaitForWriteQueue(&lock);
+    pending_writes_.matches_image_pairs.emplace_back(image_id1, image_id2);
+    pending_writes_.matches.push_back(matches);
+    RegisterPendingWrite(image_id1, image_id2);
+  }
+  write_condition_.notify_one();
 }
 
 void FeatureMatcherCache::WriteTwoViewGeometry(
     const image_t image_id1, const image_t image_id2,
     const TwoViewGeometry& two_view_geometry) {
-  std::unique_lock<std::mutex> lock(database_mutex_);
-  database_->WriteTwoViewGeometry(image_id1, image_id2, two_view_geometry);
+  {
+    std::unique_lock<std::mutex> lock(write_mutex_);
+    WaitForWriteQueue(&lock);
+    pending_writes_.two_view_geometry_image_pairs.emplace_back(image_id1,
+                                                               image_id2);
+    pending_writes_.two_view_geometries.push_back(two_view_geometry);
+    RegisterPendingWrite(image_id1, image_id2);
+  }
+  write_condition_.notify_one();
+}
+
+void FeatureMatcherCache::FlushWrites() {
+  std::unique_lock<std::mutex> lock(write_mutex_);
+  flush_condition_.wait(lock, [this]() {
+    return pending_writes_.Size() == 0 && num_writes_in_progress_ == 0;
+  });
 }
 
 void FeatureMatcherCache::DeleteMatches(const image_t image_id1,
                                         const image_t image_id2) {
+  FlushImagePairWrites(image_id1, image_id2);
   std::unique_lock<std::mutex> lock(database_mutex_);
   database_->DeleteMatches(image_id1, image_id2);
 }
 
 void FeatureMatcherCache::DeleteInlierMatches(const image_t image_id1,
                                               const image_t image_id2) {
+  FlushImagePairWrites(image_id1, image_id2);
   std::unique_lock<std::mutex> lock(database_mutex_);
   database_->DeleteInlierMatches(image_id1, image_id2);
 }
 
+size_t FeatureMatcherCache::PendingWrites::Size() const {
+  return matches.size() + two_view_geometries.size();
+}
+
+void FeatureMatcherCache::WaitForWriteQueue(
+    std::unique_lock<std::mutex>* lock) {
+  // Bound the memory of the queue, if the writer cannot keep up.
+  const size_t kMaxNumPendingWrites = 16384;
+  CHECK(writer_thread_.joinable()) << "Setup must be called before writing";
+  while (pending_writes_.Size() >= kMaxNumPendingWrites) {
+    flush_condition_.wait(*lock);
+  }
+}
+
+void FeatureMatcherCache::RegisterPendingWrite(const image_t image_id1,
+                                               const image_t image_id2) {
+  num_pending_image_pair_writes_[Database::ImagePairToPairId(
+      image_id1, image_id2)] += 1;
+}
+
+void FeatureMatcherCache::FlushImagePairWrites(const image_t image_id1,
+                                               const image_t image_id2) {
+  const image_pair_t pair_id =
+      Database::ImagePairToPairId(image_id1, image_id2);
+  std::unique_lock<std::mutex> lock(write_mutex_);
+  flush_condition_.wait(lock, [this, pair_id]() {
+    return num_pending_image_pair_writes_.count(pair_id) == 0;
+  });
+}
+
+void FeatureMatcherCache::WriteLoop() {
+  PendingWrites writes;
+  while (true) {
+    {
+      std::unique_lock<std::mutex> lock(write_mutex_);
+      write_condition_.wait(lock, [this]() {
+        return stop_writer_ || pending_writes_.Size() > 0;
+      });
+      if (pending_writes_.Size() == 0) {
+        break;
+      }
+      // Take all queued writes at once, so that the writes accumulated while
+      // the previous batch was committed are committed in one transaction.
+      std::swap(writes, pending_writes_);
+      num_writes_in_progress_ = writes.Size();
+    }
+    flush_condition_.notify_all();
+
+    {
+      std::unique_lock<std::mutex> lock(database_mutex_);
+      DatabaseTransaction database_transaction(database_);
+      database_->WriteMatches(writes.matches_image_pairs, writes.matches);
+      database_->WriteTwoViewGeometries(writes.two_view_geometry_image_pairs,
+                                        writes.two_view_geometries);
+    }
+
+    {
+      std::unique_lock<std::mutex> lock(write_mutex_);
+      auto UnregisterPendingWrites =
+          [this](const std::vector<std::pair<image_t, image_t>>& image_pairs) {
+            for (const auto& image_pair : image_pairs) {
+              const auto it = num_pending_image_pair_writes_.find(
+                  Database::ImagePairToPairId(image_pair.first,
+                                              image_pair.second));
+              CHECK(it != num_pending_image_pair_writes_.end());
+              if (--it->second == 0) {
+                num_pending_image_pair_writes_.erase(it);
+              }
+            }
+          };
+      UnregisterPendingWrites(writes.matches_image_pairs);
+      UnregisterPendingWrites(writes.two_view_geometry_image_pairs);
+      num_writes_in_progress_ = 0;
+    }
+    flush_condition_.notify_all();
+
+    writes.matches_image_pairs.clear();
+    writes.matches.clear();
+    writes.two_view_geometry_image_pairs.clear();
+    writes.two_view_geometries.clear();
+  }
+}
+
 FeatureMatcherThread::FeatureMatcherThread(const SiftMatchingOptions& options,
                                            FeatureMatcherCache* cache)
     : options_(options), cache_(cache) {}
@@ -343,13 +521,53 @@ void FeatureMatcherThread::SetMaxNumMatches(const int max_num_matches) {
   options_.max_num_matches = max_num_matches;
 }
 
-SiftCPUFeatureMatcher::SiftCPUFeatureMatcher(const SiftMatchingOptions& options,
-                                             FeatureMatcherCache* cache,
-                                             JobQueue<Input>* input_queue,
-                                             JobQueue<Output>* output_queue)
+SiftDescriptorIndexCache::SiftDescriptorIndexCache(const size_t max_num_bytes,
+                                                   FeatureMatcherCache* cache)
+    : cache_(cache),
+      indices_(max_num_bytes, [this](const image_t image_id) {
+        return BuildIndex(image_id);
+      }) {
+  CHECK_NOTNULL(cache_);
+}
+
+SiftDescriptorIndex SiftDescriptorIndexCache::Get(const image_t image_id) {
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+    if (indices_.Exists(image_id)) {
+      return indices_.Get(image_id);
+    }
+  }
+
+  // Build the index without holding the lock, so that the other threads can
+  // concurrently build or look up indices. If two threads build the index of
+  // the same image, the later one is discarded.
+  SiftDescriptorIndex index = BuildIndex(image_id);
+
+  std::unique_lock<std::mutex> lock(mutex_);
+  if (indices_.Exists(image_id)) {
+    return indices_.Get(image_id);
+  }
+  SiftDescriptorIndex cached_index = index;
+  indices_.Set(image_id, std::move(cached_index));
+  return index;
+}
+
+SiftDescriptorIndex SiftDescriptorIndexCache::BuildIndex(
+    const image_t image_id) {
+  if (cache_->ExistsStoredFeatures(image_id)) {
+    return SiftDescriptorIndex(cache_->GetStoredDescriptors(image_id));
+  }
+  return SiftDescriptorIndex(*cache_->GetDescriptors(image_id));
+}
+
+SiftCPUFeatureMatcher::SiftCPUFeatureMatcher(
+    const SiftMatchingOptions& options, FeatureMatcherCache* cache,
+    JobQueue<Input>* input_queue, JobQueue<Output>* output_queue,
+    SiftDescriptorIndexCache* index_cache)
     : FeatureMatcherThread(options, cache),
       input_queue_(input_queue),
-      output_queue_(output_queue) {
+      output_queue_(output_queue),
+      index_cache_(index_cache) {
   CHECK(options_.Check());
 }
 
@@ -371,11 +589,31 @@ void SiftCPUFeatureMatcher::Run() {
         continue;
       }
 
-      const FeatureDescriptors descriptors1 =
-          cache_->GetDescriptors(data.image_id1);
-      const FeatureDescriptors descriptors2 =
-          cache_->GetDescriptors(data.image_id2);
-      MatchSiftFeaturesCPU(options_, descriptors1, descriptors2, &data.matches);
+      // The search index of each image is built once and then reused for
+      // all pairs of the image.
+      if (index_cache_ != nullptr) {
+        MatchSiftFeaturesCPU(options_, index_cache_->Get(data.image_id1),
+                             index_cache_->Get(data.image_id2), &data.matches);
+        CHECK(output_queue_->Push(data));
+        continue;
+      }
+
+      // Match directly on the memory-mapped descriptors if possible, which
+      // avoids reading and copying them under the lock of the cache.
+      if (cache_->ExistsStoredFeatures(data.image_id1) &&
+          cache_->ExistsStoredFeatures(data.image_id2)) {
+        MatchSiftFeaturesCPU(options_,
+                             cache_->GetStoredDescriptors(data.image_id1),
+                             cache_->GetStoredDescriptors(data.image_id2),
+                             &data.matches);
+        CHECK(output_queue_->Push(data));
+        continue;
+      }
+
+      const auto descriptors1 = cache_->GetDescriptors(data.image_id1);
+      const auto descriptors2 = cache_->GetDescriptors(data.image_id2);
+      MatchSiftFeaturesCPU(options_, *descriptors1, *descriptors2,
+                           &data.matches);
 
       CHECK(output_queue_->Push(data));
     }
@@ -450,7 +688,7 @@ void SiftGPUFeatureMatcher::GetDescriptorData(
     *descriptors_ptr = nullptr;
   } else {
     prev_uploaded_descriptors_[index] = cache_->GetDescriptors(image_id);
-    *descriptors_ptr = &prev_uploaded_descriptors_[index];
+    *descriptors_ptr = prev_uploaded_descriptors_[index].get();
     prev_uploaded_image_ids_[index] = image_id;
   }
 }
@@ -490,14 +728,13 @@ void GuidedSiftCPUFeatureMatcher::Run() {
         continue;
       }
 
-      const FeatureKeypoints keypoints1 = cache_->GetKeypoints(data.image_id1);
-      const FeatureKeypoints keypoints2 = cache_->GetKeypoints(data.image_id2);
-      const FeatureDescriptors descriptors1 =
-          cache_->GetDescriptors(data.image_id1);
-      const FeatureDescriptors descriptors2 =
-          cache_->GetDescriptors(data.image_id2);
-      MatchGuidedSiftFeaturesCPU(options_, keypoints1, keypoints2, descriptors1,
-                                 descriptors2, &data.two_view_geometry);
+      const auto keypoints1 = cache_->GetKeypoints(data.image_id1);
+      const auto keypoints2 = cache_->GetKeypoints(data.image_id2);
+      const auto descriptors1 = cache_->GetDescriptors(data.image_id1);
+      const auto descriptors2 = cache_->GetDescriptors(data.image_id2);
+      MatchGuidedSiftFeaturesCPU(options_, *keypoints1, *keypoints2,
+                                 *descriptors1, *descriptors2,
+                                 &data.two_view_geometry);
 
       CHECK(output_queue_->Push(data));
     }
@@ -586,8 +823,8 @@ void GuidedSiftGPUFeatureMatcher::GetFeatureData(
   } else {
     prev_uploaded_keypoints_[index] = cache_->GetKeypoints(image_id);
     prev_uploaded_descriptors_[index] = cache_->GetDescriptors(image_id);
-    *keypoints_ptr = &prev_uploaded_keypoints_[index];
-    *descriptors_ptr = &prev_uploaded_descriptors_[index];
+    *keypoints_ptr = prev_uploaded_keypoints_[index].get();
+    *descriptors_ptr = prev_uploaded_descriptors_[index].get();
     prev_uploaded_image_ids_[index] = image_id;
   }
 }
@@ -635,8 +872,8 @@ void TwoViewGeometryVerifier::Run() {
           cache_->GetCamera(cache_->GetImage(data.image_id2).CameraId());
       const auto keypoints1 = cache_->GetKeypoints(data.image_id1);
       const auto keypoints2 = cache_->GetKeypoints(data.image_id2);
-      const auto points1 = FeatureKeypointsToPointsVector(keypoints1);
-      const auto points2 = FeatureKeypointsToPointsVector(keypoints2);
+      const auto points1 = FeatureKeypointsToPointsVector(*keypoints1);
+      const auto points2 = FeatureKeypointsToPointsVector(*keypoints2);
 
       if (options_.multiple_models) {
         data.two_view_geometry.EstimateMultiple(camera1, points1, camera2,
@@ -656,10 +893,15 @@ void TwoViewGeometryVerifier::Run() {
 SiftFeatureMatcher::SiftFeatureMatcher(const SiftMatchingOptions& options,
                                        Database* database,
                                        FeatureMatcherCache* cache)
-    : options_(options), database_(database), cache_(cache), is_setup_(false) {
+    : options_(options),
+      database_(database),
+      cache_(cache),
+      thread_budget_lease_(options_.num_threads,
+                           /*limit_explicit_num_threads=*/false),
+      is_setup_(false) {
   CHECK(options_.Check());
 
-  const int num_threads = GetEffectiveNumThreads(options_.num_threads);
+  const int num_threads = thread_budget_lease_.NumThreads();
   CHECK_GT(num_threads, 0);
 
   std::vector<int> gpu_indices = CSVToVector<int>(options_.gpu_index);
@@ -683,10 +925,17 @@ SiftFeatureMatcher::SiftFeatureMatcher(const SiftMatchingOptions& options,
           gpu_options, cache, &matcher_queue_, &verifier_queue_));
     }
   } else {
+    if (options_.cpu_index_cache_size > 0 &&
+        !options_.cpu_brute_force_matcher) {
+      index_cache_.reset(new SiftDescriptorIndexCache(
+          static_cast<size_t>(options_.cpu_index_cache_size) * 1024 * 1024,
+          cache));
+    }
     matchers_.reserve(num_threads);
     for (int i = 0; i < num_threads; ++i) {
-      matchers_.emplace_back(new SiftCPUFeatureMatcher(
-          options_, cache, &matcher_queue_, &verifier_queue_));
+      matchers_.emplace_back(
+          new SiftCPUFeatureMatcher(options_, cache, &matcher_queue_,
+                                    &verifier_queue_, index_cache_.get()));
     }
   }
 
@@ -794,18 +1043,22 @@ bool SiftFeatureMatcher::Setup() {
 
 void SiftFeatureMatcher::Match(
     const std::vector<std::pair<image_t, image_t>>& image_pairs) {
+  Submit(image_pairs);
+  while (WaitForBatch()) {
+  }
+
+  // The results are committed by the writer thread of the cache, while the
+  // next image pairs are already matched.
+
+  CHECK_EQ(output_queue_.Size(), 0);
+}
+
+void SiftFeatureMatcher::Submit(
+    const std::vector<std::pair<image_t, image_t>>& image_pairs) {
   CHECK_NOTNULL(database_);
   CHECK_NOTNULL(cache_);
   CHECK(is_setup_);
 
-  if (image_pairs.empty()) {
-    return;
-  }
-
-  //////////////////////////////////////////////////////////////////////////////
-  // Match the image pairs
-  //////////////////////////////////////////////////////////////////////////////
-
   std::unordered_set<image_pair_t> image_pair_ids;
   image_pair_ids.reserve(image_pairs.size());
 
@@ -858,10 +1111,19 @@ void SiftFeatureMatcher::Match(
     }
   }
 
-  //////////////////////////////////////////////////////////////////////////////
-  // Write results to database
-  //////////////////////////////////////////////////////////////////////////////
+  pending_batch_sizes_.push_back(num_outputs);
+}
+
+bool SiftFeatureMatcher::WaitForBatch() {
+  if (pending_batch_sizes_.empty()) {
+    return false;
+  }
+
+  const size_t num_outputs = pending_batch_sizes_.front();
+  pending_batch_sizes_.pop_front();
 
+  // The outputs of all pending batches share the same queue, but all outputs
+  // are written in the same way, so it does not matter which ones are popped.
   for (size_t i = 0; i < num_outputs; ++i) {
     const auto output_job = output_queue_.Pop();
     CHECK(output_job.IsValid());
@@ -881,7 +1143,11 @@ void SiftFeatureMatcher::Match(
                                  output.two_view_geometry);
   }
 
-  CHECK_EQ(output_queue_.Size(), 0);
+  return true;
+}
+
+size_t SiftFeatureMatcher::NumPendingBatches() const {
+  return pending_batch_sizes_.size();
 }
 
 ExhaustiveFeatureMatcher::ExhaustiveFeatureMatcher(
@@ -890,8 +1156,8 @@ ExhaustiveFeatureMatcher::ExhaustiveFeatureMatcher(
     : options_(options),
       match_options_(match_options),
       database_(database_path),
-      cache_(5 * options_.block_size, &database_),
-      matcher_(match_options, &database_, &cache_) {
+      cache_(5 * options_.block_size, &database_,
+             FeatureStorePath(match_options, database_path)) {
   CHECK(options_.Check());
   CHECK(match_options_.Check());
 }
@@ -899,7 +1165,8 @@ ExhaustiveFeatureMatcher::ExhaustiveFeatureMatcher(
 void ExhaustiveFeatureMatcher::Run() {
   PrintHeading1("Exhaustive feature matching");
 
-  if (!matcher_.Setup()) {
+  SiftFeatureMatcher matcher(match_options_, &database_, &cache_);
+  if (!matcher.Setup()) {
     return;
   }
 
@@ -912,51 +1179,113 @@ void ExhaustiveFeatureMatcher::Run() {
       std::ceil(static_cast<double>(image_ids.size()) / block_size));
   const size_t num_pairs_per_block = block_size * (block_size - 1) / 2;
 
+  // Traverse the blocks in serpentine order, so that consecutive blocks share
+  // the images of one block and their features are likely still cached.
+  std::vector<std::pair<size_t, size_t>> block_idxs;
+  block_idxs.reserve(num_blocks * num_blocks);
+  for (size_t block_idx1 = 0; block_idx1 < num_blocks; ++block_idx1) {
+    for (size_t i = 0; i < num_blocks; ++i) {
+      const size_t block_idx2 = block_idx1 % 2 == 0 ? i : num_blocks - i - 1;
+      block_idxs.emplace_back(block_idx1, block_idx2);
+    }
+  }
+
   std::vector<std::pair<image_t, image_t>> image_pairs;
   image_pairs.reserve(num_pairs_per_block);
 
-  for (size_t start_idx1 = 0; start_idx1 < image_ids.size();
-       start_idx1 += block_size) {
+  const auto SubmitBlock = [&](const size_t block_idx) {
+    const size_t start_idx1 = block_idxs[block_idx].first * block_size;
     const size_t end_idx1 =
         std::min(image_ids.size(), start_idx1 + block_size) - 1;
-    for (size_t start_idx2 = 0; start_idx2 < image_ids.size();
-         start_idx2 += block_size) {
-      const size_t end_idx2 =
-          std::min(image_ids.size(), start_idx2 + block_size) - 1;
-
-      if (IsStopped()) {
-        GetTimer().PrintMinutes();
-        return;
-      }
+    const size_t start_idx2 = block_idxs[block_idx].second * block_size;
+    const size_t end_idx2 =
+        std::min(image_ids.size(), start_idx2 + block_size) - 1;
 
-      Timer timer;
-      timer.Start();
-
-      std::cout << StringPrintf("Matching block [%d/%d, %d/%d]",
-                                start_idx1 / block_size + 1, num_blocks,
-                                start_idx2 / block_size + 1, num_blocks)
-                << std::flush;
-
-      image_pairs.clear();
-      for (size_t idx1 = start_idx1; idx1 <= end_idx1; ++idx1) {
-        for (size_t idx2 = start_idx2; idx2 <= end_idx2; ++idx2) {
-          const size_t block_id1 = idx1 % block_size;
-          const size_t block_id2 = idx2 % block_size;
-          if ((idx1 > idx2 && block_id1 <= block_id2) ||
-              (idx1 < idx2 &&
-               block_id1 < block_id2)) {  // Avoid duplicate pairs
-            image_pairs.emplace_back(image_ids[idx1], image_ids[idx2]);
-          }
+    image_pairs.clear();
+    for (size_t idx1 = start_idx1; idx1 <= end_idx1; ++idx1) {
+      for (size_t idx2 = start_idx2; idx2 <= end_idx2; ++idx2) {
+        const size_t block_id1 = idx1 % block_size;
+        const size_t block_id2 = idx2 % block_size;
+        if ((idx1 > idx2 && block_id1 <= block_id2) ||
+            (idx1 < idx2 &&
+             block_id1 < block_id2)) {  // Avoid duplicate pairs
+          image_pairs.emplace_back(image_ids[idx1], image_ids[idx2]);
         }
       }
+    }
+
+    matcher.Submit(image_pairs);
+  };
+
+  const auto GetBlockImageIds = [&](const size_t block_idx) {
+    std::vector<image_t> block_image_ids;
+    const auto AddImageIds = [&](const size_t image_block_idx) {
+      const size_t start_idx = image_block_idx * block_size;
+      const size_t end_idx = std::min(image_ids.size(), start_idx + block_size);
+      block_image_ids.insert(block_image_ids.end(),
+                             image_ids.begin() + start_idx,
+                             image_ids.begin() + end_idx);
+    };
+    AddImageIds(block_idxs[block_idx].first);
+    if (block_idxs[block_idx].second != block_idxs[block_idx].first) {
+      AddImageIds(block_idxs[block_idx].second);
+    }
+    return block_image_ids;
+  };
+
+  // The next block is always submitted before the results of the current
+  // block are collected, so the matchers immediately continue with the next
+  // block, while the features of the block after are loaded in the
+  // background. The cache holds the features of these three blocks, since
+  // they span at most four block rows and columns in serpentine order. The
+  // prefetch thread is borrowed from the thread budget like all other threads.
+  ThreadBudgetLease prefetch_thread_budget_lease(1);
+  ThreadPool prefetch_thread_pool(prefetch_thread_budget_lease.NumThreads());
+  std::future<void> prefetch_future;
+
+  if (!block_idxs.empty()) {
+    SubmitBlock(0);
+  }
+
+  for (size_t block_idx = 0; block_idx < block_idxs.size(); ++block_idx) {
+    if (IsStopped()) {
+      while (matcher.WaitForBatch()) {
+      }
+      cache_.FlushWrites();
+      GetTimer().PrintMinutes();
+      return;
+    }
+
+    Timer timer;
+    timer.Start();
 
-      DatabaseTransaction database_transaction(&database_);
-      matcher_.Match(image_pairs);
+    if (block_idx + 1 < block_idxs.size()) {
+      SubmitBlock(block_idx + 1);
+    }
 
-      PrintElapsedTime(timer);
+    if (block_idx + 2 < block_idxs.size()) {
+      if (prefetch_future.valid()) {
+        prefetch_future.get();
+      }
+      prefetch_future = prefetch_thread_pool.AddTask(
+          [this](const std::vector<image_t>& block_image_ids) {
+            cache_.Prefetch(block_image_ids);
+          },
+          GetBlockImageIds(block_idx + 2));
     }
+
+    std::cout << StringPrintf("Matching block [%d/%d, %d/%d]",
+                              block_idxs[block_idx].first + 1, num_blocks,
+                              block_idxs[block_idx].second + 1, num_blocks)
+              << std::flush;
+
+    CHECK(matcher.WaitForBatch());
+
+    PrintElapsedTime(timer);
   }
 
+  cache_.FlushWrites();
+
   GetTimer().PrintMinutes();
 }
 
@@ -968,8 +1297,7 @@ SequentialFeatureMatcher::SequentialFeatureMatcher(
       database_(database_path),
       cache_(std::max(5 * options_.loop_detection_num_images,
                       5 * options_.overlap),
-             &database_),
-      matcher_(match_options, &database_, &cache_) {
+             &database_, FeatureStorePath(match_options, database_path)) {
   CHECK(options_.Check());
   CHECK(match_options_.Check());
 }
@@ -977,7 +1305,8 @@ SequentialFeatureMatcher::SequentialFeatureMatcher(
 void SequentialFeatureMatcher::Run() {
   PrintHeading1("Sequential feature matching");
 
-  if (!matcher_.Setup()) {
+  SiftFeatureMatcher matcher(match_options_, &database_, &cache_);
+  if (!matcher.Setup()) {
     return;
   }
 
@@ -985,11 +1314,13 @@ void SequentialFeatureMatcher::Run() {
 
   const std::vector<image_t> ordered_image_ids = GetOrderedImageIds();
 
-  RunSequentialMatching(ordered_image_ids);
+  RunSequentialMatching(ordered_image_ids, &matcher);
   if (options_.loop_detection) {
-    RunLoopDetection(ordered_image_ids);
+    RunLoopDetection(ordered_image_ids, &matcher);
   }
 
+  cache_.FlushWrites();
+
   GetTimer().PrintMinutes();
 }
 
@@ -1017,7 +1348,7 @@ std::vector<image_t> SequentialFeatureMatcher::GetOrderedImageIds() const {
 }
 
 void SequentialFeatureMatcher::RunSequentialMatching(
-    const std::vector<image_t>& image_ids) {
+    const std::vector<image_t>& image_ids, SiftFeatureMatcher* matcher) {
   std::vector<std::pair<image_t, image_t>> image_pairs;
   image_pairs.reserve(options_.overlap);
 
@@ -1052,15 +1383,14 @@ void SequentialFeatureMatcher::RunSequentialMatching(
       }
     }
 
-    DatabaseTransaction database_transaction(&database_);
-    matcher_.Match(image_pairs);
+    matcher->Match(image_pairs);
 
     PrintElapsedTime(timer);
   }
 }
 
 void SequentialFeatureMatcher::RunLoopDetection(
-    const std::vector<image_t>& image_ids) {
+    const std::vector<image_t>& image_ids, SiftFeatureMatcher* matcher) {
   // Read the pre-trained vocabulary tree from disk.
   retrieval::VisualIndex<> visual_index;
   visual_index.Read(options_.vocab_tree_path);
@@ -1088,7 +1418,7 @@ void SequentialFeatureMatcher::RunLoopDetection(
       options_.loop_detection_num_checks,
       options_.loop_detection_num_images_after_verification,
       options_.loop_detection_max_num_features, match_image_ids, this, &cache_,
-      &visual_index, &matcher_);
+      &visual_index, matcher);
 }
 
 VocabTreeFeatureMatcher::VocabTreeFeatureMatcher(
@@ -1097,8 +1427,8 @@ VocabTreeFeatureMatcher::VocabTreeFeatureMatcher(
     : options_(options),
       match_options_(match_options),
       database_(database_path),
-      cache_(5 * options_.num_images, &database_),
-      matcher_(match_options, &database_, &cache_) {
+      cache_(5 * options_.num_images, &database_,
+             FeatureStorePath(match_options, database_path)) {
   CHECK(options_.Check());
   CHECK(match_options_.Check());
 }
@@ -1106,7 +1436,8 @@ VocabTreeFeatureMatcher::VocabTreeFeatureMatcher(
 void VocabTreeFeatureMatcher::Run() {
   PrintHeading1("Vocabulary tree feature matching");
 
-  if (!matcher_.Setup()) {
+  SiftFeatureMatcher matcher(match_options_, &database_, &cache_);
+  if (!matcher.Setup()) {
     return;
   }
 
@@ -1163,7 +1494,9 @@ void VocabTreeFeatureMatcher::Run() {
       match_options_.num_threads, options_.num_images,
       options_.num_nearest_neighbors, options_.num_checks,
       options_.num_images_after_verification, options_.max_num_features,
-      image_ids, this, &cache_, &visual_index, &matcher_);
+      image_ids, this, &cache_, &visual_index, &matcher);
+
+  cache_.FlushWrites();
 
   GetTimer().PrintMinutes();
 }
@@ -1174,8 +1507,8 @@ SpatialFeatureMatcher::SpatialFeatureMatcher(
     : options_(options),
       match_options_(match_options),
       database_(database_path),
-      cache_(5 * options_.max_num_neighbors, &database_),
-      matcher_(match_options, &database_, &cache_) {
+      cache_(5 * options_.max_num_neighbors, &database_,
+             FeatureStorePath(match_options, database_path)) {
   CHECK(options_.Check());
   CHECK(match_options_.Check());
 }
@@ -1183,7 +1516,8 @@ SpatialFeatureMatcher::SpatialFeatureMatcher(
 void SpatialFeatureMatcher::Run() {
   PrintHeading1("Spatial feature matching");
 
-  if (!matcher_.Setup()) {
+  SiftFeatureMatcher matcher(match_options_, &database_, &cache_);
+  if (!matcher.Setup()) {
     return;
   }
 
@@ -1290,14 +1624,7 @@ void SpatialFeatureMatcher::Run() {
   flann::Matrix<float> distances(distance_matrix.data(), num_locations, knn);
 
   flann::SearchParams search_params(flann::FLANN_CHECKS_AUTOTUNED);
-  if (match_options_.num_threads == ThreadPool::kMaxNumThreads) {
-    search_params.cores = std::thread::hardware_concurrency();
-  } else {
-    search_params.cores = match_options_.num_threads;
-  }
-  if (search_params.cores <= 0) {
-    search_params.cores = 1;
-  }
+  search_params.cores = GetEffectiveNumThreads(match_options_.num_threads);
 
   search_index.knnSearch(locations, indices, distances, knn, search_params);
 
@@ -1344,12 +1671,13 @@ void SpatialFeatureMatcher::Run() {
       image_pairs.emplace_back(image_id, nn_image_id);
     }
 
-    DatabaseTransaction database_transaction(&database_);
-    matcher_.Match(image_pairs);
+    matcher.Match(image_pairs);
 
     PrintElapsedTime(timer);
   }
 
+  cache_.FlushWrites();
+
   GetTimer().PrintMinutes();
 }
 
@@ -1359,8 +1687,8 @@ TransitiveFeatureMatcher::TransitiveFeatureMatcher(
     : options_(options),
       match_options_(match_options),
       database_(database_path),
-      cache_(options_.batch_size, &database_),
-      matcher_(match_options, &database_, &cache_) {
+      cache_(options_.batch_size, &database_,
+             FeatureStorePath(match_options, database_path)) {
   CHECK(options_.Check());
   CHECK(match_options_.Check());
 }
@@ -1368,7 +1696,8 @@ TransitiveFeatureMatcher::TransitiveFeatureMatcher(
 void TransitiveFeatureMatcher::Run() {
   PrintHeading1("Transitive feature matching");
 
-  if (!matcher_.Setup()) {
+  SiftFeatureMatcher matcher(match_options_, &database_, &cache_);
+  if (!matcher.Setup()) {
     return;
   }
 
@@ -1392,6 +1721,9 @@ void TransitiveFeatureMatcher::Run() {
                               options_.num_iterations)
               << std::endl;
 
+    // The results of the previous iteration must be committed.
+    cache_.FlushWrites();
+
     std::vector<std::pair<image_t, image_t>> existing_image_pairs;
     std::vector<int> existing_num_inliers;
     database_.ReadTwoViewGeometryNumInliers(&existing_image_pairs,
@@ -1424,8 +1756,7 @@ void TransitiveFeatureMatcher::Run() {
                 num_batches += 1;
                 std::cout << StringPrintf("  Batch %d", num_batches)
                           << std::flush;
-                DatabaseTransaction database_transaction(&database_);
-                matcher_.Match(image_pairs);
+                matcher.Match(image_pairs);
                 image_pairs.clear();
                 PrintElapsedTime(timer);
                 timer.Restart();
@@ -1443,11 +1774,12 @@ void TransitiveFeatureMatcher::Run() {
 
     num_batches += 1;
     std::cout << StringPrintf("  Batch %d", num_batches) << std::flush;
-    DatabaseTransaction database_transaction(&database_);
-    matcher_.Match(image_pairs);
+    matcher.Match(image_pairs);
     PrintElapsedTime(timer);
   }
 
+  cache_.FlushWrites();
+
   GetTimer().PrintMinutes();
 }
 
@@ -1457,8 +1789,8 @@ ImagePairsFeatureMatcher::ImagePairsFeatureMatcher(
     : options_(options),
       match_options_(match_options),
       database_(database_path),
-      cache_(options.block_size, &database_),
-      matcher_(match_options, &database_, &cache_) {
+      cache_(options.block_size, &database_,
+             FeatureStorePath(match_options, database_path)) {
   CHECK(options_.Check());
   CHECK(match_options_.Check());
 }
@@ -1466,7 +1798,8 @@ ImagePairsFeatureMatcher::ImagePairsFeatureMatcher(
 void ImagePairsFeatureMatcher::Run() {
   PrintHeading1("Custom feature matching");
 
-  if (!matcher_.Setup()) {
+  SiftFeatureMatcher matcher(match_options_, &database_, &cache_);
+  if (!matcher.Setup()) {
     return;
   }
 
@@ -1557,12 +1890,13 @@ void ImagePairsFeatureMatcher::Run() {
       block_image_pairs.push_back(image_pairs[j]);
     }
 
-    DatabaseTransaction database_transaction(&database_);
-    matcher_.Match(block_image_pairs);
+    matcher.Match(block_image_pairs);
 
     PrintElapsedTime(timer);
   }
 
+  cache_.FlushWrites();
+
   GetTimer().PrintMinutes();
 }
 
@@ -1572,7 +1906,8 @@ FeaturePairsFeatureMatcher::FeaturePairsFeatureMatcher(
     : options_(options),
       match_options_(match_options),
       database_(database_path),
-      cache_(kCacheSize, &database_) {
+      cache_(kCacheSize, &database_,
+             FeatureStorePath(match_options, database_path)) {
   CHECK(options_.Check());
   CHECK(match_options_.Check());
 }
@@ -1691,8 +2026,8 @@ void FeaturePairsFeatureMatcher::Run() {
           match_options_.min_inlier_ratio;
 
       two_view_geometry.Estimate(
-          camera1, FeatureKeypointsToPointsVector(keypoints1), camera2,
-          FeatureKeypointsToPointsVector(keypoints2), matches,
+          camera1, FeatureKeypointsToPointsVector(*keypoints1), camera2,
+          FeatureKeypointsToPointsVector(*keypoints2), matches,
           two_view_geometry_options);
 
       database_.WriteTwoViewGeometry(image1.ImageId(), image2.ImageId(),
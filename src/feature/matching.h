@@ -33,10 +33,17 @@
 #define COLMAP_SRC_FEATURE_MATCHING_H_
 
 #include <array>
+#include <condition_variable>
+#include <deque>
+#include <memory>
 #include <string>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
 #include <vector>
 
 #include "base/database.h"
+#include "base/feature_store.h"
 #include "feature/sift.h"
 #include "util/alignment.h"
 #include "util/cache.h"
@@ -177,43 +184,106 @@ struct FeatureMatcherData {
 }  // namespace internal
 
 // Cache for feature matching to minimize database access during matching.
+//
+// The cache is safe to use from multiple threads. Cache hits of keypoints and
+// descriptors only lock one shard of the cache and return shared immutable
+// handles, which remain valid after eviction. The database is only locked to
+// load missing features and to query or modify matches. Writes are queued and
+// applied behind the caller by a dedicated writer thread, which commits all
+// queued writes in one transaction using multi-row inserts.
 class FeatureMatcherCache {
  public:
-  FeatureMatcherCache(const size_t cache_size, const Database* database);
+  // If a feature store exists at the given path, the keypoints and
+  // descriptors of all images that are up-to-date in the store are read from
+  // the memory-mapped store instead of the database.
+  FeatureMatcherCache(const size_t cache_size, Database* database,
+                      const std::string& feature_store_path = "");
+  ~FeatureMatcherCache();
 
   void Setup();
 
   const Camera& GetCamera(const camera_t camera_id) const;
   const Image& GetImage(const image_t image_id) const;
-  const FeatureKeypoints& GetKeypoints(const image_t image_id);
-  const FeatureDescriptors& GetDescriptors(const image_t image_id);
-  FeatureMatches GetMatches(const image_t image_id1, const image_t image_id2);
+  std::shared_ptr<const FeatureKeypoints> GetKeypoints(const image_t image_id);
+  std::shared_ptr<const FeatureDescriptors> GetDescriptors(
+      const image_t image_id);
   std::vector<image_t> GetImageIds() const;
 
-  bool ExistsKeypoints(const image_t image_id);
-  bool ExistsDescriptors(const image_t image_id);
+  // Load the keypoints and descriptors of the given images into the cache,
+  // so that later accesses are cache hits. Descriptors of images in the
+  // feature store are not loaded, since they are accessed without the cache.
+  void Prefetch(const std::vector<image_t>& image_ids);
+
+  // Zero-copy access to the descriptors in the feature store, which is
+  // read-only after setup and therefore requires no locking.
+  bool ExistsStoredFeatures(const image_t image_id) const;
+  FeatureStore::DescriptorsMap GetStoredDescriptors(
+      const image_t image_id) const;
 
+  // Whether features exist is determined once during setup, so that these
+  // queries do not require any locking.
+  bool ExistsKeypoints(const image_t image_id) const;
+  bool ExistsDescriptors(const image_t image_id) const;
+
+  // Queries and deletions of the matches of an image pair first wait for the
+  // queued writes of the same image pair, so they always see all writes.
   bool ExistsMatches(const image_t image_id1, const image_t image_id2);
   bool ExistsInlierMatches(const image_t image_id1, const image_t image_id2);
+  FeatureMatches GetMatches(const image_t image_id1, const image_t image_id2);
 
+  // Queue the write of matches and two-view geometries. The writes are
+  // applied asynchronously, so the caller must not hold a transaction of
+  // the database, since the writer thread commits its own transactions.
   void WriteMatches(const image_t image_id1, const image_t image_id2,
                     const FeatureMatches& matches);
   void WriteTwoViewGeometry(const image_t image_id1, const image_t image_id2,
                             const TwoViewGeometry& two_view_geometry);
 
+  // Wait until all queued writes are committed to the database.
+  void FlushWrites();
+
   void DeleteMatches(const image_t image_id1, const image_t image_id2);
   void DeleteInlierMatches(const image_t image_id1, const image_t image_id2);
 
  private:
+  struct PendingWrites {
+    std::vector<std::pair<image_t, image_t>> matches_image_pairs;
+    std::vector<FeatureMatches> matches;
+    std::vector<std::pair<image_t, image_t>> two_view_geometry_image_pairs;
+    std::vector<TwoViewGeometry> two_view_geometries;
+
+    size_t Size() const;
+  };
+
+  // Called with the lock of the write queue held.
+  void WaitForWriteQueue(std::unique_lock<std::mutex>* lock);
+  void RegisterPendingWrite(const image_t image_id1, const image_t image_id2);
+  void FlushImagePairWrites(const image_t image_id1, const image_t image_id2);
+  void WriteLoop();
+
   const size_t cache_size_;
-  const Database* database_;
+  Database* database_;
+  const std::string feature_store_path_;
+  FeatureStore feature_store_;
+  std::unordered_set<image_t> stored_image_ids_;
   std::mutex database_mutex_;
   EIGEN_STL_UMAP(camera_t, Camera) cameras_cache_;
   EIGEN_STL_UMAP(image_t, Image) images_cache_;
-  std::unique_ptr<LRUCache<image_t, FeatureKeypoints>> keypoints_cache_;
-  std::unique_ptr<LRUCache<image_t, FeatureDescriptors>> descriptors_cache_;
-  std::unique_ptr<LRUCache<image_t, bool>> keypoints_exists_cache_;
-  std::unique_ptr<LRUCache<image_t, bool>> descriptors_exists_cache_;
+  std::unique_ptr<ShardedLRUCache<image_t, FeatureKeypoints>> keypoints_cache_;
+  std::unique_ptr<ShardedLRUCache<image_t, FeatureDescriptors>>
+      descriptors_cache_;
+  std::unordered_set<image_t> keypoints_image_ids_;
+  std::unordered_set<image_t> descriptors_image_ids_;
+
+  std::mutex write_mutex_;
+  std::condition_variable write_condition_;
+  std::condition_variable flush_condition_;
+  PendingWrites pending_writes_;
+  // Number of queued or uncommitted writes per image pair.
+  std::unordered_map<image_pair_t, int> num_pending_image_pair_writes_;
+  size_t num_writes_in_progress_;
+  bool stop_writer_;
+  std::thread writer_thread_;
 };
 
 class FeatureMatcherThread : public Thread {
@@ -228,21 +298,44 @@ class FeatureMatcherThread : public Thread {
   FeatureMatcherCache* cache_;
 };
 
+// Cache of the descriptor search indices of the images for CPU matching,
+// which is shared by all matcher threads. Indices are built outside of the
+// lock and the least recently used indices are evicted once the memory limit
+// is exceeded.
+class SiftDescriptorIndexCache {
+ public:
+  SiftDescriptorIndexCache(const size_t max_num_bytes,
+                           FeatureMatcherCache* cache);
+
+  SiftDescriptorIndex Get(const image_t image_id);
+
+ private:
+  SiftDescriptorIndex BuildIndex(const image_t image_id);
+
+  FeatureMatcherCache* cache_;
+  std::mutex mutex_;
+  MemoryConstrainedLRUCache<image_t, SiftDescriptorIndex> indices_;
+};
+
 class SiftCPUFeatureMatcher : public FeatureMatcherThread {
  public:
   typedef internal::FeatureMatcherData Input;
   typedef internal::FeatureMatcherData Output;
 
+  // If an index cache is given, the pairs are matched using the cached
+  // search indices of the images.
   SiftCPUFeatureMatcher(const SiftMatchingOptions& options,
                         FeatureMatcherCache* cache,
                         JobQueue<Input>* input_queue,
-                        JobQueue<Output>* output_queue);
+                        JobQueue<Output>* output_queue,
+                        SiftDescriptorIndexCache* index_cache = nullptr);
 
  protected:
   void Run() override;
 
   JobQueue<Input>* input_queue_;
   JobQueue<Output>* output_queue_;
+  SiftDescriptorIndexCache* index_cache_;
 };
 
 class SiftGPUFeatureMatcher : public FeatureMatcherThread {
@@ -268,7 +361,8 @@ class SiftGPUFeatureMatcher : public FeatureMatcherThread {
 
   // The previously uploaded images to the GPU.
   std::array<image_t, 2> prev_uploaded_image_ids_;
-  std::array<FeatureDescriptors, 2> prev_uploaded_descriptors_;
+  std::array<std::shared_ptr<const FeatureDescriptors>, 2>
+      prev_uploaded_descriptors_;
 };
 
 class GuidedSiftCPUFeatureMatcher : public FeatureMatcherThread {
@@ -312,8 +406,10 @@ class GuidedSiftGPUFeatureMatcher : public FeatureMatcherThread {
 
   // The previously uploaded images to the GPU.
   std::array<image_t, 2> prev_uploaded_image_ids_;
-  std::array<FeatureKeypoints, 2> prev_uploaded_keypoints_;
-  std::array<FeatureDescriptors, 2> prev_uploaded_descriptors_;
+  std::array<std::shared_ptr<const FeatureKeypoints>, 2>
+      prev_uploaded_keypoints_;
+  std::array<std::shared_ptr<const FeatureDescriptors>, 2>
+      prev_uploaded_descriptors_;
 };
 
 class TwoViewGeometryVerifier : public Thread {
@@ -340,7 +436,9 @@ class TwoViewGeometryVerifier : public Thread {
 // results to the database and skips already matched image pairs. To improve
 // performance of the matching by taking advantage of caching and database
 // transactions, pass multiple images to the `Match` function. Note that the
-// database should be in an active transaction while calling `Match`.
+// database should be in an active transaction while calling `Match`. The
+// matcher borrows its threads from the thread budget for its lifetime, so it
+// should only be created when the matching starts.
 class SiftFeatureMatcher {
  public:
   SiftFeatureMatcher(const SiftMatchingOptions& options, Database* database,
@@ -354,13 +452,26 @@ class SiftFeatureMatcher {
   // Match one batch of multiple image pairs.
   void Match(const std::vector<std::pair<image_t, image_t>>& image_pairs);
 
+  // Submit one batch of multiple image pairs without waiting for its results,
+  // so that the matchers can already process the batch while the results of
+  // previously submitted batches are collected. The image pairs of batches
+  // that are pending at the same time must be disjoint.
+  void Submit(const std::vector<std::pair<image_t, image_t>>& image_pairs);
+
+  // Wait for the results of the oldest submitted batch and write them to the
+  // cache. Returns false if no batch is pending.
+  bool WaitForBatch();
+  size_t NumPendingBatches() const;
+
  private:
   SiftMatchingOptions options_;
   Database* database_;
   FeatureMatcherCache* cache_;
+  ThreadBudgetLease thread_budget_lease_;
 
   bool is_setup_;
 
+  std::unique_ptr<SiftDescriptorIndexCache> index_cache_;
   std::vector<std::unique_ptr<FeatureMatcherThread>> matchers_;
   std::vector<std::unique_ptr<FeatureMatcherThread>> guided_matchers_;
   std::vector<std::unique_ptr<Thread>> verifiers_;
@@ -370,6 +481,9 @@ class SiftFeatureMatcher {
   JobQueue<internal::FeatureMatcherData> verifier_queue_;
   JobQueue<internal::FeatureMatcherData> guided_matcher_queue_;
   JobQueue<internal::FeatureMatcherData> output_queue_;
+
+  // Number of outputs of each submitted and not yet collected batch.
+  std::deque<size_t> pending_batch_sizes_;
 };
 
 // Exhaustively match images by processing each block in the exhaustive match
@@ -395,6 +509,12 @@ class SiftFeatureMatcher {
 //
 // Pairs will only be matched if 1, to avoid duplicate pairs. Pairs with #
 // are on the main diagonal and denote pairs of the same image.
+//
+// The blocks are traversed in serpentine order, so that consecutive blocks
+// share the images of one block row or column. The next block is submitted
+// to the matchers before the results of the current block are collected and
+// the features of the block after are prefetched in the background, so that
+// the matchers do not run idle between blocks.
 class ExhaustiveFeatureMatcher : public Thread {
  public:
   ExhaustiveFeatureMatcher(const ExhaustiveMatchingOptions& options,
@@ -408,7 +528,6 @@ class ExhaustiveFeatureMatcher : public Thread {
   const SiftMatchingOptions match_options_;
   Database database_;
   FeatureMatcherCache cache_;
-  SiftFeatureMatcher matcher_;
 };
 
 // Sequentially match images within neighborhood:
@@ -439,14 +558,15 @@ class SequentialFeatureMatcher : public Thread {
   void Run() override;
 
   std::vector<image_t> GetOrderedImageIds() const;
-  void RunSequentialMatching(const std::vector<image_t>& image_ids);
-  void RunLoopDetection(const std::vector<image_t>& image_ids);
+  void RunSequentialMatching(const std::vector<image_t>& image_ids,
+                             SiftFeatureMatcher* matcher);
+  void RunLoopDetection(const std::vector<image_t>& image_ids,
+                        SiftFeatureMatcher* matcher);
 
   const SequentialMatchingOptions options_;
   const SiftMatchingOptions match_options_;
   Database database_;
   FeatureMatcherCache cache_;
-  SiftFeatureMatcher matcher_;
 };
 
 // Match each image against its nearest neighbors using a vocabulary tree.
@@ -463,7 +583,6 @@ class VocabTreeFeatureMatcher : public Thread {
   const SiftMatchingOptions match_options_;
   Database database_;
   FeatureMatcherCache cache_;
-  SiftFeatureMatcher matcher_;
 };
 
 // Match images against spatial nearest neighbors using prior location
@@ -481,7 +600,6 @@ class SpatialFeatureMatcher : public Thread {
   const SiftMatchingOptions match_options_;
   Database database_;
   FeatureMatcherCache cache_;
-  SiftFeatureMatcher matcher_;
 };
 
 // Match transitive image pairs in a database with existing feature matches.
@@ -501,7 +619,6 @@ class TransitiveFeatureMatcher : public Thread {
   const SiftMatchingOptions match_options_;
   Database database_;
   FeatureMatcherCache cache_;
-  SiftFeatureMatcher matcher_;
 };
 
 // Match images manually specified in a list of image pairs.
@@ -526,7 +643,6 @@ class ImagePairsFeatureMatcher : public Thread {
   const SiftMatchingOptions match_options_;
   Database database_;
   FeatureMatcherCache cache_;
-  SiftFeatureMatcher matcher_;
 };
 
 // Import feature matches from a text file.
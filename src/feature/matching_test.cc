@@ -0,0 +1,177 @@
+// Copyright (c) 2022, ETH Zurich and UNC Chapel Hill.
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//
+//     * Neither the name of ETH Zurich and UNC Chapel Hill nor the names of
+//       its contributors may be used to endorse or promote products derived
+//       from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDERS OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//
+// Author: Johannes L. Schoenberger (jsch-at-demuc-dot-de)
+
+#define TEST_NAME "feature/matching"
+#include "util/testing.h"
+
+#include "base/database.h"
+#include "feature/matching.h"
+
+using namespace colmap;
+
+namespace {
+
+const static std::string kMemoryDatabasePath = ":memory:";
+
+std::vector<image_t> WriteImages(const int num_images, Database* database) {
+  Camera camera;
+  camera.InitializeWithName("SIMPLE_PINHOLE", 1.0, 1, 1);
+  camera.SetCameraId(database->WriteCamera(camera));
+  std::vector<image_t> image_ids;
+  for (int i = 0; i < num_images; ++i) {
+    Image image;
+    image.SetName("image" + std::to_string(i));
+    image.SetCameraId(camera.CameraId());
+    image_ids.push_back(database->WriteImage(image));
+  }
+  return image_ids;
+}
+
+FeatureMatches CreateMatches(const size_t num_matches) {
+  FeatureMatches matches(num_matches);
+  for (size_t i = 0; i < num_matches; ++i) {
+    matches[i].point2D_idx1 = i;
+    matches[i].point2D_idx2 = 2 * i;
+  }
+  return matches;
+}
+
+TwoViewGeometry CreateTwoViewGeometry(const size_t num_inlier_matches) {
+  TwoViewGeometry two_view_geometry;
+  two_view_geometry.config = TwoViewGeometry::CALIBRATED;
+  two_view_geometry.inlier_matches = CreateMatches(num_inlier_matches);
+  return two_view_geometry;
+}
+
+}  // namespace
+
+BOOST_AUTO_TEST_CASE(TestFeatureMatcherCacheReadAfterWrite) {
+  Database database(kMemoryDatabasePath);
+  const auto image_ids = WriteImages(3, &database);
+
+  FeatureMatcherCache cache(10, &database);
+  cache.Setup();
+  BOOST_CHECK_EQUAL(cache.GetImageIds().size(), 3);
+
+  cache.WriteMatches(image_ids[0], image_ids[1], CreateMatches(10));
+  cache.WriteTwoViewGeometry(image_ids[0], image_ids[1],
+                             CreateTwoViewGeometry(5));
+  cache.WriteMatches(image_ids[0], image_ids[2], CreateMatches(20));
+
+  // Queries of an image pair see its queued writes.
+  BOOST_CHECK(cache.ExistsMatches(image_ids[0], image_ids[1]));
+  BOOST_CHECK(cache.ExistsInlierMatches(image_ids[0], image_ids[1]));
+  const FeatureMatches matches = cache.GetMatches(image_ids[1], image_ids[0]);
+  BOOST_CHECK_EQUAL(matches.size(), 10);
+  BOOST_CHECK(cache.ExistsMatches(image_ids[0], image_ids[2]));
+  BOOST_CHECK(!cache.ExistsInlierMatches(image_ids[0], image_ids[2]));
+  BOOST_CHECK_EQUAL(cache.GetMatches(image_ids[0], image_ids[2]).size(), 20);
+  BOOST_CHECK(!cache.ExistsMatches(image_ids[1], image_ids[2]));
+  BOOST_CHECK(!cache.ExistsInlierMatches(image_ids[1], image_ids[2]));
+
+  cache.FlushWrites();
+
+  BOOST_CHECK_EQUAL(database.NumMatchedImagePairs(), 2);
+  BOOST_CHECK_EQUAL(database.NumMatches(), 30);
+  BOOST_CHECK_EQUAL(database.NumVerifiedImagePairs(), 1);
+  BOOST_CHECK_EQUAL(database.NumInlierMatches(), 5);
+  const TwoViewGeometry two_view_geometry =
+      database.ReadTwoViewGeometry(image_ids[0], image_ids[1]);
+  BOOST_CHECK_EQUAL(two_view_geometry.config, TwoViewGeometry::CALIBRATED);
+  BOOST_CHECK_EQUAL(two_view_geometry.inlier_matches.size(), 5);
+}
+
+BOOST_AUTO_TEST_CASE(TestFeatureMatcherCacheDeletePendingWrites) {
+  Database database(kMemoryDatabasePath);
+  const auto image_ids = WriteImages(3, &database);
+
+  FeatureMatcherCache cache(10, &database);
+  cache.Setup();
+
+  // Deletions wait for the queued writes of the same image pair, so the
+  // writes cannot be committed after the deletions.
+  cache.WriteMatches(image_ids[0], image_ids[1], CreateMatches(10));
+  cache.WriteTwoViewGeometry(image_ids[0], image_ids[1],
+                             CreateTwoViewGeometry(5));
+  cache.WriteMatches(image_ids[1], image_ids[2], CreateMatches(20));
+  cache.WriteTwoViewGeometry(image_ids[1], image_ids[2],
+                             CreateTwoViewGeometry(15));
+  cache.DeleteMatches(image_ids[0], image_ids[1]);
+  cache.DeleteInlierMatches(image_ids[2], image_ids[1]);
+
+  BOOST_CHECK(!cache.ExistsMatches(image_ids[0], image_ids[1]));
+  BOOST_CHECK(cache.ExistsInlierMatches(image_ids[0], image_ids[1]));
+  BOOST_CHECK(cache.ExistsMatches(image_ids[1], image_ids[2]));
+  BOOST_CHECK(!cache.ExistsInlierMatches(image_ids[1], image_ids[2]));
+
+  // The image pair can be written again after the deletion.
+  cache.WriteTwoViewGeometry(image_ids[1], image_ids[2],
+                             CreateTwoViewGeometry(12));
+
+  cache.FlushWrites();
+
+  BOOST_CHECK(!database.ExistsMatches(image_ids[0], image_ids[1]));
+  BOOST_CHECK(database.ExistsInlierMatches(image_ids[0], image_ids[1]));
+  BOOST_CHECK(database.ExistsMatches(image_ids[1], image_ids[2]));
+  BOOST_CHECK(database.ExistsInlierMatches(image_ids[1], image_ids[2]));
+  BOOST_CHECK_EQUAL(database.NumMatches(), 20);
+  BOOST_CHECK_EQUAL(database.NumInlierMatches(), 17);
+  BOOST_CHECK_EQUAL(
+      database.ReadTwoViewGeometry(image_ids[1], image_ids[2])
+          .inlier_matches.size(),
+      12);
+}
+
+BOOST_AUTO_TEST_CASE(TestFeatureMatcherCacheManyWrites) {
+  Database database(kMemoryDatabasePath);
+  const auto image_ids = WriteImages(50, &database);
+
+  FeatureMatcherCache cache(10, &database);
+  cache.Setup();
+
+  size_t num_matches = 0;
+  for (size_t i = 0; i < image_ids.size(); ++i) {
+    for (size_t j = 0; j < i; ++j) {
+      cache.WriteMatches(image_ids[i], image_ids[j], CreateMatches(i + j));
+      cache.WriteTwoViewGeometry(image_ids[i], image_ids[j],
+                                 CreateTwoViewGeometry(j));
+      num_matches += i + j;
+    }
+  }
+
+  BOOST_CHECK_EQUAL(cache.GetMatches(image_ids[3], image_ids[7]).size(), 10);
+
+  cache.FlushWrites();
+
+  const size_t num_image_pairs = image_ids.size() * (image_ids.size() - 1) / 2;
+  BOOST_CHECK_EQUAL(database.NumMatchedImagePairs(), num_image_pairs);
+  BOOST_CHECK_EQUAL(database.NumMatches(), num_matches);
+}
@@ -42,6 +42,7 @@
 #include "SiftGPU/SiftGPU.h"
 #include "VLFeat/covdet.h"
 #include "VLFeat/sift.h"
+#include "feature/sift_brute_force.h"
 #include "feature/utils.h"
 #include "util/cuda.h"
 #include "util/logging.h"
@@ -50,40 +51,53 @@
 #include "util/opengl_utils.h"
 
 namespace colmap {
+
+class SiftDescriptorIndex::Impl {
+ public:
+  Impl(const FeatureDescriptorsRef& descriptors, const bool copy_descriptors)
+      : owned_descriptors(copy_descriptors ? FeatureDescriptors(descriptors)
+                                           : FeatureDescriptors()),
+        descriptors(copy_descriptors ? owned_descriptors.data()
+                                     : descriptors.data(),
+                    descriptors.rows(), descriptors.cols()) {
+    const size_t kNumTreesInForest = 4;
+    if (this->descriptors.rows() > 0) {
+      const flann::Matrix<uint8_t> descriptors_matrix(
+          const_cast<uint8_t*>(this->descriptors.data()),
+          this->descriptors.rows(), 128);
+      index.reset(new flann::Index<flann::L2<uint8_t>>(
+          descriptors_matrix, flann::KDTreeIndexParams(kNumTreesInForest)));
+      index->buildIndex();
+    }
+  }
+
+  FeatureDescriptors owned_descriptors;
+  // View of either the owned descriptors or the descriptors of the caller.
+  Eigen::Map<const FeatureDescriptors> descriptors;
+  std::unique_ptr<flann::Index<flann::L2<uint8_t>>> index;
+};
+
 namespace {
 
-size_t FindBestMatchesOneWayBruteForce(const Eigen::MatrixXi& dists,
-                                       const float max_ratio,
-                                       const float max_distance,
-                                       std::vector<int>* matches) {
+size_t FindBestMatchesOneWayBruteForce(
+    const std::vector<SiftNearestNeighbors>& neighbors, const float max_ratio,
+    const float max_distance, std::vector<int>* matches) {
   // SIFT descriptor vectors are normalized to length 512.
   const float kDistNorm = 1.0f / (512.0f * 512.0f);
 
   size_t num_matches = 0;
-  matches->resize(dists.rows(), -1);
+  matches->resize(neighbors.size(), -1);
 
-  for (Eigen::Index i1 = 0; i1 < dists.rows(); ++i1) {
-    int best_i2 = -1;
-    int best_dist = 0;
-    int second_best_dist = 0;
-    for (Eigen::Index i2 = 0; i2 < dists.cols(); ++i2) {
-      const int dist = dists(i1, i2);
-      if (dist > best_dist) {
-        best_i2 = i2;
-        second_best_dist = best_dist;
-        best_dist = dist;
-      } else if (dist > second_best_dist) {
-        second_best_dist = dist;
-      }
-    }
+  for (size_t i1 = 0; i1 < neighbors.size(); ++i1) {
+    const SiftNearestNeighbors& neighbors1 = neighbors[i1];
 
     // Check if any match found.
-    if (best_i2 == -1) {
+    if (neighbors1.best_idx == -1) {
       continue;
     }
 
     const float best_dist_normed =
-        std::acos(std::min(kDistNorm * best_dist, 1.0f));
+        std::acos(std::min(kDistNorm * neighbors1.best_dist, 1.0f));
 
     // Check if match distance passes threshold.
     if (best_dist_normed > max_distance) {
@@ -91,7 +105,7 @@ size_t FindBestMatchesOneWayBruteForce(const Eigen::MatrixXi& dists,
     }
 
     const float second_best_dist_normed =
-        std::acos(std::min(kDistNorm * second_best_dist, 1.0f));
+        std::acos(std::min(kDistNorm * neighbors1.second_best_dist, 1.0f));
 
     // Check if match passes ratio test. Keep this comparison >= in order to
     // ensure that the case of best == second_best is detected.
@@ -100,26 +114,34 @@ size_t FindBestMatchesOneWayBruteForce(const Eigen::MatrixXi& dists,
     }
 
     num_matches += 1;
-    (*matches)[i1] = best_i2;
+    (*matches)[i1] = neighbors1.best_idx;
   }
 
   return num_matches;
 }
 
-void FindBestMatchesBruteForce(const Eigen::MatrixXi& dists,
+void FindBestMatchesBruteForce(const FeatureDescriptorsRef& descriptors1,
+                               const FeatureDescriptorsRef& descriptors2,
+                               const std::function<bool(int, int)>& filter,
                                const float max_ratio, const float max_distance,
                                const bool cross_check,
                                FeatureMatches* matches) {
   matches->clear();
 
+  std::vector<SiftNearestNeighbors> neighbors12;
+  std::vector<SiftNearestNeighbors> neighbors21;
+  FindSiftNearestNeighborsBruteForce(descriptors1, descriptors2, filter,
+                                     &neighbors12,
+                                     cross_check ? &neighbors21 : nullptr);
+
   std::vector<int> matches12;
   const size_t num_matches12 = FindBestMatchesOneWayBruteForce(
-      dists, max_ratio, max_distance, &matches12);
+      neighbors12, max_ratio, max_distance, &matches12);
 
   if (cross_check) {
     std::vector<int> matches21;
     const size_t num_matches21 = FindBestMatchesOneWayBruteForce(
-        dists.transpose(), max_ratio, max_distance, &matches21);
+        neighbors21, max_ratio, max_distance, &matches21);
     matches->reserve(std::min(num_matches12, num_matches21));
     for (size_t i1 = 0; i1 < matches12.size(); ++i1) {
       if (matches12[i1] != -1 && matches21[matches12[i1]] != -1 &&
@@ -168,43 +190,8 @@ FeatureDescriptors TransformVLFeatToUBCFeatureDescriptors(
   return ubc_descriptors;
 }
 
-Eigen::MatrixXi ComputeSiftDistanceMatrix(
-    const FeatureKeypoints* keypoints1, const FeatureKeypoints* keypoints2,
-    const FeatureDescriptors& descriptors1,
-    const FeatureDescriptors& descriptors2,
-    const std::function<bool(float, float, float, float)>& guided_filter) {
-  if (guided_filter != nullptr) {
-    CHECK_NOTNULL(keypoints1);
-    CHECK_NOTNULL(keypoints2);
-    CHECK_EQ(keypoints1->size(), descriptors1.rows());
-    CHECK_EQ(keypoints2->size(), descriptors2.rows());
-  }
-
-  const Eigen::Matrix<int, Eigen::Dynamic, 128> descriptors1_int =
-      descriptors1.cast<int>();
-  const Eigen::Matrix<int, Eigen::Dynamic, 128> descriptors2_int =
-      descriptors2.cast<int>();
-
-  Eigen::Matrix<int, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor> dists(
-      descriptors1.rows(), descriptors2.rows());
-
-  for (FeatureDescriptors::Index i1 = 0; i1 < descriptors1.rows(); ++i1) {
-    for (FeatureDescriptors::Index i2 = 0; i2 < descriptors2.rows(); ++i2) {
-      if (guided_filter != nullptr &&
-          guided_filter((*keypoints1)[i1].x, (*keypoints1)[i1].y,
-                        (*keypoints2)[i2].x, (*keypoints2)[i2].y)) {
-        dists(i1, i2) = 0;
-      } else {
-        dists(i1, i2) = descriptors1_int.row(i1).dot(descriptors2_int.row(i2));
-      }
-    }
-  }
-
-  return dists;
-}
-
 void FindNearestNeighborsFLANN(
-    const FeatureDescriptors& query, const FeatureDescriptors& database,
+    const FeatureDescriptorsRef& query, const FeatureDescriptorsRef& database,
     Eigen::Matrix<int, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor>*
         indices,
     Eigen::Matrix<int, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor>*
@@ -213,40 +200,9 @@ void FindNearestNeighborsFLANN(
     return;
   }
 
-  const size_t kNumNearestNeighbors = 2;
-  const size_t kNumTreesInForest = 4;
-
-  const size_t num_nearest_neighbors =
-      std::min(kNumNearestNeighbors, static_cast<size_t>(database.rows()));
-
-  indices->resize(query.rows(), num_nearest_neighbors);
-  distances->resize(query.rows(), num_nearest_neighbors);
-  const flann::Matrix<uint8_t> query_matrix(const_cast<uint8_t*>(query.data()),
-                                            query.rows(), 128);
-  const flann::Matrix<uint8_t> database_matrix(
-      const_cast<uint8_t*>(database.data()), database.rows(), 128);
-
-  flann::Matrix<int> indices_matrix(indices->data(), query.rows(),
-                                    num_nearest_neighbors);
-  std::vector<float> distances_vector(query.rows() * num_nearest_neighbors);
-  flann::Matrix<float> distances_matrix(distances_vector.data(), query.rows(),
-                                        num_nearest_neighbors);
-  flann::Index<flann::L2<uint8_t>> index(
-      database_matrix, flann::KDTreeIndexParams(kNumTreesInForest));
-  index.buildIndex();
-  index.knnSearch(query_matrix, indices_matrix, distances_matrix,
-                  num_nearest_neighbors, flann::SearchParams(128));
-
-  for (Eigen::Index query_index = 0; query_index < indices->rows();
-       ++query_index) {
-    for (Eigen::Index k = 0; k < indices->cols(); ++k) {
-      const Eigen::Index database_index = indices->coeff(query_index, k);
-      distances->coeffRef(query_index, k) =
-          query.row(query_index)
-              .cast<int>()
-              .dot(database.row(database_index).cast<int>());
-    }
-  }
+  // The index only lives for this search, so it does not need its own copy.
+  const SiftDescriptorIndex index(database, /*copy_descriptors=*/false);
+  index.FindNearestNeighbors(query, indices, distances);
 }
 
 size_t FindBestMatchesOneWayFLANN(
@@ -387,6 +343,72 @@ bool SiftExtractionOptions::Check() const {
   return true;
 }
 
+SiftDescriptorIndex::SiftDescriptorIndex() {}
+
+SiftDescriptorIndex::SiftDescriptorIndex(
+    const FeatureDescriptorsRef& descriptors, const bool copy_descriptors)
+    : impl_(std::make_shared<const Impl>(descriptors, copy_descriptors)) {}
+
+bool SiftDescriptorIndex::IsValid() const { return impl_ != nullptr; }
+
+FeatureDescriptorsRef SiftDescriptorIndex::Descriptors() const {
+  CHECK(IsValid());
+  return impl_->descriptors;
+}
+
+size_t SiftDescriptorIndex::NumBytes() const {
+  if (!IsValid()) {
+    return 0;
+  }
+  size_t num_bytes = sizeof(Impl) + impl_->owned_descriptors.size();
+  if (impl_->index) {
+    num_bytes += impl_->index->usedMemory();
+  }
+  return num_bytes;
+}
+
+void SiftDescriptorIndex::FindNearestNeighbors(
+    const FeatureDescriptorsRef& query,
+    Eigen::Matrix<int, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor>*
+        indices,
+    Eigen::Matrix<int, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor>*
+        distances) const {
+  CHECK(IsValid());
+  const auto& database = impl_->descriptors;
+  if (query.rows() == 0 || database.rows() == 0) {
+    return;
+  }
+
+  const size_t kNumNearestNeighbors = 2;
+
+  const size_t num_nearest_neighbors =
+      std::min(kNumNearestNeighbors, static_cast<size_t>(database.rows()));
+
+  indices->resize(query.rows(), num_nearest_neighbors);
+  distances->resize(query.rows(), num_nearest_neighbors);
+  const flann::Matrix<uint8_t> query_matrix(const_cast<uint8_t*>(query.data()),
+                                            query.rows(), 128);
+
+  flann::Matrix<int> indices_matrix(indices->data(), query.rows(),
+                                    num_nearest_neighbors);
+  std::vector<float> distances_vector(query.rows() * num_nearest_neighbors);
+  flann::Matrix<float> distances_matrix(distances_vector.data(), query.rows(),
+                                        num_nearest_neighbors);
+  impl_->index->knnSearch(query_matrix, indices_matrix, distances_matrix,
+                          num_nearest_neighbors, flann::SearchParams(128));
+
+  for (Eigen::Index query_index = 0; query_index < indices->rows();
+       ++query_index) {
+    for (Eigen::Index k = 0; k < indices->cols(); ++k) {
+      const Eigen::Index database_index = indices->coeff(query_index, k);
+      distances->coeffRef(query_index, k) =
+          query.row(query_index)
+              .cast<int>()
+              .dot(database.row(database_index).cast<int>());
+    }
+  }
+}
+
 bool SiftMatchingOptions::Check() const {
   if (use_gpu) {
     CHECK_OPTION_GT(CSVToVector<int>(gpu_index).size(), 0);
@@ -400,6 +422,7 @@ bool SiftMatchingOptions::Check() const {
   CHECK_OPTION_GE(min_inlier_ratio, 0);
   CHECK_OPTION_LE(min_inlier_ratio, 1);
   CHECK_OPTION_GE(min_num_inliers, 0);
+  CHECK_OPTION_GE(cpu_index_cache_size, 0);
   return true;
 }
 
@@ -962,23 +985,21 @@ void LoadSiftFeaturesFromTextFile(const std::string& path,
 }
 
 void MatchSiftFeaturesCPUBruteForce(const SiftMatchingOptions& match_options,
-                                    const FeatureDescriptors& descriptors1,
-                                    const FeatureDescriptors& descriptors2,
+                                    const FeatureDescriptorsRef& descriptors1,
+                                    const FeatureDescriptorsRef& descriptors2,
                                     FeatureMatches* matches) {
   CHECK(match_options.Check());
   CHECK_NOTNULL(matches);
 
-  const Eigen::MatrixXi distances = ComputeSiftDistanceMatrix(
-      nullptr, nullptr, descriptors1, descriptors2, nullptr);
-
-  FindBestMatchesBruteForce(distances, match_options.max_ratio,
+  FindBestMatchesBruteForce(descriptors1, descriptors2, nullptr,
+                            match_options.max_ratio,
                             match_options.max_distance,
                             match_options.cross_check, matches);
 }
 
 void MatchSiftFeaturesCPUFLANN(const SiftMatchingOptions& match_options,
-                               const FeatureDescriptors& descriptors1,
-                               const FeatureDescriptors& descriptors2,
+                               const FeatureDescriptorsRef& descriptors1,
+                               const FeatureDescriptorsRef& descriptors2,
                                FeatureMatches* matches) {
   CHECK(match_options.Check());
   CHECK_NOTNULL(matches);
@@ -1006,17 +1027,64 @@ void MatchSiftFeaturesCPUFLANN(const SiftMatchingOptions& match_options,
 }
 
 void MatchSiftFeaturesCPU(const SiftMatchingOptions& match_options,
-                          const FeatureDescriptors& descriptors1,
-                          const FeatureDescriptors& descriptors2,
+                          const FeatureDescriptorsRef& descriptors1,
+                          const FeatureDescriptorsRef& descriptors2,
                           FeatureMatches* matches) {
-  MatchSiftFeaturesCPUFLANN(match_options, descriptors1, descriptors2, matches);
+  if (match_options.cpu_brute_force_matcher) {
+    MatchSiftFeaturesCPUBruteForce(match_options, descriptors1, descriptors2,
+                                   matches);
+  } else {
+    MatchSiftFeaturesCPUFLANN(match_options, descriptors1, descriptors2,
+                              matches);
+  }
+}
+
+void MatchSiftFeaturesCPUFLANN(const SiftMatchingOptions& match_options,
+                               const SiftDescriptorIndex& index1,
+                               const SiftDescriptorIndex& index2,
+                               FeatureMatches* matches) {
+  CHECK(match_options.Check());
+  CHECK_NOTNULL(matches);
+
+  Eigen::Matrix<int, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor>
+      indices_1to2;
+  Eigen::Matrix<int, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor>
+      distances_1to2;
+  Eigen::Matrix<int, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor>
+      indices_2to1;
+  Eigen::Matrix<int, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor>
+      distances_2to1;
+
+  index2.FindNearestNeighbors(index1.Descriptors(), &indices_1to2,
+                              &distances_1to2);
+  if (match_options.cross_check) {
+    index1.FindNearestNeighbors(index2.Descriptors(), &indices_2to1,
+                                &distances_2to1);
+  }
+
+  FindBestMatchesFLANN(indices_1to2, distances_1to2, indices_2to1,
+                       distances_2to1, match_options.max_ratio,
+                       match_options.max_distance, match_options.cross_check,
+                       matches);
+}
+
+void MatchSiftFeaturesCPU(const SiftMatchingOptions& match_options,
+                          const SiftDescriptorIndex& index1,
+                          const SiftDescriptorIndex& index2,
+                          FeatureMatches* matches) {
+  if (match_options.cpu_brute_force_matcher) {
+    MatchSiftFeaturesCPUBruteForce(match_options, index1.Descriptors(),
+                                   index2.Descriptors(), matches);
+  } else {
+    MatchSiftFeaturesCPUFLANN(match_options, index1, index2, matches);
+  }
 }
 
 void MatchGuidedSiftFeaturesCPU(const SiftMatchingOptions& match_options,
                                 const FeatureKeypoints& keypoints1,
                                 const FeatureKeypoints& keypoints2,
-                                const FeatureDescriptors& descriptors1,
-                                const FeatureDescriptors& descriptors2,
+                                const FeatureDescriptorsRef& descriptors1,
+                                const FeatureDescriptorsRef& descriptors2,
                                 TwoViewGeometry* two_view_geometry) {
   CHECK(match_options.Check());
   CHECK_NOTNULL(two_view_geometry);
@@ -1057,31 +1125,17 @@ void MatchGuidedSiftFeaturesCPU(const SiftMatchingOptions& match_options,
 
   CHECK(guided_filter);
 
-  const Eigen::MatrixXi dists = ComputeSiftDistanceMatrix(
-      &keypoints1, &keypoints2, descriptors1, descriptors2, guided_filter);
-
-  Eigen::Matrix<int, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor>
-      indices_1to2(dists.rows(), dists.cols());
-  Eigen::Matrix<int, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor>
-      indices_2to1(dists.cols(), dists.rows());
-  Eigen::Matrix<int, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor>
-      distances_1to2 = dists;
-  Eigen::Matrix<int, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor>
-      distances_2to1 = dists.transpose();
-
-  for (int i = 0; i < indices_1to2.rows(); ++i) {
-    indices_1to2.row(i) = Eigen::VectorXi::LinSpaced(indices_1to2.cols(), 0,
-                                                     indices_1to2.cols() - 1);
-  }
-  for (int i = 0; i < indices_2to1.rows(); ++i) {
-    indices_2to1.row(i) = Eigen::VectorXi::LinSpaced(indices_2to1.cols(), 0,
-                                                     indices_2to1.cols() - 1);
-  }
-
-  FindBestMatchesFLANN(indices_1to2, distances_1to2, indices_2to1,
-                       distances_2to1, match_options.max_ratio,
-                       match_options.max_distance, match_options.cross_check,
-                       &two_view_geometry->inlier_matches);
+  CHECK_EQ(keypoints1.size(), descriptors1.rows());
+  CHECK_EQ(keypoints2.size(), descriptors2.rows());
+
+  FindBestMatchesBruteForce(
+      descriptors1, descriptors2,
+      [&](const int i1, const int i2) {
+        return guided_filter(keypoints1[i1].x, keypoints1[i1].y,
+                             keypoints2[i2].x, keypoints2[i2].y);
+      },
+      match_options.max_ratio, match_options.max_distance,
+      match_options.cross_check, &two_view_geometry->inlier_matches);
 }
 
 bool CreateSiftGPUMatcher(const SiftMatchingOptions& match_options,
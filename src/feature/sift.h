@@ -32,6 +32,8 @@
 #ifndef COLMAP_SRC_FEATURE_SIFT_H_
 #define COLMAP_SRC_FEATURE_SIFT_H_
 
+#include <memory>
+
 #include "estimators/two_view_geometry.h"
 #include "feature/types.h"
 #include "util/bitmap.h"
@@ -164,6 +166,23 @@ struct SiftMatchingOptions {
   // Force Homography use for Two-view Geometry (can help for planar scenes)
   bool planar_scene = false;
 
+  // Maximum memory in megabytes of the search indices of the descriptors that
+  // are cached for CPU matching, so that the index of an image is reused
+  // for all image pairs it takes part in. Set to 0 to disable the cache.
+  int cpu_index_cache_size = 2048;
+
+  // Whether to use exact brute-force instead of approximate FLANN matching
+  // on the CPU. The brute-force matcher uses the fastest SIMD kernel of the
+  // CPU and does not use the index cache.
+  bool cpu_brute_force_matcher = false;
+
+  // Whether to read the features from the memory-mapped feature store next to
+  // the database, which is written by the `database_feature_store` command.
+  // The store is not updated when the features in the database change, so
+  // images whose features were rewritten since the store was written are read
+  // from the database (see `FeatureStore::IsUpToDate`).
+  bool use_feature_store = false;
+
   bool Check() const;
 };
 
@@ -213,24 +232,66 @@ void LoadSiftFeaturesFromTextFile(const std::string& path,
                                   FeatureKeypoints* keypoints,
                                   FeatureDescriptors* descriptors);
 
+// FLANN KD-forest search index over the descriptors of one image, which can
+// be built once and reused to match the image against many other images.
+// Copies share the same immutable index, which can be searched concurrently.
+class SiftDescriptorIndex {
+ public:
+  SiftDescriptorIndex();
+  // Build the index over the given descriptors. Without copying them, the
+  // index only keeps a view and the descriptors must outlive the index.
+  explicit SiftDescriptorIndex(const FeatureDescriptorsRef& descriptors,
+                               bool copy_descriptors = true);
+
+  bool IsValid() const;
+
+  FeatureDescriptorsRef Descriptors() const;
+
+  // Approximate memory usage of the descriptors and the index.
+  size_t NumBytes() const;
+
+  // Find the two nearest neighbors of every query descriptor, where the
+  // returned distances are the dot products of the descriptors.
+  void FindNearestNeighbors(
+      const FeatureDescriptorsRef& query,
+      Eigen::Matrix<int, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor>*
+          indices,
+      Eigen::Matrix<int, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor>*
+          distances) const;
+
+ private:
+  class Impl;
+  std::shared_ptr<const Impl> impl_;
+};
+
 // Match the given SIFT features on the CPU.
 void MatchSiftFeaturesCPUBruteForce(const SiftMatchingOptions& match_options,
-                                    const FeatureDescriptors& descriptors1,
-                                    const FeatureDescriptors& descriptors2,
+                                    const FeatureDescriptorsRef& descriptors1,
+                                    const FeatureDescriptorsRef& descriptors2,
                                     FeatureMatches* matches);
 void MatchSiftFeaturesCPUFLANN(const SiftMatchingOptions& match_options,
-                               const FeatureDescriptors& descriptors1,
-                               const FeatureDescriptors& descriptors2,
+                               const FeatureDescriptorsRef& descriptors1,
+                               const FeatureDescriptorsRef& descriptors2,
+                               FeatureMatches* matches);
+void MatchSiftFeaturesCPU(const SiftMatchingOptions& match_options,
+                          const FeatureDescriptorsRef& descriptors1,
+                          const FeatureDescriptorsRef& descriptors2,
+                          FeatureMatches* matches);
+
+// Match the given SIFT features on the CPU using prebuilt search indices.
+void MatchSiftFeaturesCPUFLANN(const SiftMatchingOptions& match_options,
+                               const SiftDescriptorIndex& index1,
+                               const SiftDescriptorIndex& index2,
                                FeatureMatches* matches);
 void MatchSiftFeaturesCPU(const SiftMatchingOptions& match_options,
-                          const FeatureDescriptors& descriptors1,
-                          const FeatureDescriptors& descriptors2,
+                          const SiftDescriptorIndex& index1,
+                          const SiftDescriptorIndex& index2,
                           FeatureMatches* matches);
 void MatchGuidedSiftFeaturesCPU(const SiftMatchingOptions& match_options,
                                 const FeatureKeypoints& keypoints1,
                                 const FeatureKeypoints& keypoints2,
-                                const FeatureDescriptors& descriptors1,
-                                const FeatureDescriptors& descriptors2,
+                                const FeatureDescriptorsRef& descriptors1,
+                                const FeatureDescriptorsRef& descriptors2,
                                 TwoViewGeometry* two_view_geometry);
 
 // Create a SiftGPU feature matcher. Note that if CUDA is not available or the
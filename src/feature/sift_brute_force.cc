@@ -0,0 +1,348 @@
+// Copyright (c) 2022, ETH Zurich and UNC Chapel Hill.
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//
+//     * Neither the name of ETH Zurich and UNC Chapel Hill nor the names of
+//       its contributors may be used to endorse or promote products derived
+//       from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDERS OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//
+// Author: Johannes L. Schoenberger (jsch-at-demuc-dot-de)
+
+#include "feature/sift_brute_force.h"
+
+#include <algorithm>
+
+#include "util/logging.h"
+
+#if (defined(__GNUC__) || defined(__clang__)) && \
+    (defined(__x86_64__) || defined(__i386__))
+#define COLMAP_SIFT_X86_KERNELS
+#include <immintrin.h>
+// The avx512vnni target is only known to GCC 8 and Clang 6 or newer.
+#if (defined(__clang__) && __clang_major__ >= 6) || \
+    (!defined(__clang__) && __GNUC__ >= 8)
+#define COLMAP_SIFT_X86_VNNI_KERNEL
+#endif
+#endif
+
+namespace colmap {
+namespace {
+
+const int kDescriptorDim = 128;
+
+// Number of database descriptors whose dot products with one query descriptor
+// are computed at once. A block of widened descriptors occupies 16KB, so that
+// it stays in the L1 cache while all query descriptors are streamed past it.
+const int kBlockSize = 64;
+
+// Computes the dot products of one query descriptor with `num_database`
+// consecutive database descriptors. Descriptors are widened to 16 bits, since
+// SIFT components exceed the signed 8 bit range of vpmaddubsw/vpdpbusd.
+typedef void (*DotProductsFunc)(const int16_t* query, const int16_t* database,
+                                int num_database, int* dots);
+
+void DotProductsGeneric(const int16_t* query, const int16_t* database,
+                        const int num_database, int* dots) {
+  for (int i = 0; i < num_database; ++i) {
+    const int16_t* descriptor = database + i * kDescriptorDim;
+    int dot = 0;
+    for (int j = 0; j < kDescriptorDim; ++j) {
+      dot += static_cast<int>(query[j]) * static_cast<int>(descriptor[j]);
+    }
+    dots[i] = dot;
+  }
+}
+
+#ifdef COLMAP_SIFT_X86_KERNELS
+
+// Horizontally sums each of the four accumulators into one lane.
+__attribute__((target("avx2"))) inline __m128i HorizontalSum4(
+    const __m256i acc0, const __m256i acc1, const __m256i acc2,
+    const __m256i acc3) {
+  const __m256i sum01 = _mm256_hadd_epi32(acc0, acc1);
+  const __m256i sum23 = _mm256_hadd_epi32(acc2, acc3);
+  const __m256i sum = _mm256_hadd_epi32(sum01, sum23);
+  return _mm_add_epi32(_mm256_castsi256_si128(sum),
+                       _mm256_extracti128_si256(sum, 1));
+}
+
+__attribute__((target("avx2"))) inline __m256i DotProductAVX2(
+    const __m256i* query, const int16_t* descriptor) {
+  __m256i acc = _mm256_setzero_si256();
+  for (int k = 0; k < kDescriptorDim / 16; ++k) {
+    const __m256i d = _mm256_loadu_si256(
+        reinterpret_cast<const __m256i*>(descriptor + 16 * k));
+    acc = _mm256_add_epi32(acc, _mm256_madd_epi16(query[k], d));
+  }
+  return acc;
+}
+
+__attribute__((target("avx2"))) void DotProductsAVX2(const int16_t* query,
+                                                     const int16_t* database,
+                                                     const int num_database,
+                                                     int* dots) {
+  __m256i q[kDescriptorDim / 16];
+  for (int k = 0; k < kDescriptorDim / 16; ++k) {
+    q[k] = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(query + 16 * k));
+  }
+
+  int i = 0;
+  for (; i + 4 <= num_database; i += 4) {
+    const int16_t* descriptor = database + i * kDescriptorDim;
+    const __m256i acc0 = DotProductAVX2(q, descriptor);
+    const __m256i acc1 = DotProductAVX2(q, descriptor + kDescriptorDim);
+    const __m256i acc2 = DotProductAVX2(q, descriptor + 2 * kDescriptorDim);
+    const __m256i acc3 = DotProductAVX2(q, descriptor + 3 * kDescriptorDim);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(dots + i),
+                     HorizontalSum4(acc0, acc1, acc2, acc3));
+  }
+
+  if (i < num_database) {
+    DotProductsGeneric(query, database + i * kDescriptorDim, num_database - i,
+                       dots + i);
+  }
+}
+
+// Folds the 512 bit accumulator into 256 bits for the horizontal sum. Both
+// halves are extracted with zero-masking, since GCC warns about the undefined
+// source operand of _mm512_castsi512_si256 and _mm512_extracti64x4_epi64.
+__attribute__((target("avx2,avx512f"))) inline __m256i Fold512(
+    const __m512i acc) {
+  return _mm256_add_epi32(_mm512_maskz_extracti64x4_epi64(0xFF, acc, 0),
+                          _mm512_maskz_extracti64x4_epi64(0xFF, acc, 1));
+}
+
+__attribute__((target("avx2,avx512f,avx512bw"))) inline __m512i
+DotProductAVX512(const __m512i* query, const int16_t* descriptor) {
+  __m512i acc = _mm512_setzero_si512();
+  for (int k = 0; k < kDescriptorDim / 32; ++k) {
+    const __m512i d = _mm512_loadu_si512(descriptor + 32 * k);
+    acc = _mm512_add_epi32(acc, _mm512_madd_epi16(query[k], d));
+  }
+  return acc;
+}
+
+#ifdef COLMAP_SIFT_X86_VNNI_KERNEL
+__attribute__((target("avx2,avx512f,avx512bw,avx512vnni"))) inline __m512i
+DotProductAVX512VNNI(const __m512i* query, const int16_t* descriptor) {
+  __m512i acc = _mm512_setzero_si512();
+  for (int k = 0; k < kDescriptorDim / 32; ++k) {
+    const __m512i d = _mm512_loadu_si512(descriptor + 32 * k);
+    acc = _mm512_dpwssd_epi32(acc, query[k], d);
+  }
+  return acc;
+}
+#endif  // COLMAP_SIFT_X86_VNNI_KERNEL
+
+__attribute__((target("avx2,avx512f,avx512bw"))) void DotProductsAVX512(
+    const int16_t* query, const int16_t* database, const int num_database,
+    int* dots) {
+  __m512i q[kDescriptorDim / 32];
+  for (int k = 0; k < kDescriptorDim / 32; ++k) {
+    q[k] = _mm512_loadu_si512(query + 32 * k);
+  }
+
+  int i = 0;
+  for (; i + 4 <= num_database; i += 4) {
+    const int16_t* descriptor = database + i * kDescriptorDim;
+    const __m512i acc0 = DotProductAVX512(q, descriptor);
+    const __m512i acc1 = DotProductAVX512(q, descriptor + kDescriptorDim);
+    const __m512i acc2 = DotProductAVX512(q, descriptor + 2 * kDescriptorDim);
+    const __m512i acc3 = DotProductAVX512(q, descriptor + 3 * kDescriptorDim);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(dots + i),
+                     HorizontalSum4(Fold512(acc0), Fold512(acc1),
+                                    Fold512(acc2), Fold512(acc3)));
+  }
+
+  if (i < num_database) {
+    DotProductsGeneric(query, database + i * kDescriptorDim, num_database - i,
+                       dots + i);
+  }
+}
+
+#ifdef COLMAP_SIFT_X86_VNNI_KERNEL
+__attribute__((target("avx2,avx512f,avx512bw,avx512vnni"))) void
+DotProductsAVX512VNNI(const int16_t* query, const int16_t* database,
+                      const int num_database, int* dots) {
+  __m512i q[kDescriptorDim / 32];
+  for (int k = 0; k < kDescriptorDim / 32; ++k) {
+    q[k] = _mm512_loadu_si512(query + 32 * k);
+  }
+
+  int i = 0;
+  for (; i + 4 <= num_database; i += 4) {
+    const int16_t* descriptor = database + i * kDescriptorDim;
+    const __m512i acc0 = DotProductAVX512VNNI(q, descriptor);
+    const __m512i acc1 =
+        DotProductAVX512VNNI(q, descriptor + kDescriptorDim);
+    const __m512i acc2 =
+        DotProductAVX512VNNI(q, descriptor + 2 * kDescriptorDim);
+    const __m512i acc3 =
+        DotProductAVX512VNNI(q, descriptor + 3 * kDescriptorDim);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(dots + i),
+                     HorizontalSum4(Fold512(acc0), Fold512(acc1),
+                                    Fold512(acc2), Fold512(acc3)));
+  }
+
+  if (i < num_database) {
+    DotProductsGeneric(query, database + i * kDescriptorDim, num_database - i,
+                       dots + i);
+  }
+}
+#endif  // COLMAP_SIFT_X86_VNNI_KERNEL
+
+#endif  // COLMAP_SIFT_X86_KERNELS
+
+DotProductsFunc GetDotProductsFunc(const SiftDotProductKernel kernel) {
+  CHECK(IsSiftDotProductKernelSupported(kernel));
+  switch (kernel) {
+#ifdef COLMAP_SIFT_X86_KERNELS
+    case SiftDotProductKernel::AVX2:
+      return DotProductsAVX2;
+    case SiftDotProductKernel::AVX512:
+      return DotProductsAVX512;
+#ifdef COLMAP_SIFT_X86_VNNI_KERNEL
+    case SiftDotProductKernel::AVX512_VNNI:
+      return DotProductsAVX512VNNI;
+#endif
+#endif
+    default:
+      return DotProductsGeneric;
+  }
+}
+
+std::vector<int16_t> WidenFeatureDescriptors(
+    const FeatureDescriptorsRef& descriptors) {
+  std::vector<int16_t> widened(descriptors.rows() * kDescriptorDim);
+  for (FeatureDescriptors::Index i = 0; i < descriptors.rows(); ++i) {
+    std::copy(descriptors.row(i).data(),
+              descriptors.row(i).data() + kDescriptorDim,
+              widened.begin() + i * kDescriptorDim);
+  }
+  return widened;
+}
+
+// Keep the comparisons strict, so that the first of equal dot products in
+// index order becomes the nearest neighbor.
+inline void UpdateNearestNeighbors(const int idx, const int dist,
+                                   SiftNearestNeighbors* neighbors) {
+  if (dist > neighbors->best_dist) {
+    neighbors->best_idx = idx;
+    neighbors->second_best_dist = neighbors->best_dist;
+    neighbors->best_dist = dist;
+  } else if (dist > neighbors->second_best_dist) {
+    neighbors->second_best_dist = dist;
+  }
+}
+
+}  // namespace
+
+bool IsSiftDotProductKernelSupported(const SiftDotProductKernel kernel) {
+  switch (kernel) {
+    case SiftDotProductKernel::GENERIC:
+      return true;
+#ifdef COLMAP_SIFT_X86_KERNELS
+    case SiftDotProductKernel::AVX2:
+      return __builtin_cpu_supports("avx2");
+    case SiftDotProductKernel::AVX512:
+      return __builtin_cpu_supports("avx2") &&
+             __builtin_cpu_supports("avx512f") &&
+             __builtin_cpu_supports("avx512bw");
+#ifdef COLMAP_SIFT_X86_VNNI_KERNEL
+    case SiftDotProductKernel::AVX512_VNNI:
+      return IsSiftDotProductKernelSupported(SiftDotProductKernel::AVX512) &&
+             __builtin_cpu_supports("avx512vnni");
+#endif
+#endif
+    default:
+      return false;
+  }
+}
+
+SiftDotProductKernel GetBestSiftDotProductKernel() {
+  static const SiftDotProductKernel kBestKernel = []() {
+    for (const auto kernel :
+         {SiftDotProductKernel::AVX512_VNNI, SiftDotProductKernel::AVX512,
+          SiftDotProductKernel::AVX2}) {
+      if (IsSiftDotProductKernelSupported(kernel)) {
+        return kernel;
+      }
+    }
+    return SiftDotProductKernel::GENERIC;
+  }();
+  return kBestKernel;
+}
+
+void FindSiftNearestNeighborsBruteForce(
+    const FeatureDescriptorsRef& descriptors1,
+    const FeatureDescriptorsRef& descriptors2,
+    const std::function<bool(int, int)>& filter,
+    std::vector<SiftNearestNeighbors>* neighbors12,
+    std::vector<SiftNearestNeighbors>* neighbors21,
+    const SiftDotProductKernel kernel) {
+  CHECK_EQ(descriptors1.cols(), kDescriptorDim);
+  CHECK_EQ(descriptors2.cols(), kDescriptorDim);
+  CHECK_NOTNULL(neighbors12);
+
+  const int num_descriptors1 = static_cast<int>(descriptors1.rows());
+  const int num_descriptors2 = static_cast<int>(descriptors2.rows());
+
+  neighbors12->assign(num_descriptors1, SiftNearestNeighbors());
+  if (neighbors21 != nullptr) {
+    neighbors21->assign(num_descriptors2, SiftNearestNeighbors());
+  }
+
+  if (num_descriptors1 == 0 || num_descriptors2 == 0) {
+    return;
+  }
+
+  const DotProductsFunc dot_products = GetDotProductsFunc(kernel);
+  const std::vector<int16_t> widened1 = WidenFeatureDescriptors(descriptors1);
+  const std::vector<int16_t> widened2 = WidenFeatureDescriptors(descriptors2);
+
+  // Every row visits the columns in increasing order and vice versa, which
+  // makes the reduction identical to a scan of the full distance matrix.
+  int dots[kBlockSize];
+  for (int block_begin = 0; block_begin < num_descriptors2;
+       block_begin += kBlockSize) {
+    const int block_size =
+        std::min(kBlockSize, num_descriptors2 - block_begin);
+    const int16_t* block = widened2.data() + block_begin * kDescriptorDim;
+    for (int i1 = 0; i1 < num_descriptors1; ++i1) {
+      dot_products(widened1.data() + i1 * kDescriptorDim, block, block_size,
+                   dots);
+      SiftNearestNeighbors& neighbors1 = (*neighbors12)[i1];
+      for (int k = 0; k < block_size; ++k) {
+        const int i2 = block_begin + k;
+        const int dist = (filter && filter(i1, i2)) ? 0 : dots[k];
+        UpdateNearestNeighbors(i2, dist, &neighbors1);
+        if (neighbors21 != nullptr) {
+          UpdateNearestNeighbors(i1, dist, &(*neighbors21)[i2]);
+        }
+      }
+    }
+  }
+}
+
+}  // namespace colmap
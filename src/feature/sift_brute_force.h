@@ -0,0 +1,81 @@
+// Copyright (c) 2022, ETH Zurich and UNC Chapel Hill.
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//
+//     * Neither the name of ETH Zurich and UNC Chapel Hill nor the names of
+//       its contributors may be used to endorse or promote products derived
+//       from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDERS OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//
+// Author: Johannes L. Schoenberger (jsch-at-demuc-dot-de)
+
+#ifndef COLMAP_SRC_FEATURE_SIFT_BRUTE_FORCE_H_
+#define COLMAP_SRC_FEATURE_SIFT_BRUTE_FORCE_H_
+
+#include <functional>
+#include <vector>
+
+#include "feature/types.h"
+
+namespace colmap {
+
+// Instruction set used to compute SIFT descriptor dot products.
+enum class SiftDotProductKernel {
+  GENERIC,
+  AVX2,
+  AVX512,
+  AVX512_VNNI,
+};
+
+// Whether the kernel can run on the current CPU.
+bool IsSiftDotProductKernelSupported(const SiftDotProductKernel kernel);
+
+// The fastest kernel supported by the current CPU, detected once at runtime.
+SiftDotProductKernel GetBestSiftDotProductKernel();
+
+// The two largest descriptor dot products of one feature against all features
+// of another image. Dot products of zero are ignored, i.e. features without
+// any positive dot product have no nearest neighbor.
+struct SiftNearestNeighbors {
+  int best_idx = -1;
+  int best_dist = 0;
+  int second_best_dist = 0;
+};
+
+// Find the nearest neighbors of every feature in `descriptors1` among
+// `descriptors2` and, if `neighbors21` is not null, vice versa. The dot
+// products are computed block-wise and immediately reduced to the two nearest
+// neighbors, so the full distance matrix is never materialized. The result is
+// identical to an exhaustive scan in index order, independent of the kernel.
+// Pairs for which the optional `filter` returns true are skipped.
+void FindSiftNearestNeighborsBruteForce(
+    const FeatureDescriptorsRef& descriptors1,
+    const FeatureDescriptorsRef& descriptors2,
+    const std::function<bool(int, int)>& filter,
+    std::vector<SiftNearestNeighbors>* neighbors12,
+    std::vector<SiftNearestNeighbors>* neighbors21,
+    const SiftDotProductKernel kernel = GetBestSiftDotProductKernel());
+
+}  // namespace colmap
+
+#endif  // COLMAP_SRC_FEATURE_SIFT_BRUTE_FORCE_H_
@@ -0,0 +1,146 @@
+// Copyright (c) 2022, ETH Zurich and UNC Chapel Hill.
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//
+//     * Neither the name of ETH Zurich and UNC Chapel Hill nor the names of
+//       its contributors may be used to endorse or promote products derived
+//       from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDERS OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//
+// Author: Johannes L. Schoenberger (jsch-at-demuc-dot-de)
+
+#define TEST_NAME "feature/sift_brute_force"
+#include "util/testing.h"
+
+#include "feature/sift_brute_force.h"
+#include "util/random.h"
+
+using namespace colmap;
+
+FeatureDescriptors CreateRandomFeatureDescriptors(const size_t num_features) {
+  FeatureDescriptors descriptors(num_features, 128);
+  for (size_t i = 0; i < num_features; ++i) {
+    for (size_t j = 0; j < 128; ++j) {
+      descriptors(i, j) = RandomInteger<int>(0, 255);
+    }
+  }
+  return descriptors;
+}
+
+// Reference implementation that scans the full distance matrix.
+std::vector<SiftNearestNeighbors> FindNearestNeighborsExhaustive(
+    const FeatureDescriptors& descriptors1,
+    const FeatureDescriptors& descriptors2,
+    const std::function<bool(int, int)>& filter) {
+  std::vector<SiftNearestNeighbors> neighbors(descriptors1.rows());
+  for (int i1 = 0; i1 < descriptors1.rows(); ++i1) {
+    for (int i2 = 0; i2 < descriptors2.rows(); ++i2) {
+      int dist = 0;
+      if (!filter || !filter(i1, i2)) {
+        dist = descriptors1.row(i1).cast<int>().dot(
+            descriptors2.row(i2).cast<int>());
+      }
+      if (dist > neighbors[i1].best_dist) {
+        neighbors[i1].best_idx = i2;
+        neighbors[i1].second_best_dist = neighbors[i1].best_dist;
+        neighbors[i1].best_dist = dist;
+      } else if (dist > neighbors[i1].second_best_dist) {
+        neighbors[i1].second_best_dist = dist;
+      }
+    }
+  }
+  return neighbors;
+}
+
+void CheckEqualNeighbors(const std::vector<SiftNearestNeighbors>& neighbors1,
+                         const std::vector<SiftNearestNeighbors>& neighbors2) {
+  BOOST_REQUIRE_EQUAL(neighbors1.size(), neighbors2.size());
+  for (size_t i = 0; i < neighbors1.size(); ++i) {
+    BOOST_CHECK_EQUAL(neighbors1[i].best_idx, neighbors2[i].best_idx);
+    BOOST_CHECK_EQUAL(neighbors1[i].best_dist, neighbors2[i].best_dist);
+    BOOST_CHECK_EQUAL(neighbors1[i].second_best_dist,
+                      neighbors2[i].second_best_dist);
+  }
+}
+
+BOOST_AUTO_TEST_CASE(TestBestKernelSupported) {
+  BOOST_CHECK(
+      IsSiftDotProductKernelSupported(SiftDotProductKernel::GENERIC));
+  BOOST_CHECK(IsSiftDotProductKernelSupported(GetBestSiftDotProductKernel()));
+}
+
+BOOST_AUTO_TEST_CASE(TestFindNearestNeighbors) {
+  SetPRNGSeed(0);
+  FeatureDescriptors descriptors1 = CreateRandomFeatureDescriptors(131);
+  const FeatureDescriptors descriptors2 = CreateRandomFeatureDescriptors(150);
+  // Duplicate descriptors produce ties that must resolve in index order.
+  descriptors1.row(7) = descriptors2.row(3);
+  descriptors1.row(8) = descriptors2.row(3);
+  const auto filter = [](const int i1, const int i2) {
+    return (i1 + i2) % 3 == 0;
+  };
+
+  const std::vector<SiftNearestNeighbors> expected12 =
+      FindNearestNeighborsExhaustive(descriptors1, descriptors2, nullptr);
+  const std::vector<SiftNearestNeighbors> expected21 =
+      FindNearestNeighborsExhaustive(descriptors2, descriptors1, nullptr);
+  const std::vector<SiftNearestNeighbors> expected12_filtered =
+      FindNearestNeighborsExhaustive(descriptors1, descriptors2, filter);
+
+  for (const auto kernel :
+       {SiftDotProductKernel::GENERIC, SiftDotProductKernel::AVX2,
+        SiftDotProductKernel::AVX512, SiftDotProductKernel::AVX512_VNNI}) {
+    if (!IsSiftDotProductKernelSupported(kernel)) {
+      continue;
+    }
+
+    std::vector<SiftNearestNeighbors> neighbors12;
+    std::vector<SiftNearestNeighbors> neighbors21;
+    FindSiftNearestNeighborsBruteForce(descriptors1, descriptors2, nullptr,
+                                       &neighbors12, &neighbors21, kernel);
+    CheckEqualNeighbors(expected12, neighbors12);
+    CheckEqualNeighbors(expected21, neighbors21);
+
+    FindSiftNearestNeighborsBruteForce(descriptors1, descriptors2, filter,
+                                       &neighbors12, nullptr, kernel);
+    CheckEqualNeighbors(expected12_filtered, neighbors12);
+  }
+}
+
+BOOST_AUTO_TEST_CASE(TestFindNearestNeighborsEmpty) {
+  const FeatureDescriptors descriptors = CreateRandomFeatureDescriptors(10);
+  const FeatureDescriptors empty_descriptors(0, 128);
+  std::vector<SiftNearestNeighbors> neighbors12;
+  std::vector<SiftNearestNeighbors> neighbors21;
+  FindSiftNearestNeighborsBruteForce(descriptors, empty_descriptors, nullptr,
+                                     &neighbors12, &neighbors21);
+  BOOST_CHECK_EQUAL(neighbors12.size(), 10);
+  BOOST_CHECK_EQUAL(neighbors21.size(), 0);
+  for (const auto& neighbors : neighbors12) {
+    BOOST_CHECK_EQUAL(neighbors.best_idx, -1);
+  }
+  FindSiftNearestNeighborsBruteForce(empty_descriptors, descriptors, nullptr,
+                                     &neighbors12, &neighbors21);
+  BOOST_CHECK_EQUAL(neighbors12.size(), 0);
+  BOOST_CHECK_EQUAL(neighbors21.size(), 10);
+}
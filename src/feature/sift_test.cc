@@ -435,6 +435,52 @@ BOOST_AUTO_TEST_CASE(TestMatchSiftFeaturesCPUFLANNvsBruteForce) {
   }
 }
 
+BOOST_AUTO_TEST_CASE(TestMatchSiftFeaturesCPUWithIndex) {
+  const FeatureDescriptors descriptors1 = CreateRandomFeatureDescriptors(100);
+  const FeatureDescriptors descriptors2 = descriptors1.colwise().reverse();
+  const FeatureDescriptors descriptors3 = CreateRandomFeatureDescriptors(50);
+  const FeatureDescriptors empty_descriptors =
+      CreateRandomFeatureDescriptors(0);
+
+  const SiftDescriptorIndex index1(descriptors1);
+  const SiftDescriptorIndex index2(descriptors2);
+  const SiftDescriptorIndex index3(descriptors3);
+  const SiftDescriptorIndex empty_index(empty_descriptors);
+  BOOST_CHECK(index1.IsValid());
+  BOOST_CHECK(!SiftDescriptorIndex().IsValid());
+  BOOST_CHECK_GT(index1.NumBytes(), descriptors1.size());
+  BOOST_CHECK(index1.Descriptors() == descriptors1);
+
+  for (const bool cross_check : {true, false}) {
+    SiftMatchingOptions match_options;
+    match_options.cross_check = cross_check;
+
+    // The same indices are reused for multiple pairs.
+    FeatureMatches matches_bf;
+    FeatureMatches matches_index;
+    MatchSiftFeaturesCPUBruteForce(match_options, descriptors1, descriptors2,
+                                   &matches_bf);
+    MatchSiftFeaturesCPU(match_options, index1, index2, &matches_index);
+    CheckEqualMatches(matches_bf, matches_index);
+    BOOST_CHECK_EQUAL(matches_index.size(), 100);
+
+    MatchSiftFeaturesCPUBruteForce(match_options, descriptors1, descriptors3,
+                                   &matches_bf);
+    MatchSiftFeaturesCPU(match_options, index1, index3, &matches_index);
+    CheckEqualMatches(matches_bf, matches_index);
+
+    MatchSiftFeaturesCPUBruteForce(match_options, descriptors3, descriptors2,
+                                   &matches_bf);
+    MatchSiftFeaturesCPU(match_options, index3, index2, &matches_index);
+    CheckEqualMatches(matches_bf, matches_index);
+
+    MatchSiftFeaturesCPU(match_options, empty_index, index2, &matches_index);
+    BOOST_CHECK_EQUAL(matches_index.size(), 0);
+    MatchSiftFeaturesCPU(match_options, index1, empty_index, &matches_index);
+    BOOST_CHECK_EQUAL(matches_index.size(), 0);
+  }
+}
+
 BOOST_AUTO_TEST_CASE(TestMatchGuidedSiftFeaturesCPU) {
   FeatureKeypoints empty_keypoints(0);
   FeatureKeypoints keypoints1(2);
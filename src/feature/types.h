@@ -98,6 +98,10 @@ typedef Eigen::Matrix<uint8_t, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor>
     FeatureDescriptors;
 typedef std::vector<FeatureMatch> FeatureMatches;
 
+// Read-only view of descriptors, which binds to owned descriptors as well as
+// to memory-mapped descriptors without copying them.
+typedef Eigen::Ref<const FeatureDescriptors> FeatureDescriptorsRef;
+
 }  // namespace colmap
 
 #endif  // COLMAP_SRC_FEATURE_TYPES_H_
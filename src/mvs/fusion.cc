@@ -31,6 +31,8 @@
 
 #include "mvs/fusion.h"
 
+#include <numeric>
+
 #include "util/misc.h"
 
 namespace colmap {
@@ -78,8 +80,262 @@ int FindNextImage(const std::vector<std::vector<int>>& overlapping_images,
   return -1;
 }
 
+// Make the inclusive bounding box half-open by moving the maximum bound to the
+// next larger float, such that the resulting tile contains the same points.
+StereoFusionTile MakeRootTile(
+    const std::pair<Eigen::Vector3f, Eigen::Vector3f>& bounding_box) {
+  StereoFusionTile tile;
+  tile.min_bound = bounding_box.first;
+  for (int d = 0; d < 3; ++d) {
+    tile.max_bound(d) = std::nextafter(bounding_box.second(d),
+                                       std::numeric_limits<float>::infinity());
+  }
+  return tile;
+}
+
+// Compute the half-spaces of the viewing frustum of the image in homogeneous
+// coordinates, whose intersection contains the points that project into the
+// image within the given depth range. A negative depth range only bounds the
+// frustum by the image plane.
+std::vector<Eigen::Vector4f> ComputeFrustumHalfSpaces(
+    const Image& image, const std::pair<float, float>& depth_range) {
+  const Eigen::Map<const Eigen::Matrix<float, 3, 4, Eigen::RowMajor>> P(
+      image.GetP());
+  const float width = static_cast<float>(image.GetWidth());
+  const float height = static_cast<float>(image.GetHeight());
+  const Eigen::Vector4f p1 = P.row(0).transpose();
+  const Eigen::Vector4f p2 = P.row(1).transpose();
+  // The last row of the projection matrix computes the depth of a point.
+  const Eigen::Vector4f p3 = P.row(2).transpose();
+
+  std::vector<Eigen::Vector4f> half_spaces;
+  half_spaces.push_back(p1);
+  half_spaces.push_back(width * p3 - p1);
+  half_spaces.push_back(p2);
+  half_spaces.push_back(height * p3 - p2);
+  if (depth_range.first >= 0 && depth_range.second >= depth_range.first) {
+    half_spaces.push_back(p3 - Eigen::Vector4f(0, 0, 0, depth_range.first));
+    half_spaces.push_back(Eigen::Vector4f(0, 0, 0, depth_range.second) - p3);
+  } else {
+    half_spaces.push_back(p3);
+  }
+  return half_spaces;
+}
+
+// Compute the axis-aligned bounding box of the viewing frustum of the image
+// within the given depth range. Without a valid depth range, the frustum is
+// unbounded and so is the box.
+std::pair<Eigen::Vector3f, Eigen::Vector3f> ComputeFrustumBox(
+    const Image& image, const std::pair<float, float>& depth_range) {
+  if (depth_range.first < 0 || depth_range.second < depth_range.first) {
+    return std::make_pair(Eigen::Vector3f::Constant(-FLT_MAX),
+                          Eigen::Vector3f::Constant(FLT_MAX));
+  }
+  const Eigen::Map<const Eigen::Matrix<float, 3, 4, Eigen::RowMajor>> inv_P(
+      image.GetInvP());
+  const float width = static_cast<float>(image.GetWidth());
+  const float height = static_cast<float>(image.GetHeight());
+  Eigen::Vector3f min_xyz = Eigen::Vector3f::Constant(FLT_MAX);
+  Eigen::Vector3f max_xyz = Eigen::Vector3f::Constant(-FLT_MAX);
+  for (const float depth : {depth_range.first, depth_range.second}) {
+    for (int i = 0; i < 4; ++i) {
+      const Eigen::Vector3f xyz =
+          inv_P * Eigen::Vector4f(i & 1 ? width * depth : 0,
+                                  i & 2 ? height * depth : 0, depth, 1.0f);
+      min_xyz = min_xyz.cwiseMin(xyz);
+      max_xyz = max_xyz.cwiseMax(xyz);
+    }
+  }
+  return std::make_pair(min_xyz, max_xyz);
+}
+
+// Conservatively check whether the box overlaps the frustum by testing whether
+// all corners of the box lie outside of one of the half-spaces.
+bool BoxOverlapsFrustum(const Eigen::Vector3f& min_xyz,
+                        const Eigen::Vector3f& max_xyz,
+                        const std::vector<Eigen::Vector4f>& half_spaces) {
+  for (const auto& half_space : half_spaces) {
+    bool all_outside = true;
+    for (int i = 0; i < 8 && all_outside; ++i) {
+      const Eigen::Vector4f corner(i & 1 ? max_xyz(0) : min_xyz(0),
+                                   i & 2 ? max_xyz(1) : min_xyz(1),
+                                   i & 4 ? max_xyz(2) : min_xyz(2), 1.0f);
+      all_outside = half_space.dot(corner) < 0;
+    }
+    if (all_outside) {
+      return false;
+    }
+  }
+  return true;
+}
+
 }  // namespace internal
 
+bool StereoFusionTile::Contains(const Eigen::Vector3f& xyz) const {
+  return (xyz.array() >= min_bound.array()).all() &&
+         (xyz.array() < max_bound.array()).all();
+}
+
+std::vector<StereoFusionTile> ComputeStereoFusionTiles(
+    const Model& model, const std::vector<size_t>& image_num_bytes,
+    const size_t max_num_bytes,
+    const std::pair<Eigen::Vector3f, Eigen::Vector3f>& bounding_box) {
+  CHECK_EQ(image_num_bytes.size(), model.images.size());
+
+  // Tiles with fewer points are not split any further, since the sparse points
+  // no longer reliably determine the images observing the tile.
+  const size_t kMinNumTilePoints = 100;
+
+  struct TileNode {
+    StereoFusionTile tile;
+    std::vector<int> point_idxs;
+  };
+
+  TileNode root;
+  root.tile = internal::MakeRootTile(bounding_box);
+  for (size_t point_idx = 0; point_idx < model.points.size(); ++point_idx) {
+    const auto& point = model.points[point_idx];
+    if (root.tile.Contains(Eigen::Vector3f(point.x, point.y, point.z))) {
+      root.point_idxs.push_back(point_idx);
+    }
+  }
+
+  // Without sparse points, e.g., for raw PMVS workspaces, the scene cannot be
+  // partitioned and all images are fused as a single tile.
+  if (root.point_idxs.empty()) {
+    for (size_t image_idx = 0; image_idx < model.images.size(); ++image_idx) {
+      if (image_num_bytes[image_idx] > 0) {
+        root.tile.image_idxs.push_back(image_idx);
+      }
+    }
+    return {root.tile};
+  }
+
+  const auto depth_ranges = model.ComputeDepthRanges();
+  std::vector<std::vector<Eigen::Vector4f>> frustum_half_spaces(
+      model.images.size());
+  std::vector<std::pair<Eigen::Vector3f, Eigen::Vector3f>> frustum_boxes(
+      model.images.size());
+  for (size_t image_idx = 0; image_idx < model.images.size(); ++image_idx) {
+    if (image_num_bytes[image_idx] > 0) {
+      frustum_half_spaces[image_idx] = internal::ComputeFrustumHalfSpaces(
+          model.images[image_idx], depth_ranges[image_idx]);
+      frustum_boxes[image_idx] = internal::ComputeFrustumBox(
+          model.images[image_idx], depth_ranges[image_idx]);
+    }
+  }
+
+  std::vector<StereoFusionTile> tiles;
+  std::vector<TileNode> nodes;
+  nodes.push_back(std::move(root));
+  std::vector<char> observed_images(model.images.size());
+  while (!nodes.empty()) {
+    TileNode node = std::move(nodes.back());
+    nodes.pop_back();
+
+    size_t num_bytes = 0;
+    std::fill(observed_images.begin(), observed_images.end(), false);
+    auto AddImage = [&](const int image_idx) {
+      if (image_num_bytes.at(image_idx) > 0 && !observed_images[image_idx]) {
+        observed_images[image_idx] = true;
+        num_bytes += image_num_bytes[image_idx];
+        node.tile.image_idxs.push_back(image_idx);
+      }
+    };
+
+    for (const int point_idx : node.point_idxs) {
+      for (const int image_idx : model.points[point_idx].track) {
+        AddImage(image_idx);
+      }
+    }
+
+    // Images can see parts of the tile without observing any of its sparse
+    // points, so additionally add the images whose frustum overlaps the tile.
+    // The dense samples of an image lie within its frustum up to its depth
+    // range, which may extend beyond the sparse points. The tile is clipped
+    // to the box of that frustum, since the tiles at the border of the scene
+    // are unbounded.
+    for (size_t image_idx = 0; image_idx < model.images.size(); ++image_idx) {
+      if (observed_images[image_idx] ||
+          frustum_half_spaces[image_idx].empty()) {
+        continue;
+      }
+      const Eigen::Vector3f min_box_xyz =
+          node.tile.min_bound.cwiseMax(frustum_boxes[image_idx].first);
+      const Eigen::Vector3f max_box_xyz =
+          node.tile.max_bound.cwiseMin(frustum_boxes[image_idx].second);
+      if ((min_box_xyz.array() <= max_box_xyz.array()).all() &&
+          internal::BoxOverlapsFrustum(min_box_xyz, max_box_xyz,
+                                       frustum_half_spaces[image_idx])) {
+        AddImage(image_idx);
+      }
+    }
+
+    std::sort(node.tile.image_idxs.begin(), node.tile.image_idxs.end());
+
+    if (num_bytes <= max_num_bytes ||
+        node.point_idxs.size() < 2 * kMinNumTilePoints) {
+      if (!node.tile.image_idxs.empty()) {
+        tiles.push_back(std::move(node.tile));
+      }
+      continue;
+    }
+
+    // Split at the median of the points along their longest extent.
+    Eigen::Vector3f min_xyz = Eigen::Vector3f::Constant(FLT_MAX);
+    Eigen::Vector3f max_xyz = Eigen::Vector3f::Constant(-FLT_MAX);
+    for (const int point_idx : node.point_idxs) {
+      const auto& point = model.points[point_idx];
+      const Eigen::Vector3f xyz(point.x, point.y, point.z);
+      min_xyz = min_xyz.cwiseMin(xyz);
+      max_xyz = max_xyz.cwiseMax(xyz);
+    }
+
+    int axis;
+    (max_xyz - min_xyz).maxCoeff(&axis);
+
+    std::vector<float> coords;
+    coords.reserve(node.point_idxs.size());
+    for (const int point_idx : node.point_idxs) {
+      const auto& point = model.points[point_idx];
+      coords.push_back(Eigen::Vector3f(point.x, point.y, point.z)(axis));
+    }
+    const size_t mid_idx = coords.size() / 2;
+    std::nth_element(coords.begin(), coords.begin() + mid_idx, coords.end());
+    const float split = coords[mid_idx];
+
+    TileNode left_node;
+    TileNode right_node;
+    left_node.tile.min_bound = node.tile.min_bound;
+    left_node.tile.max_bound = node.tile.max_bound;
+    left_node.tile.max_bound(axis) = split;
+    right_node.tile.min_bound = node.tile.min_bound;
+    right_node.tile.max_bound = node.tile.max_bound;
+    right_node.tile.min_bound(axis) = split;
+    for (size_t i = 0; i < node.point_idxs.size(); ++i) {
+      const auto& point = model.points[node.point_idxs[i]];
+      if (Eigen::Vector3f(point.x, point.y, point.z)(axis) < split) {
+        left_node.point_idxs.push_back(node.point_idxs[i]);
+      } else {
+        right_node.point_idxs.push_back(node.point_idxs[i]);
+      }
+    }
+
+    // All points lie on the split plane and the tile cannot be split further.
+    if (left_node.point_idxs.empty()) {
+      tiles.push_back(std::move(node.tile));
+      continue;
+    }
+
+    // Push the right node first, such that tiles are output in depth-first
+    // order from left to right.
+    nodes.push_back(std::move(right_node));
+    nodes.push_back(std::move(left_node));
+  }
+
+  return tiles;
+}
+
 void StereoFusionOptions::Print() const {
 #define PrintOption(option) std::cout << #option ": " << option << std::endl
   PrintHeading2("StereoFusion::Options");
@@ -94,6 +350,7 @@ void StereoFusionOptions::Print() const {
   PrintOption(check_num_images);
   PrintOption(use_cache);
   PrintOption(cache_size);
+  PrintOption(use_tiles);
   const auto& bbox_min = bounding_box.first.transpose().eval();
   const auto& bbox_max = bounding_box.second.transpose().eval();
   PrintOption(bbox_min);
@@ -167,14 +424,17 @@ void StereoFusion::Run() {
   const auto image_names = ReadTextFileLines(JoinPaths(
       workspace_path_, workspace_options.stereo_folder, "fusion.cfg"));
   int num_threads = 1;
-  if (options_.use_cache) {
+  if (options_.use_cache || options_.use_tiles) {
     workspace_.reset(new CachedWorkspace(workspace_options));
   } else {
     workspace_.reset(new Workspace(workspace_options));
     workspace_->Load(image_names);
-    num_threads = GetEffectiveNumThreads(options_.num_threads);
+    num_threads = options_.num_threads;
   }
 
+  ThreadBudgetLease thread_budget_lease(num_threads);
+  num_threads = thread_budget_lease.NumThreads();
+
   if (IsStopped()) {
     GetTimer().PrintMinutes();
     return;
@@ -192,9 +452,7 @@ void StereoFusion::Run() {
     overlapping_images_ = model.GetMaxOverlappingImagesFromPMVS();
   }
 
-  task_fused_points_.resize(num_threads);
-  task_fused_points_visibility_.resize(num_threads);
-
+  std::vector<size_t> image_num_bytes(model.images.size(), 0);
   used_images_.resize(model.images.size(), false);
   fused_images_.resize(model.images.size(), false);
   fused_pixel_masks_.resize(model.images.size());
@@ -223,7 +481,11 @@ void StereoFusion::Run() {
 
     used_images_.at(image_idx) = true;
 
-    InitFusedPixelMask(image_idx, depth_map.GetWidth(), depth_map.GetHeight());
+    // Depth map, normal map, fused pixel mask, and RGB bitmap.
+    image_num_bytes.at(image_idx) =
+        depth_map.GetWidth() * depth_map.GetHeight() *
+            (4 * sizeof(float) + sizeof(char)) +
+        image.GetWidth() * image.GetHeight() * 3;
 
     depth_map_sizes_.at(image_idx) =
         std::make_pair(depth_map.GetWidth(), depth_map.GetHeight());
@@ -250,32 +512,88 @@ void StereoFusion::Run() {
             .transpose();
   }
 
+  std::vector<StereoFusionTile> tiles;
+  if (options_.use_tiles) {
+    tiles = ComputeStereoFusionTiles(
+        model, image_num_bytes,
+        static_cast<size_t>(1024.0 * 1024.0 * 1024.0 * options_.cache_size),
+        options_.bounding_box);
+  } else {
+    tiles.push_back(internal::MakeRootTile(options_.bounding_box));
+    for (size_t image_idx = 0; image_idx < used_images_.size(); ++image_idx) {
+      if (used_images_[image_idx]) {
+        tiles.back().image_idxs.push_back(image_idx);
+      }
+    }
+  }
+
+  // The fused pixel masks are only kept in memory until the last tile of the
+  // image has been fused.
+  std::vector<int> last_tile_idxs(model.images.size(), -1);
+  for (size_t tile_idx = 0; tile_idx < tiles.size(); ++tile_idx) {
+    for (const int image_idx : tiles[tile_idx].image_idxs) {
+      last_tile_idxs.at(image_idx) = tile_idx;
+    }
+  }
+
   std::cout << StringPrintf("Starting fusion with %d threads", num_threads)
             << std::endl;
-  ThreadPool thread_pool(num_threads);
 
-  // Using a row stride of 10 to avoid starting parallel processing in rows that
-  // are too close to each other which may lead to duplicated work, since nearby
-  // pixels are likely to get fused into the same point.
-  const int kRowStride = 10;
-  auto ProcessImageRows = [&, this](const int row_start, const int height,
-                                    const int width, const int image_idx,
-                                    const Mat<char>& fused_pixel_mask) {
-    const int row_end = std::min(height, row_start + kRowStride);
-    for (int row = row_start; row < row_end; ++row) {
-      for (int col = 0; col < width; ++col) {
-        if (fused_pixel_mask.Get(row, col) > 0) {
-          continue;
-        }
-        const int thread_id = thread_pool.GetThreadIndex();
-        Fuse(thread_id, image_idx, row, col);
+  for (size_t tile_idx = 0; tile_idx < tiles.size(); ++tile_idx) {
+    if (IsStopped()) {
+      break;
+    }
+    if (options_.use_tiles) {
+      std::cout << StringPrintf("Fusing tile [%d/%d] with %d images",
+                                tile_idx + 1, tiles.size(),
+                                tiles[tile_idx].image_idxs.size())
+                << std::endl;
+    }
+    FuseTile(tiles[tile_idx], num_threads);
+    for (const int image_idx : tiles[tile_idx].image_idxs) {
+      if (last_tile_idxs[image_idx] == static_cast<int>(tile_idx)) {
+        fused_pixel_masks_[image_idx] = Mat<char>();
       }
     }
-  };
+  }
+
+  if (fused_points_.empty()) {
+    std::cout << "WARNING: Could not fuse any points. This is likely caused by "
+                 "incorrect settings - filtering must be enabled for the last "
+                 "call to patch match stereo."
+              << std::endl;
+  }
+
+  std::cout << "Number of fused points: " << fused_points_.size() << std::endl;
+  GetTimer().PrintMinutes();
+}
+
+void StereoFusion::FuseTile(const StereoFusionTile& tile,
+                            const int num_threads) {
+  if (tile.image_idxs.empty()) {
+    return;
+  }
+
+  tile_ = tile;
+
+  // Only traverse the images of the tile. The fused pixel masks of images
+  // shared with previous tiles are kept, such that their pixels are not fused
+  // again into duplicate points along the tile boundaries.
+  std::fill(used_images_.begin(), used_images_.end(), false);
+  std::fill(fused_images_.begin(), fused_images_.end(), false);
+  for (const int image_idx : tile.image_idxs) {
+    used_images_.at(image_idx) = true;
+    if (fused_pixel_masks_.at(image_idx).GetWidth() == 0) {
+      const int width = depth_map_sizes_.at(image_idx).first;
+      const int height = depth_map_sizes_.at(image_idx).second;
+      InitFusedPixelMask(image_idx, width, height);
+    }
+  }
+
+  ThreadPool thread_pool(num_threads);
 
   size_t num_fused_images = 0;
-  size_t total_fused_points = 0;
-  for (int image_idx = 0; image_idx >= 0;
+  for (int image_idx = tile.image_idxs[0]; image_idx >= 0;
        image_idx = internal::FindNextImage(overlapping_images_, used_images_,
                                            fused_images_, image_idx)) {
     if (IsStopped()) {
@@ -286,57 +604,213 @@ void StereoFusion::Run() {
     timer.Start();
 
     std::cout << StringPrintf("Fusing image [%d/%d] with index %d",
-                              num_fused_images + 1, model.images.size(),
+                              num_fused_images + 1, tile.image_idxs.size(),
                               image_idx)
               << std::flush;
 
-    const int width = depth_map_sizes_.at(image_idx).first;
-    const int height = depth_map_sizes_.at(image_idx).second;
-    const auto& fused_pixel_mask = fused_pixel_masks_.at(image_idx);
-
-    for (int row_start = 0; row_start < height; row_start += kRowStride) {
-      thread_pool.AddTask(ProcessImageRows, row_start, height, width, image_idx,
-                          fused_pixel_mask);
-    }
-    thread_pool.Wait();
+    FuseImage(image_idx, &thread_pool);
 
     num_fused_images += 1;
     fused_images_.at(image_idx) = true;
 
-    total_fused_points = 0;
-    for (const auto& task_fused_points : task_fused_points_) {
-      total_fused_points += task_fused_points.size();
-    }
     std::cout << StringPrintf(" in %.3fs (%d points)", timer.ElapsedSeconds(),
-                              total_fused_points)
+                              fused_points_.size())
               << std::endl;
   }
+}
+
+void StereoFusion::FuseImage(const int image_idx, ThreadPool* thread_pool) {
+  // The image is split into blocks and every block fuses its pixels in
+  // row-major order. In each round, all blocks concurrently traverse from
+  // their next unfused pixel without modifying the fused pixel masks, and
+  // claim all visited pixels with their block index in a hash table sized to
+  // the pixels visited per round. A task is then only committed, if it owns
+  // all its visited pixels, because its result then does not depend on any
+  // other task of the round. The remaining tasks are repeated in the next
+  // round, and the task of the first block always succeeds. Since the result
+  // of a round only depends on the block indices, the fused points are
+  // independent of the number of threads. Blocks are sufficiently large that
+  // concurrently fused pixels are far apart and rarely fuse into the same
+  // point.
+  const int kBlockSize = 16;
+
+  const int width = depth_map_sizes_.at(image_idx).first;
+  const int height = depth_map_sizes_.at(image_idx).second;
+  const int num_block_cols = (width + kBlockSize - 1) / kBlockSize;
+  const int num_block_rows = (height + kBlockSize - 1) / kBlockSize;
+  const int num_blocks = num_block_cols * num_block_rows;
+  const Mat<char>& fused_pixel_mask = fused_pixel_masks_.at(image_idx);
+
+  std::vector<int> block_idxs(num_blocks);
+  std::iota(block_idxs.begin(), block_idxs.end(), 0);
+  std::vector<int> block_offsets(num_blocks, 0);
+  std::vector<FusionTask> tasks(num_blocks);
+
+  auto ClaimPixels = [&, this](const int block_idx) {
+    FusionTask& task = tasks[block_idx];
+    task.claim_slots.resize(task.visited_pixels.size());
+    for (size_t i = 0; i < task.visited_pixels.size(); ++i) {
+      const auto& pixel = task.visited_pixels[i];
+      if (!pixel_claims_.Claim(pixel.first, pixel.second, block_idx,
+                               &task.claim_slots[i])) {
+        return;
+      }
+    }
+  };
+
+  auto TraverseBlock = [&, this](const size_t i) {
+    const int block_idx = block_idxs[i];
+    const int row_start = (block_idx / num_block_cols) * kBlockSize;
+    const int col_start = (block_idx % num_block_cols) * kBlockSize;
+    const int block_height = std::min(kBlockSize, height - row_start);
+    const int block_width = std::min(kBlockSize, width - col_start);
+
+    FusionTask& task = tasks[block_idx];
+    task.is_active = false;
+    task.is_committed = false;
+    task.visited_pixels.clear();
+    task.fused_pixels.clear();
+    task.has_point = false;
+    task.visibility.clear();
+
+    int& offset = block_offsets[block_idx];
+    for (; offset < block_width * block_height; ++offset) {
+      const int row = row_start + offset / block_width;
+      const int col = col_start + offset % block_width;
+      if (fused_pixel_mask.Get(row, col) == 0) {
+        task.is_active = true;
+        Fuse(image_idx, row, col, &task);
+        break;
+      }
+    }
+
+    ClaimPixels(block_idx);
+  };
+
+  auto CommitBlock = [&, this](const size_t i) {
+    const int block_idx = block_idxs[i];
+    FusionTask& task = tasks[block_idx];
+    for (const size_t slot : task.claim_slots) {
+      if (pixel_claims_.Owner(slot) != block_idx) {
+        return;
+      }
+    }
+
+    // Committed tasks own disjoint pixels and can thus concurrently write to
+    // the fused pixel masks.
+    for (const auto& pixel : task.fused_pixels) {
+      fused_pixel_masks_[pixel.first].GetPtr()[pixel.second] = 1;
+    }
+    task.is_committed = true;
+    block_offsets[block_idx] += 1;
+  };
+
+  auto ReleaseBlock = [&, this](const size_t i) {
+    for (const size_t slot : tasks[block_idxs[i]].claim_slots) {
+      pixel_claims_.Release(slot);
+    }
+  };
+
+  // Every round visits roughly the same number of pixels, such that the claim
+  // table rarely needs to grow after the first rounds.
+  size_t num_round_pixels = block_idxs.size() * kBlockSize;
+  while (!block_idxs.empty() && !IsStopped()) {
+    pixel_claims_.Reset(num_round_pixels);
+    thread_pool->ParallelFor(0, block_idxs.size(), 1, TraverseBlock);
+
+    num_round_pixels = 0;
+    for (const int block_idx : block_idxs) {
+      num_round_pixels += tasks[block_idx].visited_pixels.size();
+    }
+
+    while (pixel_claims_.Overflowed()) {
+      pixel_claims_.Reset(num_round_pixels);
+      thread_pool->ParallelFor(0, block_idxs.size(), 1, [&](const size_t i) {
+        ClaimPixels(block_idxs[i]);
+      });
+    }
+
+    thread_pool->ParallelFor(0, block_idxs.size(), 1, CommitBlock);
+    thread_pool->ParallelFor(0, block_idxs.size(), 1, ReleaseBlock);
+
+    // Merge the fused points in the order of the blocks and remove the blocks
+    // without any remaining unfused pixels.
+    size_t num_active_blocks = 0;
+    for (const int block_idx : block_idxs) {
+      FusionTask& task = tasks[block_idx];
+      if (task.is_committed && task.has_point) {
+        fused_points_.push_back(task.point);
+        fused_points_visibility_.push_back(std::move(task.visibility));
+      }
+      if (task.is_active) {
+        block_idxs[num_active_blocks] = block_idx;
+        num_active_blocks += 1;
+      }
+    }
+    block_idxs.resize(num_active_blocks);
+  }
+}
 
-  fused_points_.reserve(total_fused_points);
-  fused_points_visibility_.reserve(total_fused_points);
-  for (size_t thread_id = 0; thread_id < task_fused_points_.size();
-       ++thread_id) {
-    fused_points_.insert(fused_points_.end(),
-                         task_fused_points_[thread_id].begin(),
-                         task_fused_points_[thread_id].end());
-    task_fused_points_[thread_id].clear();
-
-    fused_points_visibility_.insert(
-        fused_points_visibility_.end(),
-        task_fused_points_visibility_[thread_id].begin(),
-        task_fused_points_visibility_[thread_id].end());
-    task_fused_points_visibility_[thread_id].clear();
+void StereoFusion::PixelClaimTable::Reset(const size_t num_pixels) {
+  // Keep the load factor of the open addressing at most one half.
+  if (num_pixels > max_num_keys_ || overflowed_) {
+    size_t num_slots = overflowed_ ? 2 * slots_.size() : 64;
+    while (num_slots < 2 * num_pixels) {
+      num_slots *= 2;
+    }
+    slots_ = std::vector<Slot>(num_slots);
+    for (Slot& slot : slots_) {
+      slot.key.store(0);
+      slot.owner.store(std::numeric_limits<int>::max());
+    }
+    max_num_keys_ = num_slots / 2;
   }
+  num_keys_ = 0;
+  overflowed_ = false;
+}
 
-  if (fused_points_.empty()) {
-    std::cout << "WARNING: Could not fuse any points. This is likely caused by "
-                 "incorrect settings - filtering must be enabled for the last "
-                 "call to patch match stereo."
-              << std::endl;
+bool StereoFusion::PixelClaimTable::Claim(const int image_idx,
+                                          const int pixel_idx,
+                                          const int task_idx, size_t* slot) {
+  const uint64_t key =
+      ((static_cast<uint64_t>(image_idx) << 32) | pixel_idx) + 1;
+  const size_t slot_mask = slots_.size() - 1;
+  *slot = ((key * 0x9E3779B97F4A7C15ull) >> 32) & slot_mask;
+  while (true) {
+    uint64_t slot_key = slots_[*slot].key.load();
+    if (slot_key == 0) {
+      if (num_keys_.fetch_add(1) >= max_num_keys_) {
+        overflowed_ = true;
+        return false;
+      }
+      if (slots_[*slot].key.compare_exchange_strong(slot_key, key)) {
+        slot_key = key;
+      } else {
+        num_keys_.fetch_sub(1);
+      }
+    }
+    if (slot_key == key) {
+      std::atomic<int>& owner = slots_[*slot].owner;
+      int prev_owner = owner.load();
+      while (task_idx < prev_owner &&
+             !owner.compare_exchange_weak(prev_owner, task_idx)) {
+      }
+      return true;
+    }
+    *slot = (*slot + 1) & slot_mask;
   }
+}
 
-  std::cout << "Number of fused points: " << fused_points_.size() << std::endl;
-  GetTimer().PrintMinutes();
+bool StereoFusion::PixelClaimTable::Overflowed() const { return overflowed_; }
+
+int StereoFusion::PixelClaimTable::Owner(const size_t slot) const {
+  return slots_[slot].owner.load(std::memory_order_relaxed);
+}
+
+void StereoFusion::PixelClaimTable::Release(const size_t slot) {
+  slots_[slot].key.store(0, std::memory_order_relaxed);
+  slots_[slot].owner.store(std::numeric_limits<int>::max(),
+                           std::memory_order_relaxed);
 }
 
 void StereoFusion::InitFusedPixelMask(int image_idx, size_t width,
@@ -362,8 +836,8 @@ void StereoFusion::InitFusedPixelMask(int image_idx, size_t width,
   }
 }
 
-void StereoFusion::Fuse(const int thread_id, const int image_idx, const int row,
-                        const int col) {
+void StereoFusion::Fuse(const int image_idx, const int row, const int col,
+                        FusionTask* task) {
   // Next points to fuse.
   std::vector<FusionData> fusion_queue;
   fusion_queue.emplace_back(image_idx, row, col, 0);
@@ -382,6 +856,8 @@ void StereoFusion::Fuse(const int thread_id, const int image_idx, const int row,
   std::vector<uint8_t> fused_point_g;
   std::vector<uint8_t> fused_point_b;
   std::unordered_set<int> fused_point_visibility;
+  // Pixels fused by this task, as the fused pixel masks are not modified.
+  std::unordered_set<int64_t> fused_pixels;
 
   while (!fusion_queue.empty()) {
     const auto data = fusion_queue.back();
@@ -393,11 +869,16 @@ void StereoFusion::Fuse(const int thread_id, const int image_idx, const int row,
     fusion_queue.pop_back();
 
     // Check if pixel already fused.
-    auto& fused_pixel_mask = fused_pixel_masks_.at(image_idx);
-    if (fused_pixel_mask.Get(row, col) > 0) {
+    const int pixel_idx = row * depth_map_sizes_.at(image_idx).first + col;
+    const int64_t pixel_key =
+        (static_cast<int64_t>(image_idx) << 32) | pixel_idx;
+    if (fused_pixel_masks_.at(image_idx).Get(row, col) > 0 ||
+        fused_pixels.count(pixel_key) > 0) {
       continue;
     }
 
+    task->visited_pixels.emplace_back(image_idx, pixel_idx);
+
     const auto& depth_map = workspace_->GetDepthMap(image_idx);
     const float depth = depth_map.Get(row, col);
 
@@ -448,6 +929,12 @@ void StereoFusion::Fuse(const int thread_id, const int image_idx, const int row,
         inv_P_.at(image_idx) *
         Eigen::Vector4f(col * depth, row * depth, depth, 1.0f);
 
+    // Only start fusing at pixels inside the current tile, since pixels outside
+    // are fused as part of the tile owning them.
+    if (traversal_depth == 0 && !tile_.Contains(xyz)) {
+      continue;
+    }
+
     // Read the color of the pixel.
     BitmapColor<uint8_t> color;
     const auto& bitmap_scale = bitmap_scales_.at(image_idx);
@@ -455,7 +942,8 @@ void StereoFusion::Fuse(const int thread_id, const int image_idx, const int row,
         col / bitmap_scale.first, row / bitmap_scale.second, &color);
 
     // Set the current pixel as visited.
-    fused_pixel_mask.Set(row, col, 1);
+    fused_pixels.insert(pixel_key);
+    task->fused_pixels.emplace_back(image_idx, pixel_idx);
 
     // Pixels out of bounds are filtered
     if (xyz(0) < options_.bounding_box.first(0) ||
@@ -537,6 +1025,15 @@ void StereoFusion::Fuse(const int thread_id, const int image_idx, const int row,
     fused_point.ny = fused_normal.y() / fused_normal_norm;
     fused_point.nz = fused_normal.z() / fused_normal_norm;
 
+    // Fused points are owned by the tile containing them, which avoids
+    // duplicate points at the boundaries of neighboring tiles. The pixels are
+    // left unfused, such that the tile owning the point can still fuse them.
+    if (!tile_.Contains(Eigen::Vector3f(fused_point.x, fused_point.y,
+                                        fused_point.z))) {
+      task->fused_pixels.clear();
+      return;
+    }
+
     fused_point.r = TruncateCast<float, uint8_t>(
         std::round(internal::Median(&fused_point_r)));
     fused_point.g = TruncateCast<float, uint8_t>(
@@ -544,9 +1041,10 @@ void StereoFusion::Fuse(const int thread_id, const int image_idx, const int row,
     fused_point.b = TruncateCast<float, uint8_t>(
         std::round(internal::Median(&fused_point_b)));
 
-    task_fused_points_[thread_id].push_back(fused_point);
-    task_fused_points_visibility_[thread_id].emplace_back(
-        fused_point_visibility.begin(), fused_point_visibility.end());
+    task->has_point = true;
+    task->point = fused_point;
+    task->visibility.assign(fused_point_visibility.begin(),
+                            fused_point_visibility.end());
   }
 }
 
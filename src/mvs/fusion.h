@@ -32,6 +32,7 @@
 #ifndef COLMAP_SRC_MVS_FUSION_H_
 #define COLMAP_SRC_MVS_FUSION_H_
 
+#include <atomic>
 #include <cfloat>
 #include <unordered_set>
 #include <vector>
@@ -94,6 +95,20 @@ struct StereoFusionOptions {
   // consume a lot of memory, if the consistency graph is dense.
   double cache_size = 32.0;
 
+  // Flag indicating whether to fuse the scene tile by tile. The scene is
+  // recursively split at the sparse points until the bitmaps, depth maps,
+  // normal maps, and fused pixel masks of the images observing a tile fit into
+  // the cache size. The tiles at the border of the scene are unbounded, and a
+  // tile also includes the images whose viewing frustum up to their depth range
+  // overlaps it. Tiles are then fused one after another through the cache,
+  // such that the peak memory usage is independent of the number of images.
+  // The cache size is a soft limit for the tiles: Tiles with too few sparse
+  // points are not split any further, and the fused pixel masks of images
+  // shared with later tiles are kept in memory until their last tile. Without
+  // sparse points, all images are fused as a single tile. Implies the use of
+  // the LRU cache.
+  bool use_tiles = false;
+
   std::pair<Eigen::Vector3f, Eigen::Vector3f> bounding_box =
       std::make_pair(Eigen::Vector3f(-FLT_MAX, -FLT_MAX, -FLT_MAX),
                      Eigen::Vector3f(FLT_MAX, FLT_MAX, FLT_MAX));
@@ -105,6 +120,30 @@ struct StereoFusionOptions {
   void Print() const;
 };
 
+// Spatial partition of the scene for the tiled stereo fusion. The bounds are
+// half-open, such that every 3D location is contained in at most one tile.
+struct StereoFusionTile {
+  Eigen::Vector3f min_bound;
+  Eigen::Vector3f max_bound;
+  // The images observing the sparse points inside the tile or whose viewing
+  // frustum overlaps the tile.
+  std::vector<int> image_idxs;
+
+  bool Contains(const Eigen::Vector3f& xyz) const;
+};
+
+// Recursively split the bounding box at the median of the sparse points along
+// the longest extent until the total number of bytes of the images of a tile
+// is at most the given limit. Tiles with few sparse points are not split and
+// may exceed the limit. If the bounding box contains no sparse points, a single
+// tile with all images is returned. Images with zero bytes are not used for
+// fusion and are ignored. The tiles are returned in depth-first order, such
+// that consecutive tiles are spatially close and share images.
+std::vector<StereoFusionTile> ComputeStereoFusionTiles(
+    const Model& model, const std::vector<size_t>& image_num_bytes,
+    const size_t max_num_bytes,
+    const std::pair<Eigen::Vector3f, Eigen::Vector3f>& bounding_box);
+
 class StereoFusion : public Thread {
  public:
   EIGEN_MAKE_ALIGNED_OPERATOR_NEW
@@ -119,10 +158,16 @@ class StereoFusion : public Thread {
   const std::vector<std::vector<int>>& GetFusedPointsVisibility() const;
 
  private:
+  struct FusionTask;
+
   void Run();
   void InitFusedPixelMask(int image_idx, size_t width, size_t height);
-  void Fuse(const int thread_id, const int image_idx, const int row,
-            const int col);
+  void FuseTile(const StereoFusionTile& tile, const int num_threads);
+  void FuseImage(const int image_idx, ThreadPool* thread_pool);
+  // Traverse the pixels consistent with the given reference pixel without
+  // modifying the fused pixel masks and store the result in the task.
+  void Fuse(const int image_idx, const int row, const int col,
+            FusionTask* task);
 
   const StereoFusionOptions options_;
   const std::string workspace_path_;
@@ -144,6 +189,8 @@ class StereoFusion : public Thread {
   std::vector<Eigen::Matrix<float, 3, 4, Eigen::RowMajor>> P_;
   std::vector<Eigen::Matrix<float, 3, 4, Eigen::RowMajor>> inv_P_;
   std::vector<Eigen::Matrix<float, 3, 3, Eigen::RowMajor>> inv_R_;
+  // The currently fused tile, which owns the fused points inside its bounds.
+  StereoFusionTile tile_;
 
   struct FusionData {
     int image_idx = kInvalidImageId;
@@ -160,12 +207,60 @@ class StereoFusion : public Thread {
     }
   };
 
+  struct FusionTask {
+    // Whether the task has a reference pixel and was committed.
+    bool is_active = false;
+    bool is_committed = false;
+    // The visited pixels, whose fused state determines the result of the task,
+    // and the subset of pixels marked as fused, as (image_idx, pixel_idx).
+    std::vector<std::pair<int, int>> visited_pixels;
+    std::vector<std::pair<int, int>> fused_pixels;
+    // The slots of the visited pixels in the pixel claim table.
+    std::vector<size_t> claim_slots;
+    // The resulting point, if enough pixels were fused.
+    bool has_point = false;
+    PlyPoint point;
+    std::vector<int> visibility;
+  };
+
+  // Concurrent hash table from the pixels visited by the fusion tasks of the
+  // current round to the smallest index of the tasks that visited them, used
+  // to resolve conflicts. Its size only depends on the number of pixels
+  // visited in a round and not on the number or size of the images.
+  class PixelClaimTable {
+   public:
+    // Remove all claims and make room for the given number of pixels. Unless
+    // the table overflowed or is too small, all claimed slots must have been
+    // released before.
+    void Reset(const size_t num_pixels);
+
+    // Claim the pixel for the given task and return the slot of the pixel, or
+    // false if the table overflowed and must be reset.
+    bool Claim(const int image_idx, const int pixel_idx, const int task_idx,
+               size_t* slot);
+    bool Overflowed() const;
+
+    int Owner(const size_t slot) const;
+    void Release(const size_t slot);
+
+   private:
+    struct Slot {
+      // The pixel key incremented by one, such that zero marks empty slots.
+      std::atomic<uint64_t> key;
+      std::atomic<int> owner;
+    };
+
+    std::vector<Slot> slots_;
+    std::atomic<size_t> num_keys_{0};
+    std::atomic<bool> overflowed_{false};
+    size_t max_num_keys_ = 0;
+  };
+
+  PixelClaimTable pixel_claims_;
+
   // Already fused points.
   std::vector<PlyPoint> fused_points_;
   std::vector<std::vector<int>> fused_points_visibility_;
-
-  std::vector<std::vector<PlyPoint>> task_fused_points_;
-  std::vector<std::vector<std::vector<int>>> task_fused_points_visibility_;
 };
 
 // Write the visiblity information into a binary file of the following format:
@@ -0,0 +1,494 @@
+// Copyright (c) 2022, ETH Zurich and UNC Chapel Hill.
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//
+//     * Neither the name of ETH Zurich and UNC Chapel Hill nor the names of
+//       its contributors may be used to endorse or promote products derived
+//       from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDERS OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//
+// Author: Johannes L. Schoenberger (jsch-at-demuc-dot-de)
+
+#define TEST_NAME "mvs/fusion_test"
+#include "util/testing.h"
+
+#include <boost/filesystem.hpp>
+
+#include "mvs/fusion.h"
+#include "util/misc.h"
+
+using namespace colmap;
+using namespace colmap::mvs;
+
+namespace {
+
+// Create an image 5 units in front of the xy-plane at the given position along
+// the x-axis, which sees a unit distance along the x-axis on the plane.
+mvs::Image CreateImage(const float center_x) {
+  const float K[9] = {250, 0, 50, 0, 250, 50, 0, 0, 1};
+  const float R[9] = {1, 0, 0, 0, 1, 0, 0, 0, 1};
+  const float T[3] = {-center_x, -0.1f, 5};
+  return mvs::Image("", 100, 100, K, R, T);
+}
+
+// Create a model with a row of images along the x-axis, where every image
+// observes the sparse points within a unit distance along the x-axis.
+Model CreateModel(const int num_images, const int num_points_per_image) {
+  Model model;
+  for (int image_idx = 0; image_idx < num_images; ++image_idx) {
+    model.images.push_back(CreateImage(image_idx));
+    for (int i = 0; i < num_points_per_image; ++i) {
+      Model::Point point;
+      point.x = image_idx + static_cast<float>(i) / num_points_per_image;
+      point.y = 0.1f * (i % 3);
+      point.z = 0.05f * (i % 7);
+      point.track.push_back(image_idx);
+      if (image_idx + 1 < num_images) {
+        point.track.push_back(image_idx + 1);
+      }
+      model.points.push_back(point);
+    }
+  }
+  return model;
+}
+
+std::pair<Eigen::Vector3f, Eigen::Vector3f> UnboundedBox() {
+  return std::make_pair(Eigen::Vector3f(-FLT_MAX, -FLT_MAX, -FLT_MAX),
+                        Eigen::Vector3f(FLT_MAX, FLT_MAX, FLT_MAX));
+}
+
+// Create a PMVS workspace of a row of cameras observing a wavy surface with
+// noisy and partially invalid depth maps. Every camera only sees a part of the
+// surface. With sparse points, the workspace is written in the Bundler format,
+// and otherwise in the raw format without any sparse points. Optionally, the
+// top rows of the cameras see a background plane at z = 4.5 behind the
+// surface, which only has sparse points in front of the first cameras.
+std::string CreatePMVSWorkspace(const bool with_sparse_points,
+                                const bool with_background = false) {
+  const int kWidth = 80;
+  const int kHeight = 48;
+  const int kNumImages = 12;
+  const float kFocalLength = 200;
+  const float kBaseline = 0.4f;
+
+  const std::string path =
+      (boost::filesystem::temp_directory_path() /
+       boost::filesystem::unique_path("colmap-fusion-%%%%%%%%"))
+          .string();
+  const std::string stereo_path = JoinPaths(path, "stereo-option");
+  CreateDirIfNotExists(path);
+  CreateDirIfNotExists(JoinPaths(path, "visualize"));
+  CreateDirIfNotExists(JoinPaths(path, "txt"));
+  CreateDirIfNotExists(stereo_path);
+  CreateDirIfNotExists(JoinPaths(stereo_path, "depth_maps"));
+  CreateDirIfNotExists(JoinPaths(stereo_path, "normal_maps"));
+
+  std::ofstream vis_dat_file(JoinPaths(path, "vis.dat"));
+  vis_dat_file << "VISDATA" << std::endl << kNumImages << std::endl;
+  std::ofstream fusion_file(JoinPaths(stereo_path, "fusion.cfg"));
+
+  for (int image_idx = 0; image_idx < kNumImages; ++image_idx) {
+    const std::string image_name = StringPrintf("%08d.jpg", image_idx);
+    const float center_x = kBaseline * image_idx;
+
+    Bitmap bitmap;
+    bitmap.Allocate(kWidth, kHeight, true);
+    bitmap.Fill(BitmapColor<uint8_t>(image_idx * 10, 100, 200));
+    bitmap.Write(JoinPaths(path, "visualize", image_name));
+
+    std::ofstream proj_matrix_file(
+        JoinPaths(path, "txt", StringPrintf("%08d.txt", image_idx)));
+    proj_matrix_file << "CONTOUR" << std::endl
+                     << kFocalLength << " 0 " << kWidth / 2 << " "
+                     << -kFocalLength * center_x << std::endl
+                     << "0 " << kFocalLength << " " << kHeight / 2 << " 0"
+                     << std::endl
+                     << "0 0 1 0" << std::endl;
+
+    vis_dat_file << image_idx << " " << kNumImages - 1;
+    for (int other_image_idx = 0; other_image_idx < kNumImages;
+         ++other_image_idx) {
+      if (other_image_idx != image_idx) {
+        vis_dat_file << " " << other_image_idx;
+      }
+    }
+    vis_dat_file << std::endl;
+    fusion_file << image_name << std::endl;
+
+    DepthMap depth_map(kWidth, kHeight, 0, 10);
+    NormalMap normal_map(kWidth, kHeight);
+    for (int row = 0; row < kHeight; ++row) {
+      for (int col = 0; col < kWidth; ++col) {
+        const float x = center_x + (col - kWidth / 2) * 4 / kFocalLength;
+        const float noise = std::sin(17.0f * (row + 3 * col + 11 * image_idx));
+        float depth = 4 + 0.3f * std::sin(1.3f * x) + 0.03f * noise;
+        if (with_background && row < kHeight / 4) {
+          depth = 4.5f + 0.03f * noise;
+        }
+        if ((7 * row + 3 * col + image_idx) % 29 == 0) {
+          depth = -1;
+        }
+        depth_map.Set(row, col, depth);
+        normal_map.Set(row, col, 0, 0);
+        normal_map.Set(row, col, 1, 0);
+        normal_map.Set(row, col, 2, -1);
+      }
+    }
+    depth_map.Write(JoinPaths(stereo_path, "depth_maps",
+                              image_name + ".geometric.bin"));
+    normal_map.Write(JoinPaths(stereo_path, "normal_maps",
+                               image_name + ".geometric.bin"));
+  }
+
+  if (!with_sparse_points) {
+    return path;
+  }
+
+  // Bundler cameras look along the negative z-axis with a flipped y-axis.
+  std::ofstream bundle_file(JoinPaths(path, "bundle.rd.out"));
+  const int kNumPointCols = 30;
+  const int kNumPointRows = 20;
+  const int kNumBackgroundPoints = with_background ? 10 : 0;
+  bundle_file << "# Bundle file v0.3" << std::endl
+              << kNumImages << " "
+              << kNumPointCols * kNumPointRows + kNumBackgroundPoints
+              << std::endl;
+  for (int image_idx = 0; image_idx < kNumImages; ++image_idx) {
+    bundle_file << kFocalLength << " 0 0" << std::endl
+                << "1 0 0" << std::endl
+                << "0 -1 0" << std::endl
+                << "0 0 -1" << std::endl
+                << -kBaseline * image_idx << " 0 0" << std::endl;
+  }
+
+  auto WritePoint = [&](const float x, const float y, const float z) {
+    std::vector<int> track;
+    for (int image_idx = 0; image_idx < kNumImages; ++image_idx) {
+      const float col = kFocalLength * (x - kBaseline * image_idx) / z;
+      const float row = kFocalLength * y / z;
+      if (std::abs(col) < kWidth / 2 && std::abs(row) < kHeight / 2) {
+        track.push_back(image_idx);
+      }
+    }
+    bundle_file << x << " " << y << " " << z << std::endl
+                << "128 128 128" << std::endl
+                << track.size();
+    for (const int image_idx : track) {
+      bundle_file << " " << image_idx << " 0 0 0";
+    }
+    bundle_file << std::endl;
+  };
+
+  for (int i = 0; i < kNumPointCols; ++i) {
+    for (int j = 0; j < kNumPointRows; ++j) {
+      const float x = kBaseline * (kNumImages - 1) * i / kNumPointCols;
+      WritePoint(x, -0.3f + 0.03f * j, 4 + 0.3f * std::sin(1.3f * x));
+    }
+  }
+
+  for (int i = 0; i < kNumBackgroundPoints; ++i) {
+    WritePoint(0.04f * i, -0.5f, 4.5f);
+  }
+
+  return path;
+}
+
+std::vector<PlyPoint> FusePMVSWorkspace(const std::string& workspace_path,
+                                        const StereoFusionOptions& options) {
+  StereoFusion fuser(options, workspace_path, "PMVS", "option", "geometric");
+  fuser.Start();
+  fuser.Wait();
+  return fuser.GetFusedPoints();
+}
+
+}  // namespace
+
+BOOST_AUTO_TEST_CASE(TestTileContains) {
+  StereoFusionTile tile;
+  tile.min_bound = Eigen::Vector3f(0, 0, 0);
+  tile.max_bound = Eigen::Vector3f(1, 1, 1);
+  BOOST_CHECK(tile.Contains(Eigen::Vector3f(0, 0, 0)));
+  BOOST_CHECK(tile.Contains(Eigen::Vector3f(0.5, 0.5, 0.5)));
+  BOOST_CHECK(!tile.Contains(Eigen::Vector3f(1, 0.5, 0.5)));
+  BOOST_CHECK(!tile.Contains(Eigen::Vector3f(0.5, -0.1, 0.5)));
+}
+
+BOOST_AUTO_TEST_CASE(TestSingleTile) {
+  const Model model = CreateModel(10, 200);
+  const std::vector<size_t> image_num_bytes(model.images.size(), 1);
+  const auto tiles =
+      ComputeStereoFusionTiles(model, image_num_bytes, 10, UnboundedBox());
+  BOOST_REQUIRE_EQUAL(tiles.size(), 1);
+  BOOST_CHECK_EQUAL(tiles[0].image_idxs.size(), 10);
+  for (const auto& point : model.points) {
+    BOOST_CHECK(tiles[0].Contains(Eigen::Vector3f(point.x, point.y, point.z)));
+  }
+  BOOST_CHECK(tiles[0].Contains(Eigen::Vector3f(FLT_MAX, FLT_MAX, FLT_MAX)));
+}
+
+BOOST_AUTO_TEST_CASE(TestBoundingBox) {
+  const Model model = CreateModel(10, 200);
+  const std::vector<size_t> image_num_bytes(model.images.size(), 1);
+  const auto tiles = ComputeStereoFusionTiles(
+      model, image_num_bytes, 10,
+      std::make_pair(Eigen::Vector3f(2, -1, -1), Eigen::Vector3f(4, 3, 3)));
+  BOOST_REQUIRE_EQUAL(tiles.size(), 1);
+  // Image 1 sees the box without observing any of the points inside.
+  BOOST_REQUIRE_EQUAL(tiles[0].image_idxs.size(), 5);
+  BOOST_CHECK_EQUAL(tiles[0].image_idxs[0], 1);
+  BOOST_CHECK_EQUAL(tiles[0].image_idxs[1], 2);
+  BOOST_CHECK_EQUAL(tiles[0].image_idxs[2], 3);
+  BOOST_CHECK_EQUAL(tiles[0].image_idxs[3], 4);
+  BOOST_CHECK_EQUAL(tiles[0].image_idxs[4], 5);
+  BOOST_CHECK(tiles[0].Contains(Eigen::Vector3f(4, 3, 3)));
+}
+
+BOOST_AUTO_TEST_CASE(TestMemoryLimit) {
+  const Model model = CreateModel(16, 400);
+  std::vector<size_t> image_num_bytes(model.images.size(), 1);
+  // Unused images must not be part of any tile.
+  image_num_bytes[5] = 0;
+  const size_t kMaxNumBytes = 4;
+  const auto tiles = ComputeStereoFusionTiles(model, image_num_bytes,
+                                              kMaxNumBytes, UnboundedBox());
+  BOOST_CHECK_GT(tiles.size(), 1);
+
+  std::vector<int> num_image_tiles(model.images.size(), 0);
+  for (const auto& tile : tiles) {
+    BOOST_CHECK_LE(tile.image_idxs.size(), kMaxNumBytes);
+    BOOST_CHECK(std::is_sorted(tile.image_idxs.begin(), tile.image_idxs.end()));
+    for (const int image_idx : tile.image_idxs) {
+      num_image_tiles[image_idx] += 1;
+    }
+  }
+
+  for (size_t image_idx = 0; image_idx < model.images.size(); ++image_idx) {
+    if (image_idx == 5) {
+      BOOST_CHECK_EQUAL(num_image_tiles[image_idx], 0);
+    } else {
+      BOOST_CHECK_GT(num_image_tiles[image_idx], 0);
+    }
+  }
+
+  // Every point is owned by exactly one tile, whose images observe it.
+  for (const auto& point : model.points) {
+    const Eigen::Vector3f xyz(point.x, point.y, point.z);
+    int num_containing_tiles = 0;
+    for (const auto& tile : tiles) {
+      if (tile.Contains(xyz)) {
+        num_containing_tiles += 1;
+        for (const int image_idx : point.track) {
+          if (image_num_bytes[image_idx] > 0) {
+            BOOST_CHECK(std::binary_search(tile.image_idxs.begin(),
+                                           tile.image_idxs.end(), image_idx));
+          }
+        }
+      }
+    }
+    BOOST_CHECK_EQUAL(num_containing_tiles, 1);
+  }
+}
+
+BOOST_AUTO_TEST_CASE(TestDegenerateSplit) {
+  Model model;
+  for (int image_idx = 0; image_idx < 4; ++image_idx) {
+    model.images.push_back(CreateImage(image_idx));
+  }
+  for (int i = 0; i < 1000; ++i) {
+    Model::Point point;
+    point.track = {i % 4};
+    model.points.push_back(point);
+  }
+  const std::vector<size_t> image_num_bytes(model.images.size(), 1);
+  const auto tiles =
+      ComputeStereoFusionTiles(model, image_num_bytes, 1, UnboundedBox());
+  BOOST_REQUIRE_EQUAL(tiles.size(), 1);
+  BOOST_CHECK_EQUAL(tiles[0].image_idxs.size(), 4);
+}
+
+BOOST_AUTO_TEST_CASE(TestNoPoints) {
+  Model model;
+  for (int image_idx = 0; image_idx < 3; ++image_idx) {
+    model.images.push_back(CreateImage(image_idx));
+  }
+  const std::vector<size_t> image_num_bytes = {1, 0, 1};
+  const auto tiles =
+      ComputeStereoFusionTiles(model, image_num_bytes, 1, UnboundedBox());
+  BOOST_REQUIRE_EQUAL(tiles.size(), 1);
+  BOOST_REQUIRE_EQUAL(tiles[0].image_idxs.size(), 2);
+  BOOST_CHECK_EQUAL(tiles[0].image_idxs[0], 0);
+  BOOST_CHECK_EQUAL(tiles[0].image_idxs[1], 2);
+}
+
+BOOST_AUTO_TEST_CASE(TestDenseSamplesOutsideSparsePoints) {
+  // The last images do not observe any sparse points, and the frusta of all
+  // images extend beyond the sparse points within their depth ranges.
+  Model model = CreateModel(12, 400);
+  for (int image_idx = 12; image_idx < 14; ++image_idx) {
+    model.images.push_back(CreateImage(image_idx));
+  }
+  const std::vector<size_t> image_num_bytes(model.images.size(), 1);
+  const auto tiles =
+      ComputeStereoFusionTiles(model, image_num_bytes, 4, UnboundedBox());
+  BOOST_CHECK_GT(tiles.size(), 1);
+
+  // Every dense sample of an image is owned by a tile fusing the image.
+  const auto depth_ranges = model.ComputeDepthRanges();
+  for (size_t image_idx = 0; image_idx < model.images.size(); ++image_idx) {
+    const auto& depth_range = depth_ranges[image_idx];
+    std::vector<float> depths = {5, 50};
+    if (depth_range.first > 0) {
+      depths = {depth_range.first, 0.5f * (depth_range.first +
+                                           depth_range.second),
+                depth_range.second};
+    }
+    const Eigen::Map<const Eigen::Matrix<float, 3, 4, Eigen::RowMajor>> inv_P(
+        model.images[image_idx].GetInvP());
+    for (const float depth : depths) {
+      for (const float x : {0.5f, 50.0f, 99.5f}) {
+        for (const float y : {0.5f, 50.0f, 99.5f}) {
+          const Eigen::Vector3f xyz =
+              inv_P * Eigen::Vector4f(x * depth, y * depth, depth, 1);
+          for (const auto& tile : tiles) {
+            if (tile.Contains(xyz)) {
+              BOOST_CHECK(std::binary_search(tile.image_idxs.begin(),
+                                             tile.image_idxs.end(),
+                                             image_idx));
+            }
+          }
+        }
+      }
+    }
+  }
+}
+
+BOOST_AUTO_TEST_CASE(TestIndependentOfNumThreads) {
+  const std::string workspace_path = CreatePMVSWorkspace(false);
+  const int kPrevThreadBudget = kThreadBudget;
+  kThreadBudget = 4;
+
+  std::vector<std::vector<PlyPoint>> points;
+  std::vector<std::vector<std::vector<int>>> points_visibility;
+  for (const int num_threads : {1, 2, 4}) {
+    StereoFusionOptions options;
+    options.num_threads = num_threads;
+    options.min_num_pixels = 2;
+    StereoFusion fuser(options, workspace_path, "PMVS", "option", "geometric");
+    fuser.Start();
+    fuser.Wait();
+    points.push_back(fuser.GetFusedPoints());
+    points_visibility.push_back(fuser.GetFusedPointsVisibility());
+  }
+
+  kThreadBudget = kPrevThreadBudget;
+  boost::filesystem::remove_all(workspace_path);
+
+  BOOST_CHECK_GT(points[0].size(), 0);
+  for (size_t i = 1; i < points.size(); ++i) {
+    BOOST_REQUIRE_EQUAL(points[i].size(), points[0].size());
+    BOOST_CHECK(points_visibility[i] == points_visibility[0]);
+    for (size_t j = 0; j < points[0].size(); ++j) {
+      BOOST_CHECK_EQUAL(points[i][j].x, points[0][j].x);
+      BOOST_CHECK_EQUAL(points[i][j].y, points[0][j].y);
+      BOOST_CHECK_EQUAL(points[i][j].z, points[0][j].z);
+      BOOST_CHECK_EQUAL(points[i][j].r, points[0][j].r);
+    }
+  }
+}
+
+BOOST_AUTO_TEST_CASE(TestTilesWithoutPoints) {
+  const std::string workspace_path = CreatePMVSWorkspace(false);
+
+  StereoFusionOptions options;
+  options.min_num_pixels = 2;
+  const auto points = FusePMVSWorkspace(workspace_path, options);
+  options.use_tiles = true;
+  const auto tiled_points = FusePMVSWorkspace(workspace_path, options);
+
+  boost::filesystem::remove_all(workspace_path);
+
+  // The raw PMVS workspace has no sparse points and is fused as a single tile.
+  BOOST_CHECK_GT(points.size(), 0);
+  BOOST_REQUIRE_EQUAL(tiled_points.size(), points.size());
+  for (size_t i = 0; i < points.size(); ++i) {
+    BOOST_CHECK_EQUAL(tiled_points[i].x, points[i].x);
+    BOOST_CHECK_EQUAL(tiled_points[i].y, points[i].y);
+    BOOST_CHECK_EQUAL(tiled_points[i].z, points[i].z);
+  }
+}
+
+BOOST_AUTO_TEST_CASE(TestTilesWithPoints) {
+  const std::string workspace_path = CreatePMVSWorkspace(true);
+
+  // Every image only sees a part of the scene, such that the tiles of a cache
+  // size of nine images have fewer images than the scene.
+  const size_t kImageNumBytes = 80 * 48 * (4 * sizeof(float) + 1 + 3);
+  const size_t kMaxNumBytes = 9 * kImageNumBytes;
+
+  Model model;
+  model.Read(workspace_path, "PMVS");
+  const std::vector<size_t> image_num_bytes(model.images.size(),
+                                            kImageNumBytes);
+  const auto tiles = ComputeStereoFusionTiles(model, image_num_bytes,
+                                              kMaxNumBytes, UnboundedBox());
+  BOOST_CHECK_GT(tiles.size(), 1);
+  for (const auto& tile : tiles) {
+    BOOST_CHECK_LT(tile.image_idxs.size(), model.images.size());
+  }
+
+  StereoFusionOptions options;
+  options.min_num_pixels = 2;
+  options.cache_size = kMaxNumBytes / (1024.0 * 1024.0 * 1024.0);
+  const auto points = FusePMVSWorkspace(workspace_path, options);
+  options.use_tiles = true;
+  const auto tiled_points = FusePMVSWorkspace(workspace_path, options);
+
+  boost::filesystem::remove_all(workspace_path);
+
+  // The fused pixel masks are kept across tiles, such that pixels are not
+  // fused again into duplicate points along the tile boundaries.
+  BOOST_CHECK_GT(points.size(), 0);
+  BOOST_CHECK_GT(tiled_points.size(), 0.9 * points.size());
+  BOOST_CHECK_LT(tiled_points.size(), 1.1 * points.size());
+}
+
+BOOST_AUTO_TEST_CASE(TestTilesOutsideSparsePoints) {
+  const std::string workspace_path = CreatePMVSWorkspace(true, true);
+
+  // Only fuse the background plane, whose sparse points are only observed by
+  // the first images. The other images see the background outside of the
+  // extent of its sparse points.
+  StereoFusionOptions options;
+  options.min_num_pixels = 2;
+  options.bounding_box.first = Eigen::Vector3f(-FLT_MAX, -FLT_MAX, 4.4f);
+  options.bounding_box.second = Eigen::Vector3f(FLT_MAX, FLT_MAX, 4.6f);
+  const auto points = FusePMVSWorkspace(workspace_path, options);
+  options.use_tiles = true;
+  const auto tiled_points = FusePMVSWorkspace(workspace_path, options);
+
+  boost::filesystem::remove_all(workspace_path);
+
+  BOOST_CHECK_GT(points.size(), 0);
+  BOOST_CHECK_GT(tiled_points.size(), 0.9 * points.size());
+  BOOST_CHECK_LT(tiled_points.size(), 1.1 * points.size());
+}
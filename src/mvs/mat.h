@@ -36,6 +36,7 @@
 #include <string>
 #include <vector>
 
+#include "mvs/mat_file.h"
 #include "util/endian.h"
 #include "util/logging.h"
 
@@ -67,8 +68,13 @@ class Mat {
 
   void Fill(const T value);
 
+  // Read from the raw format or the tiled format of `MatFile`, which is
+  // detected from the file contents.
   void Read(const std::string& path);
+  // Write in the raw format or in the tiled format of `MatFile`.
   void Write(const std::string& path) const;
+  void Write(const std::string& path,
+             const MatFile::Compression compression) const;
 
  protected:
   size_t width_ = 0;
@@ -155,6 +161,21 @@ void Mat<T>::Fill(const T value) {
 
 template <typename T>
 void Mat<T>::Read(const std::string& path) {
+  if (MatFile::IsMatFile(path)) {
+    MatFile file;
+    CHECK(file.Open(path)) << path;
+    CHECK_EQ(file.ElemSize(), sizeof(T)) << path;
+    width_ = file.Width();
+    height_ = file.Height();
+    depth_ = file.Depth();
+    CHECK_GT(width_, 0);
+    CHECK_GT(height_, 0);
+    CHECK_GT(depth_, 0);
+    data_.resize(width_ * height_ * depth_);
+    file.ReadRegion(0, 0, height_, width_, data_.data());
+    return;
+  }
+
   std::fstream text_file(path, std::ios::in | std::ios::binary);
   CHECK(text_file.is_open()) << path;
 
@@ -190,6 +211,13 @@ void Mat<T>::Write(const std::string& path) const {
   binary_file.close();
 }
 
+template <typename T>
+void Mat<T>::Write(const std::string& path,
+                   const MatFile::Compression compression) const {
+  MatFile::Write(path, data_.data(), width_, height_, depth_, sizeof(T),
+                 compression);
+}
+
 }  // namespace mvs
 }  // namespace colmap
 
@@ -0,0 +1,495 @@
+// Copyright (c) 2022, ETH Zurich and UNC Chapel Hill.
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//
+//     * Neither the name of ETH Zurich and UNC Chapel Hill nor the names of
+//       its contributors may be used to endorse or promote products derived
+//       from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDERS OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//
+// Author: Johannes L. Schoenberger (jsch-at-demuc-dot-de)
+
+#include "mvs/mat_file.h"
+
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include <vector>
+
+#include "util/endian.h"
+#include "util/logging.h"
+#include "util/misc.h"
+
+namespace colmap {
+namespace mvs {
+namespace {
+
+const char kMatFileMagic[8] = {'C', 'O', 'L', 'M', 'A', 'P', 'M', 'F'};
+const uint32_t kMatFileVersion = 1;
+const size_t kHeaderSize = 8 + 2 * 4 + 3 * 8 + 2 * 4;
+const size_t kTileEntrySize = 2 * 8;
+
+size_t AlignOffset(const size_t offset) {
+  const size_t alignment = MatFile::kAlignment;
+  return (offset + alignment - 1) / alignment * alignment;
+}
+
+void WritePadding(std::ofstream* file) {
+  const size_t offset = static_cast<size_t>(file->tellp());
+  const size_t padding = AlignOffset(offset) - offset;
+  const char zeros[MatFile::kAlignment] = {};
+  file->write(zeros, padding);
+}
+
+template <typename T>
+T ReadValue(const char* data) {
+  T value;
+  std::memcpy(&value, data, sizeof(T));
+  return LittleEndianToNative(value);
+}
+
+void WriteVarint(size_t value, std::vector<char>* data) {
+  while (value >= 0x80) {
+    data->push_back(static_cast<char>((value & 0x7F) | 0x80));
+    value >>= 7;
+  }
+  data->push_back(static_cast<char>(value));
+}
+
+bool ReadVarint(const char* data, const size_t num_bytes, size_t* pos,
+                size_t* value) {
+  *value = 0;
+  for (int shift = 0; shift < 64; shift += 7) {
+    if (*pos >= num_bytes) {
+      return false;
+    }
+    const uint8_t byte = static_cast<uint8_t>(data[(*pos)++]);
+    *value |= static_cast<size_t>(byte & 0x7F) << shift;
+    if ((byte & 0x80) == 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// XOR every element with its left neighbor in the same row and shuffle the
+// bytes of all elements into separate planes.
+void EncodeTile(const std::vector<char>& tile_data, const size_t tile_width,
+                const size_t elem_size, std::vector<char>* encoded_data) {
+  const size_t num_elems = tile_data.size() / elem_size;
+  encoded_data->resize(tile_data.size());
+  for (size_t i = 0; i < num_elems; ++i) {
+    const bool is_row_start = i % tile_width == 0;
+    for (size_t b = 0; b < elem_size; ++b) {
+      char byte = tile_data[i * elem_size + b];
+      if (!is_row_start) {
+        byte ^= tile_data[(i - 1) * elem_size + b];
+      }
+      (*encoded_data)[b * num_elems + i] = byte;
+    }
+  }
+}
+
+void DecodeTileInPlace(const size_t tile_width, const size_t elem_size,
+                       std::vector<char>* tile_data) {
+  const std::vector<char> encoded_data = *tile_data;
+  const size_t num_elems = tile_data->size() / elem_size;
+  for (size_t i = 0; i < num_elems; ++i) {
+    const bool is_row_start = i % tile_width == 0;
+    for (size_t b = 0; b < elem_size; ++b) {
+      char byte = encoded_data[b * num_elems + i];
+      if (!is_row_start) {
+        byte ^= (*tile_data)[(i - 1) * elem_size + b];
+      }
+      (*tile_data)[i * elem_size + b] = byte;
+    }
+  }
+}
+
+}  // namespace
+
+namespace internal {
+
+void CompressLZ(const std::vector<char>& data, std::vector<char>* compressed) {
+  const size_t kMinMatchLength = 4;
+  const int kHashBits = 16;
+
+  compressed->clear();
+  compressed->reserve(data.size() / 2);
+
+  const size_t num_bytes = data.size();
+  std::vector<int64_t> last_positions(1 << kHashBits, -1);
+
+  size_t literal_start = 0;
+  size_t pos = 0;
+  while (pos + kMinMatchLength <= num_bytes) {
+    uint32_t value;
+    std::memcpy(&value, data.data() + pos, sizeof(value));
+    const uint32_t hash = (value * 2654435761u) >> (32 - kHashBits);
+    const int64_t match_pos = last_positions[hash];
+    last_positions[hash] = pos;
+
+    if (match_pos < 0 || std::memcmp(data.data() + match_pos, data.data() + pos,
+                                     kMinMatchLength) != 0) {
+      pos += 1;
+      continue;
+    }
+
+    size_t match_length = kMinMatchLength;
+    while (pos + match_length < num_bytes &&
+           data[match_pos + match_length] == data[pos + match_length]) {
+      match_length += 1;
+    }
+
+    WriteVarint(pos - literal_start, compressed);
+    compressed->insert(compressed->end(), data.begin() + literal_start,
+                       data.begin() + pos);
+    WriteVarint(match_length - kMinMatchLength, compressed);
+    WriteVarint(pos - match_pos, compressed);
+
+    pos += match_length;
+    literal_start = pos;
+  }
+
+  WriteVarint(num_bytes - literal_start, compressed);
+  compressed->insert(compressed->end(), data.begin() + literal_start,
+                     data.end());
+}
+
+bool DecompressLZ(const char* compressed, const size_t num_compressed_bytes,
+                  std::vector<char>* data) {
+  const size_t kMinMatchLength = 4;
+
+  size_t pos = 0;
+  size_t data_pos = 0;
+  while (true) {
+    size_t literal_length;
+    if (!ReadVarint(compressed, num_compressed_bytes, &pos, &literal_length) ||
+        literal_length > num_compressed_bytes - pos ||
+        literal_length > data->size() - data_pos) {
+      return false;
+    }
+    std::memcpy(data->data() + data_pos, compressed + pos, literal_length);
+    pos += literal_length;
+    data_pos += literal_length;
+
+    if (pos == num_compressed_bytes) {
+      return data_pos == data->size();
+    }
+
+    size_t match_length;
+    size_t match_offset;
+    if (!ReadVarint(compressed, num_compressed_bytes, &pos, &match_length) ||
+        !ReadVarint(compressed, num_compressed_bytes, &pos, &match_offset)) {
+      return false;
+    }
+    match_length += kMinMatchLength;
+    if (match_offset == 0 || match_offset > data_pos ||
+        match_length > data->size() - data_pos) {
+      return false;
+    }
+
+    // Byte-wise copy, since the match may overlap the output.
+    for (size_t i = 0; i < match_length; ++i) {
+      (*data)[data_pos + i] = (*data)[data_pos + i - match_offset];
+    }
+    data_pos += match_length;
+  }
+}
+
+}  // namespace internal
+
+MatFile::MatFile()
+    : compression_(Compression::NONE),
+      width_(0),
+      height_(0),
+      depth_(0),
+      elem_size_(0),
+      tile_size_(0) {}
+
+MatFile::~MatFile() { Close(); }
+
+bool MatFile::IsMatFile(const std::string& path) {
+  std::ifstream file(path, std::ios::binary);
+  char magic[sizeof(kMatFileMagic)];
+  return file.read(magic, sizeof(magic)) &&
+         std::memcmp(magic, kMatFileMagic, sizeof(kMatFileMagic)) == 0;
+}
+
+void MatFile::Write(const std::string& path, const void* data,
+                    const size_t width, const size_t height,
+                    const size_t depth, const size_t elem_size,
+                    const Compression compression, const size_t tile_size) {
+  // Uncompressed tiles are mapped as-is, so the file is only written in the
+  // byte order in which it is read.
+  CHECK(IsLittleEndian()) << "Map file requires a little-endian platform";
+  CHECK_GT(elem_size, 0);
+  CHECK_GT(tile_size, 0);
+
+  std::ofstream file(path, std::ios::binary | std::ios::trunc);
+  CHECK(file.is_open()) << path;
+
+  file.write(kMatFileMagic, sizeof(kMatFileMagic));
+  WriteBinaryLittleEndian<uint32_t>(&file, kMatFileVersion);
+  WriteBinaryLittleEndian<uint32_t>(&file, static_cast<uint32_t>(compression));
+  WriteBinaryLittleEndian<uint64_t>(&file, width);
+  WriteBinaryLittleEndian<uint64_t>(&file, height);
+  WriteBinaryLittleEndian<uint64_t>(&file, depth);
+  WriteBinaryLittleEndian<uint32_t>(&file, static_cast<uint32_t>(elem_size));
+  WriteBinaryLittleEndian<uint32_t>(&file, static_cast<uint32_t>(tile_size));
+
+  // The index is patched once all tiles are written.
+  const size_t num_tile_rows = (height + tile_size - 1) / tile_size;
+  const size_t num_tile_cols = (width + tile_size - 1) / tile_size;
+  std::vector<Tile> tiles(num_tile_rows * num_tile_cols);
+  const size_t index_offset = static_cast<size_t>(file.tellp());
+  const std::vector<char> zeros(tiles.size() * kTileEntrySize, 0);
+  file.write(zeros.data(), zeros.size());
+
+  const char* elems = static_cast<const char*>(data);
+  std::vector<char> tile_data;
+  std::vector<char> encoded_data;
+  std::vector<char> compressed_data;
+  for (size_t tile_row = 0; tile_row < num_tile_rows; ++tile_row) {
+    for (size_t tile_col = 0; tile_col < num_tile_cols; ++tile_col) {
+      const size_t row_start = tile_row * tile_size;
+      const size_t col_start = tile_col * tile_size;
+      const size_t tile_height = std::min(tile_size, height - row_start);
+      const size_t tile_width = std::min(tile_size, width - col_start);
+      const size_t row_num_bytes = tile_width * elem_size;
+
+      tile_data.resize(depth * tile_height * row_num_bytes);
+      char* tile_ptr = tile_data.data();
+      for (size_t slice = 0; slice < depth; ++slice) {
+        for (size_t row = row_start; row < row_start + tile_height; ++row) {
+          std::memcpy(
+              tile_ptr,
+              elems + (slice * width * height + row * width + col_start) *
+                          elem_size,
+              row_num_bytes);
+          tile_ptr += row_num_bytes;
+        }
+      }
+
+      const std::vector<char>* output_data = &tile_data;
+      if (compression == Compression::LZ) {
+        EncodeTile(tile_data, tile_width, elem_size, &encoded_data);
+        internal::CompressLZ(encoded_data, &compressed_data);
+        if (compressed_data.size() < tile_data.size()) {
+          output_data = &compressed_data;
+        }
+      } else {
+        WritePadding(&file);
+      }
+
+      Tile& tile = tiles[tile_row * num_tile_cols + tile_col];
+      tile.offset = static_cast<uint64_t>(file.tellp());
+      tile.num_bytes = output_data->size();
+      file.write(output_data->data(), output_data->size());
+    }
+  }
+
+  file.seekp(index_offset);
+  for (const auto& tile : tiles) {
+    WriteBinaryLittleEndian<uint64_t>(&file, tile.offset);
+    WriteBinaryLittleEndian<uint64_t>(&file, tile.num_bytes);
+  }
+}
+
+bool MatFile::Open(const std::string& path) {
+  Close();
+
+  if (!IsLittleEndian() || !ExistsFile(path) || !file_.Open(path)) {
+    return false;
+  }
+
+  const char* data = file_.Data();
+  const size_t size = file_.Size();
+
+  if (size < kHeaderSize ||
+      std::memcmp(data, kMatFileMagic, sizeof(kMatFileMagic)) != 0 ||
+      ReadValue<uint32_t>(data + 8) != kMatFileVersion) {
+    Close();
+    return false;
+  }
+
+  const uint32_t compression = ReadValue<uint32_t>(data + 12);
+  width_ = ReadValue<uint64_t>(data + 16);
+  height_ = ReadValue<uint64_t>(data + 24);
+  depth_ = ReadValue<uint64_t>(data + 32);
+  elem_size_ = ReadValue<uint32_t>(data + 40);
+  tile_size_ = ReadValue<uint32_t>(data + 44);
+  if (compression > static_cast<uint32_t>(Compression::LZ) ||
+      elem_size_ == 0 || tile_size_ == 0) {
+    Close();
+    return false;
+  }
+  compression_ = static_cast<Compression>(compression);
+
+  // Check the header fields against the file size before reading the tile
+  // table, so that corrupt or truncated files cannot overflow the sizes.
+  const size_t max_num_tiles = (size - kHeaderSize) / kTileEntrySize;
+  const uint64_t tile_area = static_cast<uint64_t>(tile_size_) * tile_size_;
+  if (NumTileRows() > max_num_tiles ||
+      (NumTileRows() > 0 &&
+       NumTileCols() > max_num_tiles / NumTileRows()) ||
+      depth_ > std::numeric_limits<uint64_t>::max() / tile_area / elem_size_) {
+    Close();
+    return false;
+  }
+
+  const size_t num_tiles = NumTileRows() * NumTileCols();
+
+  tiles_.resize(num_tiles);
+  for (size_t tile_row = 0; tile_row < NumTileRows(); ++tile_row) {
+    for (size_t tile_col = 0; tile_col < NumTileCols(); ++tile_col) {
+      const size_t tile_idx = tile_row * NumTileCols() + tile_col;
+      const char* entry_data = data + kHeaderSize + tile_idx * kTileEntrySize;
+      Tile& tile = tiles_[tile_idx];
+      tile.offset = ReadValue<uint64_t>(entry_data);
+      tile.num_bytes = ReadValue<uint64_t>(entry_data + 8);
+      const size_t tile_num_bytes =
+          depth_ * TileHeight(tile_row) * TileWidth(tile_col) * elem_size_;
+      if (tile.offset > size || tile.num_bytes > size - tile.offset ||
+          tile.num_bytes > tile_num_bytes ||
+          (compression_ == Compression::NONE &&
+           tile.num_bytes != tile_num_bytes)) {
+        Close();
+        return false;
+      }
+    }
+  }
+
+  return true;
+}
+
+void MatFile::Close() {
+  file_.Close();
+  tiles_.clear();
+}
+
+bool MatFile::IsOpen() const { return file_.IsOpen(); }
+
+size_t MatFile::Width() const { return width_; }
+
+size_t MatFile::Height() const { return height_; }
+
+size_t MatFile::Depth() const { return depth_; }
+
+size_t MatFile::ElemSize() const { return elem_size_; }
+
+size_t MatFile::TileSize() const { return tile_size_; }
+
+MatFile::Compression MatFile::GetCompression() const { return compression_; }
+
+size_t MatFile::NumTileRows() const {
+  return height_ / tile_size_ + (height_ % tile_size_ != 0);
+}
+
+size_t MatFile::NumTileCols() const {
+  return width_ / tile_size_ + (width_ % tile_size_ != 0);
+}
+
+void MatFile::ReadRegion(const size_t row, const size_t col,
+                         const size_t height, const size_t width,
+                         void* data) const {
+  CHECK(IsOpen());
+  CHECK_LE(row + height, height_);
+  CHECK_LE(col + width, width_);
+  if (height == 0 || width == 0) {
+    return;
+  }
+
+  char* elems = static_cast<char*>(data);
+  std::vector<char> buffer;
+  for (size_t tile_row = row / tile_size_;
+       tile_row <= (row + height - 1) / tile_size_; ++tile_row) {
+    for (size_t tile_col = col / tile_size_;
+         tile_col <= (col + width - 1) / tile_size_; ++tile_col) {
+      const char* tile_data = DecodeTile(tile_row, tile_col, &buffer);
+
+      const size_t tile_height = TileHeight(tile_row);
+      const size_t tile_width = TileWidth(tile_col);
+      const size_t tile_row_start = tile_row * tile_size_;
+      const size_t tile_col_start = tile_col * tile_size_;
+      const size_t row_begin = std::max(row, tile_row_start);
+      const size_t row_end =
+          std::min(row + height, tile_row_start + tile_height);
+      const size_t col_begin = std::max(col, tile_col_start);
+      const size_t col_end =
+          std::min(col + width, tile_col_start + tile_width);
+      const size_t row_num_bytes = (col_end - col_begin) * elem_size_;
+
+      for (size_t slice = 0; slice < depth_; ++slice) {
+        for (size_t r = row_begin; r < row_end; ++r) {
+          const size_t tile_elem_idx =
+              (slice * tile_height + r - tile_row_start) * tile_width +
+              col_begin - tile_col_start;
+          const size_t elem_idx =
+              slice * width * height + (r - row) * width + col_begin - col;
+          std::memcpy(elems + elem_idx * elem_size_,
+                      tile_data + tile_elem_idx * elem_size_,
+                      row_num_bytes);
+        }
+      }
+    }
+  }
+}
+
+const void* MatFile::TileData(const size_t tile_row,
+                              const size_t tile_col) const {
+  CHECK(IsOpen());
+  CHECK(compression_ == Compression::NONE);
+  CHECK_LT(tile_row, NumTileRows());
+  CHECK_LT(tile_col, NumTileCols());
+  return file_.Data() + tiles_[tile_row * NumTileCols() + tile_col].offset;
+}
+
+size_t MatFile::TileWidth(const size_t tile_col) const {
+  return std::min(tile_size_, width_ - tile_col * tile_size_);
+}
+
+size_t MatFile::TileHeight(const size_t tile_row) const {
+  return std::min(tile_size_, height_ - tile_row * tile_size_);
+}
+
+const char* MatFile::DecodeTile(const size_t tile_row, const size_t tile_col,
+                                std::vector<char>* buffer) const {
+  const Tile& tile = tiles_[tile_row * NumTileCols() + tile_col];
+  const size_t tile_width = TileWidth(tile_col);
+  const size_t tile_num_bytes =
+      depth_ * TileHeight(tile_row) * tile_width * elem_size_;
+  const char* tile_ptr = file_.Data() + tile.offset;
+  if (tile.num_bytes == tile_num_bytes) {
+    return tile_ptr;
+  }
+
+  buffer->resize(tile_num_bytes);
+  CHECK(internal::DecompressLZ(tile_ptr, tile.num_bytes, buffer))
+      << "Corrupt map file tile " << tile_row << ", " << tile_col;
+  DecodeTileInPlace(tile_width, elem_size_, buffer);
+  return buffer->data();
+}
+
+}  // namespace mvs
+}  // namespace colmap
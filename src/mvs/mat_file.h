@@ -0,0 +1,157 @@
+// Copyright (c) 2022, ETH Zurich and UNC Chapel Hill.
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//
+//     * Neither the name of ETH Zurich and UNC Chapel Hill nor the names of
+//       its contributors may be used to endorse or promote products derived
+//       from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDERS OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//
+// Author: Johannes L. Schoenberger (jsch-at-demuc-dot-de)
+
+#ifndef COLMAP_SRC_MVS_MAT_FILE_H_
+#define COLMAP_SRC_MVS_MAT_FILE_H_
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "util/mapped_file.h"
+
+namespace colmap {
+namespace mvs {
+
+// Tiled container format for depth, normal, and other maps, as an alternative
+// to the raw format of `Mat<T>::Write`. The map is split into square tiles,
+// which are stored independently, so that regions of the map can be read
+// without decoding the entire file. Tiles are either stored uncompressed and
+// aligned, such that the memory-mapped file can be accessed in place, or
+// losslessly compressed. Compressed tiles are XOR-delta encoded between
+// horizontally neighboring elements, shuffled into byte planes, and then
+// compressed with a simple LZ77 coder. For smooth depth and normal maps, this
+// zeroes most sign, exponent, and high mantissa bytes.
+//
+// File layout, where all integers are little-endian:
+//
+//    Header:  char[8] magic, uint32 version, uint32 compression,
+//             uint64 width, uint64 height, uint64 depth,
+//             uint32 elem_size, uint32 tile_size
+//    Index:   num_tiles times uint64 offset, uint64 num_bytes
+//    Tiles:   depth times tile_height times tile_width elements
+//
+// Tiles are stored in row-major order and the elements of a tile in
+// slice-major and then row-major order. Uncompressed tiles start at a
+// multiple of `kAlignment` bytes. A compressed tile is stored uncompressed if
+// compression does not reduce its size, which is indicated by `num_bytes`.
+class MatFile {
+ public:
+  enum class Compression {
+    NONE = 0,
+    LZ = 1,
+  };
+
+  static const size_t kAlignment = 64;
+  static const size_t kDefaultTileSize = 256;
+
+  MatFile();
+  ~MatFile();
+  MatFile(const MatFile&) = delete;
+  MatFile& operator=(const MatFile&) = delete;
+
+  // Check whether the file starts with the magic of the container format.
+  static bool IsMatFile(const std::string& path);
+
+  // Write the data of a map with the layout of `Mat<T>` into a new file.
+  static void Write(const std::string& path, const void* data,
+                    const size_t width, const size_t height,
+                    const size_t depth, const size_t elem_size,
+                    const Compression compression,
+                    const size_t tile_size = kDefaultTileSize);
+
+  // Map an existing file into memory. Returns false if the file does not
+  // exist, is not a valid file, or the platform is big-endian.
+  bool Open(const std::string& path);
+  void Close();
+  bool IsOpen() const;
+
+  size_t Width() const;
+  size_t Height() const;
+  size_t Depth() const;
+  size_t ElemSize() const;
+  size_t TileSize() const;
+  Compression GetCompression() const;
+
+  size_t NumTileRows() const;
+  size_t NumTileCols() const;
+
+  // Decode the given region of all slices into `data`, which is laid out as a
+  // `Mat<T>` of size `width` x `height` x `Depth()`. Only the tiles
+  // overlapping the region are decoded.
+  void ReadRegion(const size_t row, const size_t col, const size_t height,
+                  const size_t width, void* data) const;
+
+  // Zero-copy access to the elements of an uncompressed tile, which are laid
+  // out as described above. Valid until `Close`.
+  const void* TileData(const size_t tile_row, const size_t tile_col) const;
+
+ private:
+  struct Tile {
+    uint64_t offset = 0;
+    uint64_t num_bytes = 0;
+  };
+
+  size_t TileWidth(const size_t tile_col) const;
+  size_t TileHeight(const size_t tile_row) const;
+  // Return the elements of a tile, either pointing into the mapped file or
+  // into the buffer, if the tile is compressed.
+  const char* DecodeTile(const size_t tile_row, const size_t tile_col,
+                         std::vector<char>* buffer) const;
+
+  MappedFile file_;
+  Compression compression_;
+  size_t width_;
+  size_t height_;
+  size_t depth_;
+  size_t elem_size_;
+  size_t tile_size_;
+  std::vector<Tile> tiles_;
+};
+
+namespace internal {
+
+// Lossless LZ77 compression of a byte sequence. The compressed stream is a
+// sequence of literal runs, each followed by a back-reference into the
+// already decoded output.
+void CompressLZ(const std::vector<char>& data, std::vector<char>* compressed);
+
+// Decompress into `data`, which must be sized to the decompressed length.
+// Returns false if the compressed stream is corrupt.
+bool DecompressLZ(const char* compressed, const size_t num_compressed_bytes,
+                  std::vector<char>* data);
+
+}  // namespace internal
+
+}  // namespace mvs
+}  // namespace colmap
+
+#endif  // COLMAP_SRC_MVS_MAT_FILE_H_
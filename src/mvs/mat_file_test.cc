@@ -0,0 +1,249 @@
+// Copyright (c) 2022, ETH Zurich and UNC Chapel Hill.
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//
+//     * Neither the name of ETH Zurich and UNC Chapel Hill nor the names of
+//       its contributors may be used to endorse or promote products derived
+//       from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDERS OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//
+// Author: Johannes L. Schoenberger (jsch-at-demuc-dot-de)
+
+#define TEST_NAME "mvs/mat_file_test"
+#include "util/testing.h"
+
+#include <cmath>
+#include <fstream>
+#include <limits>
+
+#include <boost/filesystem.hpp>
+
+#include "mvs/mat.h"
+#include "util/misc.h"
+#include "util/random.h"
+
+using namespace colmap;
+using namespace colmap::mvs;
+
+namespace {
+
+std::string TempPath() {
+  return (boost::filesystem::temp_directory_path() /
+          boost::filesystem::unique_path("colmap-mat-file-%%%%%%%%"))
+      .string();
+}
+
+// Create a smooth map with invalid regions, similar to a depth map.
+Mat<float> CreateSmoothMat(const size_t width, const size_t height,
+                           const size_t depth) {
+  Mat<float> mat(width, height, depth);
+  for (size_t slice = 0; slice < depth; ++slice) {
+    for (size_t row = 0; row < height; ++row) {
+      for (size_t col = 0; col < width; ++col) {
+        if (col < width / 8) {
+          continue;
+        }
+        mat.Set(row, col, slice,
+                5.0f + slice + 0.01f * row + std::sin(0.02f * col));
+      }
+    }
+  }
+  return mat;
+}
+
+void CheckEqual(const Mat<float>& mat1, const Mat<float>& mat2) {
+  BOOST_REQUIRE_EQUAL(mat1.GetWidth(), mat2.GetWidth());
+  BOOST_REQUIRE_EQUAL(mat1.GetHeight(), mat2.GetHeight());
+  BOOST_REQUIRE_EQUAL(mat1.GetDepth(), mat2.GetDepth());
+  BOOST_CHECK(mat1.GetData() == mat2.GetData());
+}
+
+}  // namespace
+
+BOOST_AUTO_TEST_CASE(TestCompressLZ) {
+  SetPRNGSeed(0);
+  std::vector<char> data(10000);
+  for (size_t i = 0; i < data.size(); ++i) {
+    if (i < 3000) {
+      data[i] = 0;
+    } else if (i < 6000) {
+      data[i] = "abcdefgh"[i % 8];
+    } else {
+      data[i] = static_cast<char>(RandomInteger(0, 255));
+    }
+  }
+
+  std::vector<char> compressed;
+  internal::CompressLZ(data, &compressed);
+  BOOST_CHECK_LT(compressed.size(), 4100);
+
+  std::vector<char> decompressed(data.size());
+  BOOST_CHECK(internal::DecompressLZ(compressed.data(), compressed.size(),
+                                     &decompressed));
+  BOOST_CHECK(decompressed == data);
+
+  std::vector<char> short_decompressed(data.size() - 1);
+  BOOST_CHECK(!internal::DecompressLZ(compressed.data(), compressed.size(),
+                                      &short_decompressed));
+  BOOST_CHECK(!internal::DecompressLZ(compressed.data(),
+                                      compressed.size() / 2, &decompressed));
+
+  std::vector<char> empty_compressed;
+  internal::CompressLZ(std::vector<char>(), &empty_compressed);
+  std::vector<char> empty_decompressed;
+  BOOST_CHECK(internal::DecompressLZ(empty_compressed.data(),
+                                     empty_compressed.size(),
+                                     &empty_decompressed));
+}
+
+BOOST_AUTO_TEST_CASE(TestReadWrite) {
+  for (const auto compression :
+       {MatFile::Compression::NONE, MatFile::Compression::LZ}) {
+    for (const size_t depth : {1, 3}) {
+      const Mat<float> mat = CreateSmoothMat(301, 257, depth);
+      const std::string path = TempPath();
+      mat.Write(path, compression);
+      BOOST_CHECK(MatFile::IsMatFile(path));
+
+      Mat<float> read_mat;
+      read_mat.Read(path);
+      CheckEqual(mat, read_mat);
+
+      const size_t file_size = boost::filesystem::file_size(path);
+      if (compression == MatFile::Compression::LZ) {
+        BOOST_CHECK_LT(file_size, mat.GetNumBytes() / 2);
+      } else {
+        BOOST_CHECK_GT(file_size, mat.GetNumBytes());
+      }
+
+      boost::filesystem::remove(path);
+    }
+  }
+}
+
+BOOST_AUTO_TEST_CASE(TestReadRaw) {
+  const Mat<float> mat = CreateSmoothMat(20, 10, 2);
+  const std::string path = TempPath();
+  mat.Write(path);
+  BOOST_CHECK(!MatFile::IsMatFile(path));
+  BOOST_CHECK(!MatFile().Open(path));
+
+  Mat<float> read_mat;
+  read_mat.Read(path);
+  CheckEqual(mat, read_mat);
+
+  boost::filesystem::remove(path);
+}
+
+BOOST_AUTO_TEST_CASE(TestReadRegion) {
+  const Mat<float> mat = CreateSmoothMat(100, 70, 3);
+  for (const auto compression :
+       {MatFile::Compression::NONE, MatFile::Compression::LZ}) {
+    const std::string path = TempPath();
+    MatFile::Write(path, mat.GetPtr(), mat.GetWidth(), mat.GetHeight(),
+                   mat.GetDepth(), sizeof(float), compression, 32);
+
+    MatFile file;
+    BOOST_REQUIRE(file.Open(path));
+    BOOST_CHECK_EQUAL(file.Width(), 100);
+    BOOST_CHECK_EQUAL(file.Height(), 70);
+    BOOST_CHECK_EQUAL(file.Depth(), 3);
+    BOOST_CHECK_EQUAL(file.ElemSize(), sizeof(float));
+    BOOST_CHECK_EQUAL(file.TileSize(), 32);
+    BOOST_CHECK_EQUAL(file.NumTileRows(), 3);
+    BOOST_CHECK_EQUAL(file.NumTileCols(), 4);
+    BOOST_CHECK(file.GetCompression() == compression);
+
+    const size_t kRow = 20;
+    const size_t kCol = 30;
+    const size_t kHeight = 45;
+    const size_t kWidth = 40;
+    Mat<float> region(kWidth, kHeight, 3);
+    file.ReadRegion(kRow, kCol, kHeight, kWidth, region.GetPtr());
+    for (size_t slice = 0; slice < 3; ++slice) {
+      for (size_t row = 0; row < kHeight; ++row) {
+        for (size_t col = 0; col < kWidth; ++col) {
+          BOOST_CHECK_EQUAL(region.Get(row, col, slice),
+                            mat.Get(kRow + row, kCol + col, slice));
+        }
+      }
+    }
+
+    if (compression == MatFile::Compression::NONE) {
+      // The last tile is 4 columns wide and 6 rows high.
+      const float* tile_data = static_cast<const float*>(file.TileData(2, 3));
+      BOOST_CHECK_EQUAL(
+          reinterpret_cast<uintptr_t>(tile_data) % MatFile::kAlignment, 0);
+      BOOST_CHECK_EQUAL(tile_data[0], mat.Get(64, 96, 0));
+      BOOST_CHECK_EQUAL(tile_data[4 * 6 + 4 + 1], mat.Get(65, 97, 1));
+    }
+
+    file.Close();
+    boost::filesystem::remove(path);
+  }
+}
+
+BOOST_AUTO_TEST_CASE(TestOpenInvalid) {
+  MatFile file;
+  BOOST_CHECK(!file.Open(TempPath()));
+  BOOST_CHECK(!file.IsOpen());
+
+  const Mat<float> mat = CreateSmoothMat(50, 40, 1);
+  const std::string path = TempPath();
+  mat.Write(path, MatFile::Compression::LZ);
+  boost::filesystem::resize_file(path, boost::filesystem::file_size(path) / 2);
+  BOOST_CHECK(!file.Open(path));
+  boost::filesystem::remove(path);
+}
+
+BOOST_AUTO_TEST_CASE(TestOpenCorruptHeader) {
+  const Mat<float> mat = CreateSmoothMat(50, 40, 1);
+  const std::string path = TempPath();
+
+  // Overwrite a header field at the given offset with a huge value.
+  auto WriteCorruptHeader = [&](const std::streamoff offset) {
+    mat.Write(path, MatFile::Compression::NONE);
+    std::fstream file(path, std::ios::in | std::ios::out | std::ios::binary);
+    file.seekp(offset);
+    const uint64_t value = std::numeric_limits<uint64_t>::max() - 1;
+    file.write(reinterpret_cast<const char*>(&value), sizeof(value));
+  };
+
+  MatFile file;
+
+  // Width, height, and depth.
+  for (const std::streamoff offset : {16, 24, 32}) {
+    WriteCorruptHeader(offset);
+    BOOST_CHECK(!file.Open(path));
+    BOOST_CHECK(!file.IsOpen());
+  }
+
+  // Truncated within the tile table.
+  MatFile::Write(path, mat.GetData().data(), mat.GetWidth(), mat.GetHeight(),
+                 mat.GetDepth(), sizeof(float), MatFile::Compression::NONE,
+                 /*tile_size=*/8);
+  boost::filesystem::resize_file(path, 64);
+  BOOST_CHECK(!file.Open(path));
+
+  boost::filesystem::remove(path);
+}
@@ -31,7 +31,13 @@
 
 #include "mvs/meshing.h"
 
+#include <array>
+#include <cfloat>
+#include <cmath>
 #include <fstream>
+#include <limits>
+#include <memory>
+#include <numeric>
 #include <unordered_map>
 #include <vector>
 
@@ -117,9 +123,190 @@ bool DelaunayMeshingOptions::Check() const {
   CHECK_OPTION_LE(max_side_length_percentile, 100);
   CHECK_OPTION_GE(num_threads, -1);
   CHECK_OPTION_NE(num_threads, 0);
+  CHECK_OPTION_GE(chunk_max_num_points, 0);
+  CHECK_OPTION_GE(chunk_overlap, 0);
+  CHECK_OPTION_GT(chunk_max_memory, 0);
   return true;
 }
 
+bool MeshingChunk::Contains(const Eigen::Vector3f& xyz) const {
+  return (xyz.array() >= min_bound.array()).all() &&
+         (xyz.array() < max_bound.array()).all();
+}
+
+std::vector<MeshingChunk> ComputeMeshingChunks(
+    const std::vector<Eigen::Vector3f>& points, const size_t max_num_points,
+    const double overlap) {
+  CHECK_GT(max_num_points, 0);
+  CHECK_GE(overlap, 0);
+
+  std::vector<MeshingChunk> chunks;
+  if (points.empty()) {
+    return chunks;
+  }
+
+  // Chunks are not split beyond this depth, which is only reached if more
+  // than the maximum number of points are (nearly) coincident.
+  const int kMaxDepth = 20;
+
+  struct ChunkNode {
+    MeshingChunk chunk;
+    int depth = 0;
+  };
+
+  ChunkNode root;
+  root.chunk.min_bound = Eigen::Vector3f::Constant(FLT_MAX);
+  root.chunk.max_bound = Eigen::Vector3f::Constant(-FLT_MAX);
+  for (const auto& point : points) {
+    root.chunk.min_bound = root.chunk.min_bound.cwiseMin(point);
+    root.chunk.max_bound = root.chunk.max_bound.cwiseMax(point);
+  }
+  for (int d = 0; d < 3; ++d) {
+    root.chunk.max_bound(d) = std::nextafter(
+        root.chunk.max_bound(d), std::numeric_limits<float>::infinity());
+  }
+  root.chunk.point_idxs.resize(points.size());
+  std::iota(root.chunk.point_idxs.begin(), root.chunk.point_idxs.end(), 0);
+
+  std::vector<ChunkNode> nodes;
+  nodes.push_back(std::move(root));
+  while (!nodes.empty()) {
+    ChunkNode node = std::move(nodes.back());
+    nodes.pop_back();
+
+    const MeshingChunk& chunk = node.chunk;
+
+    size_t num_points = 0;
+    for (const auto point_idx : chunk.point_idxs) {
+      if (chunk.Contains(points[point_idx])) {
+        num_points += 1;
+      }
+    }
+
+    if (num_points <= max_num_points || node.depth >= kMaxDepth) {
+      if (!chunk.point_idxs.empty()) {
+        chunks.push_back(std::move(node.chunk));
+      }
+      continue;
+    }
+
+    const Eigen::Vector3f extent = chunk.max_bound - chunk.min_bound;
+    const Eigen::Vector3f center = chunk.min_bound + 0.5f * extent;
+    const float min_split_extent = 0.5f * extent.maxCoeff();
+
+    // Push the children in reverse order, such that they are emitted in
+    // depth-first order and consecutive chunks are spatially close.
+    for (int octant = 7; octant >= 0; --octant) {
+      ChunkNode child;
+      child.depth = node.depth + 1;
+
+      bool valid_octant = true;
+      for (int d = 0; d < 3; ++d) {
+        const bool upper = (octant >> d) & 1;
+        if (extent(d) < min_split_extent) {
+          valid_octant = valid_octant && !upper;
+          child.chunk.min_bound(d) = chunk.min_bound(d);
+          child.chunk.max_bound(d) = chunk.max_bound(d);
+        } else if (upper) {
+          child.chunk.min_bound(d) = center(d);
+          child.chunk.max_bound(d) = chunk.max_bound(d);
+        } else {
+          child.chunk.min_bound(d) = chunk.min_bound(d);
+          child.chunk.max_bound(d) = center(d);
+        }
+      }
+
+      if (!valid_octant) {
+        continue;
+      }
+
+      // The expanded bounds of the child are contained in the expanded bounds
+      // of the parent, so it suffices to filter the points of the parent.
+      const Eigen::Vector3f child_overlap =
+          overlap * (child.chunk.max_bound - child.chunk.min_bound);
+      const Eigen::Vector3f min_xyz = child.chunk.min_bound - child_overlap;
+      const Eigen::Vector3f max_xyz = child.chunk.max_bound + child_overlap;
+      for (const auto point_idx : chunk.point_idxs) {
+        const Eigen::Vector3f& xyz = points[point_idx];
+        if ((xyz.array() >= min_xyz.array()).all() &&
+            (xyz.array() < max_xyz.array()).all()) {
+          child.chunk.point_idxs.push_back(point_idx);
+        }
+      }
+
+      nodes.push_back(std::move(child));
+    }
+  }
+
+  return chunks;
+}
+
+PlyMesh StitchMeshingChunks(const std::vector<MeshingChunk>& chunks,
+                            const std::vector<PlyMesh>& chunk_meshes) {
+  CHECK_EQ(chunks.size(), chunk_meshes.size());
+
+  struct VertexHash {
+    size_t operator()(const std::array<float, 3>& xyz) const {
+      size_t seed = 0;
+      for (const float coord : xyz) {
+        seed ^= std::hash<float>()(coord) + 0x9e3779b9 + (seed << 6) +
+                (seed >> 2);
+      }
+      return seed;
+    }
+  };
+
+  PlyMesh mesh;
+  std::unordered_map<std::array<float, 3>, size_t, VertexHash> vertex_idxs;
+
+  const size_t kInvalidVertexIdx = std::numeric_limits<size_t>::max();
+  std::vector<size_t> chunk_vertex_idxs;
+
+  for (size_t chunk_idx = 0; chunk_idx < chunks.size(); ++chunk_idx) {
+    const auto& chunk = chunks[chunk_idx];
+    const auto& chunk_mesh = chunk_meshes[chunk_idx];
+
+    chunk_vertex_idxs.assign(chunk_mesh.vertices.size(), kInvalidVertexIdx);
+
+    auto StitchVertex = [&](const size_t chunk_vertex_idx) {
+      size_t& vertex_idx = chunk_vertex_idxs.at(chunk_vertex_idx);
+      if (vertex_idx == kInvalidVertexIdx) {
+        const auto& vertex = chunk_mesh.vertices[chunk_vertex_idx];
+        const std::array<float, 3> xyz = {{vertex.x, vertex.y, vertex.z}};
+        const auto it = vertex_idxs.emplace(xyz, mesh.vertices.size());
+        if (it.second) {
+          mesh.vertices.push_back(vertex);
+        }
+        vertex_idx = it.first->second;
+      }
+      return vertex_idx;
+    };
+
+    auto VertexXYZ = [&](const size_t chunk_vertex_idx) {
+      const auto& vertex = chunk_mesh.vertices.at(chunk_vertex_idx);
+      return Eigen::Vector3d(vertex.x, vertex.y, vertex.z);
+    };
+
+    for (const auto& face : chunk_mesh.faces) {
+      // Sum in double precision, which is exact for the vertices of a face,
+      // such that the centroid does not depend on the order of the vertices
+      // and neighboring chunks agree on the chunk that keeps the face.
+      const Eigen::Vector3d sum = VertexXYZ(face.vertex_idx1) +
+                                  VertexXYZ(face.vertex_idx2) +
+                                  VertexXYZ(face.vertex_idx3);
+      if (!chunk.Contains((sum / 3).cast<float>())) {
+        continue;
+      }
+      const size_t vertex_idx1 = StitchVertex(face.vertex_idx1);
+      const size_t vertex_idx2 = StitchVertex(face.vertex_idx2);
+      const size_t vertex_idx3 = StitchVertex(face.vertex_idx3);
+      mesh.faces.emplace_back(vertex_idx1, vertex_idx2, vertex_idx3);
+    }
+  }
+
+  return mesh;
+}
+
 bool PoissonMeshing(const PoissonMeshingOptions& options,
                     const std::string& input_path,
                     const std::string& output_path) {
@@ -147,10 +334,9 @@ bool PoissonMeshing(const PoissonMeshingOptions& options,
   }
 
 #ifdef OPENMP_ENABLED
-  if (options.num_threads > 0) {
-    args.push_back("--threads");
-    args.push_back(std::to_string(options.num_threads));
-  }
+  ThreadBudgetLease thread_budget_lease(options.num_threads);
+  args.push_back("--threads");
+  args.push_back(std::to_string(thread_budget_lease.NumThreads()));
 #endif  // OPENMP_ENABLED
 
   if (options.trim > 0) {
@@ -694,8 +880,12 @@ struct DelaunayCellData {
   std::array<float, 4> edge_weights;
 };
 
+// If `borrow_threads` is false, exactly the given number of threads is used
+// without borrowing them from the thread budget, e.g., if the caller already
+// borrowed them for multiple concurrent calls.
 PlyMesh DelaunayMeshing(const DelaunayMeshingOptions& options,
-                        const DelaunayMeshingInput& input_data) {
+                        const DelaunayMeshingInput& input_data,
+                        const bool borrow_threads = true) {
   CHECK(options.Check());
 
   // Create a delaunay triangulation of all input points.
@@ -726,7 +916,12 @@ PlyMesh DelaunayMeshing(const DelaunayMeshingOptions& options,
   }
 
   // Spawn threads for parallelized integration of images.
-  const int num_threads = GetEffectiveNumThreads(options.num_threads);
+  std::unique_ptr<ThreadBudgetLease> thread_budget_lease;
+  int num_threads = GetEffectiveNumThreads(options.num_threads);
+  if (borrow_threads) {
+    thread_budget_lease.reset(new ThreadBudgetLease(options.num_threads));
+    num_threads = thread_budget_lease->NumThreads();
+  }
   ThreadPool thread_pool(num_threads);
   JobQueue<CellGraphData> result_queue(num_threads);
 
@@ -978,6 +1173,11 @@ PlyMesh DelaunayMeshing(const DelaunayMeshingOptions& options,
     surface_vertex_indices.emplace(vertex, surface_vertex_indices.size());
   }
 
+  // Chunks of the chunked meshing can be too small to contain any surface.
+  if (surface_facets.empty()) {
+    return mesh;
+  }
+
   const float max_facet_side_length =
       options.max_side_length_factor *
       Percentile(surface_facet_side_lengths,
@@ -1005,6 +1205,116 @@ PlyMesh DelaunayMeshing(const DelaunayMeshingOptions& options,
   return mesh;
 }
 
+PlyMesh ChunkedDelaunayMeshing(const DelaunayMeshingOptions& options,
+                               const DelaunayMeshingInput& input_data) {
+  CHECK(options.Check());
+  CHECK_GT(options.chunk_max_num_points, 0);
+
+  std::cout << "Partitioning points into chunks..." << std::endl;
+
+  std::vector<Eigen::Vector3f> points(input_data.points.size());
+  for (size_t point_idx = 0; point_idx < points.size(); ++point_idx) {
+    points[point_idx] = input_data.points[point_idx].position;
+  }
+
+  const auto chunks = ComputeMeshingChunks(
+      points, options.chunk_max_num_points, options.chunk_overlap);
+
+  points.clear();
+  points.shrink_to_fit();
+
+  std::vector<std::vector<uint32_t>> points_visible_image_idxs(
+      input_data.points.size());
+  for (size_t image_idx = 0; image_idx < input_data.images.size();
+       ++image_idx) {
+    for (const auto point_idx : input_data.images[image_idx].point_idxs) {
+      points_visible_image_idxs[point_idx].push_back(image_idx);
+    }
+  }
+
+  // Rough estimate of the peak memory per point for the triangulation, the
+  // s-t graph, and the ray casting of a chunk.
+  const double kNumBytesPerPoint = 2048.0;
+  const double chunk_num_bytes =
+      kNumBytesPerPoint * options.chunk_max_num_points;
+  const double max_num_parallel_chunks =
+      1024.0 * 1024.0 * 1024.0 * options.chunk_max_memory / chunk_num_bytes;
+
+  // Mesh as many chunks concurrently as the memory budget allows and use the
+  // remaining threads within each chunk. All threads are borrowed here and
+  // every chunk uses its share without borrowing any further threads.
+  ThreadBudgetLease thread_budget_lease(options.num_threads);
+  const int num_threads = thread_budget_lease.NumThreads();
+  const int num_parallel_chunks = std::max(
+      1, static_cast<int>(std::min({static_cast<double>(num_threads),
+                                    max_num_parallel_chunks,
+                                    static_cast<double>(chunks.size())})));
+
+  DelaunayMeshingOptions chunk_options = options;
+  chunk_options.chunk_max_num_points = 0;
+  chunk_options.num_threads = std::max(1, num_threads / num_parallel_chunks);
+
+  std::cout << StringPrintf("Meshing %d chunks with %d in parallel...",
+                            chunks.size(), num_parallel_chunks)
+            << std::endl;
+
+  std::vector<PlyMesh> chunk_meshes(chunks.size());
+
+  // Only the input of the chunks in flight is kept in memory.
+  auto MeshChunk = [&](const size_t chunk_idx) {
+    const auto& chunk = chunks[chunk_idx];
+
+    DelaunayMeshingInput chunk_input_data;
+    chunk_input_data.cameras = input_data.cameras;
+    chunk_input_data.points.reserve(chunk.point_idxs.size());
+
+    std::unordered_map<uint32_t, size_t> image_idx_to_chunk_image_idx;
+    for (const auto point_idx : chunk.point_idxs) {
+      const size_t chunk_point_idx = chunk_input_data.points.size();
+      chunk_input_data.points.push_back(input_data.points[point_idx]);
+      for (const auto image_idx : points_visible_image_idxs[point_idx]) {
+        const auto it = image_idx_to_chunk_image_idx.emplace(
+            image_idx, chunk_input_data.images.size());
+        if (it.second) {
+          const auto& image = input_data.images[image_idx];
+          DelaunayMeshingInput::Image chunk_image;
+          chunk_image.camera_id = image.camera_id;
+          chunk_image.proj_matrix = image.proj_matrix;
+          chunk_image.proj_center = image.proj_center;
+          chunk_input_data.images.push_back(chunk_image);
+        }
+        chunk_input_data.images[it.first->second].point_idxs.push_back(
+            chunk_point_idx);
+      }
+    }
+
+    std::cout << StringPrintf("Meshing chunk [%d/%d] with %d points",
+                              chunk_idx + 1, chunks.size(),
+                              chunk_input_data.points.size())
+              << std::endl;
+
+    chunk_meshes[chunk_idx] = DelaunayMeshing(chunk_options, chunk_input_data,
+                                              /*borrow_threads=*/false);
+  };
+
+  // A tetrahedron is the smallest chunk with a non-empty triangulation.
+  const size_t kMinNumChunkPoints = 4;
+
+  {
+    ThreadPool thread_pool(num_parallel_chunks);
+    for (size_t chunk_idx = 0; chunk_idx < chunks.size(); ++chunk_idx) {
+      if (chunks[chunk_idx].point_idxs.size() >= kMinNumChunkPoints) {
+        thread_pool.AddTask(MeshChunk, chunk_idx);
+      }
+    }
+    thread_pool.Wait();
+  }
+
+  std::cout << "Stitching chunk meshes..." << std::endl;
+
+  return StitchMeshingChunks(chunks, chunk_meshes);
+}
+
 void SparseDelaunayMeshing(const DelaunayMeshingOptions& options,
                            const std::string& input_path,
                            const std::string& output_path) {
@@ -1014,7 +1324,9 @@ void SparseDelaunayMeshing(const DelaunayMeshingOptions& options,
   DelaunayMeshingInput input_data;
   input_data.ReadSparseReconstruction(input_path);
 
-  const auto mesh = DelaunayMeshing(options, input_data);
+  const auto mesh = options.chunk_max_num_points > 0
+                        ? ChunkedDelaunayMeshing(options, input_data)
+                        : DelaunayMeshing(options, input_data);
 
   std::cout << "Writing surface mesh..." << std::endl;
   WriteBinaryPlyMesh(output_path, mesh);
@@ -1031,7 +1343,9 @@ void DenseDelaunayMeshing(const DelaunayMeshingOptions& options,
   DelaunayMeshingInput input_data;
   input_data.ReadDenseReconstruction(input_path);
 
-  const auto mesh = DelaunayMeshing(options, input_data);
+  const auto mesh = options.chunk_max_num_points > 0
+                        ? ChunkedDelaunayMeshing(options, input_data)
+                        : DelaunayMeshing(options, input_data);
 
   std::cout << "Writing surface mesh..." << std::endl;
   WriteBinaryPlyMesh(output_path, mesh);
@@ -33,6 +33,11 @@
 #define COLMAP_SRC_MVS_MESHING_H_
 
 #include <string>
+#include <vector>
+
+#include <Eigen/Core>
+
+#include "util/ply.h"
 
 namespace colmap {
 namespace mvs {
@@ -99,9 +104,58 @@ struct DelaunayMeshingOptions {
   // The number of threads to use for reconstruction. Default is all threads.
   int num_threads = -1;
 
+  // Maximum number of input points per meshing chunk. If positive, the scene
+  // is recursively split into octants until every chunk contains at most this
+  // number of points. The chunks are meshed independently in parallel and the
+  // resulting meshes are stitched together, which bounds the size of every
+  // triangulation and graph-cut. If zero, the scene is meshed as a whole.
+  // Note that the stitched mesh is not watertight at the chunk borders: the
+  // chunks are triangulated separately, every face is kept by the chunk that
+  // contains its centroid, and only vertices at identical positions are
+  // merged, so the seams can have small gaps or overlapping faces.
+  int chunk_max_num_points = 0;
+
+  // The overlap between neighboring chunks relative to the chunk size. The
+  // points in the overlap are meshed with the chunk but only the faces inside
+  // the chunk are kept, so that the surfaces of neighboring chunks mostly
+  // agree at their borders.
+  double chunk_overlap = 0.1;
+
+  // Memory budget in gigabytes for the chunks that are meshed concurrently.
+  // This limits the number of chunks in flight, while the remaining threads
+  // are used within each chunk.
+  double chunk_max_memory = 32.0;
+
   bool Check() const;
 };
 
+// Spatial partition of the input points for the chunked Delaunay meshing. The
+// bounds are half-open, such that every 3D location is contained in exactly
+// one chunk. The points of the chunk include the points within the overlap
+// around the bounds.
+struct MeshingChunk {
+  Eigen::Vector3f min_bound;
+  Eigen::Vector3f max_bound;
+  std::vector<size_t> point_idxs;
+
+  bool Contains(const Eigen::Vector3f& xyz) const;
+};
+
+// Recursively split the bounding box of the points into octants until the
+// bounds of every chunk contain at most the given number of points. Only the
+// axes with an extent of at least half the longest extent are split, such
+// that flat scenes are partitioned as a quadtree. The overlap is relative to
+// the extent of the chunk. Chunks without any points are dropped.
+std::vector<MeshingChunk> ComputeMeshingChunks(
+    const std::vector<Eigen::Vector3f>& points, const size_t max_num_points,
+    const double overlap);
+
+// Stitch the meshes of the chunks into a single mesh. Every face is kept only
+// by the chunk that contains its centroid and vertices with identical
+// positions in different chunks are merged.
+PlyMesh StitchMeshingChunks(const std::vector<MeshingChunk>& chunks,
+                            const std::vector<PlyMesh>& chunk_meshes);
+
 // Perform Poisson surface reconstruction and return true if successful.
 bool PoissonMeshing(const PoissonMeshingOptions& options,
                     const std::string& input_path,
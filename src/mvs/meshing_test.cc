@@ -0,0 +1,210 @@
+// Copyright (c) 2022, ETH Zurich and UNC Chapel Hill.
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//
+//     * Neither the name of ETH Zurich and UNC Chapel Hill nor the names of
+//       its contributors may be used to endorse or promote products derived
+//       from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDERS OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//
+// Author: Johannes L. Schoenberger (jsch-at-demuc-dot-de)
+
+#define TEST_NAME "mvs/meshing_test"
+#include "util/testing.h"
+
+#include "mvs/meshing.h"
+
+using namespace colmap;
+using namespace colmap::mvs;
+
+namespace {
+
+std::vector<Eigen::Vector3f> CreateGridPoints(const int num_x, const int num_y,
+                                              const int num_z) {
+  std::vector<Eigen::Vector3f> points;
+  for (int x = 0; x < num_x; ++x) {
+    for (int y = 0; y < num_y; ++y) {
+      for (int z = 0; z < num_z; ++z) {
+        points.emplace_back(x, y, z);
+      }
+    }
+  }
+  return points;
+}
+
+size_t CountContainedPoints(const MeshingChunk& chunk,
+                            const std::vector<Eigen::Vector3f>& points) {
+  size_t num_points = 0;
+  for (const auto& point : points) {
+    if (chunk.Contains(point)) {
+      num_points += 1;
+    }
+  }
+  return num_points;
+}
+
+}  // namespace
+
+BOOST_AUTO_TEST_CASE(TestMeshingChunkContains) {
+  MeshingChunk chunk;
+  chunk.min_bound = Eigen::Vector3f(0, 0, 0);
+  chunk.max_bound = Eigen::Vector3f(1, 2, 3);
+  BOOST_CHECK(chunk.Contains(Eigen::Vector3f(0, 0, 0)));
+  BOOST_CHECK(chunk.Contains(Eigen::Vector3f(0.5, 1.5, 2.5)));
+  BOOST_CHECK(!chunk.Contains(Eigen::Vector3f(1, 0, 0)));
+  BOOST_CHECK(!chunk.Contains(Eigen::Vector3f(0, 2, 0)));
+  BOOST_CHECK(!chunk.Contains(Eigen::Vector3f(0, 0, -1)));
+}
+
+BOOST_AUTO_TEST_CASE(TestComputeMeshingChunksEmpty) {
+  BOOST_CHECK(ComputeMeshingChunks({}, 10, 0.1).empty());
+}
+
+BOOST_AUTO_TEST_CASE(TestComputeMeshingChunksSingle) {
+  const auto points = CreateGridPoints(4, 4, 4);
+  const auto chunks = ComputeMeshingChunks(points, points.size(), 0.1);
+  BOOST_CHECK_EQUAL(chunks.size(), 1);
+  BOOST_CHECK_EQUAL(chunks[0].point_idxs.size(), points.size());
+  BOOST_CHECK_EQUAL(CountContainedPoints(chunks[0], points), points.size());
+}
+
+BOOST_AUTO_TEST_CASE(TestComputeMeshingChunksPartition) {
+  const auto points = CreateGridPoints(20, 20, 20);
+  const size_t kMaxNumPoints = 500;
+  const auto chunks = ComputeMeshingChunks(points, kMaxNumPoints, 0);
+  BOOST_CHECK_GT(chunks.size(), 8);
+
+  // Every point is contained in exactly one chunk.
+  std::vector<int> num_point_chunks(points.size(), 0);
+  for (const auto& chunk : chunks) {
+    BOOST_CHECK_LE(CountContainedPoints(chunk, points), kMaxNumPoints);
+    // Without overlap, the chunk contains exactly its points.
+    BOOST_CHECK_EQUAL(chunk.point_idxs.size(),
+                      CountContainedPoints(chunk, points));
+    for (const auto point_idx : chunk.point_idxs) {
+      BOOST_CHECK(chunk.Contains(points[point_idx]));
+      num_point_chunks[point_idx] += 1;
+    }
+  }
+
+  for (const int num_chunks : num_point_chunks) {
+    BOOST_CHECK_EQUAL(num_chunks, 1);
+  }
+}
+
+BOOST_AUTO_TEST_CASE(TestComputeMeshingChunksOverlap) {
+  const auto points = CreateGridPoints(20, 20, 20);
+  const auto chunks = ComputeMeshingChunks(points, 1000, 0.2);
+
+  std::vector<int> num_point_chunks(points.size(), 0);
+  bool has_overlap = false;
+  for (const auto& chunk : chunks) {
+    const Eigen::Vector3f overlap =
+        0.2f * (chunk.max_bound - chunk.min_bound);
+    const Eigen::Vector3f min_xyz = chunk.min_bound - overlap;
+    const Eigen::Vector3f max_xyz = chunk.max_bound + overlap;
+
+    size_t num_expected_points = 0;
+    for (const auto& point : points) {
+      if ((point.array() >= min_xyz.array()).all() &&
+          (point.array() < max_xyz.array()).all()) {
+        num_expected_points += 1;
+      }
+    }
+    BOOST_CHECK_EQUAL(chunk.point_idxs.size(), num_expected_points);
+
+    for (const auto point_idx : chunk.point_idxs) {
+      if (chunk.Contains(points[point_idx])) {
+        num_point_chunks[point_idx] += 1;
+      } else {
+        has_overlap = true;
+      }
+    }
+  }
+
+  BOOST_CHECK(has_overlap);
+  for (const int num_chunks : num_point_chunks) {
+    BOOST_CHECK_EQUAL(num_chunks, 1);
+  }
+}
+
+BOOST_AUTO_TEST_CASE(TestComputeMeshingChunksFlat) {
+  const auto points = CreateGridPoints(40, 40, 2);
+  const auto chunks = ComputeMeshingChunks(points, 200, 0);
+  BOOST_CHECK_GT(chunks.size(), 4);
+  for (const auto& chunk : chunks) {
+    // The thin z-axis is never split.
+    BOOST_CHECK_EQUAL(chunk.min_bound.z(), 0);
+    BOOST_CHECK_GT(chunk.max_bound.z(), 1);
+  }
+}
+
+BOOST_AUTO_TEST_CASE(TestComputeMeshingChunksCoincident) {
+  const std::vector<Eigen::Vector3f> points(100, Eigen::Vector3f(1, 2, 3));
+  const auto chunks = ComputeMeshingChunks(points, 10, 0.1);
+  BOOST_CHECK_EQUAL(chunks.size(), 1);
+  BOOST_CHECK_EQUAL(chunks[0].point_idxs.size(), points.size());
+}
+
+BOOST_AUTO_TEST_CASE(TestStitchMeshingChunks) {
+  std::vector<MeshingChunk> chunks(2);
+  chunks[0].min_bound = Eigen::Vector3f(0, 0, 0);
+  chunks[0].max_bound = Eigen::Vector3f(1, 1, 1);
+  chunks[1].min_bound = Eigen::Vector3f(1, 0, 0);
+  chunks[1].max_bound = Eigen::Vector3f(2, 1, 1);
+
+  // Both chunks mesh the faces across the shared border at x = 1, but every
+  // face must only be kept by the chunk containing its centroid.
+  std::vector<PlyMesh> chunk_meshes(2);
+  chunk_meshes[0].vertices.emplace_back(0.5, 0, 0);
+  chunk_meshes[0].vertices.emplace_back(1, 0, 0);
+  chunk_meshes[0].vertices.emplace_back(1, 1, 0);
+  chunk_meshes[0].vertices.emplace_back(1.5, 0, 0);
+  chunk_meshes[0].faces.emplace_back(0, 1, 2);
+  chunk_meshes[0].faces.emplace_back(1, 3, 2);
+
+  chunk_meshes[1].vertices.emplace_back(1.5, 0, 0);
+  chunk_meshes[1].vertices.emplace_back(1, 1, 0);
+  chunk_meshes[1].vertices.emplace_back(1, 0, 0);
+  chunk_meshes[1].vertices.emplace_back(0.5, 0, 0);
+  chunk_meshes[1].vertices.emplace_back(1.5, 1, 0);
+  chunk_meshes[1].faces.emplace_back(3, 2, 1);
+  chunk_meshes[1].faces.emplace_back(0, 1, 2);
+  chunk_meshes[1].faces.emplace_back(0, 4, 1);
+
+  const auto mesh = StitchMeshingChunks(chunks, chunk_meshes);
+  BOOST_CHECK_EQUAL(mesh.vertices.size(), 5);
+  BOOST_CHECK_EQUAL(mesh.faces.size(), 3);
+
+  for (const auto& face : mesh.faces) {
+    BOOST_CHECK_LT(face.vertex_idx1, mesh.vertices.size());
+    BOOST_CHECK_LT(face.vertex_idx2, mesh.vertices.size());
+    BOOST_CHECK_LT(face.vertex_idx3, mesh.vertices.size());
+  }
+
+  BOOST_CHECK_EQUAL(mesh.vertices[mesh.faces[0].vertex_idx1].x, 0.5);
+  BOOST_CHECK_EQUAL(mesh.vertices[mesh.faces[1].vertex_idx1].x, 1.5);
+  BOOST_CHECK_EQUAL(mesh.vertices[mesh.faces[1].vertex_idx2].x, 1);
+  BOOST_CHECK_EQUAL(mesh.vertices[mesh.faces[2].vertex_idx2].x, 1.5);
+  BOOST_CHECK_EQUAL(mesh.vertices[mesh.faces[2].vertex_idx2].y, 1);
+}
@@ -35,11 +35,16 @@
 #include <unordered_set>
 
 #include "mvs/consistency_graph.h"
-#include "mvs/patch_match_cuda.h"
+#include "mvs/patch_match_cpu.h"
 #include "mvs/workspace.h"
 #include "util/math.h"
 #include "util/misc.h"
 
+#ifdef CUDA_ENABLED
+#include "mvs/patch_match_cuda.h"
+#include "util/cuda.h"
+#endif
+
 #define PrintOption(option) std::cout << #option ": " << option << std::endl
 
 namespace colmap {
@@ -74,6 +79,7 @@ void PatchMatchOptions::Print() const {
   PrintOption(filter_min_num_consistent);
   PrintOption(filter_geom_consistency_max_cost);
   PrintOption(write_consistency_graph);
+  PrintOption(map_format);
   PrintOption(allow_missing_files);
 }
 
@@ -159,26 +165,55 @@ void PatchMatch::Run() {
 
   Check();
 
-  patch_match_cuda_.reset(new PatchMatchCuda(options_, problem_));
-  patch_match_cuda_->Run();
+#ifdef CUDA_ENABLED
+  if (std::stoi(options_.gpu_index) >= 0 || GetNumCudaDevices() > 0) {
+    patch_match_cuda_.reset(new PatchMatchCuda(options_, problem_));
+    patch_match_cuda_->Run();
+    return;
+  }
+#endif
+
+  patch_match_cpu_.reset(new PatchMatchCpu(options_, problem_));
+  patch_match_cpu_->Run();
 }
 
 DepthMap PatchMatch::GetDepthMap() const {
-  return patch_match_cuda_->GetDepthMap();
+#ifdef CUDA_ENABLED
+  if (patch_match_cuda_) {
+    return patch_match_cuda_->GetDepthMap();
+  }
+#endif
+  return patch_match_cpu_->GetDepthMap();
 }
 
 NormalMap PatchMatch::GetNormalMap() const {
-  return patch_match_cuda_->GetNormalMap();
+#ifdef CUDA_ENABLED
+  if (patch_match_cuda_) {
+    return patch_match_cuda_->GetNormalMap();
+  }
+#endif
+  return patch_match_cpu_->GetNormalMap();
 }
 
 Mat<float> PatchMatch::GetSelProbMap() const {
-  return patch_match_cuda_->GetSelProbMap();
+#ifdef CUDA_ENABLED
+  if (patch_match_cuda_) {
+    return patch_match_cuda_->GetSelProbMap();
+  }
+#endif
+  return patch_match_cpu_->GetSelProbMap();
 }
 
 ConsistencyGraph PatchMatch::GetConsistencyGraph() const {
   const auto& ref_image = problem_.images->at(problem_.ref_image_idx);
+#ifdef CUDA_ENABLED
+  if (patch_match_cuda_) {
+    return ConsistencyGraph(ref_image.GetWidth(), ref_image.GetHeight(),
+                            patch_match_cuda_->GetConsistentImageIdxs());
+  }
+#endif
   return ConsistencyGraph(ref_image.GetWidth(), ref_image.GetHeight(),
-                          patch_match_cuda_->GetConsistentImageIdxs());
+                          patch_match_cpu_->GetConsistentImageIdxs());
 }
 
 PatchMatchController::PatchMatchController(const PatchMatchOptions& options,
@@ -400,10 +435,17 @@ void PatchMatchController::ReadProblems() {
 void PatchMatchController::ReadGpuIndices() {
   gpu_indices_ = CSVToVector<int>(options_.gpu_index);
   if (gpu_indices_.size() == 1 && gpu_indices_[0] == -1) {
+#ifdef CUDA_ENABLED
     const int num_cuda_devices = GetNumCudaDevices();
-    CHECK_GT(num_cuda_devices, 0);
-    gpu_indices_.resize(num_cuda_devices);
-    std::iota(gpu_indices_.begin(), gpu_indices_.end(), 0);
+    if (num_cuda_devices > 0) {
+      gpu_indices_.resize(num_cuda_devices);
+      std::iota(gpu_indices_.begin(), gpu_indices_.end(), 0);
+      return;
+    }
+#endif
+    // Without a GPU, the problems are processed one after the other, since
+    // the CPU implementation uses all available threads for each problem.
+    std::cout << "Running patch match stereo on the CPU..." << std::endl;
   }
 }
 
@@ -535,8 +577,16 @@ void PatchMatchController::ProcessProblem(const PatchMatchOptions& options,
                             image_name.c_str())
             << std::endl;
 
-  patch_match.GetDepthMap().Write(depth_map_path);
-  patch_match.GetNormalMap().Write(normal_map_path);
+  if (options.map_format == "raw") {
+    patch_match.GetDepthMap().Write(depth_map_path);
+    patch_match.GetNormalMap().Write(normal_map_path);
+  } else {
+    const MatFile::Compression compression =
+        options.map_format == "compressed" ? MatFile::Compression::LZ
+                                           : MatFile::Compression::NONE;
+    patch_match.GetDepthMap().Write(depth_map_path, compression);
+    patch_match.GetNormalMap().Write(normal_map_path, compression);
+  }
   if (options.write_consistency_graph) {
     patch_match.GetConsistencyGraph().Write(consistency_graph_path);
   }
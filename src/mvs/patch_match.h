@@ -53,6 +53,7 @@ namespace mvs {
 const static size_t kMaxPatchMatchWindowRadius = 32;
 
 class ConsistencyGraph;
+class PatchMatchCpu;
 class PatchMatchCuda;
 class Workspace;
 
@@ -62,6 +63,7 @@ struct PatchMatchOptions {
 
   // Index of the GPU used for patch match. For multi-GPU usage,
   // you should separate multiple GPU indices by comma, e.g., "0,1,2,3".
+  // If no GPU is available, patch match runs multi-threaded on the CPU.
   std::string gpu_index = "-1";
 
   // Depth range in which to randomly sample depth hypotheses.
@@ -140,6 +142,13 @@ struct PatchMatchOptions {
   // Whether to write the consistency graph.
   bool write_consistency_graph = false;
 
+  // File format of the output depth and normal maps. The "raw" format stores
+  // all values contiguously, "tiled" stores uncompressed tiles that can be
+  // memory-mapped, and "compressed" stores losslessly compressed tiles.
+  // All formats are read transparently by the workspace and by
+  // scripts/python/read_write_dense.py.
+  std::string map_format = "raw";
+
   void Print() const;
   bool Check() const {
     if (depth_min != -1.0f || depth_max != -1.0f) {
@@ -167,13 +176,16 @@ struct PatchMatchOptions {
     CHECK_OPTION_GE(filter_min_num_consistent, 0);
     CHECK_OPTION_GE(filter_geom_consistency_max_cost, 0.0f);
     CHECK_OPTION_GT(cache_size, 0);
+    CHECK_OPTION(map_format == "raw" || map_format == "tiled" ||
+                 map_format == "compressed");
     return true;
   }
 };
 
-// This is a wrapper class around the actual PatchMatchCuda implementation. This
-// class is necessary to hide Cuda code from any boost or Eigen code, since
-// NVCC/MSVC cannot compile complex C++ code.
+// This is a wrapper class around the actual PatchMatchCuda and PatchMatchCpu
+// implementations. This class is necessary to hide Cuda code from any boost or
+// Eigen code, since NVCC/MSVC cannot compile complex C++ code. The Cuda
+// implementation is used if CUDA is enabled and a device is available.
 class PatchMatch {
  public:
   struct Problem {
@@ -214,7 +226,10 @@ class PatchMatch {
  private:
   const PatchMatchOptions options_;
   const Problem problem_;
+  std::unique_ptr<PatchMatchCpu> patch_match_cpu_;
+#ifdef CUDA_ENABLED
   std::unique_ptr<PatchMatchCuda> patch_match_cuda_;
+#endif
 };
 
 // This thread processes all problems in a workspace. A workspace has the
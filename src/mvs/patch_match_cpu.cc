@@ -0,0 +1,1448 @@
+// Copyright (c) 2022, ETH Zurich and UNC Chapel Hill.
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//
+//     * Neither the name of ETH Zurich and UNC Chapel Hill nor the names of
+//       its contributors may be used to endorse or promote products derived
+//       from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDERS OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//
+// Author: Johannes L. Schoenberger (jsch-at-demuc-dot-de)
+
+#define _USE_MATH_DEFINES
+
+#include "mvs/patch_match_cpu.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <random>
+
+#include "util/logging.h"
+#include "util/math.h"
+#include "util/random.h"
+#include "util/string.h"
+#include "util/timer.h"
+
+namespace colmap {
+namespace mvs {
+
+struct PatchMatchCpu::SweepOptions {
+  float perturbation = 1.0f;
+  float depth_min = 0.0f;
+  float depth_max = 1.0f;
+  int num_samples = 15;
+  float sigma_spatial = 3.0f;
+  float sigma_color = 0.3f;
+  float ncc_sigma = 0.6f;
+  float min_triangulation_angle = 0.5f;
+  float incident_angle_sigma = 0.9f;
+  float prev_sel_prob_weight = 0.0f;
+  float geom_consistency_regularizer = 0.1f;
+  float geom_consistency_max_cost = 5.0f;
+  float filter_min_ncc = 0.1f;
+  float filter_min_triangulation_angle = 3.0f;
+  int filter_min_num_consistent = 2;
+  float filter_geom_consistency_max_cost = 1.0f;
+  bool geom_consistency_term = false;
+  bool filter_photo_consistency = false;
+  bool filter_geom_consistency = false;
+};
+
+namespace {
+
+// Number of adjacent columns processed by one task in a sweep, which is the
+// equivalent of a thread block in the Cuda implementation.
+const int kTileWidth = 32;
+
+// Number of parameters per source image in the relative poses.
+const int kNumTformParams = 4 + 9 + 3 + 3 + 12 + 12;
+
+// Offsets of the individual parameters in the relative poses.
+const int kPoseKOffset = 0;
+const int kPoseROffset = 4;
+const int kPoseTOffset = 13;
+const int kPoseCOffset = 16;
+const int kPosePOffset = 19;
+const int kPoseInvPOffset = 31;
+
+struct ParamState {
+  float depth = 0.0f;
+  float normal[3] = {0};
+};
+
+inline void Mat33DotVec3(const float mat[9], const float vec[3],
+                         float result[3]) {
+  result[0] = mat[0] * vec[0] + mat[1] * vec[1] + mat[2] * vec[2];
+  result[1] = mat[3] * vec[0] + mat[4] * vec[1] + mat[5] * vec[2];
+  result[2] = mat[6] * vec[0] + mat[7] * vec[1] + mat[8] * vec[2];
+}
+
+inline void Mat33DotVec3Homogeneous(const float mat[9], const float vec[2],
+                                    float result[2]) {
+  const float inv_z = 1.0f / (mat[6] * vec[0] + mat[7] * vec[1] + mat[8]);
+  result[0] = inv_z * (mat[0] * vec[0] + mat[1] * vec[1] + mat[2]);
+  result[1] = inv_z * (mat[3] * vec[0] + mat[4] * vec[1] + mat[5]);
+}
+
+inline float DotProduct3(const float vec1[3], const float vec2[3]) {
+  return vec1[0] * vec2[0] + vec1[1] * vec2[1] + vec1[2] * vec2[2];
+}
+
+inline float GenerateRandomUniform(std::mt19937* prng) {
+  return std::uniform_real_distribution<float>(0.0f, 1.0f)(*prng);
+}
+
+inline float GenerateRandomDepth(const float depth_min, const float depth_max,
+                                 std::mt19937* prng) {
+  return GenerateRandomUniform(prng) * (depth_max - depth_min) + depth_min;
+}
+
+void GenerateRandomNormal(const int row, const int col,
+                          const float ref_inv_K[4], std::mt19937* prng,
+                          float normal[3]) {
+  // Unbiased sampling of normal, according to George Marsaglia, "Choosing a
+  // Point from the Surface of a Sphere", 1972.
+  float v1 = 0.0f;
+  float v2 = 0.0f;
+  float s = 2.0f;
+  while (s >= 1.0f) {
+    v1 = 2.0f * GenerateRandomUniform(prng) - 1.0f;
+    v2 = 2.0f * GenerateRandomUniform(prng) - 1.0f;
+    s = v1 * v1 + v2 * v2;
+  }
+
+  const float s_norm = std::sqrt(1.0f - s);
+  normal[0] = 2.0f * v1 * s_norm;
+  normal[1] = 2.0f * v2 * s_norm;
+  normal[2] = 1.0f - 2.0f * s;
+
+  // Make sure normal is looking away from camera.
+  const float view_ray[3] = {ref_inv_K[0] * col + ref_inv_K[1],
+                             ref_inv_K[2] * row + ref_inv_K[3], 1.0f};
+  if (DotProduct3(normal, view_ray) > 0) {
+    normal[0] = -normal[0];
+    normal[1] = -normal[1];
+    normal[2] = -normal[2];
+  }
+}
+
+inline float PerturbDepth(const float perturbation, const float depth,
+                          std::mt19937* prng) {
+  const float depth_min = (1.0f - perturbation) * depth;
+  const float depth_max = (1.0f + perturbation) * depth;
+  return GenerateRandomDepth(depth_min, depth_max, prng);
+}
+
+void PerturbNormal(const int row, const int col, const float ref_inv_K[4],
+                   const float perturbation, const float normal[3],
+                   std::mt19937* prng, float perturbed_normal[3],
+                   const int num_trials = 0) {
+  // Perturbation rotation angles.
+  const float a1 = (GenerateRandomUniform(prng) - 0.5f) * perturbation;
+  const float a2 = (GenerateRandomUniform(prng) - 0.5f) * perturbation;
+  const float a3 = (GenerateRandomUniform(prng) - 0.5f) * perturbation;
+
+  const float sin_a1 = std::sin(a1);
+  const float sin_a2 = std::sin(a2);
+  const float sin_a3 = std::sin(a3);
+  const float cos_a1 = std::cos(a1);
+  const float cos_a2 = std::cos(a2);
+  const float cos_a3 = std::cos(a3);
+
+  // R = Rx * Ry * Rz
+  float R[9];
+  R[0] = cos_a2 * cos_a3;
+  R[1] = -cos_a2 * sin_a3;
+  R[2] = sin_a2;
+  R[3] = cos_a1 * sin_a3 + cos_a3 * sin_a1 * sin_a2;
+  R[4] = cos_a1 * cos_a3 - sin_a1 * sin_a2 * sin_a3;
+  R[5] = -cos_a2 * sin_a1;
+  R[6] = sin_a1 * sin_a3 - cos_a1 * cos_a3 * sin_a2;
+  R[7] = cos_a3 * sin_a1 + cos_a1 * sin_a2 * sin_a3;
+  R[8] = cos_a1 * cos_a2;
+
+  // Perturb the normal vector.
+  Mat33DotVec3(R, normal, perturbed_normal);
+
+  // Make sure the perturbed normal is still looking in the same direction as
+  // the viewing direction, otherwise try again but with smaller perturbation.
+  const float view_ray[3] = {ref_inv_K[0] * col + ref_inv_K[1],
+                             ref_inv_K[2] * row + ref_inv_K[3], 1.0f};
+  if (DotProduct3(perturbed_normal, view_ray) >= 0.0f) {
+    const int kMaxNumTrials = 3;
+    if (num_trials < kMaxNumTrials) {
+      PerturbNormal(row, col, ref_inv_K, 0.5f * perturbation, normal, prng,
+                    perturbed_normal, num_trials + 1);
+      return;
+    } else {
+      perturbed_normal[0] = normal[0];
+      perturbed_normal[1] = normal[1];
+      perturbed_normal[2] = normal[2];
+      return;
+    }
+  }
+
+  // Make sure normal has unit norm.
+  const float inv_norm =
+      1.0f / std::sqrt(DotProduct3(perturbed_normal, perturbed_normal));
+  perturbed_normal[0] *= inv_norm;
+  perturbed_normal[1] *= inv_norm;
+  perturbed_normal[2] *= inv_norm;
+}
+
+inline void ComputePointAtDepth(const float ref_inv_K[4], const float row,
+                                const float col, const float depth,
+                                float point[3]) {
+  point[0] = depth * (ref_inv_K[0] * col + ref_inv_K[1]);
+  point[1] = depth * (ref_inv_K[2] * row + ref_inv_K[3]);
+  point[2] = depth;
+}
+
+// Transfer depth on plane from viewing ray at row1 to row2. The returned
+// depth is the intersection of the viewing ray through row2 with the plane
+// at row1 defined by the given depth and normal.
+inline float PropagateDepth(const float ref_inv_K[4], const float depth1,
+                            const float normal1[3], const float row1,
+                            const float row2) {
+  // Point along first viewing ray.
+  const float x1 = depth1 * (ref_inv_K[2] * row1 + ref_inv_K[3]);
+  const float y1 = depth1;
+  // Point on plane defined by point along first viewing ray and plane normal1.
+  const float x2 = x1 + normal1[2];
+  const float y2 = y1 - normal1[1];
+
+  // Point on second viewing ray through the origin.
+  const float x4 = ref_inv_K[2] * row2 + ref_inv_K[3];
+
+  // Intersection of the lines ((x1, y1), (x2, y2)) and ((0, 0), (x4, 1)).
+  const float denom = x2 - x1 + x4 * (y1 - y2);
+  constexpr float kEps = 1e-5f;
+  if (std::abs(denom) < kEps) {
+    return depth1;
+  }
+  const float nom = y1 * x2 - x1 * y2;
+  return nom / denom;
+}
+
+// First, compute triangulation angle between reference and source image for 3D
+// point. Second, compute incident angle between viewing direction of source
+// image and normal direction of 3D point. Both angles are cosine distances.
+inline void ComputeViewingAngles(const float* pose, const float point[3],
+                                 const float normal[3],
+                                 float* cos_triangulation_angle,
+                                 float* cos_incident_angle) {
+  // Projection center of source image.
+  const float* C = pose + kPoseCOffset;
+
+  // Ray from point to camera.
+  const float SX[3] = {C[0] - point[0], C[1] - point[1], C[2] - point[2]};
+
+  // Length of ray from reference image to point.
+  const float RX_inv_norm = 1.0f / std::sqrt(DotProduct3(point, point));
+
+  // Length of ray from source image to point.
+  const float SX_inv_norm = 1.0f / std::sqrt(DotProduct3(SX, SX));
+
+  *cos_incident_angle = DotProduct3(SX, normal) * SX_inv_norm;
+  *cos_triangulation_angle = DotProduct3(SX, point) * RX_inv_norm * SX_inv_norm;
+}
+
+void ComposeHomography(const float* pose, const float ref_inv_K[4],
+                       const int row, const int col, const float depth,
+                       const float normal[3], float H[9]) {
+  const float* K = pose + kPoseKOffset;
+  const float* R = pose + kPoseROffset;
+  const float* T = pose + kPoseTOffset;
+
+  // Distance to the plane.
+  const float dist =
+      depth * (normal[0] * (ref_inv_K[0] * col + ref_inv_K[1]) +
+               normal[1] * (ref_inv_K[2] * row + ref_inv_K[3]) + normal[2]);
+  const float inv_dist = 1.0f / dist;
+
+  const float inv_dist_N0 = inv_dist * normal[0];
+  const float inv_dist_N1 = inv_dist * normal[1];
+  const float inv_dist_N2 = inv_dist * normal[2];
+
+  // Homography as H = K * (R - T * n' / d) * Kref^-1.
+  H[0] = ref_inv_K[0] * (K[0] * (R[0] + inv_dist_N0 * T[0]) +
+                         K[1] * (R[6] + inv_dist_N0 * T[2]));
+  H[1] = ref_inv_K[2] * (K[0] * (R[1] + inv_dist_N1 * T[0]) +
+                         K[1] * (R[7] + inv_dist_N1 * T[2]));
+  H[2] = K[0] * (R[2] + inv_dist_N2 * T[0]) +
+         K[1] * (R[8] + inv_dist_N2 * T[2]) +
+         ref_inv_K[1] * (K[0] * (R[0] + inv_dist_N0 * T[0]) +
+                         K[1] * (R[6] + inv_dist_N0 * T[2])) +
+         ref_inv_K[3] * (K[0] * (R[1] + inv_dist_N1 * T[0]) +
+                         K[1] * (R[7] + inv_dist_N1 * T[2]));
+  H[3] = ref_inv_K[0] * (K[2] * (R[3] + inv_dist_N0 * T[1]) +
+                         K[3] * (R[6] + inv_dist_N0 * T[2]));
+  H[4] = ref_inv_K[2] * (K[2] * (R[4] + inv_dist_N1 * T[1]) +
+                         K[3] * (R[7] + inv_dist_N1 * T[2]));
+  H[5] = K[2] * (R[5] + inv_dist_N2 * T[1]) +
+         K[3] * (R[8] + inv_dist_N2 * T[2]) +
+         ref_inv_K[1] * (K[2] * (R[3] + inv_dist_N0 * T[1]) +
+                         K[3] * (R[6] + inv_dist_N0 * T[2])) +
+         ref_inv_K[3] * (K[2] * (R[4] + inv_dist_N1 * T[1]) +
+                         K[3] * (R[7] + inv_dist_N1 * T[2]));
+  H[6] = ref_inv_K[0] * (R[6] + inv_dist_N0 * T[2]);
+  H[7] = ref_inv_K[2] * (R[7] + inv_dist_N1 * T[2]);
+  H[8] = R[8] + ref_inv_K[1] * (R[6] + inv_dist_N0 * T[2]) +
+         ref_inv_K[3] * (R[7] + inv_dist_N1 * T[2]) + inv_dist_N2 * T[2];
+}
+
+// Bilinearly interpolate a padded source image at the given coordinates of the
+// unpadded image. Pixels outside of the image are zero, which is equivalent to
+// the border address mode of the Cuda textures.
+inline float InterpolateBilinear(const Mat<float>& padded_image, const float x,
+                                 const float y) {
+  const int padded_width = static_cast<int>(padded_image.GetWidth());
+  const int padded_height = static_cast<int>(padded_image.GetHeight());
+  // Note that this also rejects NaN coordinates.
+  if (!(x > -1.0f && y > -1.0f && x < padded_width - 2 &&
+        y < padded_height - 2)) {
+    return 0.0f;
+  }
+
+  const float padded_x = x + 1.0f;
+  const float padded_y = y + 1.0f;
+  const int x0 = static_cast<int>(padded_x);
+  const int y0 = static_cast<int>(padded_y);
+  const float dx = padded_x - x0;
+  const float dy = padded_y - y0;
+
+  const float* data = padded_image.GetPtr() + y0 * padded_width + x0;
+  const float top = (1.0f - dx) * data[0] + dx * data[1];
+  const float bottom =
+      (1.0f - dx) * data[padded_width] + dx * data[padded_width + 1];
+  return (1.0f - dy) * top + dy * bottom;
+}
+
+// Bilaterally weighted patch of the reference image around a pixel. The
+// weights only depend on the reference image, so they are computed once per
+// pixel and then shared by all photo-consistency costs for this pixel.
+//
+// The cost is 1 - NCC, so the range is [0, 2], the smaller the value, the
+// better the color consistency.
+class PhotoConsistencyCostComputer {
+ public:
+  PhotoConsistencyCostComputer(const int window_radius, const int window_step,
+                               const float sigma_spatial,
+                               const float sigma_color)
+      : window_radius_(window_radius),
+        window_step_(window_step),
+        window_size_(2 * window_radius / window_step + 1),
+        spatial_normalization_(1.0f / (2.0f * sigma_spatial * sigma_spatial)),
+        color_normalization_(1.0f / (2.0f * sigma_color * sigma_color)),
+        weights_(window_size_ * window_size_),
+        weighted_colors_(window_size_ * window_size_),
+        src_cols_(window_size_),
+        src_rows_(window_size_) {}
+
+  // Maximum photo consistency cost as 1 - min(NCC).
+  const float kMaxCost = 2.0f;
+
+  // Read the patch centered at the given pixel.
+  void Read(const Mat<float>& ref_image, const int row, const int col) {
+    row_ = row;
+    col_ = col;
+
+    const int width = static_cast<int>(ref_image.GetWidth());
+    const int height = static_cast<int>(ref_image.GetHeight());
+    const float* data = ref_image.GetPtr();
+
+    const auto GetColor = [&](const int r, const int c) {
+      if (r < 0 || c < 0 || r >= height || c >= width) {
+        return 0.0f;
+      }
+      return data[r * width + c];
+    };
+
+    const float center_color = GetColor(row, col);
+
+    float weight_sum = 0.0f;
+    color_sum_ = 0.0f;
+    color_squared_sum_ = 0.0f;
+    int idx = 0;
+    for (int window_row = -window_radius_; window_row <= window_radius_;
+         window_row += window_step_) {
+      for (int window_col = -window_radius_; window_col <= window_radius_;
+           window_col += window_step_) {
+        const float color = GetColor(row + window_row, col + window_col);
+        const float spatial_dist_squared =
+            window_row * window_row + window_col * window_col;
+        const float color_dist = center_color - color;
+        const float weight =
+            std::exp(-spatial_dist_squared * spatial_normalization_ -
+                     color_dist * color_dist * color_normalization_);
+        const float weighted_color = weight * color;
+        weights_[idx] = weight;
+        weighted_colors_[idx] = weighted_color;
+        weight_sum += weight;
+        color_sum_ += weighted_color;
+        color_squared_sum_ += weighted_color * color;
+        idx += 1;
+      }
+    }
+
+    const float inv_weight_sum = 1.0f / weight_sum;
+    color_sum_ *= inv_weight_sum;
+    color_squared_sum_ *= inv_weight_sum;
+    for (size_t i = 0; i < weights_.size(); ++i) {
+      weights_[i] *= inv_weight_sum;
+      weighted_colors_[i] *= inv_weight_sum;
+    }
+  }
+
+  // Compute the cost for the patch warped into the source image by the given
+  // homography.
+  float Compute(const Mat<float>& src_image, const float H[9]) {
+    const float step_H0 = window_step_ * H[0];
+    const float step_H3 = window_step_ * H[3];
+    const float step_H6 = window_step_ * H[6];
+    const float col_start = col_ - window_radius_;
+
+    float src_color_sum = 0.0f;
+    float src_color_squared_sum = 0.0f;
+    float src_ref_color_sum = 0.0f;
+
+    const float* weights = weights_.data();
+    const float* weighted_colors = weighted_colors_.data();
+    float* src_cols = src_cols_.data();
+    float* src_rows = src_rows_.data();
+
+    for (int window_row = 0; window_row < window_size_; ++window_row) {
+      const float row = row_ - window_radius_ + window_row * window_step_;
+      const float base_col_src = H[0] * col_start + H[1] * row + H[2];
+      const float base_row_src = H[3] * col_start + H[4] * row + H[5];
+      const float base_z = H[6] * col_start + H[7] * row + H[8];
+
+      // Warp the coordinates of the row separately from the interpolation,
+      // so that the compiler can vectorize this loop.
+      for (int window_col = 0; window_col < window_size_; ++window_col) {
+        const float inv_z = 1.0f / (base_z + window_col * step_H6);
+        src_cols[window_col] = inv_z * (base_col_src + window_col * step_H0);
+        src_rows[window_col] = inv_z * (base_row_src + window_col * step_H3);
+      }
+
+      for (int window_col = 0; window_col < window_size_; ++window_col) {
+        const float src_color = InterpolateBilinear(
+            src_image, src_cols[window_col], src_rows[window_col]);
+        const float weighted_src_color = weights[window_col] * src_color;
+        src_color_sum += weighted_src_color;
+        src_color_squared_sum += weighted_src_color * src_color;
+        src_ref_color_sum += weighted_colors[window_col] * src_color;
+      }
+
+      weights += window_size_;
+      weighted_colors += window_size_;
+    }
+
+    const float ref_color_var = color_squared_sum_ - color_sum_ * color_sum_;
+    const float src_color_var =
+        src_color_squared_sum - src_color_sum * src_color_sum;
+
+    // Based on Jensen's Inequality for convex functions, the variance
+    // should always be larger than 0. Do not make this threshold smaller.
+    constexpr float kMinVar = 1e-5f;
+    if (ref_color_var < kMinVar || src_color_var < kMinVar) {
+      return kMaxCost;
+    } else {
+      const float src_ref_color_covar =
+          src_ref_color_sum - color_sum_ * src_color_sum;
+      const float src_ref_color_var = std::sqrt(ref_color_var * src_color_var);
+      return std::max(
+          0.0f,
+          std::min(kMaxCost, 1.0f - src_ref_color_covar / src_ref_color_var));
+    }
+  }
+
+ private:
+  const int window_radius_;
+  const int window_step_;
+  const int window_size_;
+  const float spatial_normalization_;
+  const float color_normalization_;
+
+  // Center position of patch in reference image.
+  int row_ = -1;
+  int col_ = -1;
+
+  // Normalized bilateral weights and weighted colors of the patch.
+  std::vector<float> weights_;
+  std::vector<float> weighted_colors_;
+
+  // Weighted sum of raw and squared colors of the patch.
+  float color_sum_ = 0.0f;
+  float color_squared_sum_ = 0.0f;
+
+  // Warped coordinates of the current row of the patch.
+  std::vector<float> src_cols_;
+  std::vector<float> src_rows_;
+};
+
+float ComputeGeomConsistencyCost(const float* pose, const DepthMap& depth_map,
+                                 const float ref_K[4],
+                                 const float ref_inv_K[4], const float row,
+                                 const float col, const float depth,
+                                 const float max_cost) {
+  const float* P = pose + kPosePOffset;
+  const float* inv_P = pose + kPoseInvPOffset;
+
+  // Project point in reference image to world.
+  float forward_point[3];
+  ComputePointAtDepth(ref_inv_K, row, col, depth, forward_point);
+
+  // Project world point to source image.
+  const float inv_forward_z =
+      1.0f / (P[8] * forward_point[0] + P[9] * forward_point[1] +
+              P[10] * forward_point[2] + P[11]);
+  float src_col =
+      inv_forward_z * (P[0] * forward_point[0] + P[1] * forward_point[1] +
+                       P[2] * forward_point[2] + P[3]);
+  float src_row =
+      inv_forward_z * (P[4] * forward_point[0] + P[5] * forward_point[1] +
+                       P[6] * forward_point[2] + P[7]);
+
+  // Extract depth in source image using nearest neighbor interpolation.
+  const float nearest_col = std::floor(src_col + 0.5f);
+  const float nearest_row = std::floor(src_row + 0.5f);
+  if (!(nearest_col >= 0.0f && nearest_row >= 0.0f &&
+        nearest_col < depth_map.GetWidth() &&
+        nearest_row < depth_map.GetHeight())) {
+    return max_cost;
+  }
+  const float src_depth =
+      depth_map.GetPtr()[static_cast<size_t>(nearest_row) *
+                             depth_map.GetWidth() +
+                         static_cast<size_t>(nearest_col)];
+
+  // Projection outside of source image.
+  if (src_depth == 0.0f) {
+    return max_cost;
+  }
+
+  // Project point in source image to world.
+  src_col *= src_depth;
+  src_row *= src_depth;
+  const float backward_point_x =
+      inv_P[0] * src_col + inv_P[1] * src_row + inv_P[2] * src_depth + inv_P[3];
+  const float backward_point_y =
+      inv_P[4] * src_col + inv_P[5] * src_row + inv_P[6] * src_depth + inv_P[7];
+  const float backward_point_z = inv_P[8] * src_col + inv_P[9] * src_row +
+                                 inv_P[10] * src_depth + inv_P[11];
+  const float inv_backward_point_z = 1.0f / backward_point_z;
+
+  // Project world point back to reference image.
+  const float backward_col =
+      inv_backward_point_z *
+      (ref_K[0] * backward_point_x + ref_K[1] * backward_point_z);
+  const float backward_row =
+      inv_backward_point_z *
+      (ref_K[2] * backward_point_y + ref_K[3] * backward_point_z);
+
+  // Return truncated reprojection error between original observation and
+  // the forward-backward projected observation.
+  const float diff_col = col - backward_col;
+  const float diff_row = row - backward_row;
+  return std::min(max_cost,
+                  std::sqrt(diff_col * diff_col + diff_row * diff_row));
+}
+
+// Find index of minimum in given values.
+template <int kNumCosts>
+inline int FindMinCost(const float costs[kNumCosts]) {
+  float min_cost = costs[0];
+  int min_cost_idx = 0;
+  for (int idx = 1; idx < kNumCosts; ++idx) {
+    if (costs[idx] <= min_cost) {
+      min_cost = costs[idx];
+      min_cost_idx = idx;
+    }
+  }
+  return min_cost_idx;
+}
+
+inline void TransformPDFToCDF(float* probs, const int num_probs) {
+  float prob_sum = 0.0f;
+  for (int i = 0; i < num_probs; ++i) {
+    prob_sum += probs[i];
+  }
+  const float inv_prob_sum = 1.0f / prob_sum;
+
+  float cum_prob = 0.0f;
+  for (int i = 0; i < num_probs; ++i) {
+    const float prob = probs[i] * inv_prob_sum;
+    cum_prob += prob;
+    probs[i] = cum_prob;
+  }
+}
+
+class LikelihoodComputer {
+ public:
+  LikelihoodComputer(const float ncc_sigma, const float min_triangulation_angle,
+                     const float incident_angle_sigma)
+      : cos_min_triangulation_angle_(std::cos(min_triangulation_angle)),
+        inv_incident_angle_sigma_square_(
+            -0.5f / (incident_angle_sigma * incident_angle_sigma)),
+        inv_ncc_sigma_square_(-0.5f / (ncc_sigma * ncc_sigma)),
+        ncc_norm_factor_(ComputeNCCCostNormFactor(ncc_sigma)) {}
+
+  // Compute forward message from current cost and forward message of
+  // previous / neighboring pixel.
+  float ComputeForwardMessage(const float cost, const float prev) const {
+    return ComputeMessage<true>(cost, prev);
+  }
+
+  // Compute backward message from current cost and backward message of
+  // previous / neighboring pixel.
+  float ComputeBackwardMessage(const float cost, const float prev) const {
+    return ComputeMessage<false>(cost, prev);
+  }
+
+  // Compute the selection probability from the forward and backward message.
+  inline float ComputeSelProb(const float alpha, const float beta,
+                              const float prev, const float prev_weight) const {
+    const float zn0 = (1.0f - alpha) * (1.0f - beta);
+    const float zn1 = alpha * beta;
+    const float curr = zn1 / (zn0 + zn1);
+    return prev_weight * prev + (1.0f - prev_weight) * curr;
+  }
+
+  // Compute NCC probability. Note that cost = 1 - NCC.
+  inline float ComputeNCCProb(const float cost) const {
+    return std::exp(cost * cost * inv_ncc_sigma_square_) * ncc_norm_factor_;
+  }
+
+  // Compute the triangulation angle probability.
+  inline float ComputeTriProb(const float cos_triangulation_angle) const {
+    const float abs_cos_triangulation_angle =
+        std::abs(cos_triangulation_angle);
+    if (abs_cos_triangulation_angle > cos_min_triangulation_angle_) {
+      const float scaled = 1.0f - (1.0f - abs_cos_triangulation_angle) /
+                                      (1.0f - cos_min_triangulation_angle_);
+      const float likelihood = 1.0f - scaled * scaled;
+      return std::min(1.0f, std::max(0.0f, likelihood));
+    } else {
+      return 1.0f;
+    }
+  }
+
+  // Compute the incident angle probability.
+  inline float ComputeIncProb(const float cos_incident_angle) const {
+    const float x = 1.0f - std::max(0.0f, cos_incident_angle);
+    return std::exp(x * x * inv_incident_angle_sigma_square_);
+  }
+
+  // Compute the warping/resolution prior probability.
+  inline float ComputeResolutionProb(const float H[9], const float row,
+                                     const float col,
+                                     const int window_radius) const {
+    const int window_size = 2 * window_radius + 1;
+
+    // Warp corners of patch in reference image to source image.
+    float src1[2];
+    const float ref1[2] = {col - window_radius, row - window_radius};
+    Mat33DotVec3Homogeneous(H, ref1, src1);
+    float src2[2];
+    const float ref2[2] = {col - window_radius, row + window_radius};
+    Mat33DotVec3Homogeneous(H, ref2, src2);
+    float src3[2];
+    const float ref3[2] = {col + window_radius, row + window_radius};
+    Mat33DotVec3Homogeneous(H, ref3, src3);
+    float src4[2];
+    const float ref4[2] = {col + window_radius, row - window_radius};
+    Mat33DotVec3Homogeneous(H, ref4, src4);
+
+    // Compute area of patches in reference and source image.
+    const float ref_area = window_size * window_size;
+    const float src_area = std::abs(
+        0.5f * (src1[0] * src2[1] - src2[0] * src1[1] - src1[0] * src4[1] +
+                src2[0] * src3[1] - src3[0] * src2[1] + src4[0] * src1[1] +
+                src3[0] * src4[1] - src4[0] * src3[1]));
+
+    if (ref_area > src_area) {
+      return src_area / ref_area;
+    } else {
+      return ref_area / src_area;
+    }
+  }
+
+ private:
+  // The normalization for the likelihood function, i.e. the normalization for
+  // the prior on the matching cost.
+  static inline float ComputeNCCCostNormFactor(const float ncc_sigma) {
+    // A = sqrt(2pi)*sigma/2*erf(sqrt(2)/sigma)
+    // erf(x) = 2/sqrt(pi) * integral from 0 to x of exp(-t^2) dt
+    return 2.0f / (std::sqrt(2.0f * static_cast<float>(M_PI)) * ncc_sigma *
+                   std::erf(2.0f / (ncc_sigma * 1.414213562f)));
+  }
+
+  // Compute the forward or backward message.
+  template <bool kForward>
+  inline float ComputeMessage(const float cost, const float prev) const {
+    constexpr float kUniformProb = 0.5f;
+    constexpr float kNoChangeProb = 0.99999f;
+    const float kChangeProb = 1.0f - kNoChangeProb;
+    const float emission = ComputeNCCProb(cost);
+
+    float zn0;  // Message for selection probability = 0.
+    float zn1;  // Message for selection probability = 1.
+    if (kForward) {
+      zn0 = (prev * kChangeProb + (1.0f - prev) * kNoChangeProb) * kUniformProb;
+      zn1 = (prev * kNoChangeProb + (1.0f - prev) * kChangeProb) * emission;
+    } else {
+      zn0 = prev * emission * kChangeProb +
+            (1.0f - prev) * kUniformProb * kNoChangeProb;
+      zn1 = prev * emission * kNoChangeProb +
+            (1.0f - prev) * kUniformProb * kChangeProb;
+    }
+
+    return zn1 / (zn0 + zn1);
+  }
+
+  float cos_min_triangulation_angle_;
+  float inv_incident_angle_sigma_square_;
+  float inv_ncc_sigma_square_;
+  float ncc_norm_factor_;
+};
+
+// Rotate the matrix by 90 degrees in counter-clockwise direction.
+template <typename T>
+Mat<T> RotateMat(const Mat<T>& input) {
+  const size_t width = input.GetWidth();
+  const size_t height = input.GetHeight();
+  Mat<T> output(height, width, input.GetDepth());
+  const T* input_data = input.GetPtr();
+  T* output_data = output.GetPtr();
+  for (size_t slice = 0; slice < input.GetDepth(); ++slice) {
+    for (size_t y = 0; y < height; ++y) {
+      for (size_t x = 0; x < width; ++x) {
+        output_data[(width - 1 - x) * height + y] = input_data[y * width + x];
+      }
+    }
+    input_data += width * height;
+    output_data += width * height;
+  }
+  return output;
+}
+
+void PrintElapsedSeconds(const std::string& message, const Timer& timer) {
+  std::cout << StringPrintf("%s: %.4fs", message.c_str(),
+                            timer.ElapsedSeconds())
+            << std::endl;
+}
+
+}  // namespace
+
+PatchMatchCpu::PatchMatchCpu(const PatchMatchOptions& options,
+                             const PatchMatch::Problem& problem)
+    : options_(options),
+      problem_(problem),
+      ref_width_(0),
+      ref_height_(0),
+      rotation_in_half_pi_(0),
+      num_sweeps_(0) {
+  InitRefImage();
+  InitSourceImages();
+  InitTransforms();
+  InitWorkspaceMemory();
+}
+
+void PatchMatchCpu::Run() {
+  ThreadBudgetLease thread_budget_lease(ThreadPool::kMaxNumThreads);
+  if (thread_budget_lease.NumThreads() > 1) {
+    // The calling thread participates in ParallelFor.
+    thread_pool_.reset(new ThreadPool(thread_budget_lease.NumThreads() - 1));
+  }
+
+  Timer total_timer;
+  total_timer.Start();
+  Timer init_timer;
+  init_timer.Start();
+
+  ParallelForTiles(
+      [this](const size_t tile_idx) { ComputeInitialCost(tile_idx); });
+
+  PrintElapsedSeconds("Initialization", init_timer);
+
+  const float total_num_steps = options_.num_iterations * 4;
+
+  SweepOptions sweep_options;
+  sweep_options.depth_min = options_.depth_min;
+  sweep_options.depth_max = options_.depth_max;
+  sweep_options.sigma_spatial = options_.sigma_spatial;
+  sweep_options.sigma_color = options_.sigma_color;
+  sweep_options.num_samples = options_.num_samples;
+  sweep_options.ncc_sigma = options_.ncc_sigma;
+  sweep_options.min_triangulation_angle =
+      DegToRad(options_.min_triangulation_angle);
+  sweep_options.incident_angle_sigma = options_.incident_angle_sigma;
+  sweep_options.geom_consistency_regularizer =
+      options_.geom_consistency_regularizer;
+  sweep_options.geom_consistency_max_cost = options_.geom_consistency_max_cost;
+  sweep_options.filter_min_ncc = options_.filter_min_ncc;
+  sweep_options.filter_min_triangulation_angle =
+      DegToRad(options_.filter_min_triangulation_angle);
+  sweep_options.filter_min_num_consistent = options_.filter_min_num_consistent;
+  sweep_options.filter_geom_consistency_max_cost =
+      options_.filter_geom_consistency_max_cost;
+  sweep_options.geom_consistency_term = options_.geom_consistency;
+
+  for (int iter = 0; iter < options_.num_iterations; ++iter) {
+    Timer iter_timer;
+    iter_timer.Start();
+
+    for (int sweep = 0; sweep < 4; ++sweep) {
+      Timer sweep_timer;
+      sweep_timer.Start();
+
+      // Expenentially reduce amount of perturbation during the optimization.
+      sweep_options.perturbation = 1.0f / std::pow(2.0f, iter + sweep / 4.0f);
+
+      // Linearly increase the influence of previous selection probabilities.
+      sweep_options.prev_sel_prob_weight =
+          static_cast<float>(iter * 4 + sweep) / total_num_steps;
+
+      const bool last_sweep = iter == options_.num_iterations - 1 && sweep == 3;
+
+      if (last_sweep && options_.filter) {
+        consistency_mask_ = Mat<uint8_t>(cost_map_.GetWidth(),
+                                         cost_map_.GetHeight(),
+                                         cost_map_.GetDepth());
+        sweep_options.filter_photo_consistency = true;
+        sweep_options.filter_geom_consistency = options_.geom_consistency;
+      }
+
+      ParallelForTiles([this, &sweep_options](const size_t tile_idx) {
+        Sweep(tile_idx, sweep_options);
+      });
+
+      num_sweeps_ += 1;
+
+      Rotate();
+
+      // Rotate selected image map.
+      if (last_sweep && options_.filter) {
+        consistency_mask_ = RotateMat(consistency_mask_);
+      }
+
+      PrintElapsedSeconds(" Sweep " + std::to_string(sweep + 1), sweep_timer);
+    }
+
+    PrintElapsedSeconds("Iteration " + std::to_string(iter + 1), iter_timer);
+  }
+
+  PrintElapsedSeconds("Total", total_timer);
+
+  thread_pool_.reset();
+}
+
+DepthMap PatchMatchCpu::GetDepthMap() const {
+  return DepthMap(depth_map_, options_.depth_min, options_.depth_max);
+}
+
+NormalMap PatchMatchCpu::GetNormalMap() const { return NormalMap(normal_map_); }
+
+Mat<float> PatchMatchCpu::GetSelProbMap() const { return prev_sel_prob_map_; }
+
+std::vector<int> PatchMatchCpu::GetConsistentImageIdxs() const {
+  const size_t width = consistency_mask_.GetWidth();
+  const size_t height = consistency_mask_.GetHeight();
+  const size_t num_images = consistency_mask_.GetDepth();
+  const uint8_t* mask = consistency_mask_.GetPtr();
+  std::vector<int> consistent_image_idxs;
+  std::vector<int> pixel_consistent_image_idxs;
+  pixel_consistent_image_idxs.reserve(num_images);
+  for (size_t r = 0; r < height; ++r) {
+    for (size_t c = 0; c < width; ++c) {
+      pixel_consistent_image_idxs.clear();
+      for (size_t d = 0; d < num_images; ++d) {
+        if (mask[d * width * height + r * width + c]) {
+          pixel_consistent_image_idxs.push_back(problem_.src_image_idxs[d]);
+        }
+      }
+      if (pixel_consistent_image_idxs.size() > 0) {
+        consistent_image_idxs.push_back(c);
+        consistent_image_idxs.push_back(r);
+        consistent_image_idxs.push_back(pixel_consistent_image_idxs.size());
+        consistent_image_idxs.insert(consistent_image_idxs.end(),
+                                     pixel_consistent_image_idxs.begin(),
+                                     pixel_consistent_image_idxs.end());
+      }
+    }
+  }
+  return consistent_image_idxs;
+}
+
+void PatchMatchCpu::InitRefImage() {
+  const Image& ref_image = problem_.images->at(problem_.ref_image_idx);
+
+  ref_width_ = ref_image.GetWidth();
+  ref_height_ = ref_image.GetHeight();
+
+  const std::vector<uint8_t> ref_image_array =
+      ref_image.GetBitmap().ConvertToRowMajorArray();
+  ref_image_ = Mat<float>(ref_width_, ref_height_, 1);
+  float* ref_image_data = ref_image_.GetPtr();
+  for (size_t i = 0; i < ref_image_array.size(); ++i) {
+    ref_image_data[i] = ref_image_array[i] / 255.0f;
+  }
+}
+
+void PatchMatchCpu::InitSourceImages() {
+  src_images_.reserve(problem_.src_image_idxs.size());
+  for (const auto image_idx : problem_.src_image_idxs) {
+    const Image& image = problem_.images->at(image_idx);
+    const std::vector<uint8_t> image_array =
+        image.GetBitmap().ConvertToRowMajorArray();
+    const size_t width = image.GetWidth();
+    const size_t height = image.GetHeight();
+    src_images_.emplace_back(width + 2, height + 2, 1);
+    float* padded_image_data = src_images_.back().GetPtr();
+    for (size_t r = 0; r < height; ++r) {
+      for (size_t c = 0; c < width; ++c) {
+        padded_image_data[(r + 1) * (width + 2) + c + 1] =
+            image_array[r * width + c] / 255.0f;
+      }
+    }
+  }
+}
+
+void PatchMatchCpu::InitTransforms() {
+  const Image& ref_image = problem_.images->at(problem_.ref_image_idx);
+
+  //////////////////////////////////////////////////////////////////////////////
+  // Generate rotated versions (counter-clockwise) of calibration matrix.
+  //////////////////////////////////////////////////////////////////////////////
+
+  for (size_t i = 0; i < 4; ++i) {
+    ref_K_[i][0] = ref_image.GetK()[0];
+    ref_K_[i][1] = ref_image.GetK()[2];
+    ref_K_[i][2] = ref_image.GetK()[4];
+    ref_K_[i][3] = ref_image.GetK()[5];
+  }
+
+  // Rotated by 90 degrees.
+  std::swap(ref_K_[1][0], ref_K_[1][2]);
+  std::swap(ref_K_[1][1], ref_K_[1][3]);
+  ref_K_[1][3] = ref_width_ - 1 - ref_K_[1][3];
+
+  // Rotated by 180 degrees.
+  ref_K_[2][1] = ref_width_ - 1 - ref_K_[2][1];
+  ref_K_[2][3] = ref_height_ - 1 - ref_K_[2][3];
+
+  // Rotated by 270 degrees.
+  std::swap(ref_K_[3][0], ref_K_[3][2]);
+  std::swap(ref_K_[3][1], ref_K_[3][3]);
+  ref_K_[3][1] = ref_height_ - 1 - ref_K_[3][1];
+
+  // Extract 1/fx, -cx/fx, fy, -cy/fy.
+  for (size_t i = 0; i < 4; ++i) {
+    ref_inv_K_[i][0] = 1.0f / ref_K_[i][0];
+    ref_inv_K_[i][1] = -ref_K_[i][1] / ref_K_[i][0];
+    ref_inv_K_[i][2] = 1.0f / ref_K_[i][2];
+    ref_inv_K_[i][3] = -ref_K_[i][3] / ref_K_[i][2];
+  }
+
+  //////////////////////////////////////////////////////////////////////////////
+  // Generate rotated versions of camera poses.
+  //////////////////////////////////////////////////////////////////////////////
+
+  float rotated_R[9];
+  std::copy(ref_image.GetR(), ref_image.GetR() + 9, rotated_R);
+
+  float rotated_T[3];
+  std::copy(ref_image.GetT(), ref_image.GetT() + 3, rotated_T);
+
+  // Matrix for 90deg rotation around Z-axis in counter-clockwise direction.
+  const float R_z90[9] = {0, 1, 0, -1, 0, 0, 0, 0, 1};
+
+  for (size_t i = 0; i < 4; ++i) {
+    poses_[i].resize(kNumTformParams * problem_.src_image_idxs.size());
+    float* pose = poses_[i].data();
+    for (const auto image_idx : problem_.src_image_idxs) {
+      const Image& image = problem_.images->at(image_idx);
+
+      float* K = pose + kPoseKOffset;
+      K[0] = image.GetK()[0];
+      K[1] = image.GetK()[2];
+      K[2] = image.GetK()[4];
+      K[3] = image.GetK()[5];
+
+      float* rel_R = pose + kPoseROffset;
+      float* rel_T = pose + kPoseTOffset;
+      ComputeRelativePose(rotated_R, rotated_T, image.GetR(), image.GetT(),
+                          rel_R, rel_T);
+      ComputeProjectionCenter(rel_R, rel_T, pose + kPoseCOffset);
+      ComposeProjectionMatrix(image.GetK(), rel_R, rel_T, pose + kPosePOffset);
+      ComposeInverseProjectionMatrix(image.GetK(), rel_R, rel_T,
+                                     pose + kPoseInvPOffset);
+
+      pose += kNumTformParams;
+    }
+
+    RotatePose(R_z90, rotated_R, rotated_T);
+  }
+}
+
+void PatchMatchCpu::InitWorkspaceMemory() {
+  const size_t num_src_images = problem_.src_image_idxs.size();
+
+  std::mt19937 prng(kDefaultPRNGSeed);
+
+  if (options_.geom_consistency) {
+    depth_map_ = problem_.depth_maps->at(problem_.ref_image_idx);
+    normal_map_ = problem_.normal_maps->at(problem_.ref_image_idx);
+  } else {
+    depth_map_ = Mat<float>(ref_width_, ref_height_, 1);
+    normal_map_ = Mat<float>(ref_width_, ref_height_, 3);
+    float* depth_map_data = depth_map_.GetPtr();
+    float* normal_map_data = normal_map_.GetPtr();
+    const size_t num_pixels = ref_width_ * ref_height_;
+    for (size_t row = 0; row < ref_height_; ++row) {
+      for (size_t col = 0; col < ref_width_; ++col) {
+        const size_t pixel_idx = row * ref_width_ + col;
+        depth_map_data[pixel_idx] =
+            GenerateRandomDepth(options_.depth_min, options_.depth_max, &prng);
+        float normal[3];
+        GenerateRandomNormal(row, col, ref_inv_K_[0], &prng, normal);
+        for (int i = 0; i < 3; ++i) {
+          normal_map_data[i * num_pixels + pixel_idx] = normal[i];
+        }
+      }
+    }
+  }
+
+  // Note that it is not necessary to keep the selection probability map in
+  // memory for all pixels. However, it is useful to keep the probabilities
+  // for the entire image in memory, so that it can be exported.
+  sel_prob_map_ = Mat<float>(ref_width_, ref_height_, num_src_images);
+  prev_sel_prob_map_ = Mat<float>(ref_width_, ref_height_, num_src_images);
+  prev_sel_prob_map_.Fill(0.5f);
+
+  cost_map_ = Mat<float>(ref_width_, ref_height_, num_src_images);
+
+  consistency_mask_ = Mat<uint8_t>(0, 0, 0);
+}
+
+template <typename func_t>
+void PatchMatchCpu::ParallelForTiles(func_t&& func) {
+  const size_t num_tiles = (depth_map_.GetWidth() - 1) / kTileWidth + 1;
+  if (thread_pool_) {
+    thread_pool_->ParallelFor(0, num_tiles, 1, func);
+  } else {
+    for (size_t tile_idx = 0; tile_idx < num_tiles; ++tile_idx) {
+      func(tile_idx);
+    }
+  }
+}
+
+void PatchMatchCpu::ComputeInitialCost(const size_t tile_idx) {
+  const int width = static_cast<int>(depth_map_.GetWidth());
+  const int height = static_cast<int>(depth_map_.GetHeight());
+  const size_t num_pixels = static_cast<size_t>(width) * height;
+  const int col_begin = static_cast<int>(tile_idx) * kTileWidth;
+  const int col_end = std::min(width, col_begin + kTileWidth);
+  const float* ref_inv_K = ref_inv_K_[rotation_in_half_pi_];
+  const float* poses = poses_[rotation_in_half_pi_].data();
+
+  const float* depth_map = depth_map_.GetPtr();
+  const float* normal_map = normal_map_.GetPtr();
+  float* cost_map = cost_map_.GetPtr();
+
+  PhotoConsistencyCostComputer pcc_computer(
+      options_.window_radius, options_.window_step, options_.sigma_spatial,
+      options_.sigma_color);
+
+  for (int row = 0; row < height; ++row) {
+    for (int col = col_begin; col < col_end; ++col) {
+      const size_t pixel_idx = static_cast<size_t>(row) * width + col;
+      const float depth = depth_map[pixel_idx];
+      const float normal[3] = {normal_map[pixel_idx],
+                               normal_map[num_pixels + pixel_idx],
+                               normal_map[2 * num_pixels + pixel_idx]};
+
+      pcc_computer.Read(ref_image_, row, col);
+
+      for (size_t image_idx = 0; image_idx < src_images_.size(); ++image_idx) {
+        float H[9];
+        ComposeHomography(poses + image_idx * kNumTformParams, ref_inv_K, row,
+                          col, depth, normal, H);
+        cost_map[image_idx * num_pixels + pixel_idx] =
+            pcc_computer.Compute(src_images_[image_idx], H);
+      }
+    }
+  }
+}
+
+void PatchMatchCpu::Sweep(const size_t tile_idx, const SweepOptions& options) {
+  const int width = static_cast<int>(depth_map_.GetWidth());
+  const int height = static_cast<int>(depth_map_.GetHeight());
+  const int num_images = static_cast<int>(src_images_.size());
+  const size_t num_pixels = static_cast<size_t>(width) * height;
+  const int col_begin = static_cast<int>(tile_idx) * kTileWidth;
+  const int col_end = std::min(width, col_begin + kTileWidth);
+  const int num_cols = col_end - col_begin;
+  const float* ref_K = ref_K_[rotation_in_half_pi_];
+  const float* ref_inv_K = ref_inv_K_[rotation_in_half_pi_];
+  const float* poses = poses_[rotation_in_half_pi_].data();
+
+  float* depth_map = depth_map_.GetPtr();
+  float* normal_map = normal_map_.GetPtr();
+  float* cost_map = cost_map_.GetPtr();
+  float* sel_prob_map = sel_prob_map_.GetPtr();
+  const float* prev_sel_prob_map = prev_sel_prob_map_.GetPtr();
+  uint8_t* consistency_mask = consistency_mask_.GetPtr();
+
+  // Probability for boundary pixels.
+  constexpr float kUniformProb = 0.5f;
+
+  LikelihoodComputer likelihood_computer(options.ncc_sigma,
+                                         options.min_triangulation_angle,
+                                         options.incident_angle_sigma);
+
+  //////////////////////////////////////////////////////////////////////////////
+  // Compute backward message for all rows. Note that the backward messages are
+  // temporarily stored in the sel_prob_map and replaced row by row as the
+  // updated forward messages are computed further below.
+  //////////////////////////////////////////////////////////////////////////////
+
+  // Forward messages of the columns in the tile, stored per column.
+  std::vector<float> forward_messages(num_cols * num_images, kUniformProb);
+
+  {
+    std::vector<float> backward_messages(num_cols);
+    for (int image_idx = 0; image_idx < num_images; ++image_idx) {
+      std::fill(backward_messages.begin(), backward_messages.end(),
+                kUniformProb);
+      for (int row = height - 1; row >= 0; --row) {
+        const size_t offset =
+            image_idx * num_pixels + static_cast<size_t>(row) * width;
+        for (int col = col_begin; col < col_end; ++col) {
+          float& beta = backward_messages[col - col_begin];
+          beta = likelihood_computer.ComputeBackwardMessage(
+              cost_map[offset + col], beta);
+          sel_prob_map[offset + col] = beta;
+        }
+      }
+    }
+  }
+
+  //////////////////////////////////////////////////////////////////////////////
+  // Estimate parameters for remaining rows and compute selection probabilities.
+  //////////////////////////////////////////////////////////////////////////////
+
+  PhotoConsistencyCostComputer pcc_computer(
+      options_.window_radius, options_.window_step, options.sigma_spatial,
+      options.sigma_color);
+
+  // Random numbers are drawn per tile in a fixed order, so that the result is
+  // independent of the assignment of tiles to threads.
+  std::seed_seq seed_seq{kDefaultPRNGSeed, num_sweeps_,
+                         static_cast<int>(tile_idx)};
+  std::mt19937 prng(seed_seq);
+
+  // Parameters of previous pixel in each column.
+  std::vector<ParamState> prev_param_states(num_cols);
+  for (int col = col_begin; col < col_end; ++col) {
+    ParamState& prev_param_state = prev_param_states[col - col_begin];
+    prev_param_state.depth = depth_map[col];
+    for (int i = 0; i < 3; ++i) {
+      prev_param_state.normal[i] = normal_map[i * num_pixels + col];
+    }
+  }
+
+  // Parameters of current pixel in column.
+  ParamState curr_param_state;
+  // Randomly sampled parameters.
+  ParamState rand_param_state;
+
+  constexpr int kNumCosts = 5;
+
+  // Photometric and geometric costs of all hypotheses w.r.t. all source
+  // images. The same source image is usually sampled many times, so that
+  // the costs are only computed on first use.
+  std::vector<float> photo_costs(kNumCosts * num_images);
+  std::vector<float> geom_costs(kNumCosts * num_images);
+
+  std::vector<float> sampling_probs(num_images);
+
+  for (int row = 0; row < height; ++row) {
+    for (int col = col_begin; col < col_end; ++col) {
+      const size_t pixel_idx = static_cast<size_t>(row) * width + col;
+      float* forward_message =
+          &forward_messages[(col - col_begin) * num_images];
+      ParamState& prev_param_state = prev_param_states[col - col_begin];
+
+      pcc_computer.Read(ref_image_, row, col);
+
+      // Propagate the depth at which the current ray intersects with the plane
+      // of the normal of the previous ray. This helps to better estimate
+      // the depth of very oblique structures, i.e. pixels whose normal
+      // direction is significantly different from their viewing direction.
+      prev_param_state.depth =
+          PropagateDepth(ref_inv_K, prev_param_state.depth,
+                         prev_param_state.normal, row - 1, row);
+
+      // Read parameters for current pixel from previous sweep.
+      curr_param_state.depth = depth_map[pixel_idx];
+      for (int i = 0; i < 3; ++i) {
+        curr_param_state.normal[i] = normal_map[i * num_pixels + pixel_idx];
+      }
+
+      // Generate random parameters.
+      rand_param_state.depth =
+          PerturbDepth(options.perturbation, curr_param_state.depth, &prng);
+      PerturbNormal(row, col, ref_inv_K, options.perturbation * M_PI,
+                    curr_param_state.normal, &prng, rand_param_state.normal);
+
+      // Read in the backward message, compute selection probabilities and
+      // modulate selection probabilities with priors.
+
+      float point[3];
+      ComputePointAtDepth(ref_inv_K, row, col, curr_param_state.depth, point);
+
+      for (int image_idx = 0; image_idx < num_images; ++image_idx) {
+        const float* pose = poses + image_idx * kNumTformParams;
+        const size_t cost_idx = image_idx * num_pixels + pixel_idx;
+        const float cost = cost_map[cost_idx];
+        const float alpha = likelihood_computer.ComputeForwardMessage(
+            cost, forward_message[image_idx]);
+        const float beta = sel_prob_map[cost_idx];
+        const float prev_prob = prev_sel_prob_map[cost_idx];
+        const float sel_prob = likelihood_computer.ComputeSelProb(
+            alpha, beta, prev_prob, options.prev_sel_prob_weight);
+
+        float cos_triangulation_angle;
+        float cos_incident_angle;
+        ComputeViewingAngles(pose, point, curr_param_state.normal,
+                             &cos_triangulation_angle, &cos_incident_angle);
+        const float tri_prob =
+            likelihood_computer.ComputeTriProb(cos_triangulation_angle);
+        const float inc_prob =
+            likelihood_computer.ComputeIncProb(cos_incident_angle);
+
+        float H[9];
+        ComposeHomography(pose, ref_inv_K, row, col, curr_param_state.depth,
+                          curr_param_state.normal, H);
+        const float res_prob = likelihood_computer.ComputeResolutionProb(
+            H, row, col, options_.window_radius);
+
+        sampling_probs[image_idx] = sel_prob * tri_prob * inc_prob * res_prob;
+      }
+
+      TransformPDFToCDF(sampling_probs.data(), num_images);
+
+      // Compute matching cost using Monte Carlo sampling of source images.
+      // Images with higher selection probability are more likely to be
+      // sampled. Hence, if only very few source images see the reference image
+      // pixel, the same source image is likely to be sampled many times.
+      // Instead of taking the best K probabilities, this sampling scheme has
+      // the advantage of being adaptive to any distribution of selection
+      // probabilities.
+
+      float costs[kNumCosts] = {0};
+      const float depths[kNumCosts] = {
+          curr_param_state.depth, prev_param_state.depth,
+          rand_param_state.depth, curr_param_state.depth,
+          rand_param_state.depth};
+      const float* normals[kNumCosts] = {
+          curr_param_state.normal, prev_param_state.normal,
+          rand_param_state.normal, rand_param_state.normal,
+          curr_param_state.normal};
+
+      std::fill(photo_costs.begin(), photo_costs.end(), -1.0f);
+      std::fill(geom_costs.begin(), geom_costs.end(), -1.0f);
+
+      const auto ComputePhotoCost = [&](const int i, const int image_idx) {
+        float& photo_cost = photo_costs[i * num_images + image_idx];
+        if (photo_cost < 0.0f) {
+          if (i == 0) {
+            photo_cost = cost_map[image_idx * num_pixels + pixel_idx];
+          } else {
+            float H[9];
+            ComposeHomography(poses + image_idx * kNumTformParams, ref_inv_K,
+                              row, col, depths[i], normals[i], H);
+            photo_cost = pcc_computer.Compute(src_images_[image_idx], H);
+          }
+        }
+        return photo_cost;
+      };
+
+      const auto ComputeGeomCost = [&](const int i, const int image_idx) {
+        float& geom_cost = geom_costs[i * num_images + image_idx];
+        if (geom_cost < 0.0f) {
+          geom_cost = ComputeGeomConsistencyCost(
+              poses + image_idx * kNumTformParams,
+              problem_.depth_maps->at(problem_.src_image_idxs[image_idx]),
+              ref_K, ref_inv_K, row, col, depths[i],
+              options.geom_consistency_max_cost);
+        }
+        return geom_cost;
+      };
+
+      for (int sample = 0; sample < options.num_samples; ++sample) {
+        const float rand_prob = GenerateRandomUniform(&prng) - FLT_EPSILON;
+
+        int src_image_idx = -1;
+        for (int image_idx = 0; image_idx < num_images; ++image_idx) {
+          const float prob = sampling_probs[image_idx];
+          if (prob > rand_prob) {
+            src_image_idx = image_idx;
+            break;
+          }
+        }
+
+        if (src_image_idx == -1) {
+          continue;
+        }
+
+        for (int i = 0; i < kNumCosts; ++i) {
+          costs[i] += ComputePhotoCost(i, src_image_idx);
+          if (options.geom_consistency_term) {
+            costs[i] += options.geom_consistency_regularizer *
+                        ComputeGeomCost(i, src_image_idx);
+          }
+        }
+      }
+
+      // Find the parameters of the minimum cost.
+      const int min_cost_idx = FindMinCost<kNumCosts>(costs);
+      const float best_depth = depths[min_cost_idx];
+      const float* best_normal = normals[min_cost_idx];
+
+      // Save best new parameters.
+      depth_map[pixel_idx] = best_depth;
+      for (int i = 0; i < 3; ++i) {
+        normal_map[i * num_pixels + pixel_idx] = best_normal[i];
+      }
+
+      // Use the new cost to recompute the updated forward message and
+      // the selection probability.
+      for (int image_idx = 0; image_idx < num_images; ++image_idx) {
+        const size_t cost_idx = image_idx * num_pixels + pixel_idx;
+        // Determine the cost for best depth.
+        const float cost = ComputePhotoCost(min_cost_idx, image_idx);
+        cost_map[cost_idx] = cost;
+
+        const float alpha = likelihood_computer.ComputeForwardMessage(
+            cost, forward_message[image_idx]);
+        const float beta = sel_prob_map[cost_idx];
+        const float prev_prob = prev_sel_prob_map[cost_idx];
+        const float prob = likelihood_computer.ComputeSelProb(
+            alpha, beta, prev_prob, options.prev_sel_prob_weight);
+        forward_message[image_idx] = alpha;
+        sel_prob_map[cost_idx] = prob;
+      }
+
+      if (options.filter_photo_consistency || options.filter_geom_consistency) {
+        int num_consistent = 0;
+
+        float best_point[3];
+        ComputePointAtDepth(ref_inv_K, row, col, best_depth, best_point);
+
+        const float min_ncc_prob =
+            likelihood_computer.ComputeNCCProb(1.0f - options.filter_min_ncc);
+        const float cos_min_triangulation_angle =
+            std::cos(options.filter_min_triangulation_angle);
+
+        for (int image_idx = 0; image_idx < num_images; ++image_idx) {
+          const size_t cost_idx = image_idx * num_pixels + pixel_idx;
+
+          float cos_triangulation_angle;
+          float cos_incident_angle;
+          ComputeViewingAngles(poses + image_idx * kNumTformParams, best_point,
+                               best_normal, &cos_triangulation_angle,
+                               &cos_incident_angle);
+          if (cos_triangulation_angle > cos_min_triangulation_angle ||
+              cos_incident_angle <= 0.0f) {
+            continue;
+          }
+
+          if (options.filter_photo_consistency &&
+              sel_prob_map[cost_idx] < min_ncc_prob) {
+            continue;
+          }
+
+          if (options.filter_geom_consistency &&
+              ComputeGeomCost(min_cost_idx, image_idx) >
+                  options.filter_geom_consistency_max_cost) {
+            continue;
+          }
+
+          consistency_mask[cost_idx] = 1;
+          num_consistent += 1;
+        }
+
+        if (num_consistent < options.filter_min_num_consistent) {
+          depth_map[pixel_idx] = 0.0f;
+          for (int i = 0; i < 3; ++i) {
+            normal_map[i * num_pixels + pixel_idx] = 0.0f;
+          }
+          for (int image_idx = 0; image_idx < num_images; ++image_idx) {
+            consistency_mask[image_idx * num_pixels + pixel_idx] = 0;
+          }
+        }
+      }
+
+      // Update previous depth for next row.
+      prev_param_state.depth = best_depth;
+      for (int i = 0; i < 3; ++i) {
+        prev_param_state.normal[i] = best_normal[i];
+      }
+    }
+  }
+}
+
+void PatchMatchCpu::Rotate() {
+  rotation_in_half_pi_ = (rotation_in_half_pi_ + 1) % 4;
+
+  depth_map_ = RotateMat(depth_map_);
+
+  // Rotate normals by 90deg around z-axis in counter-clockwise direction.
+  {
+    const size_t num_pixels = normal_map_.GetWidth() * normal_map_.GetHeight();
+    float* normal_map_data = normal_map_.GetPtr();
+    for (size_t i = 0; i < num_pixels; ++i) {
+      const float normal0 = normal_map_data[i];
+      normal_map_data[i] = normal_map_data[num_pixels + i];
+      normal_map_data[num_pixels + i] = -normal0;
+    }
+    normal_map_ = RotateMat(normal_map_);
+  }
+
+  ref_image_ = RotateMat(ref_image_);
+
+  // Rotate selection probability map.
+  prev_sel_prob_map_ = RotateMat(sel_prob_map_);
+  sel_prob_map_ = Mat<float>(prev_sel_prob_map_.GetWidth(),
+                             prev_sel_prob_map_.GetHeight(),
+                             prev_sel_prob_map_.GetDepth());
+
+  cost_map_ = RotateMat(cost_map_);
+}
+
+}  // namespace mvs
+}  // namespace colmap
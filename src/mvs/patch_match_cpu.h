@@ -0,0 +1,136 @@
+// Copyright (c) 2022, ETH Zurich and UNC Chapel Hill.
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//
+//     * Neither the name of ETH Zurich and UNC Chapel Hill nor the names of
+//       its contributors may be used to endorse or promote products derived
+//       from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDERS OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//
+// Author: Johannes L. Schoenberger (jsch-at-demuc-dot-de)
+
+#ifndef COLMAP_SRC_MVS_PATCH_MATCH_CPU_H_
+#define COLMAP_SRC_MVS_PATCH_MATCH_CPU_H_
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "mvs/depth_map.h"
+#include "mvs/image.h"
+#include "mvs/mat.h"
+#include "mvs/normal_map.h"
+#include "mvs/patch_match.h"
+#include "util/threading.h"
+
+namespace colmap {
+namespace mvs {
+
+// Multi-threaded CPU implementation of the patch match stereo algorithm in
+// PatchMatchCuda. It uses the same propagation scheme, in which every sweep
+// processes all columns of the reference image from top to bottom and the
+// image is rotated by 90 degrees between consecutive sweeps. Columns are
+// independent within a sweep, so that tiles of adjacent columns are processed
+// in parallel. Random numbers are drawn per tile, which makes the results
+// independent of the number of threads.
+class PatchMatchCpu {
+ public:
+  PatchMatchCpu(const PatchMatchOptions& options,
+                const PatchMatch::Problem& problem);
+
+  void Run();
+
+  DepthMap GetDepthMap() const;
+  NormalMap GetNormalMap() const;
+  Mat<float> GetSelProbMap() const;
+  std::vector<int> GetConsistentImageIdxs() const;
+
+ private:
+  struct SweepOptions;
+
+  void InitRefImage();
+  void InitSourceImages();
+  void InitTransforms();
+  void InitWorkspaceMemory();
+
+  // Call func(tile_idx) for all tiles of columns of the rotated reference
+  // image in parallel.
+  template <typename func_t>
+  void ParallelForTiles(func_t&& func);
+
+  void ComputeInitialCost(const size_t tile_idx);
+  void Sweep(const size_t tile_idx, const SweepOptions& options);
+
+  // Rotate reference image by 90 degrees in counter-clockwise direction.
+  void Rotate();
+
+  const PatchMatchOptions options_;
+  const PatchMatch::Problem problem_;
+
+  // Threads used for the parallel processing of tiles.
+  std::unique_ptr<ThreadPool> thread_pool_;
+
+  // Original (not rotated) dimension of reference image.
+  size_t ref_width_;
+  size_t ref_height_;
+
+  // Rotation of reference image in pi/2. This is equivalent to the number of
+  // calls to `rotate` mod 4.
+  int rotation_in_half_pi_;
+
+  // Number of sweeps performed so far, which seeds the random numbers.
+  int num_sweeps_;
+
+  // Calibration for rotated versions of reference image as
+  // {K[0, 0], K[0, 2], K[1, 1], K[1, 2]} and {1/fx, -cx/fx, 1/fy, -cy/fy}.
+  float ref_K_[4][4];
+  float ref_inv_K_[4][4];
+
+  // Relative poses from rotated versions of reference image to source images
+  // corresponding to rotation_in_half_pi_, stored in the same layout as in
+  // PatchMatchCuda:
+  //
+  //    S(i) = [K_i(0, 0), K_i(0, 2), K_i(1, 1), K_i(1, 2), R_i(:), T_i(:)
+  //            C_i(:), P(:), P^-1(:)]
+  //
+  std::vector<float> poses_[4];
+
+  // Source images with intensities normalized to [0, 1] and a border of one
+  // zero-valued pixel, such that bilinear interpolation does not need to check
+  // the image bounds of the interpolated pixels.
+  std::vector<Mat<float>> src_images_;
+
+  // Data for reference image with intensities normalized to [0, 1].
+  Mat<float> ref_image_;
+  Mat<float> depth_map_;
+  Mat<float> normal_map_;
+  Mat<float> sel_prob_map_;
+  Mat<float> prev_sel_prob_map_;
+  Mat<float> cost_map_;
+  Mat<uint8_t> consistency_mask_;
+};
+
+}  // namespace mvs
+}  // namespace colmap
+
+#endif  // COLMAP_SRC_MVS_PATCH_MATCH_CPU_H_
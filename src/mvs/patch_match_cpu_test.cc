@@ -0,0 +1,280 @@
+// Copyright (c) 2022, ETH Zurich and UNC Chapel Hill.
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//
+//     * Neither the name of ETH Zurich and UNC Chapel Hill nor the names of
+//       its contributors may be used to endorse or promote products derived
+//       from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDERS OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//
+// Author: Johannes L. Schoenberger (jsch-at-demuc-dot-de)
+
+#define TEST_NAME "mvs/patch_match_cpu_test"
+#include "util/testing.h"
+
+#include <cmath>
+#include <random>
+
+#include "mvs/consistency_graph.h"
+#include "mvs/patch_match_cpu.h"
+#include "util/threading.h"
+
+using namespace colmap;
+using namespace colmap::mvs;
+
+namespace {
+
+const int kImageWidth = 80;
+const int kImageHeight = 48;
+const float kFocalLength = 50.0f;
+const float kPlaneDepth = 4.0f;
+const float kBaseline = 0.4f;
+const int kNumSrcImages = 3;
+
+// Texture of the plane as smoothly interpolated random values, such that
+// the patches in the images are distinctive.
+float PlaneTexture(const float x, const float y) {
+  const int kGridSize = 64;
+  const float kGridSpacing = 0.12f;
+  static const std::vector<float> grid = []() {
+    std::mt19937 prng(0);
+    std::uniform_real_distribution<float> distribution(0.1f, 0.9f);
+    std::vector<float> values(kGridSize * kGridSize);
+    for (auto& value : values) {
+      value = distribution(prng);
+    }
+    return values;
+  }();
+
+  const float grid_x = x / kGridSpacing + kGridSize / 2;
+  const float grid_y = y / kGridSpacing + kGridSize / 2;
+  const int x0 = std::max(0, std::min(kGridSize - 2, static_cast<int>(grid_x)));
+  const int y0 = std::max(0, std::min(kGridSize - 2, static_cast<int>(grid_y)));
+  const float dx = std::max(0.0f, std::min(1.0f, grid_x - x0));
+  const float dy = std::max(0.0f, std::min(1.0f, grid_y - y0));
+  const float* row0 = &grid[y0 * kGridSize + x0];
+  const float* row1 = row0 + kGridSize;
+  return (1 - dy) * ((1 - dx) * row0[0] + dx * row0[1]) +
+         dy * ((1 - dx) * row1[0] + dx * row1[1]);
+}
+
+// Render the plane at z = kPlaneDepth in world coordinates into an image with
+// identity rotation and the given projection center.
+Image RenderPlaneImage(const float center_x, const float center_y) {
+  const float K[9] = {kFocalLength, 0, 0.5f * (kImageWidth - 1),
+                      0, kFocalLength, 0.5f * (kImageHeight - 1),
+                      0, 0, 1};
+  const float R[9] = {1, 0, 0, 0, 1, 0, 0, 0, 1};
+  const float T[3] = {-center_x, -center_y, 0};
+
+  Bitmap bitmap;
+  bitmap.Allocate(kImageWidth, kImageHeight, false);
+  const int kNumSubsamples = 3;
+  for (int y = 0; y < kImageHeight; ++y) {
+    for (int x = 0; x < kImageWidth; ++x) {
+      float color = 0;
+      for (int i = 0; i < kNumSubsamples; ++i) {
+        for (int j = 0; j < kNumSubsamples; ++j) {
+          const float u = x - 0.5f + (j + 0.5f) / kNumSubsamples;
+          const float v = y - 0.5f + (i + 0.5f) / kNumSubsamples;
+          color += PlaneTexture(
+              center_x + kPlaneDepth * (u - K[2]) / kFocalLength,
+              center_y + kPlaneDepth * (v - K[5]) / kFocalLength);
+        }
+      }
+      color /= kNumSubsamples * kNumSubsamples;
+      bitmap.SetPixel(x, y, BitmapColor<uint8_t>(std::round(255 * color)));
+    }
+  }
+
+  Image image("", kImageWidth, kImageHeight, K, R, T);
+  image.SetBitmap(bitmap);
+  return image;
+}
+
+std::vector<Image> CreatePlaneImages() {
+  std::vector<Image> images;
+  images.push_back(RenderPlaneImage(0, 0));
+  images.push_back(RenderPlaneImage(kBaseline, 0));
+  images.push_back(RenderPlaneImage(-kBaseline, 0));
+  images.push_back(RenderPlaneImage(0, kBaseline));
+  return images;
+}
+
+PatchMatch::Problem CreatePlaneProblem(std::vector<Image>* images) {
+  PatchMatch::Problem problem;
+  problem.ref_image_idx = 0;
+  for (int image_idx = 1; image_idx <= kNumSrcImages; ++image_idx) {
+    problem.src_image_idxs.push_back(image_idx);
+  }
+  problem.images = images;
+  return problem;
+}
+
+PatchMatchOptions CreatePlaneOptions() {
+  PatchMatchOptions options;
+  options.depth_min = 1;
+  options.depth_max = 10;
+  options.sigma_spatial = options.window_radius;
+  options.num_iterations = 3;
+  options.geom_consistency = false;
+  return options;
+}
+
+// Fraction of the pixels in the inner part of the image, which is seen by all
+// images, whose depth is within 1% of the plane and whose normal is close to
+// the plane normal.
+double ComputeFractionOfAccuratePixels(const DepthMap& depth_map,
+                                       const NormalMap& normal_map) {
+  const int kBorder = 12;
+  int num_pixels = 0;
+  int num_accurate_pixels = 0;
+  for (int row = kBorder; row < kImageHeight - kBorder; ++row) {
+    for (int col = kBorder; col < kImageWidth - kBorder; ++col) {
+      num_pixels += 1;
+      if (std::abs(depth_map.Get(row, col) - kPlaneDepth) <
+              0.01f * kPlaneDepth &&
+          normal_map.Get(row, col, 2) < -0.95f) {
+        num_accurate_pixels += 1;
+      }
+    }
+  }
+  return num_accurate_pixels / static_cast<double>(num_pixels);
+}
+
+}  // namespace
+
+BOOST_AUTO_TEST_CASE(TestPhotometricPlane) {
+  std::vector<Image> images = CreatePlaneImages();
+  const PatchMatch::Problem problem = CreatePlaneProblem(&images);
+  const PatchMatchOptions options = CreatePlaneOptions();
+
+  PatchMatchCpu patch_match(options, problem);
+  patch_match.Run();
+
+  const DepthMap depth_map = patch_match.GetDepthMap();
+  const NormalMap normal_map = patch_match.GetNormalMap();
+  BOOST_CHECK_EQUAL(depth_map.GetWidth(), kImageWidth);
+  BOOST_CHECK_EQUAL(depth_map.GetHeight(), kImageHeight);
+  BOOST_CHECK_EQUAL(normal_map.GetWidth(), kImageWidth);
+  BOOST_CHECK_EQUAL(normal_map.GetHeight(), kImageHeight);
+  BOOST_CHECK_GT(ComputeFractionOfAccuratePixels(depth_map, normal_map), 0.9);
+
+  const Mat<float> sel_prob_map = patch_match.GetSelProbMap();
+  BOOST_CHECK_EQUAL(sel_prob_map.GetWidth(), kImageWidth);
+  BOOST_CHECK_EQUAL(sel_prob_map.GetHeight(), kImageHeight);
+  BOOST_CHECK_EQUAL(sel_prob_map.GetDepth(), kNumSrcImages);
+
+  // Unfiltered pixels are consistent with at least the minimum number of
+  // source images and filtered pixels with none.
+  const ConsistencyGraph consistency_graph(
+      kImageWidth, kImageHeight, patch_match.GetConsistentImageIdxs());
+  int num_consistent_pixels = 0;
+  for (int row = 0; row < kImageHeight; ++row) {
+    for (int col = 0; col < kImageWidth; ++col) {
+      int num_images;
+      const int* image_idxs;
+      consistency_graph.GetImageIdxs(row, col, &num_images, &image_idxs);
+      if (depth_map.Get(row, col) == 0) {
+        BOOST_CHECK_EQUAL(num_images, 0);
+        continue;
+      }
+      BOOST_CHECK_GE(num_images, options.filter_min_num_consistent);
+      for (int i = 0; i < num_images; ++i) {
+        BOOST_CHECK_GE(image_idxs[i], 1);
+        BOOST_CHECK_LE(image_idxs[i], kNumSrcImages);
+      }
+      num_consistent_pixels += 1;
+    }
+  }
+  BOOST_CHECK_GT(num_consistent_pixels, kImageWidth * kImageHeight / 2);
+}
+
+BOOST_AUTO_TEST_CASE(TestGeometricPlane) {
+  std::vector<Image> images = CreatePlaneImages();
+  PatchMatch::Problem problem = CreatePlaneProblem(&images);
+  PatchMatchOptions options = CreatePlaneOptions();
+  options.geom_consistency = true;
+  options.num_iterations = 1;
+
+  // Ground-truth depth and normal maps of all images as input.
+  std::vector<DepthMap> depth_maps(
+      images.size(), DepthMap(kImageWidth, kImageHeight, options.depth_min,
+                              options.depth_max));
+  std::vector<NormalMap> normal_maps(images.size(),
+                                     NormalMap(kImageWidth, kImageHeight));
+  for (size_t image_idx = 0; image_idx < images.size(); ++image_idx) {
+    depth_maps[image_idx].Fill(kPlaneDepth);
+    for (int row = 0; row < kImageHeight; ++row) {
+      for (int col = 0; col < kImageWidth; ++col) {
+        normal_maps[image_idx].Set(row, col, 2, -1);
+      }
+    }
+  }
+  problem.depth_maps = &depth_maps;
+  problem.normal_maps = &normal_maps;
+
+  PatchMatchCpu patch_match(options, problem);
+  patch_match.Run();
+  const double fraction_of_accurate_pixels = ComputeFractionOfAccuratePixels(
+      patch_match.GetDepthMap(), patch_match.GetNormalMap());
+  BOOST_CHECK_GT(fraction_of_accurate_pixels, 0.9);
+
+  // Geometrically inconsistent depth maps of the source images.
+  for (size_t image_idx = 1; image_idx < images.size(); ++image_idx) {
+    depth_maps[image_idx].Fill(0.75f * kPlaneDepth);
+  }
+
+  PatchMatchCpu inconsistent_patch_match(options, problem);
+  inconsistent_patch_match.Run();
+  BOOST_CHECK_LT(
+      ComputeFractionOfAccuratePixels(inconsistent_patch_match.GetDepthMap(),
+                                      inconsistent_patch_match.GetNormalMap()),
+      0.1);
+}
+
+BOOST_AUTO_TEST_CASE(TestIndependentOfNumThreads) {
+  std::vector<Image> images = CreatePlaneImages();
+  const PatchMatch::Problem problem = CreatePlaneProblem(&images);
+  PatchMatchOptions options = CreatePlaneOptions();
+  options.num_iterations = 1;
+
+  const int kPrevThreadBudget = kThreadBudget;
+
+  kThreadBudget = 1;
+  PatchMatchCpu patch_match1(options, problem);
+  patch_match1.Run();
+
+  kThreadBudget = 4;
+  PatchMatchCpu patch_match4(options, problem);
+  patch_match4.Run();
+
+  kThreadBudget = kPrevThreadBudget;
+
+  BOOST_CHECK(patch_match1.GetDepthMap().GetData() ==
+              patch_match4.GetDepthMap().GetData());
+  BOOST_CHECK(patch_match1.GetNormalMap().GetData() ==
+              patch_match4.GetNormalMap().GetData());
+  BOOST_CHECK(patch_match1.GetConsistentImageIdxs() ==
+              patch_match4.GetConsistentImageIdxs());
+}
@@ -92,7 +92,8 @@ void Workspace::Load(const std::vector<std::string>& image_names) {
     }
   };
 
-  const int num_threads = GetEffectiveNumThreads(options_.num_threads);
+  ThreadBudgetLease thread_budget_lease(options_.num_threads);
+  const int num_threads = thread_budget_lease.NumThreads();
   ThreadPool thread_pool(num_threads);
   Timer timer;
   timer.Start();
@@ -45,6 +45,34 @@
 #include "util/timer.h"
 
 namespace colmap {
+namespace {
+
+void SetSolverNumThreads(const int num_threads,
+                         ceres::Solver::Options* solver_options) {
+  solver_options->num_threads = num_threads;
+#if CERES_VERSION_MAJOR < 2
+  solver_options->num_linear_solver_threads = std::min(
+      num_threads,
+      GetEffectiveNumThreads(solver_options->num_linear_solver_threads));
+#endif  // CERES_VERSION_MAJOR
+}
+
+// Borrow the solver threads from the thread budget for the duration of the
+// solve, unless disabled in the options.
+std::unique_ptr<ThreadBudgetLease> BorrowSolverThreads(
+    const BundleAdjustmentOptions& options, const int num_threads,
+    ceres::Solver::Options* solver_options) {
+  std::unique_ptr<ThreadBudgetLease> thread_budget_lease;
+  if (options.borrow_solver_threads) {
+    thread_budget_lease.reset(new ThreadBudgetLease(num_threads));
+    SetSolverNumThreads(thread_budget_lease->NumThreads(), solver_options);
+  } else {
+    SetSolverNumThreads(GetEffectiveNumThreads(num_threads), solver_options);
+  }
+  return thread_budget_lease;
+}
+
+}  // namespace
 
 ////////////////////////////////////////////////////////////////////////////////
 // BundleAdjustmentOptions
@@ -285,20 +313,12 @@ bool BundleAdjuster::Solve(Reconstruction* reconstruction) {
     solver_options.preconditioner_type = ceres::SCHUR_JACOBI;
   }
 
-  if (problem_->NumResiduals() <
-      options_.min_num_residuals_for_multi_threading) {
-    solver_options.num_threads = 1;
-#if CERES_VERSION_MAJOR < 2
-    solver_options.num_linear_solver_threads = 1;
-#endif  // CERES_VERSION_MAJOR
-  } else {
-    solver_options.num_threads =
-        GetEffectiveNumThreads(solver_options.num_threads);
-#if CERES_VERSION_MAJOR < 2
-    solver_options.num_linear_solver_threads =
-        GetEffectiveNumThreads(solver_options.num_linear_solver_threads);
-#endif  // CERES_VERSION_MAJOR
-  }
+  const auto thread_budget_lease = BorrowSolverThreads(
+      options_,
+      problem_->NumResiduals() < options_.min_num_residuals_for_multi_threading
+          ? 1
+          : solver_options.num_threads,
+      &solver_options);
 
   std::string solver_error;
   CHECK(solver_options.IsValid(&solver_error)) << solver_error;
@@ -842,12 +862,8 @@ bool RigBundleAdjuster::Solve(Reconstruction* reconstruction,
     solver_options.preconditioner_type = ceres::SCHUR_JACOBI;
   }
 
-  solver_options.num_threads =
-      GetEffectiveNumThreads(solver_options.num_threads);
-#if CERES_VERSION_MAJOR < 2
-  solver_options.num_linear_solver_threads =
-      GetEffectiveNumThreads(solver_options.num_linear_solver_threads);
-#endif  // CERES_VERSION_MAJOR
+  const auto thread_budget_lease =
+      BorrowSolverThreads(options_, solver_options.num_threads, &solver_options);
 
   std::string solver_error;
   CHECK(solver_options.IsValid(&solver_error)) << solver_error;
@@ -74,6 +74,11 @@ struct BundleAdjustmentOptions {
   // due to the overhead of threading.
   int min_num_residuals_for_multi_threading = 50000;
 
+  // Whether to borrow the solver threads from the process-wide thread budget.
+  // Otherwise, the solver uses exactly the given number of threads, e.g., if
+  // the caller already borrowed them and requires a fixed number of threads.
+  bool borrow_solver_threads = true;
+
   // Ceres-Solver options.
   ceres::Solver::Options solver_options;
 
@@ -199,6 +199,70 @@ bool IncrementalMapper::FindInitialImagePair(const Options& options,
   return false;
 }
 
+std::vector<std::pair<image_t, image_t>>
+IncrementalMapper::FindInitialImagePairCandidates(const Options& options,
+                                                  const image_t image_id1,
+                                                  const image_t image_id2,
+                                                  const size_t max_num_pairs) {
+  CHECK(options.Check());
+
+  std::vector<std::pair<image_t, image_t>> image_pairs;
+
+  std::vector<image_t> image_ids1;
+  if (image_id1 != kInvalidImageId && image_id2 == kInvalidImageId) {
+    // Only image_id1 provided.
+    if (!database_cache_->ExistsImage(image_id1)) {
+      return image_pairs;
+    }
+    image_ids1.push_back(image_id1);
+  } else if (image_id1 == kInvalidImageId && image_id2 != kInvalidImageId) {
+    // Only image_id2 provided.
+    if (!database_cache_->ExistsImage(image_id2)) {
+      return image_pairs;
+    }
+    image_ids1.push_back(image_id2);
+  } else {
+    // No initial seed image provided.
+    image_ids1 = FindFirstInitialImage(options);
+  }
+
+  const size_t init_max_reg_trials =
+      static_cast<size_t>(options.init_max_reg_trials);
+
+  for (const image_t candidate_id1 : image_ids1) {
+    // Do not propose the same seed image more often than it could be used for
+    // initialization when trying the pairs one after another.
+    size_t num_reg_trials = init_num_reg_trials_.count(candidate_id1)
+                                ? init_num_reg_trials_.at(candidate_id1)
+                                : 0;
+
+    for (const image_t candidate_id2 :
+         FindSecondInitialImage(options, candidate_id1)) {
+      if (num_reg_trials >= init_max_reg_trials) {
+        break;
+      }
+
+      const image_pair_t pair_id =
+          Database::ImagePairToPairId(candidate_id1, candidate_id2);
+
+      // Try every pair only once.
+      if (init_image_pairs_.count(pair_id) > 0) {
+        continue;
+      }
+
+      init_image_pairs_.insert(pair_id);
+      image_pairs.emplace_back(candidate_id1, candidate_id2);
+      num_reg_trials += 1;
+
+      if (image_pairs.size() >= max_num_pairs) {
+        return image_pairs;
+      }
+    }
+  }
+
+  return image_pairs;
+}
+
 std::vector<image_t> IncrementalMapper::FindNextImages(const Options& options) {
   CHECK_NOTNULL(reconstruction_);
   CHECK(options.Check());
@@ -343,6 +407,34 @@ bool IncrementalMapper::RegisterInitialImagePair(const Options& options,
   return true;
 }
 
+void IncrementalMapper::AdoptInitialImagePair(
+    const image_t image_id1, const image_t image_id2,
+    const Reconstruction* reconstruction) {
+  CHECK_NOTNULL(reconstruction_);
+
+  init_num_reg_trials_[image_id1] += 1;
+  init_num_reg_trials_[image_id2] += 1;
+  num_reg_trials_[image_id1] += 1;
+  num_reg_trials_[image_id2] += 1;
+
+  const image_pair_t pair_id =
+      Database::ImagePairToPairId(image_id1, image_id2);
+  init_image_pairs_.insert(pair_id);
+
+  if (reconstruction == nullptr) {
+    return;
+  }
+
+  CHECK_EQ(reconstruction_->NumRegImages(), 0);
+  *reconstruction_ = *reconstruction;
+  triangulator_.reset(new IncrementalTriangulator(
+      &database_cache_->CorrespondenceGraph(), reconstruction_));
+
+  for (const image_t image_id : reconstruction_->RegImageIds()) {
+    RegisterImageEvent(image_id);
+  }
+}
+
 bool IncrementalMapper::RegisterNextImage(const Options& options,
                                           const image_t image_id,
                                           mod::TCPClient* client) {
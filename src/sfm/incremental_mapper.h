@@ -162,6 +162,15 @@ class IncrementalMapper {
   bool FindInitialImagePair(const Options& options, image_t* image_id1,
                             image_t* image_id2);
 
+  // Find up to `max_num_pairs` candidate initial image pairs in the same order
+  // as `FindInitialImagePair` but without estimating their two-view geometry,
+  // so that the candidates can be evaluated concurrently by separate mappers.
+  // Each image is proposed at most `init_max_reg_trials` times and the
+  // returned pairs are ignored by subsequent calls.
+  std::vector<std::pair<image_t, image_t>> FindInitialImagePairCandidates(
+      const Options& options, const image_t image_id1, const image_t image_id2,
+      const size_t max_num_pairs);
+
   // Find best next image to register in the incremental reconstruction. The
   // images should be passed to `RegisterNextImage`. This function automatically
   // ignores images that failed to registered for `max_reg_trials`.
@@ -171,6 +180,12 @@ class IncrementalMapper {
   bool RegisterInitialImagePair(const Options& options, const image_t image_id1,
                                 const image_t image_id2, mod::TCPClient* client);
 
+  // Account for an initial image pair that was registered by a separate mapper
+  // on a copy of the current reconstruction. If `reconstruction` is not null,
+  // it holds the seeded copy, which replaces the current reconstruction.
+  void AdoptInitialImagePair(const image_t image_id1, const image_t image_id2,
+                             const Reconstruction* reconstruction);
+
   // Attempt to register image to the existing model. This requires that
   // a previous call to `RegisterInitialImagePair` was successful.
   bool RegisterNextImage(const Options& options, const image_t image_id, mod::TCPClient* client);
@@ -93,6 +93,7 @@ class StereoOptionsTab : public OptionsWidget {
                     std::numeric_limits<double>::max(), 0.1, 1);
     AddOptionBool(&options->patch_match_stereo->write_consistency_graph,
                   "write_consistency_graph");
+    AddOptionText(&options->patch_match_stereo->map_format, "map_format");
   }
 };
 
@@ -144,6 +145,12 @@ class MeshingOptionsTab : public OptionsWidget {
     AddOptionDouble(&options->delaunay_meshing->max_side_length_percentile,
                     "max_side_length_percentile", 0);
     AddOptionInt(&options->delaunay_meshing->num_threads, "num_threads", -1);
+    AddOptionInt(&options->delaunay_meshing->chunk_max_num_points,
+                 "chunk_max_num_points", 0);
+    AddOptionDouble(&options->delaunay_meshing->chunk_overlap, "chunk_overlap",
+                    0);
+    AddOptionDouble(&options->delaunay_meshing->chunk_max_memory,
+                    "chunk_max_memory", 0);
   }
 };
 
@@ -335,17 +342,11 @@ void DenseReconstructionWidget::Stereo() {
     return;
   }
 
-#ifdef CUDA_ENABLED
   mvs::PatchMatchController* processor = new mvs::PatchMatchController(
       *options_->patch_match_stereo, workspace_path, "COLMAP", "");
   processor->AddCallback(Thread::FINISHED_CALLBACK,
                          [this]() { refresh_workspace_action_->trigger(); });
   thread_control_widget_->StartThread("Stereo...", true, processor);
-#else
-  QMessageBox::critical(this, "",
-                        tr("Dense stereo reconstruction requires CUDA, which "
-                           "is not available on your system."));
-#endif
 }
 
 void DenseReconstructionWidget::Fusion() {
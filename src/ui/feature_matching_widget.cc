@@ -134,6 +134,13 @@ void FeatureMatchingTab::CreateGeneralOptions() {
                                  "guided_matching");
   options_widget_->AddOptionBool(&options_->sift_matching->planar_scene,
                                  "planar_scene");
+  options_widget_->AddOptionInt(&options_->sift_matching->cpu_index_cache_size,
+                                "cpu_index_cache_size [MB]", 0);
+  options_widget_->AddOptionBool(
+      &options_->sift_matching->cpu_brute_force_matcher,
+      "cpu_brute_force_matcher");
+  options_widget_->AddOptionBool(&options_->sift_matching->use_feature_store,
+                                 "use_feature_store");
   options_widget_->AddSpacer();
 
   QScrollArea* options_scroll_area = new QScrollArea(this);
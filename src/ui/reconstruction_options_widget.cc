@@ -44,6 +44,7 @@ MapperGeneralOptionsWidget::MapperGeneralOptionsWidget(QWidget* parent,
   AddOptionInt(&options->mapper->min_model_size, "min_model_size");
   AddOptionBool(&options->mapper->extract_colors, "extract_colors");
   AddOptionInt(&options->mapper->num_threads, "num_threads", -1);
+  AddOptionBool(&options->mapper->use_feature_store, "use_feature_store");
   AddOptionInt(&options->mapper->min_num_matches, "min_num_matches");
   AddOptionBool(&options->mapper->ignore_watermarks, "ignore_watermarks");
   AddOptionDirPath(&options->mapper->snapshot_path, "snapshot_path");
@@ -94,6 +95,8 @@ MapperInitializationOptionsWidget::MapperInitializationOptionsWidget(
   AddOptionInt(&options->mapper->init_image_id1, "init_image_id1", -1);
   AddOptionInt(&options->mapper->init_image_id2, "init_image_id2", -1);
   AddOptionInt(&options->mapper->init_num_trials, "init_num_trials");
+  AddOptionInt(&options->mapper->init_num_parallel_trials,
+               "init_num_parallel_trials");
   AddOptionInt(&options->mapper->mapper.init_min_num_inliers,
                "init_min_num_inliers");
   AddOptionDouble(&options->mapper->mapper.init_max_error, "init_max_error");
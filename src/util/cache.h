@@ -32,9 +32,15 @@
 #ifndef COLMAP_SRC_UTIL_CACHE_H_
 #define COLMAP_SRC_UTIL_CACHE_H_
 
+#include <algorithm>
+#include <functional>
+#include <future>
 #include <iostream>
 #include <list>
+#include <memory>
+#include <mutex>
 #include <unordered_map>
+#include <vector>
 
 #include "util/logging.h"
 
@@ -119,6 +125,50 @@ class MemoryConstrainedLRUCache : public LRUCache<key_t, value_t> {
   std::unordered_map<key_t, size_t> elems_num_bytes_;
 };
 
+// Thread-safe Least Recently Used cache, which is split into independently
+// locked shards, so that concurrent lookups of different keys rarely contend.
+// Values are returned as shared immutable handles that remain valid after the
+// element is evicted from the cache. Missing values are computed outside of
+// the lock, so a slow getter function only blocks the threads requesting the
+// same key: the first thread computes the value, while concurrent requests for
+// the key wait for and share its result.
+template <typename key_t, typename value_t>
+class ShardedLRUCache {
+ public:
+  typedef std::shared_ptr<const value_t> handle_t;
+
+  ShardedLRUCache(const size_t max_num_elems,
+                  const std::function<value_t(const key_t&)>& getter_func,
+                  const size_t num_shards = 16);
+
+  // The number of elements in the cache.
+  size_t NumElems() const;
+  size_t MaxNumElems() const;
+
+  // Check whether the element with the given key exists.
+  bool Exists(const key_t& key) const;
+
+  // Get the value of an element either from the cache or compute the new value.
+  handle_t Get(const key_t& key);
+
+  // Clear all elements from cache.
+  void Clear();
+
+ private:
+  struct Shard {
+    mutable std::mutex mutex;
+    std::unique_ptr<LRUCache<key_t, handle_t>> cache;
+    // Values that are currently computed by one of the threads.
+    std::unordered_map<key_t, std::shared_future<handle_t>> pending;
+  };
+
+  Shard& GetShard(const key_t& key) const;
+
+  const size_t max_num_elems_;
+  std::vector<std::unique_ptr<Shard>> shards_;
+  const std::function<value_t(const key_t&)> getter_func_;
+};
+
 ////////////////////////////////////////////////////////////////////////////////
 // Implementation
 ////////////////////////////////////////////////////////////////////////////////
@@ -217,15 +267,19 @@ size_t MemoryConstrainedLRUCache<key_t, value_t>::MaxNumBytes() const {
 template <typename key_t, typename value_t>
 void MemoryConstrainedLRUCache<key_t, value_t>::Set(const key_t& key,
                                                     value_t&& value) {
+  // Determine the size before the value is moved into the cache.
+  const size_t num_bytes = value.NumBytes();
+
   auto it = elems_map_.find(key);
   elems_list_.push_front(key_value_pair_t(key, std::move(value)));
   if (it != elems_map_.end()) {
     elems_list_.erase(it->second);
     elems_map_.erase(it);
+    num_bytes_ -= elems_num_bytes_.at(key);
+    elems_num_bytes_.erase(key);
   }
   elems_map_[key] = elems_list_.begin();
 
-  const size_t num_bytes = value.NumBytes();
   num_bytes_ += num_bytes;
   elems_num_bytes_.emplace(key, num_bytes);
 
@@ -268,6 +322,104 @@ void MemoryConstrainedLRUCache<key_t, value_t>::Clear() {
   elems_num_bytes_.clear();
 }
 
+template <typename key_t, typename value_t>
+ShardedLRUCache<key_t, value_t>::ShardedLRUCache(
+    const size_t max_num_elems,
+    const std::function<value_t(const key_t&)>& getter_func,
+    const size_t num_shards)
+    : max_num_elems_(max_num_elems), getter_func_(getter_func) {
+  CHECK(getter_func);
+  CHECK_GT(max_num_elems, 0);
+  CHECK_GT(num_shards, 0);
+  const size_t num_shards_used = std::min(num_shards, max_num_elems);
+  const size_t max_num_shard_elems =
+      (max_num_elems + num_shards_used - 1) / num_shards_used;
+  shards_.reserve(num_shards_used);
+  for (size_t i = 0; i < num_shards_used; ++i) {
+    shards_.emplace_back(new Shard());
+    // Values are inserted with Set, so the getter is never called.
+    shards_.back()->cache.reset(new LRUCache<key_t, handle_t>(
+        max_num_shard_elems, [](const key_t&) { return handle_t(); }));
+  }
+}
+
+template <typename key_t, typename value_t>
+size_t ShardedLRUCache<key_t, value_t>::NumElems() const {
+  size_t num_elems = 0;
+  for (const auto& shard : shards_) {
+    std::unique_lock<std::mutex> lock(shard->mutex);
+    num_elems += shard->cache->NumElems();
+  }
+  return num_elems;
+}
+
+template <typename key_t, typename value_t>
+size_t ShardedLRUCache<key_t, value_t>::MaxNumElems() const {
+  return max_num_elems_;
+}
+
+template <typename key_t, typename value_t>
+bool ShardedLRUCache<key_t, value_t>::Exists(const key_t& key) const {
+  const Shard& shard = GetShard(key);
+  std::unique_lock<std::mutex> lock(shard.mutex);
+  return shard.cache->Exists(key);
+}
+
+template <typename key_t, typename value_t>
+typename ShardedLRUCache<key_t, value_t>::handle_t
+ShardedLRUCache<key_t, value_t>::Get(const key_t& key) {
+  Shard& shard = GetShard(key);
+  std::promise<handle_t> promise;
+  {
+    std::unique_lock<std::mutex> lock(shard.mutex);
+    if (shard.cache->Exists(key)) {
+      return shard.cache->Get(key);
+    }
+    const auto pending = shard.pending.find(key);
+    if (pending != shard.pending.end()) {
+      const std::shared_future<handle_t> future = pending->second;
+      lock.unlock();
+      return future.get();
+    }
+    shard.pending.emplace(key, promise.get_future().share());
+  }
+
+  handle_t value;
+  try {
+    value = std::make_shared<const value_t>(getter_func_(key));
+  } catch (...) {
+    {
+      std::unique_lock<std::mutex> lock(shard.mutex);
+      shard.pending.erase(key);
+    }
+    promise.set_exception(std::current_exception());
+    throw;
+  }
+
+  {
+    std::unique_lock<std::mutex> lock(shard.mutex);
+    handle_t cached_value = value;
+    shard.cache->Set(key, std::move(cached_value));
+    shard.pending.erase(key);
+  }
+  promise.set_value(value);
+  return value;
+}
+
+template <typename key_t, typename value_t>
+void ShardedLRUCache<key_t, value_t>::Clear() {
+  for (auto& shard : shards_) {
+    std::unique_lock<std::mutex> lock(shard->mutex);
+    shard->cache->Clear();
+  }
+}
+
+template <typename key_t, typename value_t>
+typename ShardedLRUCache<key_t, value_t>::Shard&
+ShardedLRUCache<key_t, value_t>::GetShard(const key_t& key) const {
+  return *shards_[std::hash<key_t>()(key) % shards_.size()];
+}
+
 }  // namespace colmap
 
 #endif  // COLMAP_SRC_UTIL_CACHE_H_
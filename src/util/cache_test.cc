@@ -32,6 +32,10 @@
 #define TEST_NAME "util/cache"
 #include "util/testing.h"
 
+#include <atomic>
+#include <chrono>
+#include <thread>
+
 #include "util/cache.h"
 
 using namespace colmap;
@@ -271,3 +275,115 @@ BOOST_AUTO_TEST_CASE(TestMemoryConstrainedLRUCacheUpdateNumBytes) {
   BOOST_CHECK_EQUAL(cache.Get(2).NumBytes(), 2);
   BOOST_CHECK_EQUAL(cache.NumBytes(), 2);
 }
+
+BOOST_AUTO_TEST_CASE(TestMemoryConstrainedLRUCacheSet) {
+  MemoryConstrainedLRUCache<int, SizedElem> cache(
+      10, [](const int key) { return SizedElem(key); });
+  cache.Set(0, SizedElem(3));
+  BOOST_CHECK_EQUAL(cache.NumElems(), 1);
+  BOOST_CHECK_EQUAL(cache.NumBytes(), 3);
+  cache.Set(0, SizedElem(5));
+  BOOST_CHECK_EQUAL(cache.NumElems(), 1);
+  BOOST_CHECK_EQUAL(cache.NumBytes(), 5);
+  BOOST_CHECK_EQUAL(cache.Get(0).NumBytes(), 5);
+  cache.Set(1, SizedElem(4));
+  BOOST_CHECK_EQUAL(cache.NumElems(), 2);
+  BOOST_CHECK_EQUAL(cache.NumBytes(), 9);
+  cache.Set(2, SizedElem(2));
+  BOOST_CHECK_EQUAL(cache.NumElems(), 2);
+  BOOST_CHECK_EQUAL(cache.NumBytes(), 6);
+  BOOST_CHECK(!cache.Exists(0));
+}
+
+BOOST_AUTO_TEST_CASE(TestShardedLRUCacheGet) {
+  int num_calls = 0;
+  ShardedLRUCache<int, int> cache(
+      5,
+      [&num_calls](const int key) {
+        num_calls += 1;
+        return key;
+      },
+      2);
+  BOOST_CHECK_EQUAL(cache.NumElems(), 0);
+  BOOST_CHECK_EQUAL(cache.MaxNumElems(), 5);
+  for (int i = 0; i < 5; ++i) {
+    BOOST_CHECK_EQUAL(*cache.Get(i), i);
+    BOOST_CHECK(cache.Exists(i));
+  }
+  BOOST_CHECK_EQUAL(cache.NumElems(), 5);
+  BOOST_CHECK_EQUAL(num_calls, 5);
+
+  const ShardedLRUCache<int, int>::handle_t handle = cache.Get(0);
+  BOOST_CHECK_EQUAL(num_calls, 5);
+
+  // Evicted elements remain valid for holders of the handle.
+  for (int i = 5; i < 20; ++i) {
+    BOOST_CHECK_EQUAL(*cache.Get(i), i);
+  }
+  BOOST_CHECK_LE(cache.NumElems(), 6);
+  BOOST_CHECK(!cache.Exists(0));
+  BOOST_CHECK_EQUAL(*handle, 0);
+
+  cache.Clear();
+  BOOST_CHECK_EQUAL(cache.NumElems(), 0);
+  BOOST_CHECK_EQUAL(*handle, 0);
+}
+
+BOOST_AUTO_TEST_CASE(TestShardedLRUCacheConcurrentGet) {
+  std::atomic<int> num_calls(0);
+  ShardedLRUCache<int, std::vector<int>> cache(
+      64, [&num_calls](const int key) {
+        num_calls += 1;
+        return std::vector<int>(100, key);
+      });
+
+  // Boost.Test assertions are not thread-safe, so the threads only count the
+  // wrong values, which are checked after joining the threads.
+  std::vector<int> num_wrong_values(8, 0);
+  std::vector<std::thread> threads;
+  for (int t = 0; t < 8; ++t) {
+    threads.emplace_back([&cache, &num_wrong_values, t]() {
+      for (int i = 0; i < 1000; ++i) {
+        const int key = (i * 7 + t) % 32;
+        const auto value = cache.Get(key);
+        if (value->size() != 100 || value->front() != key) {
+          num_wrong_values[t] += 1;
+        }
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+
+  for (const int num_wrong_values_of_thread : num_wrong_values) {
+    BOOST_CHECK_EQUAL(num_wrong_values_of_thread, 0);
+  }
+
+  BOOST_CHECK_EQUAL(cache.NumElems(), 32);
+  BOOST_CHECK_EQUAL(num_calls, 32);
+}
+
+BOOST_AUTO_TEST_CASE(TestShardedLRUCacheConcurrentMiss) {
+  std::atomic<int> num_calls(0);
+  ShardedLRUCache<int, int> cache(4, [&num_calls](const int key) {
+    num_calls += 1;
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    return key;
+  });
+
+  std::vector<int> values(8, 0);
+  std::vector<std::thread> threads;
+  for (int t = 0; t < 8; ++t) {
+    threads.emplace_back([&cache, &values, t]() { values[t] = *cache.Get(1); });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+
+  for (const int value : values) {
+    BOOST_CHECK_EQUAL(value, 1);
+  }
+  BOOST_CHECK_EQUAL(cache.NumElems(), 1);
+  BOOST_CHECK_EQUAL(num_calls, 1);
+}
@@ -46,6 +46,7 @@
 #include "ui/render_options.h"
 #include "util/misc.h"
 #include "util/random.h"
+#include "util/threading.h"
 #include "util/version.h"
 
 namespace config = boost::program_options;
@@ -79,6 +80,7 @@ OptionManager::OptionManager(bool add_project_options) {
   desc_->add_options()("help,h", "");
 
   AddRandomOptions();
+  AddThreadOptions();
   AddLogOptions();
 
   if (add_project_options) {
@@ -170,6 +172,7 @@ void OptionManager::ModifyForExtremeQuality() {
 void OptionManager::AddAllOptions() {
   AddLogOptions();
   AddRandomOptions();
+  AddThreadOptions();
   AddDatabaseOptions();
   AddImageOptions();
   AddExtractionOptions();
@@ -208,6 +211,15 @@ void OptionManager::AddRandomOptions() {
   AddAndRegisterDefaultOption("random_seed", &kDefaultPRNGSeed);
 }
 
+void OptionManager::AddThreadOptions() {
+  if (added_thread_options_) {
+    return;
+  }
+  added_thread_options_ = true;
+
+  AddAndRegisterDefaultOption("thread_budget", &kThreadBudget);
+}
+
 void OptionManager::AddDatabaseOptions() {
   if (added_database_options_) {
     return;
@@ -322,6 +334,12 @@ void OptionManager::AddMatchingOptions() {
                               &sift_matching->guided_matching);
   AddAndRegisterDefaultOption("SiftMatching.planar_scene",
                               &sift_matching->planar_scene);
+  AddAndRegisterDefaultOption("SiftMatching.cpu_index_cache_size",
+                              &sift_matching->cpu_index_cache_size);
+  AddAndRegisterDefaultOption("SiftMatching.cpu_brute_force_matcher",
+                              &sift_matching->cpu_brute_force_matcher);
+  AddAndRegisterDefaultOption("SiftMatching.use_feature_store",
+                              &sift_matching->use_feature_store);
 }
 
 void OptionManager::AddExhaustiveMatchingOptions() {
@@ -477,12 +495,22 @@ void OptionManager::AddMapperOptions() {
 
   AddAndRegisterDefaultOption("Mapper.tcp_port",
                               &mapper->tcp_port);
+  AddAndRegisterDefaultOption("Mapper.tcp_endpoint",
+                              &mapper->tcp_endpoint);
   AddAndRegisterDefaultOption("Mapper.tcp_no_nlog",
                               &mapper->tcp_no_nlog);
   AddAndRegisterDefaultOption("Mapper.tcp_no_flog",
                               &mapper->tcp_no_flog);
   AddAndRegisterDefaultOption("Mapper.tcp_mlog",
                               &mapper->tcp_mlog);
+  AddAndRegisterDefaultOption("Mapper.tcp_binary",
+                              &mapper->tcp_binary);
+  AddAndRegisterDefaultOption("Mapper.tcp_async",
+                              &mapper->tcp_async);
+  AddAndRegisterDefaultOption("Mapper.tcp_batch_next_images",
+                              &mapper->tcp_batch_next_images);
+  AddAndRegisterDefaultOption("Mapper.tcp_record_path",
+                              &mapper->tcp_record_path);
   AddAndRegisterDefaultOption("Mapper.min_num_matches",
                               &mapper->min_num_matches);
   AddAndRegisterDefaultOption("Mapper.ignore_watermarks",
@@ -497,8 +525,12 @@ void OptionManager::AddMapperOptions() {
   AddAndRegisterDefaultOption("Mapper.init_image_id2", &mapper->init_image_id2);
   AddAndRegisterDefaultOption("Mapper.init_num_trials",
                               &mapper->init_num_trials);
+  AddAndRegisterDefaultOption("Mapper.init_num_parallel_trials",
+                              &mapper->init_num_parallel_trials);
   AddAndRegisterDefaultOption("Mapper.extract_colors", &mapper->extract_colors);
   AddAndRegisterDefaultOption("Mapper.num_threads", &mapper->num_threads);
+  AddAndRegisterDefaultOption("Mapper.use_feature_store",
+                              &mapper->use_feature_store);
   AddAndRegisterDefaultOption("Mapper.min_focal_length_ratio",
                               &mapper->min_focal_length_ratio);
   AddAndRegisterDefaultOption("Mapper.max_focal_length_ratio",
@@ -660,6 +692,8 @@ void OptionManager::AddPatchMatchStereoOptions() {
                               &patch_match_stereo->allow_missing_files);
   AddAndRegisterDefaultOption("PatchMatchStereo.write_consistency_graph",
                               &patch_match_stereo->write_consistency_graph);
+  AddAndRegisterDefaultOption("PatchMatchStereo.map_format",
+                              &patch_match_stereo->map_format);
 }
 
 void OptionManager::AddStereoFusionOptions() {
@@ -692,6 +726,8 @@ void OptionManager::AddStereoFusionOptions() {
                               &stereo_fusion->cache_size);
   AddAndRegisterDefaultOption("StereoFusion.use_cache",
                               &stereo_fusion->use_cache);
+  AddAndRegisterDefaultOption("StereoFusion.use_tiles",
+                              &stereo_fusion->use_tiles);
 }
 
 void OptionManager::AddPoissonMeshingOptions() {
@@ -731,6 +767,12 @@ void OptionManager::AddDelaunayMeshingOptions() {
                               &delaunay_meshing->max_side_length_percentile);
   AddAndRegisterDefaultOption("DelaunayMeshing.num_threads",
                               &delaunay_meshing->num_threads);
+  AddAndRegisterDefaultOption("DelaunayMeshing.chunk_max_num_points",
+                              &delaunay_meshing->chunk_max_num_points);
+  AddAndRegisterDefaultOption("DelaunayMeshing.chunk_overlap",
+                              &delaunay_meshing->chunk_overlap);
+  AddAndRegisterDefaultOption("DelaunayMeshing.chunk_max_memory",
+                              &delaunay_meshing->chunk_max_memory);
 }
 
 void OptionManager::AddRenderOptions() {
@@ -766,6 +808,7 @@ void OptionManager::Reset() {
 
   added_log_options_ = false;
   added_random_options_ = false;
+  added_thread_options_ = false;
   added_database_options_ = false;
   added_image_options_ = false;
   added_extraction_options_ = false;
@@ -82,6 +82,7 @@ class OptionManager {
   void AddAllOptions();
   void AddLogOptions();
   void AddRandomOptions();
+  void AddThreadOptions();
   void AddDatabaseOptions();
   void AddImageOptions();
   void AddExtractionOptions();
@@ -162,6 +163,7 @@ class OptionManager {
 
   bool added_log_options_;
   bool added_random_options_;
+  bool added_thread_options_;
   bool added_database_options_;
   bool added_image_options_;
   bool added_extraction_options_;
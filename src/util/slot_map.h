@@ -0,0 +1,525 @@
+// Copyright (c) 2022, ETH Zurich and UNC Chapel Hill.
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//
+//     * Neither the name of ETH Zurich and UNC Chapel Hill nor the names of
+//       its contributors may be used to endorse or promote products derived
+//       from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDERS OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//
+// Author: Johannes L. Schoenberger (jsch-at-demuc-dot-de)
+
+#ifndef COLMAP_SRC_UTIL_SLOT_MAP_H_
+#define COLMAP_SRC_UTIL_SLOT_MAP_H_
+
+#include <algorithm>
+#include <cstdint>
+#include <iterator>
+#include <limits>
+#include <new>
+#include <stdexcept>
+#include <tuple>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <Eigen/Core>
+
+#include "util/logging.h"
+
+namespace colmap {
+
+// Map from unsigned integer keys to values, which stores the values in slots
+// of fixed size blocks instead of individually allocated hash table nodes.
+// It implements the subset of the std::unordered_map interface, which is
+// needed to store the images and 3D points of a reconstruction:
+//
+//  - Values never move in memory, so that references to values remain valid
+//    until the value is erased, as for std::unordered_map.
+//  - The slots of erased values are reused by later insertions.
+//  - Iteration is a linear scan over the slots in contiguous memory and its
+//    order only depends on the sequence of insertions and erasures.
+//  - Keys are mapped to slots through a flat array, as long as the keys are
+//    not much larger than the number of values, e.g. for identifiers that are
+//    assigned incrementally. Only larger keys are stored in a hash map.
+//  - The slots can be accessed by index to process the values in parallel.
+template <typename key_t, typename value_t>
+class SlotMap {
+ public:
+  typedef key_t key_type;
+  typedef value_t mapped_type;
+  typedef std::pair<const key_t, value_t> value_type;
+  typedef size_t size_type;
+
+  template <bool kIsConst>
+  class Iterator;
+  typedef Iterator<false> iterator;
+  typedef Iterator<true> const_iterator;
+
+  SlotMap();
+  SlotMap(const SlotMap& other);
+  SlotMap(SlotMap&& other);
+  ~SlotMap();
+
+  SlotMap& operator=(SlotMap other);
+  void swap(SlotMap& other);
+
+  size_t size() const;
+  bool empty() const;
+  void reserve(const size_t num_values);
+  void clear();
+
+  iterator begin();
+  iterator end();
+  const_iterator begin() const;
+  const_iterator end() const;
+
+  iterator find(const key_t& key);
+  const_iterator find(const key_t& key) const;
+  size_t count(const key_t& key) const;
+
+  // Access the value of an existing key. Throws std::out_of_range otherwise.
+  value_t& at(const key_t& key);
+  const value_t& at(const key_t& key) const;
+
+  // Access the value of the key and insert a default value if necessary.
+  value_t& operator[](const key_t& key);
+
+  // Construct the value in place, if the key does not exist yet.
+  template <typename... args_t>
+  std::pair<iterator, bool> emplace(const key_t& key, args_t&&... args);
+
+  size_t erase(const key_t& key);
+  iterator erase(const_iterator pos);
+
+  // The number of slots, i.e. the upper bound of the slot indices.
+  size_t NumSlots() const;
+
+  // The element in the slot or nullptr, if the slot is empty.
+  value_type* Slot(const size_t slot_idx);
+  const value_type* Slot(const size_t slot_idx) const;
+
+  template <bool kIsConst>
+  class Iterator {
+   public:
+    typedef std::forward_iterator_tag iterator_category;
+    typedef typename SlotMap::value_type value_type;
+    typedef std::ptrdiff_t difference_type;
+    typedef typename std::conditional<kIsConst, const value_type*,
+                                      value_type*>::type pointer;
+    typedef typename std::conditional<kIsConst, const value_type&,
+                                      value_type&>::type reference;
+
+    Iterator() : map_(nullptr), slot_idx_(0) {}
+
+    // Allow the implicit conversion of iterators to const iterators.
+    Iterator(const Iterator<false>& other)
+        : map_(other.map_), slot_idx_(other.slot_idx_) {}
+
+    reference operator*() const { return *map_->SlotPtr(slot_idx_); }
+    pointer operator->() const { return map_->SlotPtr(slot_idx_); }
+
+    Iterator& operator++() {
+      slot_idx_ += 1;
+      SkipEmptySlots();
+      return *this;
+    }
+
+    Iterator operator++(int) {
+      Iterator prev = *this;
+      ++(*this);
+      return prev;
+    }
+
+    bool operator==(const Iterator& other) const {
+      return slot_idx_ == other.slot_idx_;
+    }
+
+    bool operator!=(const Iterator& other) const {
+      return slot_idx_ != other.slot_idx_;
+    }
+
+   private:
+    friend class SlotMap;
+    friend class Iterator<!kIsConst>;
+
+    typedef typename std::conditional<kIsConst, const SlotMap*, SlotMap*>::type
+        map_pointer;
+
+    Iterator(map_pointer map, const size_t slot_idx)
+        : map_(map), slot_idx_(slot_idx) {}
+
+    void SkipEmptySlots() {
+      const size_t num_slots = map_->occupied_.size();
+      while (slot_idx_ < num_slots && !map_->occupied_[slot_idx_]) {
+        slot_idx_ += 1;
+      }
+    }
+
+    map_pointer map_;
+    size_t slot_idx_;
+  };
+
+ private:
+  // Number of slots per block.
+  static const size_t kBlockSize = 256;
+  // Keys are mapped through the flat array, if they are smaller than this
+  // number or kDenseKeyFactor times the number of values.
+  static const size_t kMinNumDenseKeys = 1024;
+  static const size_t kDenseKeyFactor = 8;
+  static const uint32_t kInvalidSlotIdx = std::numeric_limits<uint32_t>::max();
+
+  typedef Eigen::aligned_allocator<value_type> allocator_t;
+
+  value_type* SlotPtr(const size_t slot_idx) const;
+  size_t FindSlotIdx(const key_t& key) const;
+  size_t AllocateSlotIdx();
+  void ReleaseSlotIdx(const size_t slot_idx);
+  void DeallocateBlocks();
+
+  std::vector<value_type*> blocks_;
+  // Whether the slot contains a value. Its size is the number of slots.
+  std::vector<char> occupied_;
+  std::vector<size_t> free_slot_idxs_;
+  size_t num_values_;
+
+  // Mapping from keys to slot indices, see kMinNumDenseKeys.
+  std::vector<uint32_t> dense_slot_idxs_;
+  std::unordered_map<key_t, uint32_t> sparse_slot_idxs_;
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// Implementation
+////////////////////////////////////////////////////////////////////////////////
+
+template <typename key_t, typename value_t>
+const size_t SlotMap<key_t, value_t>::kBlockSize;
+template <typename key_t, typename value_t>
+const size_t SlotMap<key_t, value_t>::kMinNumDenseKeys;
+template <typename key_t, typename value_t>
+const size_t SlotMap<key_t, value_t>::kDenseKeyFactor;
+template <typename key_t, typename value_t>
+const uint32_t SlotMap<key_t, value_t>::kInvalidSlotIdx;
+
+template <typename key_t, typename value_t>
+SlotMap<key_t, value_t>::SlotMap() : num_values_(0) {
+  static_assert(std::is_integral<key_t>::value &&
+                    std::is_unsigned<key_t>::value,
+                "Keys must be unsigned integers");
+}
+
+template <typename key_t, typename value_t>
+SlotMap<key_t, value_t>::SlotMap(const SlotMap& other) : SlotMap() {
+  reserve(other.occupied_.size());
+  occupied_.resize(other.occupied_.size(), false);
+  for (size_t slot_idx = 0; slot_idx < other.occupied_.size(); ++slot_idx) {
+    if (other.occupied_[slot_idx]) {
+      new (SlotPtr(slot_idx)) value_type(*other.SlotPtr(slot_idx));
+      occupied_[slot_idx] = true;
+    }
+  }
+  free_slot_idxs_ = other.free_slot_idxs_;
+  num_values_ = other.num_values_;
+  dense_slot_idxs_ = other.dense_slot_idxs_;
+  sparse_slot_idxs_ = other.sparse_slot_idxs_;
+}
+
+template <typename key_t, typename value_t>
+SlotMap<key_t, value_t>::SlotMap(SlotMap&& other) : SlotMap() {
+  swap(other);
+}
+
+template <typename key_t, typename value_t>
+SlotMap<key_t, value_t>::~SlotMap() {
+  clear();
+}
+
+template <typename key_t, typename value_t>
+SlotMap<key_t, value_t>& SlotMap<key_t, value_t>::operator=(SlotMap other) {
+  swap(other);
+  return *this;
+}
+
+template <typename key_t, typename value_t>
+void SlotMap<key_t, value_t>::swap(SlotMap& other) {
+  blocks_.swap(other.blocks_);
+  occupied_.swap(other.occupied_);
+  free_slot_idxs_.swap(other.free_slot_idxs_);
+  std::swap(num_values_, other.num_values_);
+  dense_slot_idxs_.swap(other.dense_slot_idxs_);
+  sparse_slot_idxs_.swap(other.sparse_slot_idxs_);
+}
+
+template <typename key_t, typename value_t>
+size_t SlotMap<key_t, value_t>::size() const {
+  return num_values_;
+}
+
+template <typename key_t, typename value_t>
+bool SlotMap<key_t, value_t>::empty() const {
+  return num_values_ == 0;
+}
+
+template <typename key_t, typename value_t>
+void SlotMap<key_t, value_t>::reserve(const size_t num_values) {
+  const size_t num_blocks = (num_values + kBlockSize - 1) / kBlockSize;
+  allocator_t allocator;
+  while (blocks_.size() < num_blocks) {
+    blocks_.push_back(allocator.allocate(kBlockSize));
+  }
+  occupied_.reserve(num_values);
+}
+
+template <typename key_t, typename value_t>
+void SlotMap<key_t, value_t>::clear() {
+  for (size_t slot_idx = 0; slot_idx < occupied_.size(); ++slot_idx) {
+    if (occupied_[slot_idx]) {
+      SlotPtr(slot_idx)->~value_type();
+    }
+  }
+  DeallocateBlocks();
+  occupied_.clear();
+  free_slot_idxs_.clear();
+  num_values_ = 0;
+  dense_slot_idxs_.clear();
+  sparse_slot_idxs_.clear();
+}
+
+template <typename key_t, typename value_t>
+typename SlotMap<key_t, value_t>::iterator SlotMap<key_t, value_t>::begin() {
+  iterator it(this, 0);
+  it.SkipEmptySlots();
+  return it;
+}
+
+template <typename key_t, typename value_t>
+typename SlotMap<key_t, value_t>::iterator SlotMap<key_t, value_t>::end() {
+  return iterator(this, occupied_.size());
+}
+
+template <typename key_t, typename value_t>
+typename SlotMap<key_t, value_t>::const_iterator
+SlotMap<key_t, value_t>::begin() const {
+  const_iterator it(this, 0);
+  it.SkipEmptySlots();
+  return it;
+}
+
+template <typename key_t, typename value_t>
+typename SlotMap<key_t, value_t>::const_iterator SlotMap<key_t, value_t>::end()
+    const {
+  return const_iterator(this, occupied_.size());
+}
+
+template <typename key_t, typename value_t>
+typename SlotMap<key_t, value_t>::iterator SlotMap<key_t, value_t>::find(
+    const key_t& key) {
+  const size_t slot_idx = FindSlotIdx(key);
+  if (slot_idx == kInvalidSlotIdx) {
+    return end();
+  }
+  return iterator(this, slot_idx);
+}
+
+template <typename key_t, typename value_t>
+typename SlotMap<key_t, value_t>::const_iterator SlotMap<key_t, value_t>::find(
+    const key_t& key) const {
+  const size_t slot_idx = FindSlotIdx(key);
+  if (slot_idx == kInvalidSlotIdx) {
+    return end();
+  }
+  return const_iterator(this, slot_idx);
+}
+
+template <typename key_t, typename value_t>
+size_t SlotMap<key_t, value_t>::count(const key_t& key) const {
+  return FindSlotIdx(key) == kInvalidSlotIdx ? 0 : 1;
+}
+
+template <typename key_t, typename value_t>
+value_t& SlotMap<key_t, value_t>::at(const key_t& key) {
+  const size_t slot_idx = FindSlotIdx(key);
+  if (slot_idx == kInvalidSlotIdx) {
+    throw std::out_of_range("SlotMap::at");
+  }
+  return SlotPtr(slot_idx)->second;
+}
+
+template <typename key_t, typename value_t>
+const value_t& SlotMap<key_t, value_t>::at(const key_t& key) const {
+  const size_t slot_idx = FindSlotIdx(key);
+  if (slot_idx == kInvalidSlotIdx) {
+    throw std::out_of_range("SlotMap::at");
+  }
+  return SlotPtr(slot_idx)->second;
+}
+
+template <typename key_t, typename value_t>
+value_t& SlotMap<key_t, value_t>::operator[](const key_t& key) {
+  return emplace(key).first->second;
+}
+
+template <typename key_t, typename value_t>
+template <typename... args_t>
+std::pair<typename SlotMap<key_t, value_t>::iterator, bool>
+SlotMap<key_t, value_t>::emplace(const key_t& key, args_t&&... args) {
+  const size_t existing_slot_idx = FindSlotIdx(key);
+  if (existing_slot_idx != kInvalidSlotIdx) {
+    return std::make_pair(iterator(this, existing_slot_idx), false);
+  }
+
+  const size_t slot_idx = AllocateSlotIdx();
+  try {
+    new (SlotPtr(slot_idx))
+        value_type(std::piecewise_construct, std::forward_as_tuple(key),
+                   std::forward_as_tuple(std::forward<args_t>(args)...));
+  } catch (...) {
+    ReleaseSlotIdx(slot_idx);
+    throw;
+  }
+
+  occupied_[slot_idx] = true;
+  num_values_ += 1;
+
+  const size_t max_num_dense_keys =
+      std::max(kMinNumDenseKeys, kDenseKeyFactor * num_values_);
+  if (key < dense_slot_idxs_.size()) {
+    dense_slot_idxs_[key] = static_cast<uint32_t>(slot_idx);
+  } else if (key < max_num_dense_keys) {
+    // Grow geometrically to amortize the resizing.
+    dense_slot_idxs_.resize(
+        std::max(static_cast<size_t>(key) + 1, 2 * dense_slot_idxs_.size()),
+        kInvalidSlotIdx);
+    dense_slot_idxs_[key] = static_cast<uint32_t>(slot_idx);
+  } else {
+    sparse_slot_idxs_.emplace(key, static_cast<uint32_t>(slot_idx));
+  }
+
+  return std::make_pair(iterator(this, slot_idx), true);
+}
+
+template <typename key_t, typename value_t>
+size_t SlotMap<key_t, value_t>::erase(const key_t& key) {
+  const size_t slot_idx = FindSlotIdx(key);
+  if (slot_idx == kInvalidSlotIdx) {
+    return 0;
+  }
+
+  if (key < dense_slot_idxs_.size() &&
+      dense_slot_idxs_[key] != kInvalidSlotIdx) {
+    dense_slot_idxs_[key] = kInvalidSlotIdx;
+  } else {
+    sparse_slot_idxs_.erase(key);
+  }
+
+  SlotPtr(slot_idx)->~value_type();
+  occupied_[slot_idx] = false;
+  ReleaseSlotIdx(slot_idx);
+  num_values_ -= 1;
+
+  return 1;
+}
+
+template <typename key_t, typename value_t>
+typename SlotMap<key_t, value_t>::iterator SlotMap<key_t, value_t>::erase(
+    const_iterator pos) {
+  iterator next(this, pos.slot_idx_);
+  ++next;
+  const key_t key = pos->first;
+  erase(key);
+  return next;
+}
+
+template <typename key_t, typename value_t>
+size_t SlotMap<key_t, value_t>::NumSlots() const {
+  return occupied_.size();
+}
+
+template <typename key_t, typename value_t>
+typename SlotMap<key_t, value_t>::value_type* SlotMap<key_t, value_t>::Slot(
+    const size_t slot_idx) {
+  return occupied_.at(slot_idx) ? SlotPtr(slot_idx) : nullptr;
+}
+
+template <typename key_t, typename value_t>
+const typename SlotMap<key_t, value_t>::value_type*
+SlotMap<key_t, value_t>::Slot(const size_t slot_idx) const {
+  return occupied_.at(slot_idx) ? SlotPtr(slot_idx) : nullptr;
+}
+
+template <typename key_t, typename value_t>
+typename SlotMap<key_t, value_t>::value_type* SlotMap<key_t, value_t>::SlotPtr(
+    const size_t slot_idx) const {
+  return blocks_[slot_idx / kBlockSize] + slot_idx % kBlockSize;
+}
+
+template <typename key_t, typename value_t>
+size_t SlotMap<key_t, value_t>::FindSlotIdx(const key_t& key) const {
+  if (key < dense_slot_idxs_.size() &&
+      dense_slot_idxs_[key] != kInvalidSlotIdx) {
+    return dense_slot_idxs_[key];
+  }
+  if (!sparse_slot_idxs_.empty()) {
+    const auto it = sparse_slot_idxs_.find(key);
+    if (it != sparse_slot_idxs_.end()) {
+      return it->second;
+    }
+  }
+  return kInvalidSlotIdx;
+}
+
+template <typename key_t, typename value_t>
+size_t SlotMap<key_t, value_t>::AllocateSlotIdx() {
+  if (!free_slot_idxs_.empty()) {
+    const size_t slot_idx = free_slot_idxs_.back();
+    free_slot_idxs_.pop_back();
+    return slot_idx;
+  }
+
+  const size_t slot_idx = occupied_.size();
+  CHECK_LT(slot_idx, kInvalidSlotIdx);
+  if (slot_idx / kBlockSize == blocks_.size()) {
+    blocks_.push_back(allocator_t().allocate(kBlockSize));
+  }
+  occupied_.push_back(false);
+  return slot_idx;
+}
+
+template <typename key_t, typename value_t>
+void SlotMap<key_t, value_t>::ReleaseSlotIdx(const size_t slot_idx) {
+  free_slot_idxs_.push_back(slot_idx);
+}
+
+template <typename key_t, typename value_t>
+void SlotMap<key_t, value_t>::DeallocateBlocks() {
+  allocator_t allocator;
+  for (value_type* block : blocks_) {
+    allocator.deallocate(block, kBlockSize);
+  }
+  blocks_.clear();
+}
+
+}  // namespace colmap
+
+#endif  // COLMAP_SRC_UTIL_SLOT_MAP_H_
@@ -0,0 +1,263 @@
+// Copyright (c) 2022, ETH Zurich and UNC Chapel Hill.
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//
+//     * Neither the name of ETH Zurich and UNC Chapel Hill nor the names of
+//       its contributors may be used to endorse or promote products derived
+//       from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDERS OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//
+// Author: Johannes L. Schoenberger (jsch-at-demuc-dot-de)
+
+#define TEST_NAME "util/slot_map"
+#include "util/testing.h"
+
+#include <memory>
+#include <string>
+
+#include "util/alignment.h"
+#include "util/slot_map.h"
+#include "util/timer.h"
+
+using namespace colmap;
+
+BOOST_AUTO_TEST_CASE(TestEmpty) {
+  SlotMap<uint32_t, int> map;
+  BOOST_CHECK_EQUAL(map.size(), 0);
+  BOOST_CHECK(map.empty());
+  BOOST_CHECK(map.begin() == map.end());
+  BOOST_CHECK(map.find(0) == map.end());
+  BOOST_CHECK_EQUAL(map.count(0), 0);
+  BOOST_CHECK_THROW(map.at(0), std::out_of_range);
+  BOOST_CHECK_EQUAL(map.erase(0), 0);
+  BOOST_CHECK_EQUAL(map.NumSlots(), 0);
+}
+
+BOOST_AUTO_TEST_CASE(TestEmplaceFindErase) {
+  SlotMap<uint32_t, std::string> map;
+  BOOST_CHECK(map.emplace(1, "a").second);
+  BOOST_CHECK(map.emplace(2, "b").second);
+  BOOST_CHECK(!map.emplace(1, "c").second);
+  BOOST_CHECK_EQUAL(map.size(), 2);
+  BOOST_CHECK_EQUAL(map.at(1), "a");
+  BOOST_CHECK_EQUAL(map.at(2), "b");
+  BOOST_CHECK_EQUAL(map.find(2)->first, 2);
+  BOOST_CHECK_EQUAL(map.find(2)->second, "b");
+  BOOST_CHECK_EQUAL(map.count(1), 1);
+  BOOST_CHECK_EQUAL(map.count(3), 0);
+
+  map[3] = "c";
+  BOOST_CHECK_EQUAL(map.size(), 3);
+  BOOST_CHECK_EQUAL(map.at(3), "c");
+  map[3] += "d";
+  BOOST_CHECK_EQUAL(map.at(3), "cd");
+
+  BOOST_CHECK_EQUAL(map.erase(1), 1);
+  BOOST_CHECK_EQUAL(map.erase(1), 0);
+  BOOST_CHECK_EQUAL(map.size(), 2);
+  BOOST_CHECK_EQUAL(map.count(1), 0);
+  BOOST_CHECK_THROW(map.at(1), std::out_of_range);
+
+  map.clear();
+  BOOST_CHECK(map.empty());
+  BOOST_CHECK(map.begin() == map.end());
+  BOOST_CHECK_EQUAL(map.count(2), 0);
+}
+
+BOOST_AUTO_TEST_CASE(TestSparseKeys) {
+  SlotMap<uint64_t, int> map;
+  const uint64_t kLargeKey = std::numeric_limits<uint64_t>::max() - 1;
+  map.emplace(kLargeKey, 1);
+  map.emplace(100000000, 2);
+  map.emplace(5, 3);
+  BOOST_CHECK_EQUAL(map.size(), 3);
+  BOOST_CHECK_EQUAL(map.at(kLargeKey), 1);
+  BOOST_CHECK_EQUAL(map.at(100000000), 2);
+  BOOST_CHECK_EQUAL(map.at(5), 3);
+  BOOST_CHECK_EQUAL(map.count(100000001), 0);
+
+  // Sparse keys remain accessible when the flat array grows past them.
+  for (uint64_t key = 10; key < 20000000; key += 1000) {
+    map.emplace(key, 4);
+  }
+  map.emplace(20000000, 5);
+  BOOST_CHECK_EQUAL(map.at(100000000), 2);
+  BOOST_CHECK_EQUAL(map.at(20000000), 5);
+
+  BOOST_CHECK_EQUAL(map.erase(kLargeKey), 1);
+  BOOST_CHECK_EQUAL(map.erase(20000000), 1);
+  BOOST_CHECK_EQUAL(map.count(kLargeKey), 0);
+  BOOST_CHECK_EQUAL(map.count(20000000), 0);
+  BOOST_CHECK_EQUAL(map.at(5), 3);
+}
+
+BOOST_AUTO_TEST_CASE(TestIteration) {
+  SlotMap<uint32_t, int> map;
+  for (uint32_t key = 0; key < 1000; ++key) {
+    map.emplace(key, static_cast<int>(key));
+  }
+
+  // Iteration visits the values in the order of their slots.
+  int num_values = 0;
+  for (const auto& value : map) {
+    BOOST_CHECK_EQUAL(value.first, num_values);
+    BOOST_CHECK_EQUAL(value.second, num_values);
+    num_values += 1;
+  }
+  BOOST_CHECK_EQUAL(num_values, 1000);
+
+  for (auto it = map.begin(); it != map.end();) {
+    if (it->first % 2 == 0) {
+      it = map.erase(it);
+    } else {
+      it->second *= 2;
+      ++it;
+    }
+  }
+  BOOST_CHECK_EQUAL(map.size(), 500);
+  for (const auto& value : map) {
+    BOOST_CHECK_EQUAL(value.first % 2, 1);
+    BOOST_CHECK_EQUAL(value.second, 2 * static_cast<int>(value.first));
+  }
+
+  // Erased slots are reused.
+  BOOST_CHECK_EQUAL(map.NumSlots(), 1000);
+  for (uint32_t key = 1000; key < 1500; ++key) {
+    map.emplace(key, 0);
+  }
+  BOOST_CHECK_EQUAL(map.size(), 1000);
+  BOOST_CHECK_EQUAL(map.NumSlots(), 1000);
+
+  size_t num_occupied_slots = 0;
+  for (size_t slot_idx = 0; slot_idx < map.NumSlots(); ++slot_idx) {
+    const auto* value = map.Slot(slot_idx);
+    if (value != nullptr) {
+      BOOST_CHECK_EQUAL(map.count(value->first), 1);
+      num_occupied_slots += 1;
+    }
+  }
+  BOOST_CHECK_EQUAL(num_occupied_slots, map.size());
+}
+
+BOOST_AUTO_TEST_CASE(TestStableReferences) {
+  SlotMap<uint32_t, int> map;
+  map.emplace(0, 1);
+  const int* value = &map.at(0);
+  for (uint32_t key = 1; key < 10000; ++key) {
+    map.emplace(key, 0);
+  }
+  for (uint32_t key = 1; key < 10000; key += 2) {
+    map.erase(key);
+  }
+  BOOST_CHECK_EQUAL(value, &map.at(0));
+  BOOST_CHECK_EQUAL(*value, 1);
+}
+
+BOOST_AUTO_TEST_CASE(TestCopyMove) {
+  SlotMap<uint32_t, std::shared_ptr<int>> map;
+  for (uint32_t key = 0; key < 1000; ++key) {
+    map.emplace(key, std::make_shared<int>(key));
+  }
+  map.erase(10);
+
+  SlotMap<uint32_t, std::shared_ptr<int>> map_copy(map);
+  BOOST_CHECK_EQUAL(map_copy.size(), map.size());
+  BOOST_CHECK_EQUAL(map_copy.count(10), 0);
+  for (const auto& value : map) {
+    BOOST_CHECK_EQUAL(map_copy.at(value.first), value.second);
+    BOOST_CHECK_EQUAL(value.second.use_count(), 2);
+  }
+
+  SlotMap<uint32_t, std::shared_ptr<int>> map_moved(std::move(map_copy));
+  BOOST_CHECK_EQUAL(map_moved.size(), map.size());
+  BOOST_CHECK(map_copy.empty());
+
+  map_copy = map_moved;
+  BOOST_CHECK_EQUAL(map_copy.size(), map.size());
+  BOOST_CHECK_EQUAL(*map.at(0).get(), 0);
+  BOOST_CHECK_EQUAL(map.at(0).use_count(), 3);
+
+  map_moved.clear();
+  map_copy = std::move(map_moved);
+  BOOST_CHECK(map_copy.empty());
+  BOOST_CHECK_EQUAL(map.at(0).use_count(), 1);
+}
+
+BOOST_AUTO_TEST_CASE(TestAlignedValues) {
+  SlotMap<uint32_t, Eigen::Vector4d> map;
+  for (uint32_t key = 0; key < 1000; ++key) {
+    map.emplace(key, Eigen::Vector4d::Constant(key));
+  }
+  for (const auto& value : map) {
+    BOOST_CHECK_EQUAL(
+        reinterpret_cast<size_t>(value.second.data()) % EIGEN_MAX_ALIGN_BYTES,
+        0);
+    BOOST_CHECK_EQUAL(value.second(0), value.first);
+  }
+}
+
+BOOST_AUTO_TEST_CASE(TestIterationSpeed) {
+  // Microbenchmark of the iteration over values resembling 3D points, which
+  // are inserted and partially erased as in the incremental mapper.
+  struct Value {
+    Eigen::Vector3d xyz;
+    double error;
+    std::vector<uint64_t> track;
+  };
+
+  const uint64_t kNumValues = 1000000;
+
+  SlotMap<uint64_t, Value> slot_map;
+  EIGEN_STL_UMAP(uint64_t, Value) hash_map;
+  for (uint64_t key = 0; key < kNumValues; ++key) {
+    Value value;
+    value.xyz = Eigen::Vector3d::Constant(key);
+    value.error = 1;
+    slot_map.emplace(key, value);
+    hash_map.emplace(key, value);
+  }
+  for (uint64_t key = 0; key < kNumValues; key += 3) {
+    slot_map.erase(key);
+    hash_map.erase(key);
+  }
+
+  Timer timer;
+  timer.Start();
+  double slot_map_sum = 0;
+  for (const auto& value : slot_map) {
+    slot_map_sum += value.second.xyz.sum() + value.second.error;
+  }
+  const double slot_map_time = timer.ElapsedSeconds();
+
+  timer.Restart();
+  double hash_map_sum = 0;
+  for (const auto& value : hash_map) {
+    hash_map_sum += value.second.xyz.sum() + value.second.error;
+  }
+  const double hash_map_time = timer.ElapsedSeconds();
+
+  BOOST_TEST_MESSAGE("Iteration: " << slot_map_time << "s for SlotMap, "
+                                   << hash_map_time
+                                   << "s for std::unordered_map");
+  BOOST_CHECK_EQUAL(slot_map_sum, hash_map_sum);
+}
@@ -2,14 +2,24 @@
 #include <stdlib.h>
 #include <unistd.h>
 #include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <time.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/un.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <arpa/inet.h>
 #include <netdb.h>
 
 #include "socket.h"
 
+#include "util/endian.h"
+
 namespace mod {
 
   namespace {
@@ -39,10 +49,89 @@ namespace mod {
       (iss >> ... >> args);
       return !iss.fail();
     }
+
+    // Upper bound on the payload of a single frame, to detect corrupt streams.
+    const uint32_t kMaxFrameSize = 1U << 30;
+
+    // Number of bytes requested from the kernel per read.
+    const size_t kReadChunkSize = 64 * 1024;
+
+    // Outgoing data is flushed at the latest when this many bytes are pending.
+    const size_t kMaxWriteBufferSize = 256 * 1024;
+
+    // Maximum number of notifications that are sent before their
+    // acknowledgements are read.
+    const size_t kMaxBatchSize = 64;
+
+    // Serializes the fields of a binary frame in little-endian byte order.
+    class FrameWriter {
+    public:
+      explicit FrameWriter(MessageType type) {
+        Write(static_cast<uint8_t>(type));
+      }
+
+      template <typename T>
+      FrameWriter& Write(T value) {
+        value = colmap::NativeToLittleEndian(value);
+        payload.append(reinterpret_cast<const char*>(&value), sizeof(T));
+        return *this;
+      }
+
+      template <typename T>
+      FrameWriter& WriteArray(const std::vector<T>& values) {
+        Write(static_cast<uint32_t>(values.size()));
+        if (colmap::IsLittleEndian()) {
+          payload.append(reinterpret_cast<const char*>(values.data()),
+                         values.size() * sizeof(T));
+        } else {
+          for (const T& value : values) Write(value);
+        }
+        return *this;
+      }
+
+      const std::string& Payload() const {
+        return payload;
+      }
+
+    private:
+      std::string payload;
+    };
+
+    // Deserializes the fields of a binary reply. Reading past the end of the
+    // payload fails, which is how optional decision fields are detected.
+    class FrameReader {
+    public:
+      explicit FrameReader(const std::string& payload): payload(payload), offset(0) {}
+
+      template <typename T>
+      bool Read(T* value) {
+        if (offset + sizeof(T) > payload.size()) return false;
+        ::memcpy(value, payload.data() + offset, sizeof(T));
+        *value = colmap::LittleEndianToNative(*value);
+        offset += sizeof(T);
+        return true;
+      }
+
+      // Reads a uint8 flag, which is false if absent.
+      bool ReadFlag() {
+        uint8_t flag = 0;
+        return Read(&flag) && flag != 0;
+      }
+
+    private:
+      const std::string& payload;
+      size_t offset;
+    };
+  }
+
+  StreamTransport::StreamTransport(int sock): sock(sock) {}
+
+  StreamTransport::~StreamTransport() {
+    close();
   }
 
-  Socket::Socket(const std::string& address, int port): address(address), port(port) {
-    sock = ::socket(AF_INET, SOCK_STREAM, 0);
+  std::unique_ptr<StreamTransport> StreamTransport::ConnectTCP(const std::string& address, int port) {
+    int sock = ::socket(AF_INET, SOCK_STREAM, 0);
     struct sockaddr_in addr;
     ::memset(&addr, 0, sizeof(addr));
     addr.sin_port = htons(port);
@@ -50,68 +139,405 @@ namespace mod {
     ::inet_pton(AF_INET, address.c_str(), &addr.sin_addr);
     if (::connect(sock, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
       ::perror("connect failed");
-      close();
+      ::close(sock);
+      ::exit(255);
+    }
+    // Writes are batched in user space, so never let the kernel delay them.
+    int flag = 1;
+    ::setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &flag, sizeof(flag));
+    return std::unique_ptr<StreamTransport>(new StreamTransport(sock));
+  }
+
+  std::unique_ptr<StreamTransport> StreamTransport::ConnectUnix(const std::string& path) {
+    struct sockaddr_un addr;
+    ::memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(addr.sun_path)) {
+      ::fprintf(stderr, "connect failed: socket path too long: %s\n", path.c_str());
+      ::exit(255);
+    }
+    ::strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+    int sock = ::socket(AF_UNIX, SOCK_STREAM, 0);
+    if (::connect(sock, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+      ::perror("connect failed");
+      ::close(sock);
+      ::exit(255);
+    }
+    return std::unique_ptr<StreamTransport>(new StreamTransport(sock));
+  }
+
+  bool StreamTransport::connected() const {
+    return sock != -1;
+  }
+
+  ssize_t StreamTransport::write(const char* data, size_t size) {
+    return ::send(sock, data, size, MSG_NOSIGNAL);
+  }
+
+  ssize_t StreamTransport::read(char* data, size_t size) {
+    return ::recv(sock, data, size, 0);
+  }
+
+  void StreamTransport::close() {
+    if (sock != -1) {
+      ::close(sock);
+      sock = -1;
+    }
+  }
+
+#ifdef __linux__
+
+  SharedMemoryTransport::SharedMemoryTransport(SharedMemoryRegion* region, const std::string& name, bool owner):
+    region(region),
+    in(&region->rings[owner ? 0 : 1]),
+    out(&region->rings[owner ? 1 : 0]),
+    name(name),
+    owner(owner) {}
+
+  SharedMemoryTransport::~SharedMemoryTransport() {
+    close();
+  }
+
+  std::unique_ptr<SharedMemoryTransport> SharedMemoryTransport::Open(const std::string& name) {
+    int fd = ::shm_open(name.c_str(), O_RDWR, 0);
+    if (fd < 0) {
+      ::perror("shm_open failed");
+      ::exit(255);
+    }
+    // Accessing the region beyond the size of the object raises SIGBUS, e.g.,
+    // if the controller has not yet resized it.
+    struct stat st;
+    if (::fstat(fd, &st) < 0) {
+      ::perror("fstat failed");
+      ::close(fd);
+      ::exit(255);
+    }
+    if (static_cast<size_t>(st.st_size) < sizeof(SharedMemoryRegion)) {
+      ::fprintf(stderr, "shm_open failed: %s is not a controller region\n", name.c_str());
+      ::close(fd);
+      ::exit(255);
+    }
+    void* addr = ::mmap(nullptr, sizeof(SharedMemoryRegion), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (addr == MAP_FAILED) {
+      ::perror("mmap failed");
+      ::exit(255);
+    }
+    auto region = static_cast<SharedMemoryRegion*>(addr);
+    if (region->magic != SharedMemoryRegion::kMagic ||
+        region->version != SharedMemoryRegion::kVersion) {
+      ::fprintf(stderr, "shm_open failed: %s is not a controller region\n", name.c_str());
       ::exit(255);
     }
+    region->mapper_pid = ::getpid();
+    return std::unique_ptr<SharedMemoryTransport>(new SharedMemoryTransport(region, name, false));
+  }
+
+  std::unique_ptr<SharedMemoryTransport> SharedMemoryTransport::Create(const std::string& name) {
+    ::shm_unlink(name.c_str());
+    int fd = ::shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (fd < 0) {
+      ::perror("shm_open failed");
+      return nullptr;
+    }
+    if (::ftruncate(fd, sizeof(SharedMemoryRegion)) < 0) {
+      ::perror("ftruncate failed");
+      ::close(fd);
+      ::shm_unlink(name.c_str());
+      return nullptr;
+    }
+    void* addr = ::mmap(nullptr, sizeof(SharedMemoryRegion), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (addr == MAP_FAILED) {
+      ::perror("mmap failed");
+      ::shm_unlink(name.c_str());
+      return nullptr;
+    }
+    auto region = static_cast<SharedMemoryRegion*>(addr);
+    region->closed = 0;
+    region->controller_pid = ::getpid();
+    region->mapper_pid = 0;
+    for (SharedMemoryRing& ring : region->rings) {
+      ring.head = 0;
+      ring.tail = 0;
+      ::sem_init(&ring.readable, 1, 0);
+      ::sem_init(&ring.writable, 1, 0);
+    }
+    region->version = SharedMemoryRegion::kVersion;
+    std::atomic_thread_fence(std::memory_order_release);
+    region->magic = SharedMemoryRegion::kMagic;
+    return std::unique_ptr<SharedMemoryTransport>(new SharedMemoryTransport(region, name, true));
+  }
+
+  bool SharedMemoryTransport::connected() const {
+    return region != nullptr;
   }
 
+  bool SharedMemoryTransport::peer_attached() const {
+    return (owner ? region->mapper_pid : region->controller_pid) != 0;
+  }
+
+  bool SharedMemoryTransport::peer_alive() const {
+    const pid_t pid = owner ? region->mapper_pid : region->controller_pid;
+    return pid != 0 && (::kill(pid, 0) == 0 || errno != ESRCH);
+  }
+
+  bool SharedMemoryTransport::wait(sem_t* sem) {
+    while (true) {
+      if (region->closed) return false;
+      struct timespec deadline;
+      ::clock_gettime(CLOCK_REALTIME, &deadline);
+      deadline.tv_nsec += 100 * 1000 * 1000;
+      if (deadline.tv_nsec >= 1000 * 1000 * 1000) {
+        deadline.tv_sec += 1;
+        deadline.tv_nsec -= 1000 * 1000 * 1000;
+      }
+      if (::sem_timedwait(sem, &deadline) == 0) return true;
+      // Like a listening socket, the controller keeps waiting until the
+      // mapper attached to the region.
+      if (errno == ETIMEDOUT && (!owner || peer_attached()) && !peer_alive()) return false;
+    }
+  }
+
+  ssize_t SharedMemoryTransport::write(const char* data, size_t size) {
+    if (region == nullptr) {
+      errno = EBADF;
+      return -1;
+    }
+    while (true) {
+      const uint64_t head = out->head.load(std::memory_order_relaxed);
+      const uint64_t tail = out->tail.load(std::memory_order_acquire);
+      const size_t num_free = SharedMemoryRing::kCapacity - (head - tail);
+      if (num_free > 0) {
+        const size_t num_bytes = std::min(size, num_free);
+        const size_t begin = head % SharedMemoryRing::kCapacity;
+        const size_t num_first = std::min(num_bytes, SharedMemoryRing::kCapacity - begin);
+        ::memcpy(out->data + begin, data, num_first);
+        ::memcpy(out->data, data + num_first, num_bytes - num_first);
+        out->head.store(head + num_bytes, std::memory_order_release);
+        ::sem_post(&out->readable);
+        return num_bytes;
+      }
+      if (!wait(&out->writable)) {
+        errno = EPIPE;
+        return -1;
+      }
+    }
+  }
+
+  ssize_t SharedMemoryTransport::read(char* data, size_t size) {
+    if (region == nullptr) {
+      errno = EBADF;
+      return -1;
+    }
+    while (true) {
+      const uint64_t tail = in->tail.load(std::memory_order_relaxed);
+      const uint64_t head = in->head.load(std::memory_order_acquire);
+      if (head > tail) {
+        const size_t num_bytes = std::min<size_t>(size, head - tail);
+        const size_t begin = tail % SharedMemoryRing::kCapacity;
+        const size_t num_first = std::min(num_bytes, SharedMemoryRing::kCapacity - begin);
+        ::memcpy(data, in->data + begin, num_first);
+        ::memcpy(data + num_first, in->data, num_bytes - num_first);
+        in->tail.store(tail + num_bytes, std::memory_order_release);
+        ::sem_post(&in->writable);
+        return num_bytes;
+      }
+      if (!wait(&in->readable)) return 0;
+    }
+  }
+
+  void SharedMemoryTransport::close() {
+    if (region == nullptr) return;
+    region->closed = 1;
+    for (SharedMemoryRing& ring : region->rings) {
+      ::sem_post(&ring.readable);
+      ::sem_post(&ring.writable);
+    }
+    ::munmap(region, sizeof(SharedMemoryRegion));
+    region = nullptr;
+    if (owner) ::shm_unlink(name.c_str());
+  }
+
+#endif  // __linux__
+
+  std::unique_ptr<Transport> ConnectTransport(const std::string& endpoint) {
+    const size_t colon = endpoint.find(':');
+    const std::string scheme = endpoint.substr(0, colon);
+    const std::string target = colon == std::string::npos ? "" : endpoint.substr(colon + 1);
+    if (scheme == "tcp") {
+      const size_t port_colon = target.rfind(':');
+      int port;
+      if (port_colon != std::string::npos && Parse(target.substr(port_colon + 1), port)) {
+        return StreamTransport::ConnectTCP(target.substr(0, port_colon), port);
+      }
+    } else if (scheme == "unix" && !target.empty()) {
+      return StreamTransport::ConnectUnix(target);
+#ifdef __linux__
+    } else if (scheme == "shm" && !target.empty()) {
+      return SharedMemoryTransport::Open(target);
+#endif
+    }
+    ::fprintf(stderr, "connect failed: invalid endpoint: %s\n", endpoint.c_str());
+    ::exit(255);
+  }
+
+  Socket::Socket(std::unique_ptr<Transport> transport):
+    transport(std::move(transport)),
+    is_connected(this->transport->connected()),
+    read_offset(0) {}
+
+  Socket::Socket(const std::string& address, int port): Socket(StreamTransport::ConnectTCP(address, port)) {}
+
   Socket::~Socket() {
+    if (connected()) flush();
     close();
   }
 
   bool Socket::connected() const {
-    return sock != -1;
+    return is_connected;
   }
 
 
   bool Socket::send(const std::string& data) {
-    if (::send(sock, data.c_str(), data.length() + 1, 0) < 0) {
-      ::perror("send failed");
-      close();
-      ::exit(255);
-    }
+    write_buffer.append(data.c_str(), data.length() + 1);
+    if (write_buffer.size() >= kMaxWriteBufferSize) return flush();
     return true;
   }
 
   std::string Socket::recv() {
-    char buffer[512] = {};
+    flush();
     std::string reply;
     while (true) {
-      ssize_t len = ::recv(sock, buffer, sizeof(buffer) - 1, 0);
-      if (len == 0) {
-        close();
+      const size_t end = read_buffer.find('\0', read_offset);
+      if (end != std::string::npos) {
+        reply = read_buffer.substr(read_offset, end - read_offset);
+        read_offset = end + 1;
         break;
       }
+      if (!fill()) {
+        // Connection closed, return whatever arrived.
+        reply = read_buffer.substr(read_offset);
+        read_offset = read_buffer.size();
+        break;
+      }
+    }
+    return reply;
+  }
+
+  void Socket::close() {
+    is_connected = false;
+    transport->close();
+  }
+
+  bool Socket::flush() {
+    if (write_buffer.empty()) return true;
+    const char* data = write_buffer.data();
+    size_t size = write_buffer.size();
+    while (size > 0) {
+      ssize_t len = transport->write(data, size);
       if (len < 0) {
-        ::perror("recv failed");
+        ::perror("send failed");
         close();
         ::exit(255);
       }
-      buffer[len] = 0;
-      reply += buffer;
-      if (buffer[len - 1] == 0) break; // protocol
+      data += len;
+      size -= len;
     }
-    return reply;
+    write_buffer.clear();
+    return true;
   }
 
-  void Socket::close() {
-    if (sock != -1) {
-      ::close(sock);
-      sock = -1;
+  bool Socket::fill() {
+    // Drop consumed bytes, so the buffer only grows with unread data.
+    if (read_offset > 0) {
+      read_buffer.erase(0, read_offset);
+      read_offset = 0;
+    }
+    const size_t size = read_buffer.size();
+    read_buffer.resize(size + kReadChunkSize);
+    ssize_t len = transport->read(&read_buffer[size], kReadChunkSize);
+    if (len < 0) {
+      ::perror("recv failed");
+      close();
+      ::exit(255);
     }
+    read_buffer.resize(size + len);
+    if (len == 0) {
+      close();
+      return false;
+    }
+    return true;
+  }
+
+  bool Socket::recv_bytes(char* data, size_t size) {
+    flush();
+    while (read_buffer.size() - read_offset < size) {
+      if (!fill()) return false;
+    }
+    ::memcpy(data, read_buffer.data() + read_offset, size);
+    read_offset += size;
+    return true;
+  }
+
+  bool Socket::send_frame(const std::string& payload) {
+    const uint32_t size = colmap::NativeToLittleEndian(static_cast<uint32_t>(payload.size()));
+    write_buffer.append(reinterpret_cast<const char*>(&size), sizeof(size));
+    write_buffer.append(payload);
+    if (write_buffer.size() >= kMaxWriteBufferSize) return flush();
+    return true;
+  }
+
+  bool Socket::recv_frame(std::string* payload) {
+    uint32_t size;
+    if (!recv_bytes(reinterpret_cast<char*>(&size), sizeof(size))) return false;
+    size = colmap::LittleEndianToNative(size);
+    if (size > kMaxFrameSize) {
+      close();
+      return false;
+    }
+    payload->resize(size);
+    return size == 0 || recv_bytes(&(*payload)[0], size);
   }
 
 
-  TCPClient::TCPClient(const std::string& address, int port, bool normal_log, bool failure_log, bool major_log):
-    socket(address, port),
+  TCPClient::TCPClient(const std::string& address, int port, bool normal_log, bool failure_log, bool major_log, Protocol protocol, bool async):
+    TCPClient(StreamTransport::ConnectTCP(address, port), normal_log, failure_log, major_log, protocol, async) {}
+
+  TCPClient::TCPClient(std::unique_ptr<Transport> transport, bool normal_log, bool failure_log, bool major_log, Protocol protocol, bool async):
+    socket(std::move(transport)),
     normal_log(normal_log),
     failure_log(failure_log),
-    major_log(major_log)
+    major_log(major_log),
+    protocol(protocol),
+    async(false),
+    num_pending(0)
   {
-    if (socket.connected()) {
+    if (!socket.connected()) return;
+    if (protocol == Protocol::BINARY) {
+      socket.send(Concat("connected binary/", kBinaryProtocolVersion));
+      const std::string resp = socket.recv();
+      if (resp != Concat("acknowledge binary/", kBinaryProtocolVersion)) {
+        // The controller does not speak the binary protocol.
+        this->protocol = Protocol::TEXT;
+        if (resp != "acknowledge") socket.close();
+      }
+    } else {
       socket.send("connected");
       Validate("acknowledge");
     }
+    if (async && socket.connected()) {
+      this->async = true;
+      sender = std::thread(&TCPClient::SenderFunc, this);
+    }
+  }
+
+  TCPClient::~TCPClient() {
+    if (async) {
+      Flush();
+      outgoing.Stop();
+      sender.join();
+    }
   }
 
 
@@ -119,21 +545,108 @@ namespace mod {
     return socket.connected();
   }
 
+  Protocol TCPClient::NegotiatedProtocol() const {
+    return protocol;
+  }
+
   void TCPClient::Validate(const char* expected) {
     if (socket.recv() != expected) socket.close();
   }
 
+  void TCPClient::Deliver(const std::string& message) {
+    if (protocol == Protocol::BINARY) {
+      Exchange(message);
+    } else {
+      socket.send(message);
+      Validate("acknowledge");
+    }
+  }
+
+  void TCPClient::Notify(const std::string& message) {
+    if (!async) {
+      Deliver(message);
+      return;
+    }
+    {
+      std::unique_lock<std::mutex> lock(pending_mutex);
+      num_pending += 1;
+    }
+    outgoing.Push(message);
+  }
+
+  void TCPClient::Flush() {
+    if (!async) return;
+    std::unique_lock<std::mutex> lock(pending_mutex);
+    pending_condition.wait(lock, [this]() { return num_pending == 0; });
+  }
+
+  void TCPClient::DeliverBatch(const std::vector<std::string>& messages) {
+    if (protocol != Protocol::BINARY) {
+      for (const std::string& message : messages) Deliver(message);
+      return;
+    }
+    // Frames are self-delimiting, so all messages go out in one write and
+    // the acknowledgements are read afterwards.
+    for (const std::string& message : messages) socket.send_frame(message);
+    std::string reply;
+    for (size_t i = 0; i < messages.size(); ++i) {
+      if (!socket.recv_frame(&reply)) {
+        socket.close();
+        break;
+      }
+    }
+  }
+
+  void TCPClient::SenderFunc() {
+    std::vector<std::string> batch;
+    while (true) {
+      auto message = outgoing.Pop();
+      if (!message.IsValid()) break;
+      batch.clear();
+      batch.push_back(std::move(message.Data()));
+      while (batch.size() < kMaxBatchSize && outgoing.Size() > 0) {
+        message = outgoing.Pop();
+        if (!message.IsValid()) break;
+        batch.push_back(std::move(message.Data()));
+      }
+      DeliverBatch(batch);
+      {
+        std::unique_lock<std::mutex> lock(pending_mutex);
+        num_pending -= batch.size();
+      }
+      pending_condition.notify_all();
+    }
+  }
+
+  std::string TCPClient::Exchange(const std::string& payload) {
+    std::string reply;
+    if (!socket.send_frame(payload) || !socket.recv_frame(&reply)) {
+      socket.close();
+      reply.clear();
+    }
+    return reply;
+  }
+
 
   void TCPClient::BeginReconstruction(int num_init_trials) {
-    socket.send(Concat(
+    if (protocol == Protocol::BINARY) {
+      Notify(FrameWriter(MessageType::BEGIN_RECONSTRUCTION)
+                 .Write<int32_t>(num_init_trials).Payload());
+      return;
+    }
+    Notify(Concat(
       "[Begin Reconstruction]\n",
       "    This is ", num_init_trials + 1, "th initial trial.\n"
     ));
-    Validate("acknowledge");
   }
 
   bool TCPClient::Abort() {
     if (!normal_log && !major_log) return false;
+    Flush();
+    if (protocol == Protocol::BINARY) {
+      const std::string reply = Exchange(FrameWriter(MessageType::ABORT).Payload());
+      return FrameReader(reply).ReadFlag();
+    }
     socket.send(Concat(
       "[Abort]\n",
       "    Do you want to abort this reconstruction? y/n\n"
@@ -151,6 +664,18 @@ namespace mod {
 
   void TCPClient::FindInitialImagePair(uint32_t* img1, uint32_t* img2) {
     if (!normal_log && !major_log) return;
+    Flush();
+    if (protocol == Protocol::BINARY) {
+      const std::string reply = Exchange(FrameWriter(MessageType::FIND_INITIAL_IMAGE_PAIR)
+                                           .Write<uint32_t>(*img1).Write<uint32_t>(*img2).Payload());
+      FrameReader reader(reply);
+      uint32_t a, b;
+      if (reader.ReadFlag() && reader.Read(&a) && reader.Read(&b)) {
+        *img1 = a;
+        *img2 = b;
+      }
+      return;
+    }
     if (*img1 == ~0U || *img2 == ~0U) {
       socket.send(Concat(
         "[Find Initial Image Pair]\n",
@@ -179,26 +704,52 @@ namespace mod {
 
   void TCPClient::InitializeWithImagePair(uint32_t img1, uint32_t img2) {
     if (!normal_log) return;
-    socket.send(Concat(
+    if (protocol == Protocol::BINARY) {
+      Notify(FrameWriter(MessageType::INITIALIZE_WITH_IMAGE_PAIR)
+                 .Write<uint32_t>(img1).Write<uint32_t>(img2).Payload());
+      return;
+    }
+    Notify(Concat(
       "[Initialize With ImagePair]\n",
       "    To use pair #", img1, ", #", img2, ".\n"
     ));
-    Validate("acknowledge");
   }
 
   void TCPClient::FailInitialization(uint32_t img1, uint32_t img2, double min_tri_angle, int min_num_inliers) {
     if (!normal_log) return;
-    socket.send(Concat(
+    if (protocol == Protocol::BINARY) {
+      Notify(FrameWriter(MessageType::FAIL_INITIALIZATION)
+                 .Write<uint32_t>(img1).Write<uint32_t>(img2)
+                 .Write<double>(min_tri_angle).Write<int32_t>(min_num_inliers).Payload());
+      return;
+    }
+    Notify(Concat(
       "[Fail Initialization]\n",
       "    Used pair #", img1, ", #", img2, ".\n",
       "    Used min_tri_angle = ", min_tri_angle, ".\n",
       "    Used min_num_inliers = ", min_num_inliers, ".\n"
     ));
-    Validate("acknowledge");
   }
 
   bool TCPClient::RelaxAndRestart(int* min_num_inliers, double* min_tri_angle) {
     if (!normal_log) return false;
+    Flush();
+    if (protocol == Protocol::BINARY) {
+      const std::string reply = Exchange(FrameWriter(MessageType::RELAX_AND_RESTART)
+                                           .Write<double>(*min_tri_angle)
+                                           .Write<int32_t>(*min_num_inliers).Payload());
+      FrameReader reader(reply);
+      uint8_t action = 0;
+      reader.Read(&action);
+      if (action == 2) return false;
+      double b;
+      int32_t a;
+      if (action == 1 && reader.Read(&b) && reader.Read(&a)) {
+        *min_num_inliers = a;
+        *min_tri_angle = b;
+      }
+      return true;
+    }
     socket.send(Concat(
       "[Relax And Restart]\n",
       "    To use min_tri_angle = ", *min_tri_angle, ".\n",
@@ -231,40 +782,96 @@ namespace mod {
 
   void TCPClient::SucceedInitialRegistration(uint32_t img1, uint32_t img2, int num_reg_images, int num_points_3d) {
     if (!normal_log && !major_log) return;
-    socket.send(Concat(
+    if (protocol == Protocol::BINARY) {
+      Notify(FrameWriter(MessageType::SUCCEED_INITIAL_REGISTRATION)
+                 .Write<uint32_t>(img1).Write<uint32_t>(img2)
+                 .Write<int32_t>(num_reg_images).Write<int32_t>(num_points_3d).Payload());
+      return;
+    }
+    Notify(Concat(
       "[Succeed Initial Registration]{", img1, ",", img2, "}\n",
       "    Used pair #", img1, ", #", img2, ".\n",
       "    Registered images: ", num_reg_images, ".\n",
       "    Fused 3d points: ", num_points_3d, ".\n"
     ));
-    Validate("acknowledge");
   }
 
   void TCPClient::FailInitialRegistration(uint32_t img1, uint32_t img2, int num_reg_images, int num_points_3d) {
     if (!normal_log) return;
-    socket.send(Concat(
+    if (protocol == Protocol::BINARY) {
+      Notify(FrameWriter(MessageType::FAIL_INITIAL_REGISTRATION)
+                 .Write<uint32_t>(img1).Write<uint32_t>(img2)
+                 .Write<int32_t>(num_reg_images).Write<int32_t>(num_points_3d).Payload());
+      return;
+    }
+    Notify(Concat(
       "[Fail Initial Registration]{", img1, ",", img2, "}\n",
       "    Used pair #", img1, ", #", img2, ".\n",
       "    Registered images: ", num_reg_images, ".\n",
       "    Fused 3d points: ", num_points_3d, ".\n"
     ));
-    Validate("acknowledge");
+  }
+
+  void TCPClient::InitialImagePairTrials(const std::vector<InitialImagePairTrial>& trials, int best_trial) {
+    if (!normal_log && !major_log) return;
+    if (protocol == Protocol::BINARY) {
+      FrameWriter writer(MessageType::INITIAL_IMAGE_PAIR_TRIALS);
+      writer.Write<int32_t>(best_trial).Write<uint32_t>(trials.size());
+      for (const auto& trial : trials) {
+        writer.Write<uint32_t>(trial.img1).Write<uint32_t>(trial.img2)
+              .Write<uint8_t>(trial.success)
+              .Write<int32_t>(trial.num_reg_images).Write<int32_t>(trial.num_points_3d);
+      }
+      Notify(writer.Payload());
+      return;
+    }
+    std::string message = Concat(
+      "[Initial Image Pair Trials]\n",
+      "    Evaluated ", trials.size(), " pairs concurrently.\n"
+    );
+    for (const auto& trial : trials) {
+      message = Concat(message,
+        "    Pair #", trial.img1, ", #", trial.img2, ": ",
+        trial.success ? "succeeded" : "failed",
+        ", registered images: ", trial.num_reg_images,
+        ", fused 3d points: ", trial.num_points_3d, ".\n"
+      );
+    }
+    if (best_trial >= 0) {
+      message = Concat(message, "    Kept pair #", trials[best_trial].img1, ", #", trials[best_trial].img2, ".\n");
+    } else {
+      message = Concat(message, "    No pair succeeded.\n");
+    }
+    Notify(message);
   }
 
   void TCPClient::FindNextImages(const std::vector<uint32_t>& next_images) {
     if (!normal_log) return;
+    if (protocol == Protocol::BINARY) {
+      Notify(FrameWriter(MessageType::FIND_NEXT_IMAGES).WriteArray(next_images).Payload());
+      return;
+    }
     std::string ids = "";
     for (uint32_t id: next_images) ids = Concat(ids, id, ",");
     if (ids.length()) ids.pop_back();
-    socket.send(Concat(
+    Notify(Concat(
       "[Find Next Images]{", ids, "}\n",
       "    Next images to use: [", ids, "].\n"
     ));
-    Validate("acknowledge");
   }
 
   void TCPClient::RegisterNextImage(uint32_t* next_image_id, int num_reg_images) {
     if (!normal_log && !major_log) return;
+    Flush();
+    if (protocol == Protocol::BINARY) {
+      const std::string reply = Exchange(FrameWriter(MessageType::REGISTER_NEXT_IMAGE)
+                                           .Write<uint32_t>(*next_image_id)
+                                           .Write<int32_t>(num_reg_images).Payload());
+      FrameReader reader(reply);
+      uint32_t a;
+      if (reader.ReadFlag() && reader.Read(&a)) *next_image_id = a;
+      return;
+    }
     socket.send(Concat(
       "[Register Next Image]\n",
       "    ", num_reg_images, " images are already registered.\n",
@@ -283,28 +890,102 @@ namespace mod {
     Validate("acknowledge");
   }
 
-  void TCPClient::SucceedRegistration(uint32_t image_id, int num_reg_images, int num_points_3d) {
+  void TCPClient::RankNextImages(const std::vector<uint32_t>& next_images, int num_reg_images, std::vector<NextImageDecision>* decisions) {
+    decisions->clear();
     if (!normal_log && !major_log) return;
+    Flush();
+    if (protocol == Protocol::BINARY) {
+      const std::string reply = Exchange(FrameWriter(MessageType::RANK_NEXT_IMAGES)
+                                           .WriteArray(next_images)
+                                           .Write<int32_t>(num_reg_images).Payload());
+      FrameReader reader(reply);
+      uint32_t num_decisions = 0;
+      reader.Read(&num_decisions);
+      for (uint32_t i = 0; i < num_decisions; ++i) {
+        NextImageDecision decision;
+        int32_t min_num_inliers;
+        if (!reader.Read(&decision.image_id) || !reader.Read(&min_num_inliers) ||
+            !reader.Read(&decision.max_error)) {
+          decisions->clear();
+          break;
+        }
+        decision.min_num_inliers = min_num_inliers;
+        decisions->push_back(decision);
+      }
+      return;
+    }
+    std::string ids = "";
+    for (uint32_t id: next_images) ids = Concat(ids, id, ",");
+    if (ids.length()) ids.pop_back();
     socket.send(Concat(
+      "[Rank Next Images]{", ids, "}\n",
+      "    ", num_reg_images, " images are already registered.\n",
+      "    Candidates: [", ids, "].\n",
+      "    Do you want to mannually specify the order? ${image_id}[:${min_num_inliers}[:${max_error}]] ...\n",
+      "    Anything else for not.\n"
+    ));
+    std::istringstream resp { socket.recv() };
+    std::string token;
+    while (resp >> token) {
+      for (char& c : token) {
+        if (c == ':') c = ' ';
+      }
+      std::istringstream fields { token };
+      NextImageDecision decision;
+      fields >> decision.image_id;
+      if (!fields.eof()) fields >> decision.min_num_inliers;
+      if (!fields.eof()) fields >> decision.max_error;
+      if (fields.fail() || !fields.eof()) {
+        decisions->clear();
+        break;
+      }
+      decisions->push_back(decision);
+    }
+    if (decisions->empty()) {
+      socket.send("    Skip.\n");
+    } else {
+      socket.send(Concat("    Mannually specify ", decisions->size(), " images.\n"));
+    }
+    Validate("acknowledge");
+  }
+
+  void TCPClient::SucceedRegistration(uint32_t image_id, int num_reg_images, int num_points_3d) {
+    if (!normal_log && !major_log) return;
+    if (protocol == Protocol::BINARY) {
+      Notify(FrameWriter(MessageType::SUCCEED_REGISTRATION)
+                 .Write<uint32_t>(image_id).Write<int32_t>(num_reg_images)
+                 .Write<int32_t>(num_points_3d).Payload());
+      return;
+    }
+    Notify(Concat(
       "[Succeed Registration]{", image_id, "}\n",
       "    ", num_reg_images, " images are already registered.\n",
       "    ", num_points_3d, " 3d points are already fused.\n"
     ));
-    Validate("acknowledge");
   }
 
   void TCPClient::FailRegistration(uint32_t image_id, int num_reg_trials, int num_reg_images) {
     if (!normal_log && !major_log) return;
-    socket.send(Concat(
+    if (protocol == Protocol::BINARY) {
+      Notify(FrameWriter(MessageType::FAIL_REGISTRATION)
+                 .Write<uint32_t>(image_id).Write<int32_t>(num_reg_trials)
+                 .Write<int32_t>(num_reg_images).Payload());
+      return;
+    }
+    Notify(Concat(
       "[Fail Registration]{", image_id, "}\n",
       "    This is ", num_reg_trials + 1, "th register trial.\n",
       "    ", num_reg_images, " images are already registered.\n"
     ));
-    Validate("acknowledge");
   }
 
   bool TCPClient::GiveUp() {
     if (!normal_log && !major_log) return false;
+    Flush();
+    if (protocol == Protocol::BINARY) {
+      const std::string reply = Exchange(FrameWriter(MessageType::GIVE_UP).Payload());
+      return FrameReader(reply).ReadFlag();
+    }
     socket.send(Concat(
       "[Give Up]\n",
       "    Do you want to give up registering rest images? y/n\n",
@@ -325,12 +1006,23 @@ namespace mod {
     if (!normal_log && !major_log) return;
     if (*reg_next_success) return;
     if (*prev_reg_next_success) {
-      socket.send(Concat(
+      // The mapper retries anyway, so this is only a notification.
+      if (protocol == Protocol::BINARY) {
+        Notify(FrameWriter(MessageType::FAIL_ALL_REGISTRATION).Write<uint8_t>(0).Payload());
+        return;
+      }
+      Notify(Concat(
         "[Fail All Registration]\n",
         "    None of images can be registered.\n",
         "    It will retry after an Iterative Global Refinement.\n"
       ));
-      Validate("acknowledge");
+      return;
+    }
+    Flush();
+    if (protocol == Protocol::BINARY) {
+      const std::string reply = Exchange(FrameWriter(MessageType::FAIL_ALL_REGISTRATION)
+                                           .Write<uint8_t>(1).Payload());
+      if (FrameReader(reply).ReadFlag()) *prev_reg_next_success = true;
       return;
     }
     socket.send(Concat(
@@ -351,85 +1043,118 @@ namespace mod {
   }
 
   void TCPClient::EndReconstruction(int num_init_trials, int num_reg_images, int num_points_3d) {
-    socket.send(Concat(
+    if (protocol == Protocol::BINARY) {
+      Notify(FrameWriter(MessageType::END_RECONSTRUCTION)
+                 .Write<int32_t>(num_init_trials).Write<int32_t>(num_reg_images)
+                 .Write<int32_t>(num_points_3d).Payload());
+      return;
+    }
+    Notify(Concat(
       "[End Reconstruction]\n",
       "    This is ", num_init_trials + 1, "th initial trial.\n",
       "    ", num_reg_images, " images are registered.\n"
       "    ", num_points_3d, " 3d points are fused.\n"
     ));
-    Validate("acknowledge");
   }
 
   void TCPClient::FailDueToBadOverlap(uint32_t img1, uint32_t img2) {
     if (!failure_log) return;
-    socket.send(Concat(
+    if (protocol == Protocol::BINARY) {
+      Notify(FrameWriter(MessageType::FAIL_DUE_TO_BAD_OVERLAP)
+                 .Write<uint32_t>(img1).Write<uint32_t>(img2).Payload());
+      return;
+    }
+    Notify(Concat(
       "[Fail Due To Bad Overlap]{", img1, ",", img2, "}\n"
     ));
-    Validate("acknowledge");
   }
 
 
   void TCPClient::FailDueToLittleTriAngle(uint32_t img1, uint32_t img2) {
     if (!failure_log) return;
-    socket.send(Concat(
+    if (protocol == Protocol::BINARY) {
+      Notify(FrameWriter(MessageType::FAIL_DUE_TO_LITTLE_TRI_ANGLE)
+                 .Write<uint32_t>(img1).Write<uint32_t>(img2).Payload());
+      return;
+    }
+    Notify(Concat(
       "[Fail Due To Little Tri Angle]{", img1, ",", img2, "}\n"
     ));
-    Validate("acknowledge");
   }
 
   void TCPClient::FailDueToLittleVisible3DPoints(uint32_t img, const std::vector<double>& xys) {
     if (!failure_log) return;
+    if (protocol == Protocol::BINARY) {
+      Notify(FrameWriter(MessageType::FAIL_DUE_TO_LITTLE_VISIBLE_3D_POINTS)
+                 .Write<uint32_t>(img).WriteArray(xys).Payload());
+      return;
+    }
     std::string string_xys;
     for (double v : xys) {
       string_xys += ",";
       string_xys += std::to_string(static_cast<int>(v));
     }
-    socket.send(Concat(
+    Notify(Concat(
       "[Fail Due To Little Visible 3D Points]{", img, string_xys, "}\n"
     ));
-    Validate("acknowledge");
   }
 
   void TCPClient::FailDueToLittleTri2DPoints(uint32_t img, const std::vector<double>& xys) {
     if (!failure_log) return;
+    if (protocol == Protocol::BINARY) {
+      Notify(FrameWriter(MessageType::FAIL_DUE_TO_LITTLE_TRI_2D_POINTS)
+                 .Write<uint32_t>(img).WriteArray(xys).Payload());
+      return;
+    }
     std::string string_xys;
     for (double v : xys) {
       string_xys += ",";
       string_xys += std::to_string(static_cast<int>(v));
     }
-    socket.send(Concat(
+    Notify(Concat(
       "[Fail Due To Little Tri 2D Points]{", img, string_xys, "}\n"
     ));
-    Validate("acknowledge");
   }
 
   void TCPClient::FailDueToBadPoseEstimation(uint32_t img) {
     if (!failure_log) return;
-    socket.send(Concat(
+    if (protocol == Protocol::BINARY) {
+      Notify(FrameWriter(MessageType::FAIL_DUE_TO_BAD_POSE_ESTIMATION)
+                 .Write<uint32_t>(img).Payload());
+      return;
+    }
+    Notify(Concat(
       "[Fail Due To Bad Pose Estimation]{", img, "}\n"
     ));
-    Validate("acknowledge");
   }
 
   void TCPClient::FailDueToLittle2DInliers(uint32_t img, const std::vector<double>& xys) {
     if (!failure_log) return;
+    if (protocol == Protocol::BINARY) {
+      Notify(FrameWriter(MessageType::FAIL_DUE_TO_LITTLE_2D_INLIERS)
+                 .Write<uint32_t>(img).WriteArray(xys).Payload());
+      return;
+    }
     std::string string_xys;
     for (double v : xys) {
       string_xys += ",";
       string_xys += std::to_string(static_cast<int>(v));
     }
-    socket.send(Concat(
+    Notify(Concat(
       "[Fail Due To Little 2D Inliers]{", img, string_xys, "}\n"
     ));
-    Validate("acknowledge");
   }
 
   void TCPClient::FailDueToBadPoseRefinement(uint32_t img) {
     if (!failure_log) return;
-    socket.send(Concat(
+    if (protocol == Protocol::BINARY) {
+      Notify(FrameWriter(MessageType::FAIL_DUE_TO_BAD_POSE_REFINEMENT)
+                 .Write<uint32_t>(img).Payload());
+      return;
+    }
+    Notify(Concat(
       "[Fail Due To Bad Pose Refinement]{", img, "}\n"
     ));
-    Validate("acknowledge");
   }
 
 
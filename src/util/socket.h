@@ -1,40 +1,321 @@
 #ifndef TCP_CLIENT_H
 #define TCP_CLIENT_H
 
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
 #include <iostream>
+#include <memory>
+#include <mutex>
 #include <vector>
 #include <string>
 #include <sstream>
+#include <thread>
+
+#include <sys/types.h>
+#ifdef __linux__
+#include <semaphore.h>
+#endif
+
+#include "util/threading.h"
 
 namespace mod {
 
-class Socket {
+// Wire protocol spoken with the controller. The protocol is negotiated once
+// at connect time and stays fixed for the lifetime of the connection:
+//
+//   TEXT:   Every event is a human-readable, NUL-terminated string and every
+//           reply is one as well. Questions are followed by an echo of the
+//           decision and an "acknowledge" round-trip.
+//
+//   BINARY: The client sends "connected binary/1" instead of "connected". A
+//           controller that understands the binary protocol replies with
+//           "acknowledge binary/1", any other controller replies with
+//           "acknowledge" and the connection falls back to TEXT. After the
+//           handshake, both directions exchange length-prefixed frames:
+//
+//             uint32 payload_size | payload_size bytes of payload
+//
+//           A client payload starts with a uint8 `MessageType` followed by
+//           the raw little-endian fields of the event. Arrays are encoded as
+//           a uint32 element count followed by the elements. Every client
+//           frame is answered by exactly one reply frame. An empty reply is a
+//           plain acknowledgement; decision fields missing from a reply are
+//           treated as "no" / "skip".
+enum class Protocol {
+  TEXT = 0,
+  BINARY = 1,
+};
+
+// Version announced in the binary handshake.
+const int kBinaryProtocolVersion = 1;
+
+enum class MessageType : uint8_t {
+  // Payload: int32 num_init_trials.
+  BEGIN_RECONSTRUCTION = 1,
+  // Reply: uint8 abort.
+  ABORT = 2,
+  // Payload: uint32 img1, uint32 img2 (~0 if unspecified).
+  // Reply: uint8 specified, uint32 img1, uint32 img2.
+  FIND_INITIAL_IMAGE_PAIR = 3,
+  // Payload: uint32 img1, uint32 img2.
+  INITIALIZE_WITH_IMAGE_PAIR = 4,
+  // Payload: uint32 img1, uint32 img2, float64 min_tri_angle,
+  //          int32 min_num_inliers.
+  FAIL_INITIALIZATION = 5,
+  // Payload: float64 min_tri_angle, int32 min_num_inliers.
+  // Reply: uint8 action (0: continue, 1: override, 2: quit),
+  //        float64 min_tri_angle, int32 min_num_inliers (if override).
+  RELAX_AND_RESTART = 6,
+  // Payload: uint32 img1, uint32 img2, int32 num_reg_images,
+  //          int32 num_points_3d.
+  SUCCEED_INITIAL_REGISTRATION = 7,
+  FAIL_INITIAL_REGISTRATION = 8,
+  // Payload: uint32[] next_images.
+  FIND_NEXT_IMAGES = 9,
+  // Payload: uint32 next_image_id, int32 num_reg_images.
+  // Reply: uint8 specified, uint32 next_image_id.
+  REGISTER_NEXT_IMAGE = 10,
+  // Payload: uint32 image_id, int32 num_reg_images, int32 num_points_3d.
+  SUCCEED_REGISTRATION = 11,
+  // Payload: uint32 image_id, int32 num_reg_trials, int32 num_reg_images.
+  FAIL_REGISTRATION = 12,
+  // Reply: uint8 give_up.
+  GIVE_UP = 13,
+  // Payload: uint8 retried.
+  // Reply: uint8 force_retry (only evaluated if retried).
+  FAIL_ALL_REGISTRATION = 14,
+  // Payload: int32 num_init_trials, int32 num_reg_images,
+  //          int32 num_points_3d.
+  END_RECONSTRUCTION = 15,
+  // Payload: uint32 img1, uint32 img2.
+  FAIL_DUE_TO_BAD_OVERLAP = 16,
+  FAIL_DUE_TO_LITTLE_TRI_ANGLE = 17,
+  // Payload: uint32 img, float64[] xys.
+  FAIL_DUE_TO_LITTLE_VISIBLE_3D_POINTS = 18,
+  FAIL_DUE_TO_LITTLE_TRI_2D_POINTS = 19,
+  // Payload: uint32 img.
+  FAIL_DUE_TO_BAD_POSE_ESTIMATION = 20,
+  // Payload: uint32 img, float64[] xys.
+  FAIL_DUE_TO_LITTLE_2D_INLIERS = 21,
+  // Payload: uint32 img.
+  FAIL_DUE_TO_BAD_POSE_REFINEMENT = 22,
+  // Payload: uint32[] next_images, int32 num_reg_images.
+  // Reply: uint32 num_decisions, followed by num_decisions times
+  //        uint32 image_id, int32 min_num_inliers, float64 max_error.
+  RANK_NEXT_IMAGES = 23,
+  // Payload: int32 best_trial (-1 if none succeeded), uint32 num_trials,
+  //          followed by num_trials times uint32 img1, uint32 img2,
+  //          uint8 success, int32 num_reg_images, int32 num_points_3d.
+  INITIAL_IMAGE_PAIR_TRIALS = 24,
+};
+
+// Decision of the controller for one image in `RankNextImages`.
+struct NextImageDecision {
+  uint32_t image_id = 0;
+  // Registration options for this image, negative values keep the defaults.
+  int min_num_inliers = -1;
+  double max_error = -1;
+};
+
+// Outcome of one initial image pair evaluated in `InitialImagePairTrials`.
+struct InitialImagePairTrial {
+  uint32_t img1 = 0;
+  uint32_t img2 = 0;
+  bool success = false;
+  int num_reg_images = 0;
+  int num_points_3d = 0;
+};
+
+// Byte stream between the mapper and the controller. Implementations only
+// move bytes, message boundaries are handled by `Socket` on top of them.
+class Transport {
+public:
+  virtual ~Transport() = default;
+
+  virtual bool connected() const = 0;
+  // Write up to `size` bytes. Returns the number of written bytes, or -1 on
+  // error.
+  virtual ssize_t write(const char* data, size_t size) = 0;
+  // Read up to `size` bytes, blocking until at least one byte is available.
+  // Returns the number of read bytes, 0 if the peer closed, or -1 on error.
+  virtual ssize_t read(char* data, size_t size) = 0;
+  virtual void close() = 0;
+};
+
+// Transport over a connected stream socket file descriptor.
+class StreamTransport : public Transport {
 private:
   int sock;
-  std::string address;
-  int port;
 
 public:
+  explicit StreamTransport(int sock);
+  ~StreamTransport();
+  StreamTransport(const StreamTransport&) = delete;
+
+  // Connect over TCP or to a Unix domain socket. Exits the process if the
+  // connection cannot be established.
+  static std::unique_ptr<StreamTransport> ConnectTCP(const std::string& address, int port);
+  static std::unique_ptr<StreamTransport> ConnectUnix(const std::string& path);
+
+  bool connected() const override;
+  ssize_t write(const char* data, size_t size) override;
+  ssize_t read(char* data, size_t size) override;
+  void close() override;
+};
+
+#ifdef __linux__
+
+// Single-producer single-consumer byte ring in shared memory. `head` and
+// `tail` count the total number of written and read bytes, the semaphores
+// wake up a blocked reader or writer.
+struct SharedMemoryRing {
+  static const size_t kCapacity = 1 << 20;
+  std::atomic<uint64_t> head;
+  std::atomic<uint64_t> tail;
+  sem_t readable;
+  sem_t writable;
+  char data[kCapacity];
+};
+
+// Layout of a POSIX shared memory object used as transport. The controller
+// creates and initializes it (see `SharedMemoryTransport::Create`) and the
+// mapper attaches to it by name.
+struct SharedMemoryRegion {
+  static const uint32_t kMagic = 0x434d4150;  // "CMAP"
+  static const uint32_t kVersion = 1;
+  uint32_t magic;
+  uint32_t version;
+  std::atomic<uint32_t> closed;
+  std::atomic<int32_t> controller_pid;
+  std::atomic<int32_t> mapper_pid;
+  // Ring 0 carries data from the mapper to the controller, ring 1 back.
+  SharedMemoryRing rings[2];
+};
+
+// Transport through two ring buffers in shared memory, for controllers
+// running on the same machine. Avoids the loopback network stack entirely.
+class SharedMemoryTransport : public Transport {
+private:
+  SharedMemoryRegion* region;
+  SharedMemoryRing* in;
+  SharedMemoryRing* out;
+  std::string name;
+  bool owner;
+
+  SharedMemoryTransport(SharedMemoryRegion* region, const std::string& name, bool owner);
+  // Wait on a semaphore of the peer. Returns false if the peer is gone.
+  bool wait(sem_t* sem);
+  // Whether the peer stored its pid in the region and whether it still runs.
+  bool peer_attached() const;
+  bool peer_alive() const;
+
+public:
+  ~SharedMemoryTransport();
+  SharedMemoryTransport(const SharedMemoryTransport&) = delete;
+
+  // Attach to the region created by the controller. Exits the process if
+  // the region does not exist.
+  static std::unique_ptr<SharedMemoryTransport> Open(const std::string& name);
+  // Create and initialize a region, which is removed again on close. This is
+  // the controller side of the transport.
+  static std::unique_ptr<SharedMemoryTransport> Create(const std::string& name);
+
+  bool connected() const override;
+  ssize_t write(const char* data, size_t size) override;
+  ssize_t read(char* data, size_t size) override;
+  void close() override;
+};
+
+#endif  // __linux__
+
+// Connect to a controller endpoint, which is one of
+//
+//   tcp:<address>:<port>
+//   unix:<path>
+//   shm:<name>       (Linux only)
+//
+// Exits the process if the endpoint is invalid or cannot be reached.
+std::unique_ptr<Transport> ConnectTransport(const std::string& endpoint);
+
+class Socket {
+private:
+  std::unique_ptr<Transport> transport;
+  // Whether the transport is still open. This is atomic, since the sender
+  // thread of an asynchronous client closes the socket on failure, while
+  // the caller's thread may query the state at the same time.
+  std::atomic<bool> is_connected;
+
+public:
+  explicit Socket(std::unique_ptr<Transport> transport);
   Socket(const std::string& address, int port);
   ~Socket();
   Socket(const Socket&) = delete;
-  
+
   bool connected() const;
   bool send(const std::string& data);
   std::string recv();
   void close();
+
+  // Length-prefixed frames of the binary protocol.
+  bool send_frame(const std::string& payload);
+  bool recv_frame(std::string* payload);
+
+  // Write all pending outgoing data. Sends are buffered and only hit the
+  // wire on flush, when the buffer is full, or before the next receive, so
+  // consecutive messages without a reply in between share one syscall.
+  bool flush();
+
+private:
+  // Incoming data is read in large chunks and split at message boundaries
+  // here, so that coalesced or fragmented TCP segments are handled.
+  std::string read_buffer;
+  size_t read_offset;
+  std::string write_buffer;
+
+  // Read more data into the read buffer. Returns false if the peer closed.
+  bool fill();
+  bool recv_bytes(char* data, size_t size);
 };
 
+// Client of the controller. Events are either notifications, which only need
+// to be acknowledged, or decisions, which wait for the controller's answer:
+// Abort, FindInitialImagePair, RelaxAndRestart, RegisterNextImage,
+// RankNextImages, GiveUp, and FailAllRegistration after the final retry.
+//
+// In asynchronous mode, notifications are queued and delivered by a sender
+// thread, so the caller does not wait for the acknowledgement round-trip.
+// Decisions first wait for all queued notifications to be acknowledged, so
+// the controller always observes the events in order.
 class TCPClient {
 private:
   Socket socket;
   bool normal_log, failure_log, major_log;
+  Protocol protocol;
+  bool async;
+  std::thread sender;
+  colmap::JobQueue<std::string> outgoing;
+  std::mutex pending_mutex;
+  std::condition_variable pending_condition;
+  size_t num_pending;
   void Validate(const char* expected);
+  std::string Exchange(const std::string& payload);
+  // Send a message and wait for its acknowledgement.
+  void Deliver(const std::string& message);
+  void DeliverBatch(const std::vector<std::string>& messages);
+  // Deliver a notification, either directly or through the sender thread.
+  void Notify(const std::string& message);
+  // Wait until all queued notifications are acknowledged.
+  void Flush();
+  void SenderFunc();
 
 public:
-  TCPClient(const std::string& address, int port, bool normal_log = true, bool failure_log = true, bool major_log = true);
+  TCPClient(const std::string& address, int port, bool normal_log = true, bool failure_log = true, bool major_log = true, Protocol protocol = Protocol::TEXT, bool async = false);
+  TCPClient(std::unique_ptr<Transport> transport, bool normal_log = true, bool failure_log = true, bool major_log = true, Protocol protocol = Protocol::TEXT, bool async = false);
+  ~TCPClient();
   TCPClient(const TCPClient&) = delete;
   bool Connected() const;
+  Protocol NegotiatedProtocol() const;
 
   void BeginReconstruction(int num_init_trials);
   bool Abort();
@@ -44,8 +325,15 @@ public:
   bool RelaxAndRestart(int* min_num_inliers, double* min_tri_angle);
   void SucceedInitialRegistration(uint32_t img1, uint32_t img2, int num_reg_images, int num_points_3d);
   void FailInitialRegistration(uint32_t img1, uint32_t img2, int num_reg_images, int num_points_3d);
+  // Report all initial image pairs that were evaluated concurrently, where
+  // `best_trial` is the index of the kept seed or -1 if none succeeded.
+  void InitialImagePairTrials(const std::vector<InitialImagePairTrial>& trials, int best_trial);
   void FindNextImages(const std::vector<uint32_t>& next_images);
   void RegisterNextImage(uint32_t* next_image_id, int num_reg_images);
+  // Let the controller order the candidates of FindNextImages and choose
+  // per-image registration options in a single round-trip. An empty result
+  // means that the controller keeps the mapper's order.
+  void RankNextImages(const std::vector<uint32_t>& next_images, int num_reg_images, std::vector<NextImageDecision>* decisions);
   void SucceedRegistration(uint32_t image_id, int num_reg_images, int num_points_3d);
   void FailRegistration(uint32_t image_id, int num_reg_trials, int num_reg_images);
   bool GiveUp();
@@ -63,4 +351,4 @@ public:
 
 } // namespace mod
 
-#endif
\ No newline at end of file
+#endif
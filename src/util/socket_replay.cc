@@ -0,0 +1,307 @@
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include <algorithm>
+#include <thread>
+
+#include "socket_replay.h"
+
+#include "util/endian.h"
+
+namespace mod {
+
+  namespace {
+    const char kSessionMagic[8] = {'C', 'M', 'A', 'P', 'S', 'E', 'S', '1'};
+
+    template <typename T>
+    void WriteValue(std::ostream& stream, T value) {
+      value = colmap::NativeToLittleEndian(value);
+      stream.write(reinterpret_cast<const char*>(&value), sizeof(T));
+    }
+
+    template <typename T>
+    bool ReadValue(std::istream& stream, T* value) {
+      if (!stream.read(reinterpret_cast<char*>(value), sizeof(T))) return false;
+      *value = colmap::LittleEndianToNative(*value);
+      return true;
+    }
+
+    uint64_t Microseconds(std::chrono::steady_clock::duration duration) {
+      return std::chrono::duration_cast<std::chrono::microseconds>(duration).count();
+    }
+
+    double Seconds(std::chrono::steady_clock::duration duration) {
+      return std::chrono::duration<double>(duration).count();
+    }
+
+    // Length of the message at `offset` of a recorded stream, including its
+    // delimiter or length prefix, or 0 if the stream ends before it is
+    // complete.
+    size_t MessageLength(const std::string& stream, size_t offset, bool text) {
+      if (text) {
+        const size_t end = stream.find('\0', offset);
+        return end == std::string::npos ? 0 : end + 1 - offset;
+      }
+      if (offset + sizeof(uint32_t) > stream.size()) return 0;
+      uint32_t size;
+      ::memcpy(&size, stream.data() + offset, sizeof(size));
+      size = colmap::LittleEndianToNative(size);
+      if (offset + sizeof(uint32_t) + size > stream.size()) return 0;
+      return sizeof(uint32_t) + size;
+    }
+  }
+
+  bool ReadSession(const std::string& path, std::vector<RecordedChunk>* chunks) {
+    chunks->clear();
+    std::ifstream file(path, std::ios::binary);
+    char magic[sizeof(kSessionMagic)];
+    if (!file.read(magic, sizeof(magic)) ||
+        ::memcmp(magic, kSessionMagic, sizeof(magic)) != 0) {
+      return false;
+    }
+    while (file.peek() != std::ifstream::traits_type::eof()) {
+      RecordedChunk chunk;
+      uint8_t direction;
+      uint32_t size;
+      if (!ReadValue(file, &direction) || !ReadValue(file, &chunk.time_us) ||
+          !ReadValue(file, &chunk.wait_us) || !ReadValue(file, &size)) {
+        return false;
+      }
+      chunk.direction = static_cast<Direction>(direction);
+      chunk.data.resize(size);
+      if (!file.read(&chunk.data[0], size)) return false;
+      chunks->push_back(std::move(chunk));
+    }
+    return true;
+  }
+
+  RecordingTransport::RecordingTransport(std::unique_ptr<Transport> transport, const std::string& path):
+    transport(std::move(transport)),
+    file(path, std::ios::binary | std::ios::trunc),
+    start(std::chrono::steady_clock::now())
+  {
+    if (!file.is_open()) {
+      ::fprintf(stderr, "record failed: cannot open %s\n", path.c_str());
+      return;
+    }
+    file.write(kSessionMagic, sizeof(kSessionMagic));
+  }
+
+  void RecordingTransport::record(Direction direction, const char* data, ssize_t size,
+                                  std::chrono::steady_clock::time_point call_start) {
+    if (size <= 0) return;
+    const auto now = std::chrono::steady_clock::now();
+    std::lock_guard<std::mutex> lock(file_mutex);
+    WriteValue<uint8_t>(file, static_cast<uint8_t>(direction));
+    WriteValue<uint64_t>(file, Microseconds(now - start));
+    WriteValue<uint64_t>(file, Microseconds(now - call_start));
+    WriteValue<uint32_t>(file, static_cast<uint32_t>(size));
+    file.write(data, size);
+  }
+
+  bool RecordingTransport::connected() const {
+    return transport->connected();
+  }
+
+  ssize_t RecordingTransport::write(const char* data, size_t size) {
+    const auto call_start = std::chrono::steady_clock::now();
+    const ssize_t num_written = transport->write(data, size);
+    record(Direction::TO_CONTROLLER, data, num_written, call_start);
+    return num_written;
+  }
+
+  ssize_t RecordingTransport::read(char* data, size_t size) {
+    const auto call_start = std::chrono::steady_clock::now();
+    const ssize_t num_read = transport->read(data, size);
+    record(Direction::TO_MAPPER, data, num_read, call_start);
+    return num_read;
+  }
+
+  void RecordingTransport::close() {
+    transport->close();
+    std::lock_guard<std::mutex> lock(file_mutex);
+    file.flush();
+  }
+
+  bool SplitSession(const std::vector<RecordedChunk>& chunks,
+                    std::vector<RecordedExchange>* exchanges, Protocol* protocol) {
+    exchanges->clear();
+    *protocol = Protocol::TEXT;
+
+    std::string requests;
+    std::string replies;
+    // Offset of every read in the reply stream and the time it blocked.
+    std::vector<std::pair<size_t, uint64_t>> reads;
+    for (const auto& chunk : chunks) {
+      if (chunk.direction == Direction::TO_CONTROLLER) {
+        requests += chunk.data;
+      } else {
+        reads.emplace_back(replies.size(), chunk.wait_us);
+        replies += chunk.data;
+      }
+    }
+
+    // Pair up the messages, the handshake is always text.
+    std::vector<size_t> reply_offsets;
+    size_t request_offset = 0;
+    size_t reply_offset = 0;
+    while (true) {
+      const bool text = exchanges->empty() || *protocol == Protocol::TEXT;
+      const size_t request_length = MessageLength(requests, request_offset, text);
+      const size_t reply_length = MessageLength(replies, reply_offset, text);
+      if (request_length == 0 || reply_length == 0) break;
+      RecordedExchange exchange;
+      exchange.request = requests.substr(request_offset, request_length);
+      exchange.reply = replies.substr(reply_offset, reply_length);
+      if (exchanges->empty() && exchange.reply ==
+          "acknowledge binary/" + std::to_string(kBinaryProtocolVersion) + '\0') {
+        *protocol = Protocol::BINARY;
+      }
+      exchanges->push_back(std::move(exchange));
+      reply_offsets.push_back(reply_offset);
+      request_offset += request_length;
+      reply_offset += reply_length;
+    }
+
+    // Attribute the blocked time of each read to the reply it started.
+    for (const auto& read : reads) {
+      const auto it = std::upper_bound(reply_offsets.begin(), reply_offsets.end(), read.first);
+      if (it == reply_offsets.begin()) continue;
+      const size_t index = it - reply_offsets.begin() - 1;
+      if (index < exchanges->size()) (*exchanges)[index].wait_us += read.second;
+    }
+
+    return !exchanges->empty();
+  }
+
+  ReplayServer::ReplayServer(const std::vector<RecordedChunk>& chunks, bool emulate_wait):
+    protocol(Protocol::TEXT),
+    emulate_wait(emulate_wait),
+    listen_sock(-1),
+    port(-1)
+  {
+    SplitSession(chunks, &exchanges, &protocol);
+  }
+
+  ReplayServer::~ReplayServer() {
+    if (listen_sock != -1) ::close(listen_sock);
+    if (!unix_path.empty()) ::unlink(unix_path.c_str());
+  }
+
+  bool ReplayServer::valid() const {
+    return !exchanges.empty();
+  }
+
+  bool ReplayServer::ListenTCP(int port) {
+    listen_sock = ::socket(AF_INET, SOCK_STREAM, 0);
+    int flag = 1;
+    ::setsockopt(listen_sock, SOL_SOCKET, SO_REUSEADDR, &flag, sizeof(flag));
+    struct sockaddr_in addr;
+    ::memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    ::inet_pton(AF_INET, "127.0.0.1", &addr.sin_addr);
+    if (::bind(listen_sock, (struct sockaddr*)&addr, sizeof(addr)) < 0 ||
+        ::listen(listen_sock, 1) < 0) {
+      ::perror("listen failed");
+      return false;
+    }
+    socklen_t addr_len = sizeof(addr);
+    ::getsockname(listen_sock, (struct sockaddr*)&addr, &addr_len);
+    this->port = ntohs(addr.sin_port);
+    return true;
+  }
+
+  bool ReplayServer::ListenUnix(const std::string& path) {
+    struct sockaddr_un addr;
+    ::memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(addr.sun_path)) {
+      ::fprintf(stderr, "listen failed: socket path too long: %s\n", path.c_str());
+      return false;
+    }
+    ::strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+    ::unlink(path.c_str());
+    listen_sock = ::socket(AF_UNIX, SOCK_STREAM, 0);
+    if (::bind(listen_sock, (struct sockaddr*)&addr, sizeof(addr)) < 0 ||
+        ::listen(listen_sock, 1) < 0) {
+      ::perror("listen failed");
+      return false;
+    }
+    unix_path = path;
+    return true;
+  }
+
+  int ReplayServer::Port() const {
+    return port;
+  }
+
+  ReplayStats ReplayServer::Serve() {
+    ReplayStats stats;
+    const int sock = ::accept(listen_sock, nullptr, nullptr);
+    if (sock < 0) {
+      stats.matched = false;
+      return stats;
+    }
+    const auto start = std::chrono::steady_clock::now();
+
+    std::string buffer;
+    auto fill = [&]() {
+      char chunk[64 * 1024];
+      const ssize_t num_read = ::recv(sock, chunk, sizeof(chunk), 0);
+      if (num_read <= 0) return false;
+      buffer.append(chunk, num_read);
+      return true;
+    };
+
+    for (const auto& exchange : exchanges) {
+      const bool text = stats.num_messages == 0 || protocol == Protocol::TEXT;
+      size_t length;
+      while ((length = MessageLength(buffer, 0, text)) == 0) {
+        if (!fill()) break;
+      }
+      if (length == 0 || buffer.compare(0, length, exchange.request) != 0) {
+        stats.matched = false;
+        break;
+      }
+      buffer.erase(0, length);
+      const auto received = std::chrono::steady_clock::now();
+
+      if (emulate_wait) {
+        std::this_thread::sleep_for(std::chrono::microseconds(exchange.wait_us));
+      }
+      size_t num_sent = 0;
+      while (num_sent < exchange.reply.size()) {
+        const ssize_t n = ::send(sock, exchange.reply.data() + num_sent,
+                                 exchange.reply.size() - num_sent, MSG_NOSIGNAL);
+        if (n <= 0) break;
+        num_sent += n;
+      }
+
+      const double latency = Seconds(std::chrono::steady_clock::now() - received);
+      stats.latencies.push_back(latency);
+      stats.reply_time += latency;
+      stats.recorded_blocked_time += exchange.wait_us * 1e-6;
+      stats.num_messages += 1;
+      if (num_sent < exchange.reply.size()) {
+        stats.matched = false;
+        break;
+      }
+    }
+
+    // The mapper must not send anything beyond the recording.
+    if (stats.matched && (!buffer.empty() || fill())) {
+      stats.matched = false;
+    }
+
+    stats.total_time = Seconds(std::chrono::steady_clock::now() - start);
+    ::close(sock);
+    return stats;
+  }
+
+} // namespace mod
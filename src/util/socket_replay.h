@@ -0,0 +1,139 @@
+#ifndef TCP_CLIENT_REPLAY_H
+#define TCP_CLIENT_REPLAY_H
+
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "util/socket.h"
+
+namespace mod {
+
+// Recorded sessions are stored as the raw byte stream moved by the transport
+// of the mapper, so that they are independent of the protocol and the
+// buffering of `Socket`. A session file starts with the 8 byte magic
+// "CMAPSES1", followed by one record per transport call:
+//
+//   uint8 direction | uint64 time_us | uint64 wait_us | uint32 size | data
+//
+// All integers are little-endian. `time_us` is the time since the start of
+// the session and `wait_us` the time the mapper spent inside the call, i.e.
+// blocked on the controller for reads.
+enum class Direction : uint8_t {
+  TO_CONTROLLER = 0,
+  TO_MAPPER = 1,
+};
+
+struct RecordedChunk {
+  Direction direction = Direction::TO_CONTROLLER;
+  uint64_t time_us = 0;
+  uint64_t wait_us = 0;
+  std::string data;
+};
+
+// Read all records of a session file. Returns false if the file cannot be
+// read or is not a session file.
+bool ReadSession(const std::string& path, std::vector<RecordedChunk>* chunks);
+
+// Transport that forwards to another transport and records the session to
+// a file for `ReplayServer`.
+class RecordingTransport : public Transport {
+private:
+  std::unique_ptr<Transport> transport;
+  std::ofstream file;
+  std::mutex file_mutex;
+  std::chrono::steady_clock::time_point start;
+
+  void record(Direction direction, const char* data, ssize_t size,
+              std::chrono::steady_clock::time_point call_start);
+
+public:
+  RecordingTransport(std::unique_ptr<Transport> transport, const std::string& path);
+  RecordingTransport(const RecordingTransport&) = delete;
+
+  bool connected() const override;
+  ssize_t write(const char* data, size_t size) override;
+  ssize_t read(char* data, size_t size) override;
+  void close() override;
+};
+
+// One message of a recorded session and the controller's reply to it, both
+// including their delimiter or length prefix.
+struct RecordedExchange {
+  std::string request;
+  std::string reply;
+  // Time the mapper was blocked on the controller for the reply.
+  uint64_t wait_us = 0;
+};
+
+// Split a recorded session into request/reply pairs. Every message of the
+// mapper is answered by exactly one reply in both protocols, the protocol
+// itself is taken from the recorded handshake. Returns false if the
+// recording is truncated or corrupt.
+bool SplitSession(const std::vector<RecordedChunk>& chunks,
+                  std::vector<RecordedExchange>* exchanges, Protocol* protocol);
+
+struct ReplayStats {
+  // Whether the mapper sent exactly the recorded messages. The replay stops
+  // at the first mismatch.
+  bool matched = true;
+  // Number of replayed request/reply pairs.
+  size_t num_messages = 0;
+  // Per message, time between receiving the complete request and sending
+  // the reply, in seconds.
+  std::vector<double> latencies;
+  // Total time the stand-in controller took to reply, i.e., the sum of the
+  // latencies, in seconds. This is measured by the server and excludes the
+  // transport, so the mapper is blocked at least as long. Record the replayed
+  // session with `RecordingTransport` to measure the blocked time of the
+  // mapper itself.
+  double reply_time = 0;
+  // Total time the mapper was blocked on the controller during the recording,
+  // in seconds.
+  double recorded_blocked_time = 0;
+  // Time from accepting the connection until the mapper disconnected.
+  double total_time = 0;
+};
+
+// Stand-in controller that replays the decisions of a recorded session
+// deterministically. Each request of the mapper is checked against the
+// recording and answered with the recorded reply, so that the mapper can be
+// benchmarked with the controller in the loop but without a live process.
+// With `emulate_wait`, each reply is delayed by the time the mapper waited
+// for it during the recording, which reproduces the controller overhead.
+class ReplayServer {
+private:
+  std::vector<RecordedExchange> exchanges;
+  Protocol protocol;
+  bool emulate_wait;
+  int listen_sock;
+  int port;
+  std::string unix_path;
+
+public:
+  ReplayServer(const std::vector<RecordedChunk>& chunks, bool emulate_wait = false);
+  ~ReplayServer();
+  ReplayServer(const ReplayServer&) = delete;
+
+  // Whether the recording could be split into messages.
+  bool valid() const;
+
+  // Listen on a loopback TCP port, where 0 picks an ephemeral port, or on a
+  // Unix domain socket. The mapper connects to `tcp:127.0.0.1:<Port()>` or
+  // `unix:<path>` respectively.
+  bool ListenTCP(int port = 0);
+  bool ListenUnix(const std::string& path);
+  int Port() const;
+
+  // Accept a single mapper connection and replay the session until the
+  // mapper disconnects, the recording ends, or the mapper diverges.
+  ReplayStats Serve();
+};
+
+} // namespace mod
+
+#endif
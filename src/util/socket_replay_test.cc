@@ -0,0 +1,194 @@
+#define TEST_NAME "util/socket_replay"
+#include "util/testing.h"
+
+#include <cstring>
+#include <deque>
+#include <future>
+#include <thread>
+
+#include <boost/filesystem.hpp>
+
+#include "util/endian.h"
+#include "util/socket_replay.h"
+
+using namespace colmap;
+
+namespace {
+
+// Transport that answers every read with the next scripted reply, standing
+// in for a live controller while recording.
+class ScriptedTransport : public mod::Transport {
+ public:
+  explicit ScriptedTransport(const std::vector<std::string>& replies)
+      : replies_(replies.begin(), replies.end()) {}
+
+  bool connected() const override { return connected_; }
+
+  ssize_t write(const char*, size_t size) override {
+    return connected_ ? static_cast<ssize_t>(size) : -1;
+  }
+
+  ssize_t read(char* data, size_t size) override {
+    if (!connected_ || replies_.empty()) return 0;
+    std::string& reply = replies_.front();
+    const size_t num_read = std::min(size, reply.size());
+    ::memcpy(data, reply.data(), num_read);
+    reply.erase(0, num_read);
+    if (reply.empty()) replies_.pop_front();
+    return static_cast<ssize_t>(num_read);
+  }
+
+  void close() override { connected_ = false; }
+
+ private:
+  std::deque<std::string> replies_;
+  bool connected_ = true;
+};
+
+template <typename T>
+std::string Encode(T value) {
+  value = NativeToLittleEndian(value);
+  return std::string(reinterpret_cast<const char*>(&value), sizeof(T));
+}
+
+std::string Frame(const std::string& payload) {
+  return Encode<uint32_t>(payload.size()) + payload;
+}
+
+std::string Text(const std::string& message) {
+  return std::string(message.c_str(), message.size() + 1);
+}
+
+std::string SessionPath() {
+  return (boost::filesystem::temp_directory_path() /
+          boost::filesystem::unique_path("colmap-session-%%%%%%%%"))
+      .string();
+}
+
+// Record a binary session with one notification and one decision.
+std::vector<mod::RecordedChunk> RecordBinarySession() {
+  const std::string path = SessionPath();
+  {
+    std::unique_ptr<mod::Transport> transport(new ScriptedTransport(
+        {Text("acknowledge binary/1"), Frame(""), Frame(Encode<uint8_t>(1))}));
+    mod::TCPClient client(std::unique_ptr<mod::Transport>(
+                              new mod::RecordingTransport(std::move(transport),
+                                                          path)),
+                          true, true, true, mod::Protocol::BINARY);
+    client.SucceedRegistration(3, 10, 200);
+    BOOST_CHECK(client.GiveUp());
+  }
+  std::vector<mod::RecordedChunk> chunks;
+  BOOST_CHECK(mod::ReadSession(path, &chunks));
+  boost::filesystem::remove(path);
+  return chunks;
+}
+
+}  // namespace
+
+BOOST_AUTO_TEST_CASE(TestRecordSession) {
+  const std::vector<mod::RecordedChunk> chunks = RecordBinarySession();
+  BOOST_CHECK(!chunks.empty());
+  BOOST_CHECK(chunks.front().direction == mod::Direction::TO_CONTROLLER);
+  BOOST_CHECK_EQUAL(chunks.front().data, Text("connected binary/1"));
+
+  std::vector<mod::RecordedExchange> exchanges;
+  mod::Protocol protocol;
+  BOOST_CHECK(mod::SplitSession(chunks, &exchanges, &protocol));
+  BOOST_CHECK(protocol == mod::Protocol::BINARY);
+  BOOST_CHECK_EQUAL(exchanges.size(), 3);
+  BOOST_CHECK_EQUAL(exchanges[0].reply, Text("acknowledge binary/1"));
+  BOOST_CHECK_EQUAL(
+      exchanges[1].request,
+      Frame(Encode<uint8_t>(static_cast<uint8_t>(
+                mod::MessageType::SUCCEED_REGISTRATION)) +
+            Encode<uint32_t>(3) + Encode<int32_t>(10) + Encode<int32_t>(200)));
+  BOOST_CHECK_EQUAL(exchanges[1].reply, Frame(""));
+  BOOST_CHECK_EQUAL(exchanges[2].reply, Frame(Encode<uint8_t>(1)));
+}
+
+BOOST_AUTO_TEST_CASE(TestReplaySession) {
+  mod::ReplayServer server(RecordBinarySession());
+  BOOST_CHECK(server.valid());
+  BOOST_CHECK(server.ListenTCP());
+  std::future<mod::ReplayStats> stats =
+      std::async(std::launch::async, [&]() { return server.Serve(); });
+
+  {
+    mod::TCPClient client("127.0.0.1", server.Port(), true, true, true,
+                          mod::Protocol::BINARY, true);
+    BOOST_CHECK(client.NegotiatedProtocol() == mod::Protocol::BINARY);
+    client.SucceedRegistration(3, 10, 200);
+    BOOST_CHECK(client.GiveUp());
+  }
+
+  const mod::ReplayStats replay_stats = stats.get();
+  BOOST_CHECK(replay_stats.matched);
+  BOOST_CHECK_EQUAL(replay_stats.num_messages, 3);
+  BOOST_CHECK_EQUAL(replay_stats.latencies.size(), 3);
+  BOOST_CHECK_GE(replay_stats.reply_time, 0);
+  BOOST_CHECK_GE(replay_stats.total_time, replay_stats.reply_time);
+  BOOST_TEST_MESSAGE("Replayed " << replay_stats.num_messages
+                                 << " messages, replied in "
+                                 << replay_stats.reply_time << "s of "
+                                 << replay_stats.total_time << "s");
+}
+
+BOOST_AUTO_TEST_CASE(TestReplayDivergence) {
+  mod::ReplayServer server(RecordBinarySession());
+  BOOST_CHECK(server.ListenTCP());
+  std::future<mod::ReplayStats> stats =
+      std::async(std::launch::async, [&]() { return server.Serve(); });
+
+  {
+    mod::TCPClient client("127.0.0.1", server.Port(), true, true, true,
+                          mod::Protocol::BINARY);
+    client.SucceedRegistration(4, 10, 200);
+    BOOST_CHECK(!client.Connected());
+  }
+
+  const mod::ReplayStats replay_stats = stats.get();
+  BOOST_CHECK(!replay_stats.matched);
+  BOOST_CHECK_EQUAL(replay_stats.num_messages, 1);
+}
+
+BOOST_AUTO_TEST_CASE(TestReplayTextSession) {
+  const std::string path = SessionPath();
+  {
+    std::unique_ptr<mod::Transport> transport(new ScriptedTransport(
+        {Text("acknowledge"), Text("acknowledge"), Text("y"),
+         Text("acknowledge")}));
+    mod::TCPClient client(std::unique_ptr<mod::Transport>(
+                              new mod::RecordingTransport(std::move(transport),
+                                                          path)));
+    client.BeginReconstruction(0);
+    BOOST_CHECK(client.GiveUp());
+  }
+  std::vector<mod::RecordedChunk> chunks;
+  BOOST_CHECK(mod::ReadSession(path, &chunks));
+  boost::filesystem::remove(path);
+
+  const std::string unix_path = SessionPath();
+  mod::ReplayServer server(chunks, true);
+  BOOST_CHECK(server.ListenUnix(unix_path));
+  std::future<mod::ReplayStats> stats =
+      std::async(std::launch::async, [&]() { return server.Serve(); });
+
+  {
+    mod::TCPClient client(mod::ConnectTransport("unix:" + unix_path));
+    BOOST_CHECK(client.NegotiatedProtocol() == mod::Protocol::TEXT);
+    client.BeginReconstruction(0);
+    BOOST_CHECK(client.GiveUp());
+  }
+
+  const mod::ReplayStats replay_stats = stats.get();
+  BOOST_CHECK(replay_stats.matched);
+  BOOST_CHECK_EQUAL(replay_stats.num_messages, 4);
+  BOOST_CHECK_GE(replay_stats.recorded_blocked_time, 0);
+}
+
+BOOST_AUTO_TEST_CASE(TestReadInvalidSession) {
+  std::vector<mod::RecordedChunk> chunks;
+  BOOST_CHECK(!mod::ReadSession(SessionPath(), &chunks));
+  BOOST_CHECK(!mod::ReplayServer(chunks).valid());
+}
@@ -0,0 +1,514 @@
+#define TEST_NAME "util/socket"
+#include "util/testing.h"
+
+#include <cstring>
+#include <future>
+#include <thread>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "util/endian.h"
+#include "util/socket.h"
+
+using namespace colmap;
+
+namespace {
+
+// Minimal controller that accepts a single connection on an ephemeral
+// loopback port and speaks the raw wire protocol.
+class Controller {
+ public:
+  Controller() {
+    listen_sock_ = ::socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in addr;
+    ::memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = 0;
+    ::inet_pton(AF_INET, "127.0.0.1", &addr.sin_addr);
+    ::bind(listen_sock_, (struct sockaddr*)&addr, sizeof(addr));
+    ::listen(listen_sock_, 1);
+    socklen_t addr_len = sizeof(addr);
+    ::getsockname(listen_sock_, (struct sockaddr*)&addr, &addr_len);
+    port_ = ntohs(addr.sin_port);
+  }
+
+  explicit Controller(const std::string& unix_path) {
+    listen_sock_ = ::socket(AF_UNIX, SOCK_STREAM, 0);
+    struct sockaddr_un addr;
+    ::memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    ::strncpy(addr.sun_path, unix_path.c_str(), sizeof(addr.sun_path) - 1);
+    ::unlink(unix_path.c_str());
+    ::bind(listen_sock_, (struct sockaddr*)&addr, sizeof(addr));
+    ::listen(listen_sock_, 1);
+  }
+
+  ~Controller() {
+    if (sock_ != -1) ::close(sock_);
+    ::close(listen_sock_);
+  }
+
+  int Port() const { return port_; }
+
+  void Accept() { sock_ = ::accept(listen_sock_, nullptr, nullptr); }
+
+  void Close() {
+    ::close(sock_);
+    sock_ = -1;
+  }
+
+  std::string RecvString() {
+    std::string data;
+    char c;
+    while (::recv(sock_, &c, 1, 0) == 1 && c != 0) {
+      data += c;
+    }
+    return data;
+  }
+
+  void SendString(const std::string& data) {
+    ::send(sock_, data.c_str(), data.size() + 1, 0);
+  }
+
+  std::string RecvFrame() {
+    uint32_t size = 0;
+    RecvBytes(reinterpret_cast<char*>(&size), sizeof(size));
+    std::string payload(LittleEndianToNative(size), 0);
+    RecvBytes(&payload[0], payload.size());
+    return payload;
+  }
+
+  void SendRaw(const std::string& data) {
+    ::send(sock_, data.data(), data.size(), 0);
+  }
+
+  void SendFrame(const std::string& payload) {
+    const uint32_t size =
+        NativeToLittleEndian(static_cast<uint32_t>(payload.size()));
+    ::send(sock_, &size, sizeof(size), 0);
+    ::send(sock_, payload.data(), payload.size(), 0);
+  }
+
+  void AcceptBinary() {
+    Accept();
+    handshake_ = RecvString();
+    SendString("acknowledge binary/1");
+  }
+
+  std::string handshake_;
+
+ private:
+  void RecvBytes(char* data, size_t size) {
+    while (size > 0) {
+      const ssize_t len = ::recv(sock_, data, size, 0);
+      if (len <= 0) return;
+      data += len;
+      size -= len;
+    }
+  }
+
+  int listen_sock_ = -1;
+  int sock_ = -1;
+  int port_ = 0;
+};
+
+template <typename T>
+std::string Encode(const T value) {
+  const T le_value = NativeToLittleEndian(value);
+  return std::string(reinterpret_cast<const char*>(&le_value), sizeof(T));
+}
+
+}  // namespace
+
+BOOST_AUTO_TEST_CASE(TestTextFallback) {
+  Controller controller;
+  std::string event;
+  std::thread thread([&]() {
+    controller.Accept();
+    controller.handshake_ = controller.RecvString();
+    controller.SendString("acknowledge");
+    event = controller.RecvString();
+    controller.SendString("acknowledge");
+  });
+
+  mod::TCPClient client("127.0.0.1", controller.Port(), true, true, true,
+                        mod::Protocol::BINARY);
+  BOOST_CHECK(client.Connected());
+  BOOST_CHECK(client.NegotiatedProtocol() == mod::Protocol::TEXT);
+  client.BeginReconstruction(0);
+  thread.join();
+
+  BOOST_CHECK_EQUAL(controller.handshake_, "connected binary/1");
+  BOOST_CHECK_EQUAL(event.find("[Begin Reconstruction]"), 0);
+  BOOST_CHECK(client.Connected());
+}
+
+BOOST_AUTO_TEST_CASE(TestBinaryNotification) {
+  Controller controller;
+  std::string frame1;
+  std::string frame2;
+  std::thread thread([&]() {
+    controller.AcceptBinary();
+    frame1 = controller.RecvFrame();
+    controller.SendFrame("");
+    frame2 = controller.RecvFrame();
+    controller.SendFrame("");
+  });
+
+  mod::TCPClient client("127.0.0.1", controller.Port(), true, true, true,
+                        mod::Protocol::BINARY);
+  BOOST_CHECK(client.NegotiatedProtocol() == mod::Protocol::BINARY);
+  client.SucceedRegistration(3, 10, 200);
+  client.FailDueToLittle2DInliers(7, {1.5, -2.25});
+  thread.join();
+
+  BOOST_CHECK_EQUAL(
+      frame1,
+      Encode<uint8_t>(
+          static_cast<uint8_t>(mod::MessageType::SUCCEED_REGISTRATION)) +
+          Encode<uint32_t>(3) + Encode<int32_t>(10) + Encode<int32_t>(200));
+  BOOST_CHECK_EQUAL(
+      frame2,
+      Encode<uint8_t>(static_cast<uint8_t>(
+          mod::MessageType::FAIL_DUE_TO_LITTLE_2D_INLIERS)) +
+          Encode<uint32_t>(7) + Encode<uint32_t>(2) + Encode<double>(1.5) +
+          Encode<double>(-2.25));
+  BOOST_CHECK(client.Connected());
+}
+
+BOOST_AUTO_TEST_CASE(TestBinaryDecisions) {
+  Controller controller;
+  std::thread thread([&]() {
+    controller.AcceptBinary();
+    // Manually specify the initial pair.
+    controller.RecvFrame();
+    controller.SendFrame(Encode<uint8_t>(1) + Encode<uint32_t>(4) +
+                         Encode<uint32_t>(5));
+    // Keep the proposed next image.
+    controller.RecvFrame();
+    controller.SendFrame("");
+    // Override the relaxed thresholds.
+    controller.RecvFrame();
+    controller.SendFrame(Encode<uint8_t>(1) + Encode<double>(0.5) +
+                         Encode<int32_t>(25));
+    // Quit.
+    controller.RecvFrame();
+    controller.SendFrame(Encode<uint8_t>(2));
+    // Give up.
+    controller.RecvFrame();
+    controller.SendFrame(Encode<uint8_t>(1));
+  });
+
+  mod::TCPClient client("127.0.0.1", controller.Port(), true, true, true,
+                        mod::Protocol::BINARY);
+
+  uint32_t image_id1 = ~0U;
+  uint32_t image_id2 = ~0U;
+  client.FindInitialImagePair(&image_id1, &image_id2);
+  BOOST_CHECK_EQUAL(image_id1, 4);
+  BOOST_CHECK_EQUAL(image_id2, 5);
+
+  uint32_t next_image_id = 9;
+  client.RegisterNextImage(&next_image_id, 2);
+  BOOST_CHECK_EQUAL(next_image_id, 9);
+
+  int min_num_inliers = 100;
+  double min_tri_angle = 16.0;
+  BOOST_CHECK(client.RelaxAndRestart(&min_num_inliers, &min_tri_angle));
+  BOOST_CHECK_EQUAL(min_num_inliers, 25);
+  BOOST_CHECK_EQUAL(min_tri_angle, 0.5);
+  BOOST_CHECK(!client.RelaxAndRestart(&min_num_inliers, &min_tri_angle));
+
+  BOOST_CHECK(client.GiveUp());
+  thread.join();
+}
+
+BOOST_AUTO_TEST_CASE(TestAsyncNotifications) {
+  Controller controller;
+  std::promise<void> notified;
+  bool pipelined = false;
+  std::vector<uint8_t> types;
+  std::thread thread([&]() {
+    controller.AcceptBinary();
+    // Do not acknowledge anything before the client returned from all
+    // notifications, which only works if they do not block.
+    pipelined = notified.get_future().wait_for(std::chrono::seconds(10)) ==
+                std::future_status::ready;
+    for (int i = 0; i < 4; ++i) {
+      types.push_back(controller.RecvFrame()[0]);
+      controller.SendFrame(i == 3 ? Encode<uint8_t>(1) : "");
+    }
+  });
+
+  mod::TCPClient client("127.0.0.1", controller.Port(), true, true, true,
+                        mod::Protocol::BINARY, /*async=*/true);
+  client.BeginReconstruction(0);
+  client.FindNextImages({1, 2, 3});
+  client.FailRegistration(1, 0, 2);
+  notified.set_value();
+  BOOST_CHECK(client.GiveUp());
+  thread.join();
+
+  BOOST_CHECK(pipelined);
+  BOOST_CHECK_EQUAL(types.size(), 4);
+  BOOST_CHECK_EQUAL(types[0], static_cast<uint8_t>(
+                                  mod::MessageType::BEGIN_RECONSTRUCTION));
+  BOOST_CHECK_EQUAL(types[1],
+                    static_cast<uint8_t>(mod::MessageType::FIND_NEXT_IMAGES));
+  BOOST_CHECK_EQUAL(types[2],
+                    static_cast<uint8_t>(mod::MessageType::FAIL_REGISTRATION));
+  BOOST_CHECK_EQUAL(types[3], static_cast<uint8_t>(mod::MessageType::GIVE_UP));
+}
+
+BOOST_AUTO_TEST_CASE(TestAsyncDisconnect) {
+  Controller controller;
+  std::thread thread([&]() {
+    controller.AcceptBinary();
+    controller.RecvFrame();
+    controller.Close();
+  });
+
+  mod::TCPClient client("127.0.0.1", controller.Port(), true, true, true,
+                        mod::Protocol::BINARY, /*async=*/true);
+  client.BeginReconstruction(0);
+  // The sender thread closes the socket when the acknowledgement is missing,
+  // while this thread polls the connection state.
+  const auto deadline =
+      std::chrono::steady_clock::now() + std::chrono::seconds(10);
+  while (client.Connected() && std::chrono::steady_clock::now() < deadline) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  thread.join();
+
+  BOOST_CHECK(!client.Connected());
+}
+
+BOOST_AUTO_TEST_CASE(TestCoalescedMessages) {
+  Controller controller;
+  std::string event1;
+  std::string event2;
+  std::thread thread([&]() {
+    controller.Accept();
+    controller.RecvString();
+    // Handshake and the acknowledgement of the next event in one segment.
+    controller.SendRaw(std::string("acknowledge\0acknowledge\0", 24));
+    event1 = controller.RecvString();
+    event2 = controller.RecvString();
+    controller.SendString("acknowledge");
+  });
+
+  mod::TCPClient client("127.0.0.1", controller.Port());
+  BOOST_CHECK(client.Connected());
+  client.BeginReconstruction(0);
+  client.BeginReconstruction(1);
+  thread.join();
+
+  BOOST_CHECK(client.Connected());
+  BOOST_CHECK_EQUAL(event1.find("[Begin Reconstruction]"), 0);
+  BOOST_CHECK_EQUAL(event2.find("[Begin Reconstruction]"), 0);
+  BOOST_CHECK_NE(event1, event2);
+}
+
+BOOST_AUTO_TEST_CASE(TestFragmentedFrames) {
+  Controller controller;
+  std::thread thread([&]() {
+    controller.AcceptBinary();
+    controller.RecvFrame();
+    const std::string reply = Encode<uint32_t>(9) + Encode<uint8_t>(1) +
+                              Encode<uint32_t>(11) + Encode<uint32_t>(12);
+    for (const char c : reply) {
+      controller.SendRaw(std::string(1, c));
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+  });
+
+  mod::TCPClient client("127.0.0.1", controller.Port(), true, true, true,
+                        mod::Protocol::BINARY);
+  uint32_t image_id1 = ~0U;
+  uint32_t image_id2 = ~0U;
+  client.FindInitialImagePair(&image_id1, &image_id2);
+  thread.join();
+
+  BOOST_CHECK(client.Connected());
+  BOOST_CHECK_EQUAL(image_id1, 11);
+  BOOST_CHECK_EQUAL(image_id2, 12);
+}
+
+BOOST_AUTO_TEST_CASE(TestUnixTransport) {
+  const std::string path =
+      "/tmp/colmap_socket_test_" + std::to_string(::getpid()) + ".sock";
+  Controller controller(path);
+  std::string event;
+  std::thread thread([&]() {
+    controller.AcceptBinary();
+    event = controller.RecvFrame();
+    controller.SendFrame("");
+  });
+
+  mod::TCPClient client(mod::ConnectTransport("unix:" + path), true, true,
+                        true, mod::Protocol::BINARY);
+  BOOST_CHECK(client.NegotiatedProtocol() == mod::Protocol::BINARY);
+  client.FailDueToBadPoseEstimation(42);
+  thread.join();
+  ::unlink(path.c_str());
+
+  BOOST_CHECK(client.Connected());
+  BOOST_CHECK_EQUAL(event, Encode<uint8_t>(static_cast<uint8_t>(
+                               mod::MessageType::
+                                   FAIL_DUE_TO_BAD_POSE_ESTIMATION)) +
+                               Encode<uint32_t>(42));
+}
+
+#ifdef __linux__
+
+BOOST_AUTO_TEST_CASE(TestSharedMemoryTransport) {
+  const std::string name =
+      "/colmap_socket_test_" + std::to_string(::getpid());
+  auto transport = mod::SharedMemoryTransport::Create(name);
+  BOOST_REQUIRE(transport);
+
+  // Larger than the ring capacity to exercise wrap-around and blocking.
+  std::vector<double> xys(300000);
+  for (size_t i = 0; i < xys.size(); ++i) {
+    xys[i] = 0.5 * i;
+  }
+
+  std::string handshake;
+  std::string event;
+  std::thread thread([&]() {
+    mod::Socket controller(std::move(transport));
+    handshake = controller.recv();
+    controller.send("acknowledge binary/1");
+    controller.recv_frame(&event);
+    controller.send_frame("");
+    controller.flush();
+  });
+
+  {
+    mod::TCPClient client(mod::ConnectTransport("shm:" + name), true, true,
+                          true, mod::Protocol::BINARY);
+    BOOST_CHECK(client.NegotiatedProtocol() == mod::Protocol::BINARY);
+    client.FailDueToLittleVisible3DPoints(5, xys);
+    thread.join();
+  }
+
+  BOOST_CHECK_EQUAL(handshake, "connected binary/1");
+  std::string expected =
+      Encode<uint8_t>(static_cast<uint8_t>(
+          mod::MessageType::FAIL_DUE_TO_LITTLE_VISIBLE_3D_POINTS)) +
+      Encode<uint32_t>(5) + Encode<uint32_t>(xys.size());
+  for (const double xy : xys) {
+    expected += Encode<double>(xy);
+  }
+  BOOST_CHECK(event == expected);
+}
+
+#endif  // __linux__
+
+BOOST_AUTO_TEST_CASE(TestRankNextImages) {
+  Controller controller;
+  std::string request;
+  std::thread thread([&]() {
+    controller.AcceptBinary();
+    request = controller.RecvFrame();
+    controller.SendFrame(Encode<uint32_t>(2) + Encode<uint32_t>(3) +
+                         Encode<int32_t>(-1) + Encode<double>(-1) +
+                         Encode<uint32_t>(1) + Encode<int32_t>(20) +
+                         Encode<double>(8.0));
+    // Keep the order of the mapper.
+    controller.RecvFrame();
+    controller.SendFrame("");
+  });
+
+  mod::TCPClient client("127.0.0.1", controller.Port(), true, true, true,
+                        mod::Protocol::BINARY);
+  std::vector<mod::NextImageDecision> decisions;
+  client.RankNextImages({1, 2, 3}, 5, &decisions);
+  BOOST_CHECK_EQUAL(
+      request,
+      Encode<uint8_t>(
+          static_cast<uint8_t>(mod::MessageType::RANK_NEXT_IMAGES)) +
+          Encode<uint32_t>(3) + Encode<uint32_t>(1) + Encode<uint32_t>(2) +
+          Encode<uint32_t>(3) + Encode<int32_t>(5));
+  BOOST_CHECK_EQUAL(decisions.size(), 2);
+  BOOST_CHECK_EQUAL(decisions[0].image_id, 3);
+  BOOST_CHECK_EQUAL(decisions[0].min_num_inliers, -1);
+  BOOST_CHECK_EQUAL(decisions[0].max_error, -1);
+  BOOST_CHECK_EQUAL(decisions[1].image_id, 1);
+  BOOST_CHECK_EQUAL(decisions[1].min_num_inliers, 20);
+  BOOST_CHECK_EQUAL(decisions[1].max_error, 8.0);
+
+  client.RankNextImages({1, 2, 3}, 5, &decisions);
+  BOOST_CHECK(decisions.empty());
+  thread.join();
+}
+
+BOOST_AUTO_TEST_CASE(TestRankNextImagesText) {
+  Controller controller;
+  std::thread thread([&]() {
+    controller.Accept();
+    controller.RecvString();
+    controller.SendString("acknowledge");
+    controller.RecvString();
+    controller.SendString("4 2:25 9:30:6.5");
+    controller.RecvString();
+    controller.SendString("acknowledge");
+    controller.RecvString();
+    controller.SendString("4 x");
+    controller.RecvString();
+    controller.SendString("acknowledge");
+  });
+
+  mod::TCPClient client("127.0.0.1", controller.Port());
+  std::vector<mod::NextImageDecision> decisions;
+  client.RankNextImages({2, 4, 9}, 5, &decisions);
+  BOOST_CHECK_EQUAL(decisions.size(), 3);
+  BOOST_CHECK_EQUAL(decisions[0].image_id, 4);
+  BOOST_CHECK_EQUAL(decisions[0].min_num_inliers, -1);
+  BOOST_CHECK_EQUAL(decisions[1].image_id, 2);
+  BOOST_CHECK_EQUAL(decisions[1].min_num_inliers, 25);
+  BOOST_CHECK_EQUAL(decisions[1].max_error, -1);
+  BOOST_CHECK_EQUAL(decisions[2].image_id, 9);
+  BOOST_CHECK_EQUAL(decisions[2].min_num_inliers, 30);
+  BOOST_CHECK_EQUAL(decisions[2].max_error, 6.5);
+
+  client.RankNextImages({2, 4, 9}, 5, &decisions);
+  BOOST_CHECK(decisions.empty());
+  thread.join();
+}
+
+BOOST_AUTO_TEST_CASE(TestInitialImagePairTrials) {
+  Controller controller;
+  std::string frame;
+  std::thread thread([&]() {
+    controller.AcceptBinary();
+    frame = controller.RecvFrame();
+    controller.SendFrame("");
+  });
+
+  mod::TCPClient client("127.0.0.1", controller.Port(), true, true, true,
+                        mod::Protocol::BINARY);
+  std::vector<mod::InitialImagePairTrial> trials(2);
+  trials[0].img1 = 1;
+  trials[0].img2 = 2;
+  trials[1].img1 = 1;
+  trials[1].img2 = 3;
+  trials[1].success = true;
+  trials[1].num_reg_images = 2;
+  trials[1].num_points_3d = 150;
+  client.InitialImagePairTrials(trials, 1);
+  thread.join();
+
+  BOOST_CHECK_EQUAL(
+      frame,
+      Encode<uint8_t>(static_cast<uint8_t>(
+          mod::MessageType::INITIAL_IMAGE_PAIR_TRIALS)) +
+          Encode<int32_t>(1) + Encode<uint32_t>(2) + Encode<uint32_t>(1) +
+          Encode<uint32_t>(2) + Encode<uint8_t>(0) + Encode<int32_t>(0) +
+          Encode<int32_t>(0) + Encode<uint32_t>(1) + Encode<uint32_t>(3) +
+          Encode<uint8_t>(1) + Encode<int32_t>(2) + Encode<int32_t>(150));
+}
@@ -183,9 +183,25 @@ void Thread::RunFunc() {
   Callback(FINISHED_CALLBACK);
 }
 
+namespace {
+
+// The pool and index of the worker that executes the current thread.
+thread_local const ThreadPool* current_thread_pool = nullptr;
+thread_local int current_thread_index = -1;
+
+}  // namespace
+
 ThreadPool::ThreadPool(const int num_threads)
-    : stopped_(false), num_active_workers_(0) {
+    : stopped_(false),
+      next_queue_idx_(0),
+      num_queued_tasks_(0),
+      num_unfinished_tasks_(0),
+      num_sleeping_workers_(0) {
   const int num_effective_threads = GetEffectiveNumThreads(num_threads);
+  queues_.reserve(num_effective_threads);
+  for (int index = 0; index < num_effective_threads; ++index) {
+    queues_.emplace_back(new WorkerQueue());
+  }
   for (int index = 0; index < num_effective_threads; ++index) {
     std::function<void(void)> worker =
         std::bind(&ThreadPool::WorkerFunc, this, index);
@@ -204,9 +220,19 @@ void ThreadPool::Stop() {
     }
 
     stopped_ = true;
+  }
 
-    std::queue<std::function<void()>> empty_tasks;
-    std::swap(tasks_, empty_tasks);
+  // Discard the tasks that have not started yet. New tasks are rejected once
+  // the stop flag is set, which is checked under the lock of the queue.
+  size_t num_discarded_tasks = 0;
+  for (auto& queue : queues_) {
+    std::deque<std::function<void()>> discarded_tasks;
+    {
+      std::unique_lock<std::mutex> lock(queue->mutex);
+      std::swap(queue->tasks, discarded_tasks);
+      num_queued_tasks_ -= discarded_tasks.size();
+    }
+    num_discarded_tasks += discarded_tasks.size();
   }
 
   task_condition_.notify_all();
@@ -215,45 +241,109 @@ void ThreadPool::Stop() {
     worker.join();
   }
 
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+    num_unfinished_tasks_ -= num_discarded_tasks;
+  }
+
   finished_condition_.notify_all();
 }
 
 void ThreadPool::Wait() {
   std::unique_lock<std::mutex> lock(mutex_);
-  if (!tasks_.empty() || num_active_workers_ > 0) {
-    finished_condition_.wait(
-        lock, [this]() { return tasks_.empty() && num_active_workers_ == 0; });
-  }
+  finished_condition_.wait(lock,
+                           [this]() { return num_unfinished_tasks_ == 0; });
 }
 
-void ThreadPool::WorkerFunc(const int index) {
+int ThreadPool::CurrentThreadIndex() const {
+  return current_thread_pool == this ? current_thread_index : -1;
+}
+
+void ThreadPool::PushTask(std::function<void()> task) {
+  // Tasks of workers are added to their own queue, while other threads
+  // distribute their tasks over the queues of all workers.
+  const bool is_worker = CurrentThreadIndex() != -1;
+  const size_t index = is_worker ? CurrentThreadIndex()
+                                 : next_queue_idx_++ % queues_.size();
+
   {
-    std::lock_guard<std::mutex> lock(mutex_);
-    thread_id_to_index_.emplace(GetThreadId(), index);
+    WorkerQueue& queue = *queues_[index];
+    std::unique_lock<std::mutex> lock(queue.mutex);
+    if (stopped_) {
+      throw std::runtime_error("Cannot add task to stopped thread pool.");
+    }
+    num_unfinished_tasks_ += 1;
+    num_queued_tasks_ += 1;
+    if (is_worker) {
+      queue.tasks.push_front(std::move(task));
+    } else {
+      queue.tasks.push_back(std::move(task));
+    }
   }
 
+  // Workers register as sleeping before they check for queued tasks, so
+  // either they see the new task or we see them sleeping and wake them up.
+  if (num_sleeping_workers_ > 0) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    task_condition_.notify_one();
+  }
+}
+
+bool ThreadPool::PopTask(const int index, std::function<void()>* task) {
+  // Take the task at the front of the own queue and otherwise steal the task
+  // at the back of the other queues. Workers push their tasks to the front, so
+  // they execute their newest task and thieves steal their oldest task. Tasks
+  // from outside the pool are pushed to the back, so they are executed by the
+  // owner in submission order and thieves steal the newest of them.
+  for (size_t i = 0; i < queues_.size(); ++i) {
+    const size_t queue_idx = (index + i) % queues_.size();
+    WorkerQueue& queue = *queues_[queue_idx];
+    std::unique_lock<std::mutex> lock(queue.mutex);
+    if (queue.tasks.empty()) {
+      continue;
+    }
+    if (i == 0) {
+      *task = std::move(queue.tasks.front());
+      queue.tasks.pop_front();
+    } else {
+      *task = std::move(queue.tasks.back());
+      queue.tasks.pop_back();
+    }
+    num_queued_tasks_ -= 1;
+    return true;
+  }
+  return false;
+}
+
+void ThreadPool::WorkerFunc(const int index) {
+  current_thread_pool = this;
+  current_thread_index = index;
+
   while (true) {
     std::function<void()> task;
-    {
+    if (!PopTask(index, &task)) {
       std::unique_lock<std::mutex> lock(mutex_);
-      task_condition_.wait(lock,
-                           [this] { return stopped_ || !tasks_.empty(); });
-      if (stopped_ && tasks_.empty()) {
+      num_sleeping_workers_ += 1;
+      task_condition_.wait(
+          lock, [this] { return stopped_ || num_queued_tasks_ > 0; });
+      num_sleeping_workers_ -= 1;
+      if (stopped_) {
         return;
       }
-      task = std::move(tasks_.front());
-      tasks_.pop();
-      num_active_workers_ += 1;
+      continue;
     }
 
     task();
+    task = nullptr;
 
-    {
+    if (--num_unfinished_tasks_ == 0) {
       std::unique_lock<std::mutex> lock(mutex_);
-      num_active_workers_ -= 1;
+      finished_condition_.notify_all();
     }
 
-    finished_condition_.notify_all();
+    if (stopped_) {
+      return;
+    }
   }
 }
 
@@ -262,13 +352,22 @@ std::thread::id ThreadPool::GetThreadId() const {
 }
 
 int ThreadPool::GetThreadIndex() {
-  std::unique_lock<std::mutex> lock(mutex_);
-  return thread_id_to_index_.at(GetThreadId());
+  const int index = CurrentThreadIndex();
+  if (index == -1) {
+    throw std::out_of_range("Current thread is not a worker of the pool.");
+  }
+  return index;
 }
 
+int kThreadBudget = -1;
+
 int GetEffectiveNumThreads(const int num_threads) {
   int num_effective_threads = num_threads;
   if (num_threads <= 0) {
+    num_effective_threads = kThreadBudget;
+  }
+
+  if (num_effective_threads <= 0) {
     num_effective_threads = std::thread::hardware_concurrency();
   }
 
@@ -279,4 +378,41 @@ int GetEffectiveNumThreads(const int num_threads) {
   return num_effective_threads;
 }
 
+namespace {
+
+std::mutex thread_budget_mutex;
+int num_borrowed_threads = 0;
+
+int BorrowThreads(const int num_threads,
+                  const bool limit_explicit_num_threads) {
+  std::unique_lock<std::mutex> lock(thread_budget_mutex);
+  const int num_available_threads =
+      GetEffectiveNumThreads(-1) - num_borrowed_threads;
+  const int num_granted_threads =
+      (num_threads > 0 && !limit_explicit_num_threads)
+          ? num_threads
+          : std::max(1, std::min(GetEffectiveNumThreads(num_threads),
+                                 num_available_threads));
+  num_borrowed_threads += num_granted_threads;
+  return num_granted_threads;
+}
+
+}  // namespace
+
+ThreadBudgetLease::ThreadBudgetLease(const int num_threads,
+                                     const bool limit_explicit_num_threads)
+    : num_threads_(BorrowThreads(num_threads, limit_explicit_num_threads)) {}
+
+ThreadBudgetLease::~ThreadBudgetLease() {
+  std::unique_lock<std::mutex> lock(thread_budget_mutex);
+  num_borrowed_threads -= num_threads_;
+}
+
+int ThreadBudgetLease::NumThreads() const { return num_threads_; }
+
+int ThreadBudgetLease::NumBorrowedThreads() {
+  std::unique_lock<std::mutex> lock(thread_budget_mutex);
+  return num_borrowed_threads;
+}
+
 }  // namespace colmap
@@ -32,12 +32,16 @@
 #ifndef COLMAP_SRC_UTIL_THREADING_
 #define COLMAP_SRC_UTIL_THREADING_
 
+#include <algorithm>
 #include <atomic>
 #include <climits>
+#include <deque>
 #include <functional>
 #include <future>
 #include <list>
+#include <memory>
 #include <queue>
+#include <thread>
 #include <unordered_map>
 
 #include "util/timer.h"
@@ -191,6 +195,11 @@ class Thread {
 //    }
 //    thread_pool.Wait();
 //
+//    thread_pool.ParallelFor(0, 1000, 10, [](const size_t i) { /* Work */ });
+//
+// Every worker owns a task queue, so that workers do not contend on a single
+// lock. Workers execute the tasks of their own queue and steal tasks from the
+// queues of the other workers once their own queue is empty.
 class ThreadPool {
  public:
   static const int kMaxNumThreads = -1;
@@ -200,11 +209,21 @@ class ThreadPool {
 
   inline size_t NumThreads() const;
 
-  // Add new task to the thread pool.
+  // Add new task to the thread pool. Tasks added from within a task of the
+  // same pool are queued to the current worker, which executes them next.
   template <class func_t, class... args_t>
   auto AddTask(func_t&& f, args_t&&... args)
       -> std::future<typename std::result_of<func_t(args_t...)>::type>;
 
+  // Call func(i) for all i in [begin, end), where consecutive indices are
+  // processed in chunks of grain_size indices. The calling thread processes
+  // chunks as well and returns once all chunks are processed, so this can
+  // also be called from within a task of the same pool. The first exception
+  // thrown by func is rethrown after all chunks are processed.
+  template <typename func_t>
+  void ParallelFor(const size_t begin, const size_t end,
+                   const size_t grain_size, func_t&& func);
+
   // Stop the execution of all workers.
   void Stop();
 
@@ -220,19 +239,30 @@ class ThreadPool {
   int GetThreadIndex();
 
  private:
+  struct WorkerQueue {
+    std::mutex mutex;
+    std::deque<std::function<void()>> tasks;
+  };
+
+  // Returns the index of the current thread in this pool or -1.
+  int CurrentThreadIndex() const;
+
+  void PushTask(std::function<void()> task);
+  bool PopTask(const int index, std::function<void()>* task);
   void WorkerFunc(const int index);
 
   std::vector<std::thread> workers_;
-  std::queue<std::function<void()>> tasks_;
+  std::vector<std::unique_ptr<WorkerQueue>> queues_;
 
   std::mutex mutex_;
   std::condition_variable task_condition_;
   std::condition_variable finished_condition_;
 
-  bool stopped_;
-  int num_active_workers_;
-
-  std::unordered_map<std::thread::id, int> thread_id_to_index_;
+  std::atomic<bool> stopped_;
+  std::atomic<size_t> next_queue_idx_;
+  std::atomic<size_t> num_queued_tasks_;
+  std::atomic<size_t> num_unfinished_tasks_;
+  std::atomic<int> num_sleeping_workers_;
 };
 
 // A job queue class for the producer-consumer paradigm.
@@ -308,10 +338,47 @@ class JobQueue {
   std::condition_variable empty_condition_;
 };
 
-// Return the number of logical CPU cores if num_threads <= 0,
+// Number of threads in the process-wide thread budget, which all components
+// borrow the threads for their computations from (see ThreadBudgetLease).
+// If the budget is not positive, it equals the number of logical CPU cores.
+extern int kThreadBudget;
+
+// Return the thread budget if num_threads <= 0,
 // otherwise return the input value of num_threads.
 int GetEffectiveNumThreads(const int num_threads);
 
+// Borrow threads from the process-wide thread budget for the lifetime of the
+// lease, so that components running concurrently in the same process do not
+// oversubscribe the CPU cores, e.g.:
+//
+//    ThreadBudgetLease lease(options.num_threads);
+//    ThreadPool thread_pool(lease.NumThreads());
+//
+// The requested number of threads is determined by GetEffectiveNumThreads and
+// is limited to the threads not borrowed by other leases. At least one thread
+// is always granted, so that components make progress when the budget is
+// exhausted by long-running leases. If `limit_explicit_num_threads` is false,
+// a positive number of threads is granted in full, even if it exceeds the
+// remaining budget, so that thread counts set by the user are kept.
+class ThreadBudgetLease {
+ public:
+  explicit ThreadBudgetLease(const int num_threads,
+                             const bool limit_explicit_num_threads = true);
+  ~ThreadBudgetLease();
+
+  ThreadBudgetLease(const ThreadBudgetLease&) = delete;
+  ThreadBudgetLease& operator=(const ThreadBudgetLease&) = delete;
+
+  // The number of granted threads.
+  int NumThreads() const;
+
+  // The number of threads currently borrowed by all leases.
+  static int NumBorrowedThreads();
+
+ private:
+  const int num_threads_;
+};
+
 ////////////////////////////////////////////////////////////////////////////////
 // Implementation
 ////////////////////////////////////////////////////////////////////////////////
@@ -328,17 +395,79 @@ auto ThreadPool::AddTask(func_t&& f, args_t&&... args)
 
   std::future<return_t> result = task->get_future();
 
-  {
-    std::unique_lock<std::mutex> lock(mutex_);
-    if (stopped_) {
-      throw std::runtime_error("Cannot add task to stopped thread pool.");
+  PushTask([task]() { (*task)(); });
+
+  return result;
+}
+
+template <typename func_t>
+void ThreadPool::ParallelFor(const size_t begin, const size_t end,
+                             const size_t grain_size, func_t&& func) {
+  if (begin >= end) {
+    return;
+  }
+
+  // The state is shared with the helper tasks, since they may only be
+  // executed after this function returned, when all chunks were processed by
+  // other threads. In this case, they return without touching the functor.
+  struct State {
+    size_t num_chunks = 0;
+    std::atomic<size_t> next_chunk_idx{0};
+    size_t num_finished_chunks = 0;
+    std::mutex mutex;
+    std::condition_variable finished_condition;
+    std::exception_ptr exception;
+  };
+
+  const size_t chunk_size = std::max<size_t>(grain_size, 1);
+  auto state = std::make_shared<State>();
+  state->num_chunks = (end - begin + chunk_size - 1) / chunk_size;
+
+  auto* func_ptr = &func;
+  const auto ProcessChunks = [state, func_ptr, begin, end, chunk_size]() {
+    while (true) {
+      const size_t chunk_idx = state->next_chunk_idx++;
+      if (chunk_idx >= state->num_chunks) {
+        return;
+      }
+      const size_t chunk_begin = begin + chunk_idx * chunk_size;
+      const size_t chunk_end = std::min(end, chunk_begin + chunk_size);
+      try {
+        for (size_t i = chunk_begin; i < chunk_end; ++i) {
+          (*func_ptr)(i);
+        }
+      } catch (...) {
+        std::unique_lock<std::mutex> lock(state->mutex);
+        if (!state->exception) {
+          state->exception = std::current_exception();
+        }
+      }
+      std::unique_lock<std::mutex> lock(state->mutex);
+      state->num_finished_chunks += 1;
+      if (state->num_finished_chunks == state->num_chunks) {
+        state->finished_condition.notify_all();
+      }
     }
-    tasks_.emplace([task]() { (*task)(); });
+  };
+
+  const size_t num_helpers = std::min(state->num_chunks - 1, NumThreads());
+  for (size_t i = 0; i < num_helpers; ++i) {
+    PushTask(ProcessChunks);
   }
 
-  task_condition_.notify_one();
+  ProcessChunks();
 
-  return result;
+  // Only wait for the chunks that are currently processed by other threads.
+  // The calling thread sleeps meanwhile, so that it does not occupy a core
+  // that is not accounted for in the thread budget.
+  std::unique_lock<std::mutex> lock(state->mutex);
+  state->finished_condition.wait(lock, [&state]() {
+    return state->num_finished_chunks == state->num_chunks;
+  });
+
+  if (state->exception) {
+    std::rethrow_exception(state->exception);
+  }
 }
 
 template <typename T>
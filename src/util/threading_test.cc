@@ -644,6 +644,131 @@ BOOST_AUTO_TEST_CASE(TestThreadPoolGetThreadIndex) {
   }
 }
 
+BOOST_AUTO_TEST_CASE(TestThreadPoolNestedTasks) {
+  ThreadPool pool(4);
+
+  std::atomic<int> num_tasks(0);
+  for (int i = 0; i < 10; ++i) {
+    pool.AddTask([&]() {
+      num_tasks += 1;
+      for (int j = 0; j < 10; ++j) {
+        pool.AddTask([&]() {
+          num_tasks += 1;
+          pool.AddTask([&]() { num_tasks += 1; });
+        });
+      }
+    });
+  }
+
+  pool.Wait();
+
+  BOOST_CHECK_EQUAL(num_tasks, 210);
+}
+
+BOOST_AUTO_TEST_CASE(TestThreadPoolParallelFor) {
+  ThreadPool pool(4);
+
+  for (const size_t grain_size : {0, 1, 7, 100, 1000}) {
+    std::vector<int> results(997, 0);
+    pool.ParallelFor(0, results.size(), grain_size,
+                     [&](const size_t i) { results[i] += 1; });
+    for (const auto result : results) {
+      BOOST_CHECK_EQUAL(result, 1);
+    }
+  }
+
+  std::vector<int> results(100, 0);
+  pool.ParallelFor(10, 10, 1, [&](const size_t i) { results[i] += 1; });
+  pool.ParallelFor(50, 100, 3, [&](const size_t i) { results[i] += 1; });
+  for (size_t i = 0; i < results.size(); ++i) {
+    BOOST_CHECK_EQUAL(results[i], i < 50 ? 0 : 1);
+  }
+}
+
+BOOST_AUTO_TEST_CASE(TestThreadPoolParallelForNested) {
+  ThreadPool pool(2);
+
+  std::vector<std::atomic<int>> results(100);
+  for (auto& result : results) {
+    result = 0;
+  }
+
+  // More outer tasks than workers, so that all workers block in the nested
+  // loop and the nested loops must be processed by the calling workers.
+  for (int i = 0; i < 8; ++i) {
+    pool.AddTask([&]() {
+      pool.ParallelFor(0, results.size(), 1,
+                       [&](const size_t j) { results[j] += 1; });
+    });
+  }
+
+  pool.Wait();
+
+  for (const auto& result : results) {
+    BOOST_CHECK_EQUAL(result, 8);
+  }
+}
+
+BOOST_AUTO_TEST_CASE(TestThreadPoolParallelForException) {
+  ThreadPool pool(4);
+
+  std::atomic<int> num_calls(0);
+  BOOST_CHECK_THROW(pool.ParallelFor(0, 100, 1,
+                                     [&](const size_t i) {
+                                       num_calls += 1;
+                                       if (i == 42) {
+                                         throw std::runtime_error("");
+                                       }
+                                     }),
+                    std::runtime_error);
+  BOOST_CHECK_EQUAL(num_calls, 100);
+}
+
+BOOST_AUTO_TEST_CASE(TestThreadPoolManySmallTasks) {
+  // Microbenchmark of the scheduling overhead of many small tasks, which are
+  // added from multiple threads at the same time.
+  const int kNumProducers = 4;
+  const int kNumTasksPerProducer = 25000;
+
+  ThreadPool pool;
+
+  std::atomic<int> num_tasks(0);
+
+  Timer timer;
+  timer.Start();
+
+  std::vector<std::thread> producers;
+  for (int i = 0; i < kNumProducers; ++i) {
+    producers.emplace_back([&]() {
+      for (int j = 0; j < kNumTasksPerProducer; ++j) {
+        pool.AddTask([&]() { num_tasks += 1; });
+      }
+    });
+  }
+
+  for (auto& producer : producers) {
+    producer.join();
+  }
+
+  pool.Wait();
+
+  BOOST_TEST_MESSAGE("AddTask: " << timer.ElapsedSeconds() << "s for "
+                                 << num_tasks << " tasks on "
+                                 << pool.NumThreads() << " threads");
+  BOOST_CHECK_EQUAL(num_tasks, kNumProducers * kNumTasksPerProducer);
+
+  timer.Restart();
+
+  std::atomic<int> num_iterations(0);
+  pool.ParallelFor(0, kNumProducers * kNumTasksPerProducer, 256,
+                   [&](const size_t) { num_iterations += 1; });
+
+  BOOST_TEST_MESSAGE("ParallelFor: " << timer.ElapsedSeconds() << "s for "
+                                     << num_iterations << " iterations on "
+                                     << pool.NumThreads() << " threads");
+  BOOST_CHECK_EQUAL(num_iterations, kNumProducers * kNumTasksPerProducer);
+}
+
 BOOST_AUTO_TEST_CASE(TestJobQueueSingleProducerSingleConsumer) {
   JobQueue<int> job_queue;
 
@@ -899,3 +1024,40 @@ BOOST_AUTO_TEST_CASE(TestGetEffectiveNumThreads) {
   BOOST_CHECK_EQUAL(GetEffectiveNumThreads(2), 2);
   BOOST_CHECK_EQUAL(GetEffectiveNumThreads(3), 3);
 }
+
+BOOST_AUTO_TEST_CASE(TestGetEffectiveNumThreadsBudget) {
+  kThreadBudget = 5;
+  BOOST_CHECK_EQUAL(GetEffectiveNumThreads(-1), 5);
+  BOOST_CHECK_EQUAL(GetEffectiveNumThreads(0), 5);
+  BOOST_CHECK_EQUAL(GetEffectiveNumThreads(8), 8);
+  kThreadBudget = -1;
+  BOOST_CHECK_GT(GetEffectiveNumThreads(-1), 0);
+}
+
+BOOST_AUTO_TEST_CASE(TestThreadBudgetLease) {
+  kThreadBudget = 8;
+  BOOST_CHECK_EQUAL(ThreadBudgetLease::NumBorrowedThreads(), 0);
+  {
+    ThreadBudgetLease lease1(3);
+    BOOST_CHECK_EQUAL(lease1.NumThreads(), 3);
+    BOOST_CHECK_EQUAL(ThreadBudgetLease::NumBorrowedThreads(), 3);
+    {
+      ThreadBudgetLease lease2(-1);
+      BOOST_CHECK_EQUAL(lease2.NumThreads(), 5);
+      BOOST_CHECK_EQUAL(ThreadBudgetLease::NumBorrowedThreads(), 8);
+      ThreadBudgetLease lease3(2);
+      BOOST_CHECK_EQUAL(lease3.NumThreads(), 1);
+      BOOST_CHECK_EQUAL(ThreadBudgetLease::NumBorrowedThreads(), 9);
+    }
+    BOOST_CHECK_EQUAL(ThreadBudgetLease::NumBorrowedThreads(), 3);
+    ThreadBudgetLease lease4(10);
+    BOOST_CHECK_EQUAL(lease4.NumThreads(), 5);
+    ThreadBudgetLease lease5(10, /*limit_explicit_num_threads=*/false);
+    BOOST_CHECK_EQUAL(lease5.NumThreads(), 10);
+    BOOST_CHECK_EQUAL(ThreadBudgetLease::NumBorrowedThreads(), 18);
+    ThreadBudgetLease lease6(-1, /*limit_explicit_num_threads=*/false);
+    BOOST_CHECK_EQUAL(lease6.NumThreads(), 1);
+  }
+  BOOST_CHECK_EQUAL(ThreadBudgetLease::NumBorrowedThreads(), 0);
+  kThreadBudget = -1;
+}